@@ -6,5 +6,5 @@ layout(location = 0) out vec4 outColor;
 
 void main()
 {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+	outColor = vec4(fragColor, 1.0);
+}
@@ -0,0 +1,20 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(push_constant) uniform Camera
+{
+	mat4 viewProjection;
+} camera;
+
+layout(location = 0) out vec3 fragColor;
+
+//the depth prepass and the equal-tested shading pass must produce bit identical depth
+invariant gl_Position;
+
+void main()
+{
+	gl_Position = camera.viewProjection * vec4(inPosition, 1.0);
+	fragColor = inColor;
+}
@@ -1,2 +0,0 @@
-C:\VulkanSDK\1.3.268.0\Bin\glslc.exe shader.vert -o vertex.spv
-C:\VulkanSDK\1.3.268.0\Bin\glslc.exe shader.frag -o fragment.spv
\ No newline at end of file
@@ -0,0 +1,402 @@
+#pragma once
+#include "config.h"
+#include "gpu_memory.h"
+#include "upload.h"
+#include "chunk.h"
+#include "chunk_map.h"
+#include "hash.h"
+
+namespace vkUtil
+{
+	struct BrickmapInput
+	{
+		MemoryManager* memoryManager;
+		UploadService* uploadService;
+		uint32_t frameCount;
+
+		//the chunks covered: origin and size of the chunk grid, chunks outside are ignored
+		ChunkCoordinate origin{ 0, 0, 0 };
+		std::array<uint32_t, 3> gridChunks{ 32, 4, 32 };
+
+		//a multiple of the 8 voxel brick size
+		uint32_t chunkSize{ Chunk::defaultSize };
+
+		//device memory for the cell grid and the brick pool together
+		vk::DeviceSize vramBudget{ 64ull << 20 };
+	};
+
+	//cells and brick pool occupancy, for logging
+	struct BrickmapStatistics
+	{
+		uint32_t brickCapacity{ 0 };
+		uint32_t bricksUsed{ 0 };
+		uint32_t uniformCells{ 0 };
+		uint32_t emptyCells{ 0 };
+
+		//bricks that did not fit the pool and were stored as a uniform cell of their most common id
+		uint32_t overflowCells{ 0 };
+	};
+
+	/*
+	* Two level acceleration structure for compute ray marching: a coarse grid of cells, one per
+	* 8^3 brick of voxels, pointing into a pool of bricks. Empty and single id bricks are elided,
+	* their cell says all there is to know. The cells of one chunk are consecutive (64 words for
+	* 32^3 chunks) so a chunk update uploads them as one copy; chunks go x fastest, then y, then z.
+	*
+	* A cell is 0 for empty space, terminalBit | id for a brick of a single id, or otherwise the
+	* brick's index in the pool plus one. A brick is 512 16 bit voxel ids and both bricks in a chunk and voxels
+	* in a brick go x fastest, then z, then y, like voxels in a chunk.
+	*
+	* Both buffers are allocated once, sized by the VRAM budget, and bricks come from a free list:
+	* updating chunks allocates nothing once the scratch and retire lists have grown. Freed bricks
+	* go back to the list only once the frames in flight that may still read them have finished.
+	*
+	* A chunk update uploads only the bricks whose voxels changed, found by hashing each brick
+	* against the one stored. A changed brick goes to a fresh slot and its old slot is retired, so
+	* no brick is written while a frame may read it. Cells are rewritten in place: a frame reading
+	* the brickmap waits on the ticket of the updates it has to see, and a chunk's cells must not
+	* be updated while a frame that reads them is still in flight.
+	*/
+	class Brickmap
+	{
+	public:
+
+		static constexpr uint32_t brickSize = 8;
+		static constexpr uint32_t brickVoxels = brickSize * brickSize * brickSize;
+		static constexpr vk::DeviceSize brickBytes = brickVoxels * sizeof(VoxelId);
+		static constexpr uint32_t terminalBit = 0x80000000u;
+
+		Brickmap(const BrickmapInput& input, bool debug) :
+			memoryManager(input.memoryManager),
+			uploadService(input.uploadService),
+			frameCount(input.frameCount),
+			origin(input.origin),
+			gridChunks(input.gridChunks),
+			chunkSize(input.chunkSize),
+			bricksPerAxis(input.chunkSize / brickSize),
+			bricksPerChunk(bricksPerAxis * bricksPerAxis * bricksPerAxis)
+		{
+			//a chunk has to split into whole bricks, anything else leaves the brickmap without buffers
+			if (chunkSize < brickSize || chunkSize % brickSize != 0)
+			{
+				if (debug)
+				{
+					std::cout << "Brickmap: " << chunkSize << " voxel chunks do not split into " << brickSize
+						<< "^3 bricks, the brickmap stays empty\n";
+				}
+				bricksPerAxis = 0;
+				bricksPerChunk = 0;
+				return;
+			}
+
+			uint32_t chunkCount = gridChunks[0] * gridChunks[1] * gridChunks[2];
+			cells.assign(static_cast<size_t>(chunkCount) * bricksPerChunk, 0);
+			vk::DeviceSize cellBytes = cells.size() * sizeof(uint32_t);
+
+			//buffers past the chunk mesh pool's block size get memory of their own, the budget is used as given
+			vk::DeviceSize budget = input.vramBudget;
+			brickCapacity = budget > cellBytes ? static_cast<uint32_t>((budget - cellBytes) / brickBytes) : 0;
+
+			cellBuffer = memoryManager->create_buffer(std::max(cellBytes, vk::DeviceSize(4)), vk::BufferUsageFlagBits::eStorageBuffer, MemoryPool::ChunkMesh, debug);
+			brickBuffer = memoryManager->create_buffer(std::max(brickCapacity * brickBytes, brickBytes), vk::BufferUsageFlagBits::eStorageBuffer, MemoryPool::ChunkMesh, debug);
+			if (!brickBuffer)
+			{
+				brickCapacity = 0;
+			}
+
+			//popped from the back, so bricks fill the pool from the front
+			brickHashes.assign(brickCapacity, 0);
+			freeBricks.reserve(brickCapacity);
+			for (uint32_t brick = brickCapacity; brick > 0; brick--)
+			{
+				freeBricks.push_back(brick - 1);
+			}
+			voxels.resize(static_cast<size_t>(chunkSize) * chunkSize * chunkSize);
+			packedBricks.resize(static_cast<size_t>(bricksPerChunk) * brickVoxels);
+			regions.resize(bricksPerChunk);
+
+			if (cellBuffer)
+			{
+				lastTicket = uploadService->upload_buffer(cellBuffer, cells.data(), cellBytes, 0, debug);
+			}
+
+			if (debug)
+			{
+				std::cout << "Brickmap: " << gridChunks[0] << 'x' << gridChunks[1] << 'x' << gridChunks[2] << " chunks, "
+					<< (cellBytes >> 10) << "KiB of cells and " << brickCapacity << " bricks ("
+					<< ((brickCapacity * brickBytes) >> 20) << "MiB) in a " << (budget >> 20) << "MiB budget\n";
+			}
+		}
+
+		Brickmap(const Brickmap&) = delete;
+		Brickmap& operator=(const Brickmap&) = delete;
+
+		/*
+		* Rewrites the cells and bricks of the chunk at coordinate, null when it was removed. Returns
+		* the upload ticket the frame first reading the new contents has to wait for, 0 when the
+		* chunk is outside the grid or not the brickmap's chunk size, which leaves its cells as they were.
+		*/
+		uint64_t update_chunk(const ChunkCoordinate& coordinate, const Chunk* chunk, uint64_t frameNumber, bool debug)
+		{
+			if (!cellBuffer)
+			{
+				return 0;
+			}
+
+			if (chunk && chunk->get_size() != chunkSize)
+			{
+				if (debug)
+				{
+					std::cout << "Brickmap: chunk (" << coordinate[0] << ", " << coordinate[1] << ", " << coordinate[2]
+						<< ") is " << chunk->get_size() << " voxels wide instead of " << chunkSize << ", not stored\n";
+				}
+				return 0;
+			}
+
+			uint32_t chunkSlot = 0;
+			uint32_t stride = 1;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				int32_t local = coordinate[axis] - origin[axis];
+				if (local < 0 || local >= static_cast<int32_t>(gridChunks[axis]))
+				{
+					return 0;
+				}
+				chunkSlot += static_cast<uint32_t>(local) * stride;
+				stride *= gridChunks[axis];
+			}
+			uint32_t* chunkCells = &cells[static_cast<size_t>(chunkSlot) * bricksPerChunk];
+
+			//uniform chunks are uniform bricks, nothing to decode
+			bool uniform = !chunk || chunk->is_uniform();
+			if (!uniform)
+			{
+				chunk->decode(voxels.data());
+			}
+			uint32_t uniformCell = chunk && chunk->is_uniform() ? terminal(chunk->get_uniform_id()) : 0;
+
+			//changed bricks are packed one after the other and go up as one scattered copy
+			uint32_t brickUploads = 0;
+			bool cellsChanged = false;
+			for (uint32_t brickY = 0; brickY < bricksPerAxis; brickY++)
+			{
+				for (uint32_t brickZ = 0; brickZ < bricksPerAxis; brickZ++)
+				{
+					for (uint32_t brickX = 0; brickX < bricksPerAxis; brickX++)
+					{
+						uint32_t& cell = chunkCells[brickX + bricksPerAxis * (brickZ + bricksPerAxis * brickY)];
+						VoxelId* packed = &packedBricks[static_cast<size_t>(brickUploads) * brickVoxels];
+						uint32_t newCell = uniform ? uniformCell : gather_brick(packed, brickX, brickY, brickZ);
+
+						if (is_brick(newCell))
+						{
+							//a brick with the same voxels as the one already stored stays as it is
+							uint64_t hash = hash_bytes(packed, brickBytes);
+							if (is_brick(cell) && brickHashes[cell - 1] == hash)
+							{
+								continue;
+							}
+
+							//a changed brick never overwrites its old slot, frames in flight may still read it
+							if (!freeBricks.empty())
+							{
+								uint32_t brick = freeBricks.back();
+								freeBricks.pop_back();
+								brickHashes[brick] = hash;
+
+								vk::BufferCopy& region = regions[brickUploads];
+								region.srcOffset = brickUploads * brickBytes;
+								region.dstOffset = brick * brickBytes;
+								region.size = brickBytes;
+								brickUploads++;
+								newCell = brick + 1;
+							}
+							else
+							{
+								if (debug && overflowCells == 0)
+								{
+									std::cout << "Brick pool is full, bricks fall back to their most common voxel" << std::endl;
+								}
+								overflowCells++;
+								newCell = terminal(most_common_id(packed));
+							}
+						}
+
+						//the old brick is freed once the frames that may read it have finished
+						retire(cell, frameNumber);
+						cellsChanged = cellsChanged || newCell != cell;
+						cell = newCell;
+					}
+				}
+			}
+
+			uint64_t ticket = uploadService->upload_buffer_regions(brickBuffer, packedBricks.data(), brickUploads * brickBytes, regions.data(), brickUploads, debug);
+			if (cellsChanged)
+			{
+				ticket = std::max(ticket, uploadService->upload_buffer(cellBuffer, chunkCells, bricksPerChunk * sizeof(uint32_t),
+					static_cast<vk::DeviceSize>(chunkSlot) * bricksPerChunk * sizeof(uint32_t), debug));
+			}
+			lastTicket = std::max(lastTicket, ticket);
+			return ticket;
+		}
+
+		//returns bricks freed at least frameCount frames ago to the free list
+		void begin_frame(uint64_t frameNumber)
+		{
+			size_t kept = 0;
+			for (size_t i = 0; i < retired.size(); i++)
+			{
+				if (frameNumber >= retired[i].second)
+				{
+					freeBricks.push_back(retired[i].first);
+				}
+				else
+				{
+					retired[kept++] = retired[i];
+				}
+			}
+			retired.resize(kept);
+		}
+
+		//the last upload ticket, all cells and bricks written so far are on the GPU once it completes
+		uint64_t get_last_ticket() const
+		{
+			return lastTicket;
+		}
+
+		Buffer* get_cell_buffer() const
+		{
+			return cellBuffer;
+		}
+
+		Buffer* get_brick_buffer() const
+		{
+			return brickBuffer;
+		}
+
+		BrickmapStatistics get_statistics() const
+		{
+			BrickmapStatistics statistics = {};
+			statistics.brickCapacity = brickCapacity;
+			statistics.bricksUsed = brickCapacity - static_cast<uint32_t>(freeBricks.size() + retired.size());
+			statistics.overflowCells = overflowCells;
+			for (uint32_t cell : cells)
+			{
+				statistics.emptyCells += cell == 0 ? 1 : 0;
+				statistics.uniformCells += (cell & terminalBit) ? 1 : 0;
+			}
+			return statistics;
+		}
+
+		void destroy()
+		{
+			memoryManager->destroy_buffer(cellBuffer);
+			memoryManager->destroy_buffer(brickBuffer);
+			cellBuffer = nullptr;
+			brickBuffer = nullptr;
+		}
+
+	private:
+
+		MemoryManager* memoryManager;
+		UploadService* uploadService;
+		uint32_t frameCount;
+
+		ChunkCoordinate origin;
+		std::array<uint32_t, 3> gridChunks;
+		uint32_t chunkSize;
+		uint32_t bricksPerAxis;
+		uint32_t bricksPerChunk;
+
+		//CPU copy of the cell grid, chunk by chunk
+		std::vector<uint32_t> cells;
+		Buffer* cellBuffer{ nullptr };
+
+		uint32_t brickCapacity{ 0 };
+		Buffer* brickBuffer{ nullptr };
+		std::vector<uint32_t> freeBricks;
+
+		//hash of each stored brick's voxels, a gathered brick with the same hash is not uploaded again
+		std::vector<uint64_t> brickHashes;
+
+		//freed bricks and the frame from which they can be reused
+		std::vector<std::pair<uint32_t, uint64_t>> retired;
+
+		uint32_t overflowCells{ 0 };
+		uint64_t lastTicket{ 0 };
+
+		//scratch: the decoded chunk, its changed bricks packed for upload and where each goes
+		std::vector<VoxelId> voxels;
+		std::vector<VoxelId> packedBricks;
+		std::vector<vk::BufferCopy> regions;
+
+		static uint32_t terminal(VoxelId id)
+		{
+			return id == airVoxel ? 0 : terminalBit | id;
+		}
+
+		static bool is_brick(uint32_t cell)
+		{
+			return cell != 0 && (cell & terminalBit) == 0;
+		}
+
+		void retire(uint32_t cell, uint64_t frameNumber)
+		{
+			if (is_brick(cell))
+			{
+				retired.push_back({ cell - 1, frameNumber + frameCount });
+			}
+		}
+
+		//copies one brick of the decoded chunk to destination, returns its cell if it is uniform and 1 (any brick) otherwise
+		uint32_t gather_brick(VoxelId* destination, uint32_t brickX, uint32_t brickY, uint32_t brickZ) const
+		{
+			bool uniform = true;
+			VoxelId first = voxels[voxel_index(brickX * brickSize, brickY * brickSize, brickZ * brickSize)];
+			uint32_t index = 0;
+			for (uint32_t y = 0; y < brickSize; y++)
+			{
+				for (uint32_t z = 0; z < brickSize; z++)
+				{
+					const VoxelId* row = &voxels[voxel_index(brickX * brickSize, brickY * brickSize + y, brickZ * brickSize + z)];
+					for (uint32_t x = 0; x < brickSize; x++)
+					{
+						destination[index++] = row[x];
+						uniform = uniform && row[x] == first;
+					}
+				}
+			}
+			return uniform ? terminal(first) : 1;
+		}
+
+		uint32_t voxel_index(uint32_t x, uint32_t y, uint32_t z) const
+		{
+			return x + chunkSize * (z + chunkSize * y);
+		}
+
+		//what an overflowing brick is stored as, the air in a mostly empty brick does not count
+		static VoxelId most_common_id(const VoxelId* brick)
+		{
+			std::array<VoxelId, brickVoxels> sorted;
+			std::copy(brick, brick + brickVoxels, sorted.begin());
+			std::sort(sorted.begin(), sorted.end());
+			VoxelId best = airVoxel;
+			uint32_t bestCount = 0;
+			for (uint32_t begin = 0; begin < brickVoxels; )
+			{
+				uint32_t end = begin;
+				while (end < brickVoxels && sorted[end] == sorted[begin])
+				{
+					end++;
+				}
+				if (sorted[begin] != airVoxel && end - begin > bestCount)
+				{
+					best = sorted[begin];
+					bestCount = end - begin;
+				}
+				begin = end;
+			}
+			return best;
+		}
+	};
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "config.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace vkUtil
+{
+	//inward facing planes (xyz normal, w distance), a point p is inside when dot(normal, p) + w >= 0 for every plane
+	struct Frustum
+	{
+		std::array<glm::vec4, 6> planes;
+	};
+
+	/*
+	* Reverse-Z with an infinite far plane: the near plane maps to depth 1 and infinity to 0,
+	* so float depth keeps its precision far out instead of piling it up at the camera.
+	* Vulkan clip space, y points down.
+	*/
+	glm::mat4 reverse_z_perspective(float fovY, float aspect, float nearPlane)
+	{
+		float focalLength = 1.0f / std::tan(fovY * 0.5f);
+
+		glm::mat4 projection(0.0f);
+		projection[0][0] = focalLength / aspect;
+		projection[1][1] = -focalLength;
+		projection[2][3] = -1.0f;
+		projection[3][2] = nearPlane;
+		return projection;
+	}
+
+	/*
+	* Planes of the clip volume -w <= x, y <= w, 0 <= z <= w pulled back into world space.
+	* With an infinite far plane the z >= 0 plane degenerates to one every point is inside.
+	*/
+	Frustum extract_frustum(const glm::mat4& viewProjection)
+	{
+		glm::mat4 rows = glm::transpose(viewProjection);
+
+		Frustum frustum = {};
+		frustum.planes[0] = rows[3] + rows[0];
+		frustum.planes[1] = rows[3] - rows[0];
+		frustum.planes[2] = rows[3] + rows[1];
+		frustum.planes[3] = rows[3] - rows[1];
+		frustum.planes[4] = rows[3] - rows[2];
+		frustum.planes[5] = rows[2];
+
+		for (glm::vec4& plane : frustum.planes)
+		{
+			float length = glm::length(glm::vec3(plane));
+			if (length > 0.0f)
+			{
+				plane /= length;
+			}
+		}
+		return frustum;
+	}
+
+	//conservative: a box is only rejected when its corner farthest along some plane's normal is still outside it
+	bool box_in_frustum(const Frustum& frustum, const std::array<float, 3>& boundsMin, const std::array<float, 3>& boundsMax)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			glm::vec3 corner(
+				plane.x >= 0.0f ? boundsMax[0] : boundsMin[0],
+				plane.y >= 0.0f ? boundsMax[1] : boundsMin[1],
+				plane.z >= 0.0f ? boundsMax[2] : boundsMin[2]);
+			if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//orbits a target point, enough to look at the world until there is player input
+	struct Camera
+	{
+		glm::vec3 target{ 0.0f };
+		float distance{ 100.0f };
+		float yaw{ 0.0f };
+		float pitch{ -0.5f };
+		float fovY{ glm::radians(70.0f) };
+		float nearPlane{ 0.1f };
+
+		glm::vec3 position() const
+		{
+			glm::vec3 direction(std::cos(pitch) * std::sin(yaw), std::sin(pitch), std::cos(pitch) * std::cos(yaw));
+			return target - direction * distance;
+		}
+
+		glm::mat4 view() const
+		{
+			return glm::lookAt(position(), target, glm::vec3(0.0f, 1.0f, 0.0f));
+		}
+
+		glm::mat4 view_projection(float aspect) const
+		{
+			return reverse_z_perspective(fovY, aspect, nearPlane) * view();
+		}
+	};
+}
@@ -0,0 +1,375 @@
+#pragma once
+#include "config.h"
+
+namespace vkInit
+{
+	/*
+	* What the device can do beyond Vulkan 1.0, probed once at startup and enabled as found.
+	* Every flag has a fallback path, the renderer checks the flag and never the API version.
+	* Flags can be cleared before device creation (--disable-feature) to exercise a fallback.
+	*/
+	struct DeviceCapabilities
+	{
+		//effective version, the lower of what the instance asked for and what the device reports
+		uint32_t apiVersion{ VK_API_VERSION_1_0 };
+
+		//core 1.0 features
+		bool multiDrawIndirect{ false };
+		bool drawIndirectFirstInstance{ false };
+		bool pipelineStatisticsQuery{ false };
+
+		//queries may stay active across secondary command buffers
+		//fallback: no statistics around passes recorded in parallel
+		bool inheritedQueries{ false };
+		bool fillModeNonSolid{ false };
+		bool samplerAnisotropy{ false };
+
+		//fallback: a fence per submission, waited on by the host
+		bool timelineSemaphore{ false };
+
+		//runtime sized, partially bound, non-uniformly indexed sampled image arrays (bindless textures)
+		//fallback: one descriptor set per material
+		bool descriptorIndexing{ false };
+
+		//fallback: buffers bound through descriptors
+		bool bufferDeviceAddress{ false };
+
+		//fallback: indirect draws with a CPU side count
+		bool drawIndirectCount{ false };
+
+		//8 and 16 bit types in storage buffers, packed vertex and voxel data
+		//fallback: 32 bit storage with manual unpacking in the shader
+		bool storage8Bit{ false };
+		bool storage16Bit{ false };
+
+		//fallback: vkCmdPipelineBarrier with the 1.0 stage and access masks
+		bool synchronization2{ false };
+
+		//fallback: render pass and framebuffer objects
+		bool dynamicRendering{ false };
+
+		//extensions providing the features above on devices older than their promotion
+		std::vector<const char*> extensions;
+	};
+
+	/*
+	* Feature structs for both the probe and device creation. From 1.2 the VulkanXYFeatures structs
+	* cover everything, before that each promoted extension has its own struct. The two must not be
+	* chained together, only the set matching apiVersion is linked.
+	*/
+	struct DeviceFeatureChain
+	{
+		vk::PhysicalDeviceFeatures2 features2;
+
+		vk::PhysicalDeviceVulkan11Features vulkan11;
+		vk::PhysicalDeviceVulkan12Features vulkan12;
+		vk::PhysicalDeviceVulkan13Features vulkan13;
+
+		vk::PhysicalDevice16BitStorageFeatures storage16Bit;
+		vk::PhysicalDevice8BitStorageFeatures storage8Bit;
+		vk::PhysicalDeviceDescriptorIndexingFeatures descriptorIndexing;
+		vk::PhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddress;
+		vk::PhysicalDeviceTimelineSemaphoreFeatures timelineSemaphore;
+		vk::PhysicalDeviceSynchronization2Features synchronization2;
+		vk::PhysicalDeviceDynamicRenderingFeatures dynamicRendering;
+
+		DeviceFeatureChain() = default;
+		DeviceFeatureChain(const DeviceFeatureChain&) = delete;
+		DeviceFeatureChain& operator=(const DeviceFeatureChain&) = delete;
+
+		//links the structs in use behind features2, extension structs only when their extension is listed
+		void link(uint32_t apiVersion, const std::vector<const char*>& extensions)
+		{
+			void** next = &features2.pNext;
+			auto append = [&next](auto& feature)
+			{
+				*next = &feature;
+				next = &feature.pNext;
+			};
+			auto listed = [&extensions](const char* name)
+			{
+				for (const char* extension : extensions)
+				{
+					if (strcmp(extension, name) == 0)
+					{
+						return true;
+					}
+				}
+				return false;
+			};
+
+			if (apiVersion >= VK_API_VERSION_1_2)
+			{
+				append(vulkan11);
+				append(vulkan12);
+			}
+			else
+			{
+				//16 bit storage is core in 1.1, an extension on 1.0
+				if (apiVersion >= VK_API_VERSION_1_1 || listed(VK_KHR_16BIT_STORAGE_EXTENSION_NAME))
+				{
+					append(storage16Bit);
+				}
+				if (listed(VK_KHR_8BIT_STORAGE_EXTENSION_NAME))
+				{
+					append(storage8Bit);
+				}
+				if (listed(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+				{
+					append(descriptorIndexing);
+				}
+				if (listed(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME))
+				{
+					append(bufferDeviceAddress);
+				}
+				if (listed(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+				{
+					append(timelineSemaphore);
+				}
+			}
+
+			if (apiVersion >= VK_API_VERSION_1_3)
+			{
+				append(vulkan13);
+			}
+			else
+			{
+				if (listed(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME))
+				{
+					append(synchronization2);
+				}
+				if (listed(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME))
+				{
+					append(dynamicRendering);
+				}
+			}
+			*next = nullptr;
+		}
+	};
+
+	//extensions that carry the probed features on devices older than the version they were promoted in
+	std::vector<const char*> get_feature_extensions(vk::PhysicalDevice physicalDevice, uint32_t apiVersion)
+	{
+		struct Candidate
+		{
+			const char* name;
+			uint32_t promotedIn;
+
+			//lowest version that has every extension this one depends on in core
+			uint32_t requiredVersion;
+		};
+
+		std::vector<Candidate> candidates = {
+			{ VK_KHR_16BIT_STORAGE_EXTENSION_NAME, VK_API_VERSION_1_1, VK_API_VERSION_1_1 },
+			{ VK_KHR_8BIT_STORAGE_EXTENSION_NAME, VK_API_VERSION_1_2, VK_API_VERSION_1_1 },
+			{ VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME, VK_API_VERSION_1_2, VK_API_VERSION_1_1 },
+			{ VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME, VK_API_VERSION_1_2, VK_API_VERSION_1_1 },
+			{ VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, VK_API_VERSION_1_2, VK_API_VERSION_1_0 },
+			{ VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, VK_API_VERSION_1_3, VK_API_VERSION_1_1 },
+			{ VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME, VK_API_VERSION_1_3, VK_API_VERSION_1_2 }
+		};
+
+		std::vector<vk::ExtensionProperties> supportedExtensions = physicalDevice.enumerateDeviceExtensionProperties();
+
+		std::vector<const char*> extensions;
+		for (const Candidate& candidate : candidates)
+		{
+			if (apiVersion >= candidate.promotedIn || apiVersion < candidate.requiredVersion)
+			{
+				continue;
+			}
+			for (vk::ExtensionProperties& ext : supportedExtensions)
+			{
+				if (strcmp(ext.extensionName, candidate.name) == 0)
+				{
+					extensions.push_back(candidate.name);
+					break;
+				}
+			}
+		}
+		return extensions;
+	}
+
+	/*
+	* Reads the device's features into capabilities. optionalExtensions are the extensions the
+	* engine already enables (timeline semaphores live there on 1.0 and 1.1 devices).
+	* Without 1.1 or VK_KHR_get_physical_device_properties2 only the 1.0 features can be read.
+	*/
+	DeviceCapabilities probe_device_capabilities(
+		vk::PhysicalDevice physicalDevice, uint32_t instanceApiVersion, bool properties2Enabled,
+		const std::vector<const char*>& optionalExtensions, const vk::DispatchLoaderDynamic& dispatch, bool debug)
+	{
+		DeviceCapabilities capabilities = {};
+
+		vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+		capabilities.apiVersion = std::min(instanceApiVersion, properties.apiVersion);
+		capabilities.apiVersion -= VK_API_VERSION_PATCH(capabilities.apiVersion);
+
+		std::vector<const char*> extensions = get_feature_extensions(physicalDevice, capabilities.apiVersion);
+		std::vector<const char*> probedExtensions = extensions;
+		probedExtensions.insert(probedExtensions.end(), optionalExtensions.begin(), optionalExtensions.end());
+
+		DeviceFeatureChain chain;
+		chain.link(capabilities.apiVersion, probedExtensions);
+
+		bool features2 = capabilities.apiVersion >= VK_API_VERSION_1_1 || properties2Enabled;
+		if (capabilities.apiVersion >= VK_API_VERSION_1_1)
+		{
+			physicalDevice.getFeatures2(&chain.features2);
+		}
+		else if (properties2Enabled)
+		{
+			physicalDevice.getFeatures2KHR(&chain.features2, dispatch);
+		}
+		else
+		{
+			chain.features2.features = physicalDevice.getFeatures();
+		}
+
+		const vk::PhysicalDeviceFeatures& core = chain.features2.features;
+		capabilities.multiDrawIndirect = core.multiDrawIndirect;
+		capabilities.drawIndirectFirstInstance = core.drawIndirectFirstInstance;
+		capabilities.pipelineStatisticsQuery = core.pipelineStatisticsQuery;
+		capabilities.inheritedQueries = core.inheritedQueries;
+		capabilities.fillModeNonSolid = core.fillModeNonSolid;
+		capabilities.samplerAnisotropy = core.samplerAnisotropy;
+
+		auto listed = [&probedExtensions](const char* name)
+		{
+			for (const char* extension : probedExtensions)
+			{
+				if (strcmp(extension, name) == 0)
+				{
+					return true;
+				}
+			}
+			return false;
+		};
+
+		//without features2 nothing beyond 1.0 can be queried, everything stays on its fallback
+		if (features2)
+		{
+			if (capabilities.apiVersion >= VK_API_VERSION_1_2)
+			{
+				const vk::PhysicalDeviceVulkan12Features& v12 = chain.vulkan12;
+				capabilities.timelineSemaphore = v12.timelineSemaphore;
+				capabilities.descriptorIndexing = v12.descriptorIndexing && v12.runtimeDescriptorArray
+					&& v12.descriptorBindingPartiallyBound && v12.shaderSampledImageArrayNonUniformIndexing;
+				capabilities.bufferDeviceAddress = v12.bufferDeviceAddress;
+				capabilities.drawIndirectCount = v12.drawIndirectCount;
+				capabilities.storage8Bit = v12.storageBuffer8BitAccess;
+				capabilities.storage16Bit = chain.vulkan11.storageBuffer16BitAccess;
+			}
+			else
+			{
+				capabilities.timelineSemaphore = listed(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) && chain.timelineSemaphore.timelineSemaphore;
+				capabilities.descriptorIndexing = listed(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+					&& chain.descriptorIndexing.runtimeDescriptorArray && chain.descriptorIndexing.descriptorBindingPartiallyBound
+					&& chain.descriptorIndexing.shaderSampledImageArrayNonUniformIndexing;
+				capabilities.bufferDeviceAddress = listed(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME) && chain.bufferDeviceAddress.bufferDeviceAddress;
+				capabilities.drawIndirectCount = listed(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+				capabilities.storage8Bit = listed(VK_KHR_8BIT_STORAGE_EXTENSION_NAME) && chain.storage8Bit.storageBuffer8BitAccess;
+				capabilities.storage16Bit = (capabilities.apiVersion >= VK_API_VERSION_1_1 || listed(VK_KHR_16BIT_STORAGE_EXTENSION_NAME))
+					&& chain.storage16Bit.storageBuffer16BitAccess;
+			}
+
+			if (capabilities.apiVersion >= VK_API_VERSION_1_3)
+			{
+				capabilities.synchronization2 = chain.vulkan13.synchronization2;
+				capabilities.dynamicRendering = chain.vulkan13.dynamicRendering;
+			}
+			else
+			{
+				capabilities.synchronization2 = listed(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) && chain.synchronization2.synchronization2;
+				capabilities.dynamicRendering = listed(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) && chain.dynamicRendering.dynamicRendering;
+			}
+		}
+
+		capabilities.extensions = extensions;
+
+		if (debug)
+		{
+			std::cout << "Device capabilities (Vulkan " << VK_API_VERSION_MAJOR(capabilities.apiVersion) << '.'
+				<< VK_API_VERSION_MINOR(capabilities.apiVersion) << "):\n"
+				<< "\ttimeline semaphores: " << capabilities.timelineSemaphore << '\n'
+				<< "\tdescriptor indexing: " << capabilities.descriptorIndexing << '\n'
+				<< "\tbuffer device address: " << capabilities.bufferDeviceAddress << '\n'
+				<< "\tdraw indirect count: " << capabilities.drawIndirectCount << '\n'
+				<< "\t8/16 bit storage: " << capabilities.storage8Bit << '/' << capabilities.storage16Bit << '\n'
+				<< "\tsynchronization2: " << capabilities.synchronization2 << '\n'
+				<< "\tdynamic rendering: " << capabilities.dynamicRendering << '\n'
+				<< "\tmulti draw indirect: " << capabilities.multiDrawIndirect << '\n';
+		}
+
+		return capabilities;
+	}
+
+	//clears a capability by name so its fallback runs instead, returns false for unknown names
+	bool disable_capability(DeviceCapabilities& capabilities, const std::string& name)
+	{
+		std::vector<std::pair<const char*, bool*>> flags = {
+			{ "timeline-semaphore", &capabilities.timelineSemaphore },
+			{ "descriptor-indexing", &capabilities.descriptorIndexing },
+			{ "buffer-device-address", &capabilities.bufferDeviceAddress },
+			{ "draw-indirect-count", &capabilities.drawIndirectCount },
+			{ "storage-8bit", &capabilities.storage8Bit },
+			{ "storage-16bit", &capabilities.storage16Bit },
+			{ "synchronization2", &capabilities.synchronization2 },
+			{ "dynamic-rendering", &capabilities.dynamicRendering },
+			{ "multi-draw-indirect", &capabilities.multiDrawIndirect },
+			{ "pipeline-statistics", &capabilities.pipelineStatisticsQuery },
+			{ "inherited-queries", &capabilities.inheritedQueries },
+			{ "fill-mode-non-solid", &capabilities.fillModeNonSolid }
+		};
+
+		for (std::pair<const char*, bool*>& flag : flags)
+		{
+			if (name == flag.first)
+			{
+				*flag.second = false;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	* Fills chain with exactly the features capabilities has set, ready to hang off the device create info.
+	* Extensions listed in extensions decide which pre-promotion structs get linked.
+	*/
+	void make_enabled_features(const DeviceCapabilities& capabilities, const std::vector<const char*>& extensions, DeviceFeatureChain& chain)
+	{
+		vk::PhysicalDeviceFeatures& core = chain.features2.features;
+		core.multiDrawIndirect = capabilities.multiDrawIndirect;
+		core.drawIndirectFirstInstance = capabilities.drawIndirectFirstInstance;
+		core.pipelineStatisticsQuery = capabilities.pipelineStatisticsQuery;
+		core.inheritedQueries = capabilities.inheritedQueries;
+		core.fillModeNonSolid = capabilities.fillModeNonSolid;
+		core.samplerAnisotropy = capabilities.samplerAnisotropy;
+
+		chain.vulkan11.storageBuffer16BitAccess = capabilities.storage16Bit;
+		chain.storage16Bit.storageBuffer16BitAccess = capabilities.storage16Bit;
+
+		chain.vulkan12.timelineSemaphore = capabilities.timelineSemaphore;
+		chain.vulkan12.descriptorIndexing = capabilities.descriptorIndexing;
+		chain.vulkan12.runtimeDescriptorArray = capabilities.descriptorIndexing;
+		chain.vulkan12.descriptorBindingPartiallyBound = capabilities.descriptorIndexing;
+		chain.vulkan12.shaderSampledImageArrayNonUniformIndexing = capabilities.descriptorIndexing;
+		chain.vulkan12.bufferDeviceAddress = capabilities.bufferDeviceAddress;
+		chain.vulkan12.drawIndirectCount = capabilities.drawIndirectCount;
+		chain.vulkan12.storageBuffer8BitAccess = capabilities.storage8Bit;
+		chain.timelineSemaphore.timelineSemaphore = capabilities.timelineSemaphore;
+		chain.descriptorIndexing.runtimeDescriptorArray = capabilities.descriptorIndexing;
+		chain.descriptorIndexing.descriptorBindingPartiallyBound = capabilities.descriptorIndexing;
+		chain.descriptorIndexing.shaderSampledImageArrayNonUniformIndexing = capabilities.descriptorIndexing;
+		chain.bufferDeviceAddress.bufferDeviceAddress = capabilities.bufferDeviceAddress;
+		chain.storage8Bit.storageBuffer8BitAccess = capabilities.storage8Bit;
+
+		chain.vulkan13.synchronization2 = capabilities.synchronization2;
+		chain.vulkan13.dynamicRendering = capabilities.dynamicRendering;
+		chain.synchronization2.synchronization2 = capabilities.synchronization2;
+		chain.dynamicRendering.dynamicRendering = capabilities.dynamicRendering;
+
+		chain.link(capabilities.apiVersion, extensions);
+	}
+}
@@ -0,0 +1,551 @@
+#pragma once
+#include "config.h"
+#include "simd.h"
+#include <unordered_map>
+
+namespace vkUtil
+{
+	//what a voxel is made of, an index into the engine's material table
+	using VoxelId = uint16_t;
+	constexpr VoxelId airVoxel = 0;
+
+	/*
+	* A cube of voxels stored as indices into a per chunk palette of the voxel ids it holds, packed at
+	* 1, 2, 4, 8 or 16 bits per voxel. Widths are powers of two so an index never straddles two 64 bit
+	* words and get/set are a shift and a mask. Writing an id the palette has no room for widens every
+	* index, and once enough ids have disappeared the palette is compacted back to a narrower width.
+	* Terrain with a handful of materials costs 2 or 4 bits a voxel instead of 16.
+	*
+	* Most chunks are all air or all stone. Those hold just the id and allocate nothing: a write of a
+	* different id promotes them to palette storage, and a compaction that finds a single id left
+	* demotes them again. Whatever walks voxels should check is_uniform() first and treat the whole
+	* chunk as one value.
+	* Voxels are laid out x fastest, then z, then y: horizontal slices are contiguous.
+	*/
+	class Chunk
+	{
+	public:
+
+		static constexpr uint32_t defaultSize = 32;
+
+		//size is a power of two from 4 to 256, every voxel starts out as fill, uniform until written
+		explicit Chunk(uint32_t size = defaultSize, VoxelId fill = airVoxel) :
+			sizeShift(log2_size(size)),
+			uniformId(fill)
+		{
+		}
+
+		uint32_t get_size() const
+		{
+			return 1u << sizeShift;
+		}
+
+		uint32_t get_volume() const
+		{
+			return 1u << (3 * sizeShift);
+		}
+
+		uint32_t voxel_index(uint32_t x, uint32_t y, uint32_t z) const
+		{
+			return x | (z << sizeShift) | (y << (2 * sizeShift));
+		}
+
+		//every voxel holds get_uniform_id(), there is no palette storage
+		bool is_uniform() const
+		{
+			return bitsPerVoxel == 0;
+		}
+
+		VoxelId get_uniform_id() const
+		{
+			return uniformId;
+		}
+
+		//all air, nothing to mesh, light or save beyond the fact
+		bool is_empty() const
+		{
+			return is_uniform() && uniformId == airVoxel;
+		}
+
+		VoxelId get(uint32_t x, uint32_t y, uint32_t z) const
+		{
+			if (is_uniform())
+			{
+				return uniformId;
+			}
+			return palette[read_entry(voxel_index(x, y, z))];
+		}
+
+		void set(uint32_t x, uint32_t y, uint32_t z, VoxelId id)
+		{
+			if (is_uniform())
+			{
+				if (id == uniformId)
+				{
+					return;
+				}
+				promote();
+			}
+
+			uint32_t index = voxel_index(x, y, z);
+			uint32_t previous = read_entry(index);
+			if (palette[previous] == id)
+			{
+				return;
+			}
+
+			uint32_t entry = find_or_add_entry(id);
+			write_entry(index, entry);
+			entryCounts[entry]++;
+			if (--entryCounts[previous] == 0)
+			{
+				release_entry(previous);
+				compact_if_sparse();
+			}
+		}
+
+		//sets every voxel in [begin, end), the palette is looked up once instead of per voxel
+		void fill(const std::array<uint32_t, 3>& begin, const std::array<uint32_t, 3>& end, VoxelId id)
+		{
+			uint32_t size = get_size();
+			if (begin[0] >= std::min(end[0], size) || begin[1] >= std::min(end[1], size) || begin[2] >= std::min(end[2], size))
+			{
+				return;
+			}
+
+			//covering the whole chunk drops whatever storage it had
+			if (begin[0] == 0 && begin[1] == 0 && begin[2] == 0 && end[0] >= size && end[1] >= size && end[2] >= size)
+			{
+				demote(id);
+				return;
+			}
+			if (is_uniform())
+			{
+				if (id == uniformId)
+				{
+					return;
+				}
+				promote();
+			}
+
+			uint32_t entry = find_or_add_entry(id);
+			for (uint32_t y = begin[1]; y < std::min(end[1], size); y++)
+			{
+				for (uint32_t z = begin[2]; z < std::min(end[2], size); z++)
+				{
+					for (uint32_t x = begin[0]; x < std::min(end[0], size); x++)
+					{
+						uint32_t index = voxel_index(x, y, z);
+						uint32_t previous = read_entry(index);
+						if (previous != entry)
+						{
+							write_entry(index, entry);
+							entryCounts[previous]--;
+							entryCounts[entry]++;
+						}
+					}
+				}
+			}
+
+			for (uint32_t previous = 0; previous < palette.size(); previous++)
+			{
+				if (entryCounts[previous] == 0 && !is_free(previous))
+				{
+					release_entry(previous);
+				}
+			}
+			compact_if_sparse();
+		}
+
+		/*
+		* Writes all get_volume() voxel ids to out in voxel_index order, what meshers walk instead of
+		* calling get per voxel. Palettes of up to 16 entries are looked up 16 voxels at a time with
+		* byte shuffles when the CPU has SSE4.1.
+		*/
+		void decode(VoxelId* out) const
+		{
+			if (is_uniform())
+			{
+				std::fill_n(out, get_volume(), uniformId);
+				return;
+			}
+#if defined(VOXEL_SIMD_X86)
+			static const SimdLevel simdLevel = detect_simd_level();
+			if (simdLevel != SimdLevel::Scalar && bitsPerVoxel <= 4)
+			{
+				decode_sse41(out);
+				return;
+			}
+#endif
+			decode_scalar(out);
+		}
+
+		//rebuilds the palette from the ids still in use at the narrowest width that holds them, a single id left demotes the chunk to uniform
+		void compact()
+		{
+			if (is_uniform())
+			{
+				return;
+			}
+			if (get_palette_size() == 1)
+			{
+				for (uint32_t entry = 0; entry < palette.size(); entry++)
+				{
+					if (entryCounts[entry] > 0)
+					{
+						demote(palette[entry]);
+						return;
+					}
+				}
+			}
+
+			std::vector<uint32_t> remap(palette.size(), 0);
+			std::vector<VoxelId> compactPalette;
+			std::vector<uint32_t> compactCounts;
+			for (uint32_t entry = 0; entry < palette.size(); entry++)
+			{
+				if (entryCounts[entry] > 0)
+				{
+					remap[entry] = static_cast<uint32_t>(compactPalette.size());
+					compactPalette.push_back(palette[entry]);
+					compactCounts.push_back(entryCounts[entry]);
+				}
+			}
+
+			repack(bits_for_entries(static_cast<uint32_t>(compactPalette.size())), remap);
+			palette = std::move(compactPalette);
+			entryCounts = std::move(compactCounts);
+			freeEntries.clear();
+			rebuild_lookup();
+		}
+
+		//0 for uniform chunks
+		uint32_t get_bits_per_voxel() const
+		{
+			return bitsPerVoxel;
+		}
+
+		//ids in the palette, including entries no voxel uses until the next compaction, empty for uniform chunks
+		const std::vector<VoxelId>& get_palette() const
+		{
+			return palette;
+		}
+
+		uint32_t get_palette_size() const
+		{
+			if (is_uniform())
+			{
+				return 1;
+			}
+			return static_cast<uint32_t>(palette.size() - freeEntries.size());
+		}
+
+		//heap and object bytes, compare against get_volume() * sizeof(VoxelId) for a flat grid
+		size_t memory_bytes() const
+		{
+			return sizeof(Chunk) + words.capacity() * sizeof(uint64_t) + palette.capacity() * sizeof(VoxelId)
+				+ entryCounts.capacity() * sizeof(uint32_t) + freeEntries.capacity() * sizeof(uint32_t)
+				+ (paletteLookup ? sizeof(*paletteLookup) + paletteLookup->size() * (sizeof(VoxelId) + sizeof(uint32_t) + 2 * sizeof(void*)) : 0);
+		}
+
+	private:
+
+		//above this many entries palette lookups go through a hash map instead of a linear search
+		static constexpr uint32_t linearSearchEntries = 16;
+
+		uint32_t sizeShift;
+		uint32_t bitsPerVoxel{ 0 };
+		VoxelId uniformId;
+		std::vector<uint64_t> words;
+		std::vector<VoxelId> palette;
+		std::vector<uint32_t> entryCounts;
+
+		//entries no voxel uses anymore, reused before the palette grows
+		std::vector<uint32_t> freeEntries;
+
+		//only for large palettes, some standard libraries allocate even for an empty map
+		std::unique_ptr<std::unordered_map<VoxelId, uint32_t>> paletteLookup;
+
+		static uint32_t log2_size(uint32_t size)
+		{
+			uint32_t shift = 2;
+			while ((1u << shift) < size && shift < 8)
+			{
+				shift++;
+			}
+			return shift;
+		}
+
+		//the narrowest of 1, 2, 4, 8 and 16 bits that indexes entryCount entries
+		static uint32_t bits_for_entries(uint32_t entryCount)
+		{
+			uint32_t bits = 1;
+			while (bits < 16 && (1u << bits) < entryCount)
+			{
+				bits *= 2;
+			}
+			return bits;
+		}
+
+		size_t word_count(uint32_t bits) const
+		{
+			return (static_cast<size_t>(get_volume()) * bits + 63) / 64;
+		}
+
+		uint32_t read_entry(uint32_t index) const
+		{
+			uint32_t bit = index * bitsPerVoxel;
+			uint64_t mask = (1ull << bitsPerVoxel) - 1;
+			return static_cast<uint32_t>((words[bit >> 6] >> (bit & 63)) & mask);
+		}
+
+		void write_entry(uint32_t index, uint32_t entry)
+		{
+			uint32_t bit = index * bitsPerVoxel;
+			uint64_t mask = (1ull << bitsPerVoxel) - 1;
+			uint64_t& word = words[bit >> 6];
+			word = (word & ~(mask << (bit & 63))) | (static_cast<uint64_t>(entry) << (bit & 63));
+		}
+
+		bool is_free(uint32_t entry) const
+		{
+			return std::find(freeEntries.begin(), freeEntries.end(), entry) != freeEntries.end();
+		}
+
+		uint32_t find_or_add_entry(VoxelId id)
+		{
+			if (palette.size() > linearSearchEntries)
+			{
+				auto found = paletteLookup->find(id);
+				if (found != paletteLookup->end())
+				{
+					return found->second;
+				}
+			}
+			else
+			{
+				for (uint32_t entry = 0; entry < palette.size(); entry++)
+				{
+					if (palette[entry] == id && entryCounts[entry] > 0)
+					{
+						return entry;
+					}
+				}
+			}
+
+			uint32_t entry;
+			if (!freeEntries.empty())
+			{
+				entry = freeEntries.back();
+				freeEntries.pop_back();
+				palette[entry] = id;
+			}
+			else
+			{
+				entry = static_cast<uint32_t>(palette.size());
+				if (entry >= (1u << bitsPerVoxel))
+				{
+					std::vector<uint32_t> identity(palette.size());
+					for (uint32_t i = 0; i < identity.size(); i++)
+					{
+						identity[i] = i;
+					}
+					repack(bitsPerVoxel * 2, identity);
+				}
+				palette.push_back(id);
+				entryCounts.push_back(0);
+				if (palette.size() == linearSearchEntries + 1)
+				{
+					rebuild_lookup();
+				}
+			}
+
+			if (palette.size() > linearSearchEntries)
+			{
+				(*paletteLookup)[id] = entry;
+			}
+			return entry;
+		}
+
+		void release_entry(uint32_t entry)
+		{
+			freeEntries.push_back(entry);
+			if (palette.size() > linearSearchEntries)
+			{
+				paletteLookup->erase(palette[entry]);
+			}
+		}
+
+		//narrows once half of the next smaller width would do, so a single id coming and going does not thrash
+		void compact_if_sparse()
+		{
+			if (get_palette_size() == 1 || (bitsPerVoxel > 1 && get_palette_size() <= (1u << (bitsPerVoxel / 2)) / 2))
+			{
+				compact();
+			}
+		}
+
+		//rewrites every index as remap[index] at a new width
+		void repack(uint32_t bits, const std::vector<uint32_t>& remap)
+		{
+			std::vector<uint64_t> packed(word_count(bits), 0);
+			for (uint32_t index = 0; index < get_volume(); index++)
+			{
+				uint32_t bit = index * bits;
+				packed[bit >> 6] |= static_cast<uint64_t>(remap[read_entry(index)]) << (bit & 63);
+			}
+			words = std::move(packed);
+			bitsPerVoxel = bits;
+		}
+
+		void rebuild_lookup()
+		{
+			if (palette.size() <= linearSearchEntries)
+			{
+				paletteLookup.reset();
+				return;
+			}
+			paletteLookup = std::make_unique<std::unordered_map<VoxelId, uint32_t>>();
+			for (uint32_t entry = 0; entry < palette.size(); entry++)
+			{
+				if (entryCounts[entry] > 0 || !is_free(entry))
+				{
+					(*paletteLookup)[palette[entry]] = entry;
+				}
+			}
+		}
+
+		//uniform to a one entry palette at 1 bit, every index 0
+		void promote()
+		{
+			palette.assign(1, uniformId);
+			entryCounts.assign(1, get_volume());
+			bitsPerVoxel = 1;
+			words.assign(word_count(bitsPerVoxel), 0);
+		}
+
+		//frees the palette storage, swapping with empty vectors gives the memory back
+		void demote(VoxelId id)
+		{
+			std::vector<uint64_t>().swap(words);
+			std::vector<VoxelId>().swap(palette);
+			std::vector<uint32_t>().swap(entryCounts);
+			std::vector<uint32_t>().swap(freeEntries);
+			paletteLookup.reset();
+			bitsPerVoxel = 0;
+			uniformId = id;
+		}
+
+		void decode_scalar(VoxelId* out) const
+		{
+			//byte and short wide indices are plain arrays on little endian hosts
+			if (bitsPerVoxel == 8)
+			{
+				const uint8_t* entries = reinterpret_cast<const uint8_t*>(words.data());
+				for (uint32_t index = 0; index < get_volume(); index++)
+				{
+					out[index] = palette[entries[index]];
+				}
+				return;
+			}
+			if (bitsPerVoxel == 16)
+			{
+				const uint16_t* entries = reinterpret_cast<const uint16_t*>(words.data());
+				for (uint32_t index = 0; index < get_volume(); index++)
+				{
+					out[index] = palette[entries[index]];
+				}
+				return;
+			}
+
+			uint32_t perWord = 64 / bitsPerVoxel;
+			uint64_t mask = (1ull << bitsPerVoxel) - 1;
+			for (size_t word = 0; word < words.size(); word++)
+			{
+				uint64_t bits = words[word];
+				for (uint32_t i = 0; i < perWord; i++)
+				{
+					*out++ = palette[bits & mask];
+					bits >>= bitsPerVoxel;
+				}
+			}
+		}
+
+#if defined(VOXEL_SIMD_X86)
+		//16 byte wide palette entries through the shuffle tables, written out as 16 ids
+		VOXEL_TARGET_SSE41 static void store_16(__m128i lowTable, __m128i highTable, __m128i entries, VoxelId* out)
+		{
+			__m128i low = _mm_shuffle_epi8(lowTable, entries);
+			__m128i high = _mm_shuffle_epi8(highTable, entries);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(low, high));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(low, high));
+		}
+
+		/*
+		* Up to 16 palette entries fit in two byte shuffle tables, one for the low and one for the
+		* high bytes of the ids. The packed indices are spread out to a byte each, shuffled through
+		* both tables and interleaved back into 16 bit ids.
+		*/
+		VOXEL_TARGET_SSE41 void decode_sse41(VoxelId* out) const
+		{
+			alignas(16) uint8_t lowBytes[16] = {};
+			alignas(16) uint8_t highBytes[16] = {};
+			for (uint32_t entry = 0; entry < palette.size() && entry < 16; entry++)
+			{
+				lowBytes[entry] = static_cast<uint8_t>(palette[entry] & 0xFF);
+				highBytes[entry] = static_cast<uint8_t>(palette[entry] >> 8);
+			}
+			__m128i lowTable = _mm_load_si128(reinterpret_cast<const __m128i*>(lowBytes));
+			__m128i highTable = _mm_load_si128(reinterpret_cast<const __m128i*>(highBytes));
+
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words.data());
+			size_t byteCount = words.size() * sizeof(uint64_t);
+
+			if (bitsPerVoxel == 4)
+			{
+				__m128i nibble = _mm_set1_epi8(0x0F);
+				for (size_t offset = 0; offset < byteCount; offset += 8, out += 16)
+				{
+					__m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes + offset));
+					__m128i low = _mm_and_si128(packed, nibble);
+					__m128i high = _mm_and_si128(_mm_srli_epi16(packed, 4), nibble);
+					store_16(lowTable, highTable, _mm_unpacklo_epi8(low, high), out);
+				}
+			}
+			else if (bitsPerVoxel == 2)
+			{
+				__m128i pair = _mm_set1_epi8(0x03);
+				for (size_t offset = 0; offset < byteCount; offset += 8, out += 32)
+				{
+					__m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes + offset));
+					__m128i first = _mm_and_si128(packed, pair);
+					__m128i second = _mm_and_si128(_mm_srli_epi16(packed, 2), pair);
+					__m128i third = _mm_and_si128(_mm_srli_epi16(packed, 4), pair);
+					__m128i fourth = _mm_and_si128(_mm_srli_epi16(packed, 6), pair);
+					__m128i firstHalf = _mm_unpacklo_epi8(first, second);
+					__m128i secondHalf = _mm_unpacklo_epi8(third, fourth);
+					store_16(lowTable, highTable, _mm_unpacklo_epi16(firstHalf, secondHalf), out);
+					store_16(lowTable, highTable, _mm_unpackhi_epi16(firstHalf, secondHalf), out + 16);
+				}
+			}
+			else
+			{
+				//one bit picks between two ids, 8 voxels per blend
+				__m128i zero = _mm_set1_epi16(static_cast<short>(palette[0]));
+				__m128i one = _mm_set1_epi16(static_cast<short>(palette.size() > 1 ? palette[1] : palette[0]));
+				__m128i lowBits = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+				__m128i highBits = _mm_setr_epi16(256, 512, 1024, 2048, 4096, 8192, 16384, static_cast<short>(0x8000));
+				const uint16_t* halves = reinterpret_cast<const uint16_t*>(bytes);
+				for (size_t half = 0; half < byteCount / 2; half++, out += 16)
+				{
+					__m128i broadcast = _mm_set1_epi16(static_cast<short>(halves[half]));
+					__m128i lowMask = _mm_cmpeq_epi16(_mm_and_si128(broadcast, lowBits), lowBits);
+					__m128i highMask = _mm_cmpeq_epi16(_mm_and_si128(broadcast, highBits), highBits);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_blendv_epi8(zero, one, lowMask));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_blendv_epi8(zero, one, highMask));
+				}
+			}
+		}
+#endif
+	};
+}
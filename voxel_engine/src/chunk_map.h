@@ -0,0 +1,475 @@
+#pragma once
+#include "config.h"
+#include "chunk.h"
+#include "simd.h"
+#include <atomic>
+#include <cassert>
+
+namespace vkUtil
+{
+	using ChunkCoordinate = std::array<int32_t, 3>;
+
+	//21 bits per axis, coordinates from -2^20 to 2^20 - 1
+	constexpr int32_t chunkCoordinateBias = 1 << 20;
+
+	//spreads the low 21 bits of value to every third bit
+	inline uint64_t dilate_3(uint64_t value)
+	{
+		value &= 0x1FFFFF;
+		value = (value | (value << 32)) & 0x1F00000000FFFFull;
+		value = (value | (value << 16)) & 0x1F0000FF0000FFull;
+		value = (value | (value << 8)) & 0x100F00F00F00F00Full;
+		value = (value | (value << 4)) & 0x10C30C30C30C30C3ull;
+		value = (value | (value << 2)) & 0x1249249249249249ull;
+		return value;
+	}
+
+	//interleaves x, y and z (x in the lowest bit), nearby chunks get nearby keys
+	inline uint64_t morton_key(const ChunkCoordinate& coordinate)
+	{
+		return dilate_3(static_cast<uint64_t>(coordinate[0] + chunkCoordinateBias))
+			| (dilate_3(static_cast<uint64_t>(coordinate[1] + chunkCoordinateBias)) << 1)
+			| (dilate_3(static_cast<uint64_t>(coordinate[2] + chunkCoordinateBias)) << 2);
+	}
+
+	//a chunk and the 26 chunks touching it
+	constexpr uint32_t neighborhoodSize = 27;
+	using ChunkNeighborhood = std::array<const Chunk*, neighborhoodSize>;
+
+	//index of the (dx, dy, dz) neighbor in a ChunkNeighborhood, each in -1..1, 13 is the chunk itself
+	constexpr uint32_t neighbor_index(int32_t dx, int32_t dy, int32_t dz)
+	{
+		return static_cast<uint32_t>((dx + 1) + 3 * (dz + 1) + 9 * (dy + 1));
+	}
+
+	/*
+	* World chunks by coordinate, millions of them. Open addressing with linear probing over Morton
+	* keys. One owner thread inserts, replaces and erases; up to maxReaders reader threads (render,
+	* meshing, culling jobs) look chunks up at the same time without locks or retries: a lookup
+	* probes a bounded run of slots whatever the owner is doing.
+	*
+	* Chunks are immutable once inserted, an edit inserts a changed copy. Readers hold a ReadGuard
+	* while they use what they found. Replaced and erased chunks, and tables outgrown by a resize,
+	* are retired with the epoch they were removed in and only freed by collect() once every reader
+	* has moved past it (epoch based reclamation).
+	*/
+	class ChunkMap
+	{
+	public:
+
+		//readers identify themselves by an index below maxReaders, e.g. the thread index a JobPool hands its jobs
+		ChunkMap(uint32_t maxReaders, bool debug) :
+			readers(std::max(maxReaders, 1u))
+		{
+			table.store(new Table(minCapacity));
+
+			if (debug)
+			{
+				std::cout << "Chunk map: " << readers.size() << " reader slots\n";
+			}
+		}
+
+		ChunkMap(const ChunkMap&) = delete;
+		ChunkMap& operator=(const ChunkMap&) = delete;
+
+		~ChunkMap()
+		{
+			Table* current = table.load();
+			for (size_t i = 0; i <= current->mask; i++)
+			{
+				delete current->slots[i].entry.load(std::memory_order_relaxed);
+			}
+			delete current;
+			free_retired(UINT64_MAX);
+		}
+
+		/*
+		* Pins the current epoch for one reader while it is alive: nothing it finds is freed until
+		* the guard is gone. A reader index may only have one guard at a time.
+		*/
+		class ReadGuard
+		{
+		public:
+
+			ReadGuard(const ChunkMap& map, uint32_t reader) :
+				epoch(map.reader_epoch(reader))
+			{
+				epoch.store(map.globalEpoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+
+			ReadGuard(const ReadGuard&) = delete;
+			ReadGuard& operator=(const ReadGuard&) = delete;
+
+			~ReadGuard()
+			{
+				epoch.store(0, std::memory_order_release);
+			}
+
+		private:
+
+			std::atomic<uint64_t>& epoch;
+		};
+
+		//any thread holding a ReadGuard, or the owner, null when there is no chunk there
+		const Chunk* find(const ChunkCoordinate& coordinate) const
+		{
+			const Table* current = table.load(std::memory_order_acquire);
+			return find_in(*current, morton_key(coordinate));
+		}
+
+		/*
+		* The 3x3x3 chunks around coordinate in one call, indexed by neighbor_index. The 27 keys come
+		* from stepping the Morton key directly and every home slot is prefetched before the first
+		* probe, so the cache misses overlap instead of queueing up one after another.
+		*/
+		void find_neighbors(const ChunkCoordinate& coordinate, ChunkNeighborhood& neighbors) const
+		{
+			const Table* current = table.load(std::memory_order_acquire);
+
+			std::array<uint64_t, neighborhoodSize> keys;
+			std::array<bool, neighborhoodSize> valid;
+			uint64_t center = morton_key(coordinate);
+			for (int32_t dy = -1; dy <= 1; dy++)
+			{
+				for (int32_t dz = -1; dz <= 1; dz++)
+				{
+					for (int32_t dx = -1; dx <= 1; dx++)
+					{
+						uint32_t index = neighbor_index(dx, dy, dz);
+						valid[index] = in_range(coordinate[0] + dx) && in_range(coordinate[1] + dy) && in_range(coordinate[2] + dz);
+						keys[index] = step(step(step(center, 0, dx), 1, dy), 2, dz);
+#if defined(VOXEL_SIMD_X86)
+						_mm_prefetch(reinterpret_cast<const char*>(&current->slots[home_slot(*current, keys[index])]), _MM_HINT_T0);
+#endif
+					}
+				}
+			}
+
+			for (uint32_t index = 0; index < neighborhoodSize; index++)
+			{
+				neighbors[index] = valid[index] ? find_in(*current, keys[index]) : nullptr;
+			}
+		}
+
+		//owner thread only: adds or replaces the chunk at coordinate, the returned pointer is the stored chunk
+		const Chunk* insert(const ChunkCoordinate& coordinate, Chunk&& chunk)
+		{
+			grow_if_needed();
+
+			Table& current = *table.load(std::memory_order_relaxed);
+			uint64_t key = morton_key(coordinate);
+			Entry* entry = new Entry{ key, std::move(chunk) };
+
+			//the first tombstone on the way can be reused once the key is known to be absent
+			size_t reusable = SIZE_MAX;
+			for (size_t slot = home_slot(current, key); ; slot = (slot + 1) & current.mask)
+			{
+				Slot& probe = current.slots[slot];
+				uint64_t probeKey = probe.key.load(std::memory_order_relaxed);
+				if (probeKey == key)
+				{
+					//replacing: readers that already loaded the old entry keep it until collect
+					retire(probe.entry.exchange(entry, std::memory_order_release));
+					return &entry->chunk;
+				}
+				if (probeKey == tombstoneKey && reusable == SIZE_MAX)
+				{
+					reusable = slot;
+				}
+				if (probeKey == emptyKey)
+				{
+					if (reusable == SIZE_MAX)
+					{
+						reusable = slot;
+						current.used++;
+					}
+					else
+					{
+						current.tombstones--;
+					}
+					break;
+				}
+			}
+
+			//the entry is published before the key, a reader matching the key finds a complete entry
+			Slot& target = current.slots[reusable];
+			target.entry.store(entry, std::memory_order_release);
+			target.key.store(key, std::memory_order_release);
+			count++;
+			return &entry->chunk;
+		}
+
+		//owner thread only
+		bool erase(const ChunkCoordinate& coordinate)
+		{
+			Table& current = *table.load(std::memory_order_relaxed);
+			uint64_t key = morton_key(coordinate);
+			for (size_t slot = home_slot(current, key); ; slot = (slot + 1) & current.mask)
+			{
+				Slot& probe = current.slots[slot];
+				uint64_t probeKey = probe.key.load(std::memory_order_relaxed);
+				if (probeKey == emptyKey)
+				{
+					return false;
+				}
+				if (probeKey == key)
+				{
+					retire(probe.entry.exchange(nullptr, std::memory_order_release));
+					probe.key.store(tombstoneKey, std::memory_order_release);
+					current.tombstones++;
+					count--;
+					return true;
+				}
+			}
+		}
+
+		/*
+		* Owner thread only, once a frame or so: starts a new epoch and frees whatever was retired
+		* before the oldest epoch a reader still has pinned.
+		*/
+		void collect()
+		{
+			globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			uint64_t oldest = globalEpoch.load(std::memory_order_relaxed);
+			for (const ReaderEpoch& reader : readers)
+			{
+				uint64_t epoch = reader.epoch.load(std::memory_order_acquire);
+				if (epoch != 0)
+				{
+					oldest = std::min(oldest, epoch);
+				}
+			}
+			free_retired(oldest);
+		}
+
+		//owner thread only, visits every chunk
+		template<typename Callback>
+		void for_each(Callback callback) const
+		{
+			const Table& current = *table.load(std::memory_order_relaxed);
+			for (size_t i = 0; i <= current.mask; i++)
+			{
+				if (Entry* entry = current.slots[i].entry.load(std::memory_order_relaxed))
+				{
+					callback(entry->coordinate(), entry->chunk);
+				}
+			}
+		}
+
+		size_t size() const
+		{
+			return count;
+		}
+
+		size_t get_capacity() const
+		{
+			return table.load(std::memory_order_relaxed)->mask + 1;
+		}
+
+		//chunks and tables waiting for readers to move on
+		size_t get_retired_count() const
+		{
+			return retiredEntries.size() + retiredTables.size();
+		}
+
+	private:
+
+		static constexpr uint64_t emptyKey = UINT64_MAX;
+		static constexpr uint64_t tombstoneKey = UINT64_MAX - 1;
+		static constexpr size_t minCapacity = 1024;
+
+		struct Entry
+		{
+			uint64_t key;
+			Chunk chunk;
+
+			ChunkCoordinate coordinate() const
+			{
+				ChunkCoordinate result;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					result[axis] = static_cast<int32_t>(compact_3(key >> axis)) - chunkCoordinateBias;
+				}
+				return result;
+			}
+		};
+
+		struct Slot
+		{
+			std::atomic<uint64_t> key{ emptyKey };
+			std::atomic<Entry*> entry{ nullptr };
+		};
+
+		struct Table
+		{
+			size_t mask;
+			std::unique_ptr<Slot[]> slots;
+
+			//owner side bookkeeping: slots ever filled and slots holding tombstones
+			size_t used{ 0 };
+			size_t tombstones{ 0 };
+
+			explicit Table(size_t capacity) :
+				mask(capacity - 1),
+				slots(new Slot[capacity])
+			{
+			}
+		};
+
+		//one cache line per reader, readers pinning epochs do not contend
+		struct alignas(64) ReaderEpoch
+		{
+			std::atomic<uint64_t> epoch{ 0 };
+		};
+
+		std::atomic<Table*> table{ nullptr };
+		size_t count{ 0 };
+
+		//0 in a reader slot means not reading, so epochs start at 1
+		std::atomic<uint64_t> globalEpoch{ 1 };
+		mutable std::vector<ReaderEpoch> readers;
+		std::vector<std::pair<uint64_t, Entry*>> retiredEntries;
+		std::vector<std::pair<uint64_t, Table*>> retiredTables;
+
+		//two readers sharing a slot would let one unpin chunks the other still uses
+		std::atomic<uint64_t>& reader_epoch(uint32_t reader) const
+		{
+			assert(reader < readers.size());
+			return readers[reader].epoch;
+		}
+
+		static uint64_t compact_3(uint64_t value)
+		{
+			value &= 0x1249249249249249ull;
+			value = (value | (value >> 2)) & 0x10C30C30C30C30C3ull;
+			value = (value | (value >> 4)) & 0x100F00F00F00F00Full;
+			value = (value | (value >> 8)) & 0x1F0000FF0000FFull;
+			value = (value | (value >> 16)) & 0x1F00000000FFFFull;
+			value = (value | (value >> 32)) & 0x1FFFFF;
+			return value;
+		}
+
+		static bool in_range(int32_t value)
+		{
+			return value >= -chunkCoordinateBias && value < chunkCoordinateBias;
+		}
+
+		//adds delta (-1, 0 or 1) to one axis of a Morton key without decoding it: the other axes'
+		//bits are filled with ones so carries ripple across them
+		static uint64_t step(uint64_t key, int axis, int32_t delta)
+		{
+			uint64_t axisBits = 0x1249249249249249ull << axis;
+			if (delta > 0)
+			{
+				return (((key | ~axisBits) + (1ull << axis)) & axisBits) | (key & ~axisBits);
+			}
+			if (delta < 0)
+			{
+				return (((key & axisBits) - (1ull << axis)) & axisBits) | (key & ~axisBits);
+			}
+			return key;
+		}
+
+		//Fibonacci hashing, consecutive Morton keys spread over the table
+		static size_t home_slot(const Table& current, uint64_t key)
+		{
+			return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 20) & current.mask;
+		}
+
+		//at most one pass over the table, readers never wait on the owner
+		static const Chunk* find_in(const Table& current, uint64_t key)
+		{
+			size_t slot = home_slot(current, key);
+			for (size_t probes = 0; probes <= current.mask; probes++, slot = (slot + 1) & current.mask)
+			{
+				const Slot& probe = current.slots[slot];
+				uint64_t probeKey = probe.key.load(std::memory_order_acquire);
+				if (probeKey == emptyKey)
+				{
+					return nullptr;
+				}
+				if (probeKey == key)
+				{
+					//the slot may have been erased and reused since its key was read, the entry carries its own key
+					const Entry* entry = probe.entry.load(std::memory_order_acquire);
+					return entry && entry->key == key ? &entry->chunk : nullptr;
+				}
+			}
+			return nullptr;
+		}
+
+		void retire(Entry* entry)
+		{
+			if (entry)
+			{
+				retiredEntries.push_back({ globalEpoch.load(std::memory_order_relaxed), entry });
+			}
+		}
+
+		void free_retired(uint64_t oldestPinned)
+		{
+			auto free_entries = [oldestPinned](std::pair<uint64_t, Entry*>& retired)
+			{
+				if (retired.first < oldestPinned)
+				{
+					delete retired.second;
+					return true;
+				}
+				return false;
+			};
+			retiredEntries.erase(std::remove_if(retiredEntries.begin(), retiredEntries.end(), free_entries), retiredEntries.end());
+
+			auto free_tables = [oldestPinned](std::pair<uint64_t, Table*>& retired)
+			{
+				if (retired.first < oldestPinned)
+				{
+					delete retired.second;
+					return true;
+				}
+				return false;
+			};
+			retiredTables.erase(std::remove_if(retiredTables.begin(), retiredTables.end(), free_tables), retiredTables.end());
+		}
+
+		/*
+		* Keeps filled slots, tombstones included, at no more than half the table so probe runs stay
+		* short. The entries move to a new table, doubled when live chunks alone pass a quarter, which
+		* replaces the old one in a single store. Readers still probing the old table find what it held
+		* when it was replaced, it is retired like an erased chunk.
+		*/
+		void grow_if_needed()
+		{
+			Table* current = table.load(std::memory_order_relaxed);
+			size_t capacity = current->mask + 1;
+			if ((current->used + 1) * 2 <= capacity)
+			{
+				return;
+			}
+
+			size_t newCapacity = (count + 1) * 4 > capacity ? capacity * 2 : capacity;
+			Table* grown = new Table(newCapacity);
+			for (size_t i = 0; i < capacity; i++)
+			{
+				Entry* entry = current->slots[i].entry.load(std::memory_order_relaxed);
+				if (!entry)
+				{
+					continue;
+				}
+				size_t slot = home_slot(*grown, entry->key);
+				while (grown->slots[slot].key.load(std::memory_order_relaxed) != emptyKey)
+				{
+					slot = (slot + 1) & grown->mask;
+				}
+				grown->slots[slot].entry.store(entry, std::memory_order_relaxed);
+				grown->slots[slot].key.store(entry->key, std::memory_order_relaxed);
+				grown->used++;
+			}
+
+			table.store(grown, std::memory_order_release);
+			retiredTables.push_back({ globalEpoch.load(std::memory_order_relaxed), current });
+		}
+	};
+}
@@ -0,0 +1,895 @@
+#pragma once
+#include "config.h"
+#include "gpu_memory.h"
+#include "upload.h"
+#include "pipeline.h"
+#include "descriptors.h"
+#include "depth_pyramid.h"
+#include "software_occlusion.h"
+#include "camera.h"
+
+namespace vkUtil
+{
+	//interleaved in the order chunk.vert declares its inputs
+	struct ChunkVertex
+	{
+		float position[3];
+		float color[3];
+	};
+
+	struct ChunkMeshData
+	{
+		std::vector<ChunkVertex> vertices;
+		std::vector<uint32_t> indices;
+		std::array<float, 3> boundsMin{};
+		std::array<float, 3> boundsMax{};
+
+		//solid boxes inside the chunk, what hides other chunks when culling on the CPU
+		std::vector<OccluderBox> occluders;
+	};
+
+	//slot in the chunk metadata buffer, stable for the chunk's lifetime
+	using ChunkHandle = uint32_t;
+	constexpr ChunkHandle invalidChunk = UINT32_MAX;
+
+	//the early phase draws last frame's visible chunks, the late phase the ones the depth pyramid reveals
+	enum class CullPhase : uint32_t
+	{
+		Early,
+		Late
+	};
+
+	//GPU culling counters of one frame, read back once its fence has signaled
+	struct CullStatistics
+	{
+		uint32_t drawnEarly{ 0 };
+		uint32_t drawnLate{ 0 };
+
+		//live chunks, and how many of them the late phase found outside the frustum or hidden
+		uint32_t tested{ 0 };
+		uint32_t frustumCulled{ 0 };
+		uint32_t occlusionCulled{ 0 };
+	};
+
+	//CPU culling of the frame being recorded, when the GPU cannot decide the draw count itself
+	struct CpuCullStatistics
+	{
+		uint32_t tested{ 0 };
+		uint32_t frustumCulled{ 0 };
+		uint32_t occlusionCulled{ 0 };
+		uint32_t occluders{ 0 };
+		double milliseconds{ 0.0 };
+	};
+
+	struct ChunkRendererInput
+	{
+		vk::Device device;
+		MemoryManager* memoryManager;
+		UploadService* uploadService;
+		uint32_t frameCount;
+
+		//occluder boxes rasterized per frame by cull_on_cpu, the nearest and largest are kept
+		uint32_t maxOccluders{ 128 };
+
+		uint32_t maxChunks{ 65536 };
+		vk::DeviceSize vertexCapacity{ 32ull << 20 };
+		vk::DeviceSize indexCapacity{ 16ull << 20 };
+
+		//vkCmdDrawIndexedIndirectCount (1.2 or VK_KHR_draw_indirect_count) and multi draw indirect are enabled
+		bool drawIndirectCount;
+		bool multiDrawIndirect;
+		const vk::DispatchLoaderDynamic* dispatch;
+	};
+
+	/*
+	* GPU driven chunk drawing. Every chunk mesh is suballocated from one vertex and one index buffer,
+	* its bounds and index range go into a metadata buffer, and each frame a compute pass culls the
+	* chunks and writes a VkDrawIndexedIndirectCommand per visible chunk. One
+	* vkCmdDrawIndexedIndirectCount then draws them all, however many there are, without the CPU
+	* touching a single chunk. Without the count variant every slot gets a command (culled ones draw
+	* zero instances) for multi draw indirect, or one indirect draw per slot without that either.
+	*
+	* Culling runs in two phases around a depth pyramid (chunk_cull.comp): chunks visible last frame
+	* are drawn first, their depth becomes the pyramid, then every chunk is tested against the
+	* frustum and the pyramid and the newly visible ones are drawn. Hidden chunks cost one compute
+	* invocation, and nothing pops in a frame late when the camera turns a corner.
+	*
+	* Without the count variant the CPU records draws for every slot, so cull_on_cpu trims the list
+	* first: frustum tests and a software occlusion buffer (SoftwareOcclusion) on the job pool leave
+	* only the slots that may be visible, the GPU phases still cull those further.
+	*/
+	class ChunkRenderer
+	{
+	public:
+
+		ChunkRenderer(const ChunkRendererInput& input, bool debug) :
+			device(input.device),
+			memoryManager(input.memoryManager),
+			uploadService(input.uploadService),
+			maxChunks(input.maxChunks),
+			maxOccluders(input.maxOccluders),
+			drawIndirectCount(input.drawIndirectCount),
+			multiDrawIndirect(input.multiDrawIndirect),
+			dispatch(input.dispatch)
+		{
+			vertexArena = make_arena(input.vertexCapacity, vk::BufferUsageFlagBits::eVertexBuffer, debug);
+			indexArena = make_arena(input.indexCapacity, vk::BufferUsageFlagBits::eIndexBuffer, debug);
+			chunkDraws = memoryManager->create_buffer(
+				sizeof(ChunkDraw) * maxChunks, vk::BufferUsageFlagBits::eStorageBuffer, MemoryPool::ChunkMesh, debug
+			);
+
+			//written by the late phase, read by the next frame's early phase: shared by the frames in flight
+			visibility = memoryManager->create_buffer(
+				sizeof(uint32_t) * maxChunks, vk::BufferUsageFlagBits::eStorageBuffer, MemoryPool::ChunkMesh, debug
+			);
+
+			frames.resize(input.frameCount);
+			for (FrameResources& frame : frames)
+			{
+				for (Buffer*& commands : frame.commands)
+				{
+					commands = memoryManager->create_buffer(
+						sizeof(vk::DrawIndexedIndirectCommand) * maxChunks,
+						vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer, MemoryPool::ChunkMesh, debug
+					);
+				}
+				frame.counters = memoryManager->create_buffer(
+					sizeof(CullStatistics), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+					MemoryPool::ChunkMesh, debug
+				);
+				frame.readback = memoryManager->create_buffer(
+					sizeof(CullStatistics), vk::BufferUsageFlagBits::eTransferDst, MemoryPool::Readback, debug
+				);
+			}
+
+			descriptorPool = vkInit::make_descriptor_pool(device, {
+				vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, storageBindings * input.frameCount),
+				vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, input.frameCount)
+			}, input.frameCount, debug);
+
+			if (debug)
+			{
+				std::cout << "Chunk renderer: " << maxChunks << " chunk slots, "
+					<< (input.vertexCapacity >> 20) << "MiB vertex and " << (input.indexCapacity >> 20) << "MiB index arenas, drawn with "
+					<< (drawIndirectCount ? "draw indirect count" : multiDrawIndirect ? "multi draw indirect" : "one indirect draw per chunk") << '\n';
+			}
+		}
+
+		ChunkRenderer(const ChunkRenderer&) = delete;
+		ChunkRenderer& operator=(const ChunkRenderer&) = delete;
+
+		//the culling compute pipeline, rebuilt from new SPIR-V when called again, empty SPIR-V (a failed compile) builds nothing
+		bool build_cull_pipeline(const std::vector<uint32_t>& spirv, vk::PipelineCache pipelineCache, LayoutCache* layoutCache, bool debug)
+		{
+			if (spirv.empty())
+			{
+				return false;
+			}
+
+			vkInit::ComputePipelineInBundle specification = {};
+			specification.device = device;
+			specification.computeCode = spirv;
+			specification.pipelineCache = pipelineCache;
+			specification.layoutCache = layoutCache;
+
+			vkInit::ComputePipelineOutBundle output = vkInit::make_compute_pipeline(specification, debug);
+			if (!output.pipeline || output.setLayouts.empty())
+			{
+				return false;
+			}
+
+			device.destroyPipeline(cullPipeline);
+			cullPipeline = output.pipeline;
+			cullLayout = output.layout;
+
+			for (FrameResources& frame : frames)
+			{
+				if (!frame.descriptorSet)
+				{
+					frame.descriptorSet = vkInit::allocate_descriptor_set(device, descriptorPool, output.setLayouts[0], debug);
+				}
+			}
+			return true;
+		}
+
+		/*
+		* Suballocates and uploads a chunk mesh, the returned upload ticket has to complete before
+		* the frame that first culls the chunk (Engine::wait_for_upload).
+		*/
+		ChunkHandle add_chunk(const ChunkMeshData& mesh, uint64_t& ticket, bool debug)
+		{
+			ticket = 0;
+			if (mesh.vertices.empty() || mesh.indices.empty())
+			{
+				return invalidChunk;
+			}
+
+			ChunkHandle handle = invalidChunk;
+			if (!freeHandles.empty())
+			{
+				handle = freeHandles.back();
+				freeHandles.pop_back();
+			}
+			else if (slotCount < maxChunks)
+			{
+				handle = slotCount++;
+			}
+			if (handle == invalidChunk)
+			{
+				if (debug)
+				{
+					std::cout << "Out of chunk slots" << std::endl;
+				}
+				return invalidChunk;
+			}
+
+			Chunk& chunk = chunks.size() > handle ? chunks[handle] : chunks.emplace_back();
+			chunk = {};
+			vk::DeviceSize vertexBytes = mesh.vertices.size() * sizeof(ChunkVertex);
+			vk::DeviceSize indexBytes = mesh.indices.size() * sizeof(uint32_t);
+			if (!vertexArena.allocate(vertexBytes, sizeof(ChunkVertex), chunk.vertices)
+				|| !indexArena.allocate(indexBytes, sizeof(uint32_t), chunk.indices))
+			{
+				if (debug)
+				{
+					std::cout << "Chunk mesh arenas are full" << std::endl;
+				}
+				vertexArena.free(chunk.vertices);
+				freeHandles.push_back(handle);
+				return invalidChunk;
+			}
+
+			ChunkDraw draw = {};
+			draw.boundsMin = { mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2], 0.0f };
+			draw.boundsMax = { mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2], 0.0f };
+			draw.indexCount = static_cast<uint32_t>(mesh.indices.size());
+			draw.firstIndex = static_cast<uint32_t>(chunk.indices.offset / sizeof(uint32_t));
+			draw.vertexOffset = static_cast<int32_t>(chunk.vertices.offset / sizeof(ChunkVertex));
+
+			uploadService->upload_buffer(vertexArena.buffer, mesh.vertices.data(), vertexBytes, chunk.vertices.offset, debug);
+			uploadService->upload_buffer(indexArena.buffer, mesh.indices.data(), indexBytes, chunk.indices.offset, debug);
+			ticket = uploadService->upload_buffer(chunkDraws, &draw, sizeof(ChunkDraw), sizeof(ChunkDraw) * handle, debug);
+
+			chunk.boundsMin = mesh.boundsMin;
+			chunk.boundsMax = mesh.boundsMax;
+			chunk.occluders = mesh.occluders;
+			chunk.live = true;
+			liveChunks++;
+			return handle;
+		}
+
+		/*
+		* The chunk stops drawing from the first culled frame that waits for the returned upload
+		* ticket (Engine::wait_for_upload). Its mesh ranges and slot are only reused once the frames
+		* in flight that may still draw them have finished and the cleared draw has landed.
+		*/
+		uint64_t remove_chunk(ChunkHandle handle, uint64_t frameNumber, bool debug)
+		{
+			if (handle >= chunks.size() || !chunks[handle].live)
+			{
+				return 0;
+			}
+
+			ChunkDraw empty = {};
+			uint64_t ticket = uploadService->upload_buffer(chunkDraws, &empty, sizeof(ChunkDraw), sizeof(ChunkDraw) * handle, debug);
+
+			chunks[handle].live = false;
+			chunks[handle].occluders.clear();
+			liveChunks--;
+			retired.push_back({ handle, frameNumber + frames.size(), ticket });
+			return ticket;
+		}
+
+		//frees what removed chunks held once no frame in flight can reference it
+		void begin_frame(uint64_t frameNumber)
+		{
+			for (size_t i = 0; i < retired.size(); )
+			{
+				if (frameNumber >= retired[i].frame && uploadService->is_complete(retired[i].ticket))
+				{
+					Chunk& chunk = chunks[retired[i].handle];
+					vertexArena.free(chunk.vertices);
+					indexArena.free(chunk.indices);
+					freeHandles.push_back(retired[i].handle);
+					retired.erase(retired.begin() + i);
+				}
+				else
+				{
+					i++;
+				}
+			}
+		}
+
+		/*
+		* Records one culling phase, outside of any render pass, before the passes drawing that phase.
+		* The early phase comes first in the frame. The late phase needs this frame's pyramid, built
+		* from the depth the early draws left behind, and writes the counters read by collect_statistics.
+		*/
+		void record_cull(
+			vk::CommandBuffer commandBuffer, uint32_t frame, CullPhase phase,
+			const std::array<float, 16>& viewProjection, const DepthPyramid& pyramid)
+		{
+			FrameResources& resources = frames[frame];
+			if (!cullPipeline || !resources.descriptorSet)
+			{
+				return;
+			}
+
+			if (phase == CullPhase::Early)
+			{
+				//defragmentation may have replaced the buffers, the set is idle since the slot's fence signaled
+				vkUtil::write_storage_buffers(device, resources.descriptorSet, {
+					chunkDraws->buffer, visibility->buffer,
+					resources.commands[0]->buffer, resources.commands[1]->buffer, resources.counters->buffer
+				});
+				write_image(device, resources.descriptorSet, storageBindings, vk::DescriptorType::eCombinedImageSampler,
+					pyramid.get_sampler(), pyramid.get_view(), vk::ImageLayout::eGeneral);
+
+				//nothing was visible before the first frame
+				if (!visibilityCleared)
+				{
+					commandBuffer.fillBuffer(visibility->buffer, 0, VK_WHOLE_SIZE, 0);
+					visibilityCleared = true;
+				}
+				commandBuffer.fillBuffer(resources.counters->buffer, 0, sizeof(CullStatistics), 0);
+
+				//the previous frame's late phase wrote visibility
+				buffer_barrier(commandBuffer, visibility->buffer,
+					vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+					vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite,
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+				buffer_barrier(commandBuffer, resources.counters->buffer,
+					vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+			}
+			else
+			{
+				//the early phase read the visibility the late phase is about to overwrite
+				buffer_barrier(commandBuffer, visibility->buffer,
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlags(),
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+			}
+
+			uint32_t index = static_cast<uint32_t>(phase);
+			if (slotCount > 0)
+			{
+				CullConstants constants = {};
+				std::copy(viewProjection.begin(), viewProjection.end(), constants.viewProjection);
+				constants.chunkCount = slotCount;
+				constants.phase = index;
+				constants.compact = drawIndirectCount ? 1 : 0;
+				if (phase == CullPhase::Late && pyramid.ready())
+				{
+					constants.pyramidLevels = pyramid.get_level_count();
+					constants.pyramidSize[0] = static_cast<float>(pyramid.get_extent().width);
+					constants.pyramidSize[1] = static_cast<float>(pyramid.get_extent().height);
+				}
+
+				commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+				commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullLayout, 0, resources.descriptorSet, nullptr);
+				commandBuffer.pushConstants(cullLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants), &constants);
+				commandBuffer.dispatch((slotCount + cullGroupSize - 1) / cullGroupSize, 1, 1);
+			}
+
+			//the phase's draw commands and count are read as indirect arguments, the late phase adds to the counters
+			buffer_barrier(commandBuffer, resources.commands[index]->buffer,
+				vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite,
+				vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead);
+
+			if (phase == CullPhase::Early)
+			{
+				buffer_barrier(commandBuffer, resources.counters->buffer,
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite,
+					vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader,
+					vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+				return;
+			}
+
+			buffer_barrier(commandBuffer, resources.counters->buffer,
+				vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite,
+				vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eTransfer,
+				vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eTransferRead);
+
+			vk::BufferCopy copy(0, 0, sizeof(CullStatistics));
+			commandBuffer.copyBuffer(resources.counters->buffer, resources.readback->buffer, copy);
+			buffer_barrier(commandBuffer, resources.readback->buffer,
+				vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+				vk::PipelineStageFlagBits::eHost, vk::AccessFlagBits::eHostRead);
+			resources.countersWritten = true;
+		}
+
+		//one draw call for the phase's visible chunks, only valid when gpu_driven()
+		void record_draws(vk::CommandBuffer commandBuffer, uint32_t frame, CullPhase phase)
+		{
+			FrameResources& resources = frames[frame];
+			if (slotCount == 0 || !cullPipeline)
+			{
+				return;
+			}
+
+			uint32_t index = static_cast<uint32_t>(phase);
+			bind_geometry(commandBuffer);
+			commandBuffer.drawIndexedIndirectCount(
+				resources.commands[index]->buffer, 0, resources.counters->buffer, sizeof(uint32_t) * index,
+				slotCount, sizeof(vk::DrawIndexedIndirectCommand), *dispatch
+			);
+		}
+
+		/*
+		* Fallback for draws [begin, end) of get_fallback_draw_count(): the slots cull_on_cpu kept this
+		* frame, or every slot without it. Slots the GPU phase culled draw nothing.
+		*/
+		void record_draws(vk::CommandBuffer commandBuffer, uint32_t frame, CullPhase phase, uint32_t begin, uint32_t end)
+		{
+			FrameResources& resources = frames[frame];
+			end = std::min(end, get_fallback_draw_count());
+			if (begin >= end || !cullPipeline)
+			{
+				return;
+			}
+
+			vk::Buffer commands = resources.commands[static_cast<uint32_t>(phase)]->buffer;
+			bind_geometry(commandBuffer);
+			vk::DeviceSize stride = sizeof(vk::DrawIndexedIndirectCommand);
+			if (!multiDrawIndirect)
+			{
+				for (uint32_t draw = begin; draw < end; draw++)
+				{
+					commandBuffer.drawIndexedIndirect(commands, fallback_slot(draw) * stride, 1, static_cast<uint32_t>(stride));
+				}
+				return;
+			}
+
+			//runs of consecutive slots share a draw call
+			for (uint32_t draw = begin; draw < end; )
+			{
+				uint32_t first = fallback_slot(draw);
+				uint32_t count = 1;
+				while (draw + count < end && fallback_slot(draw + count) == first + count)
+				{
+					count++;
+				}
+				commandBuffer.drawIndexedIndirect(commands, first * stride, count, static_cast<uint32_t>(stride));
+				draw += count;
+			}
+		}
+
+		//indirect draws the fallback path records this frame
+		uint32_t get_fallback_draw_count() const
+		{
+			return cpuCulled ? static_cast<uint32_t>(visibleSlots.size()) : slotCount;
+		}
+
+		/*
+		* Culls on the CPU before the fallback draws are recorded: chunks outside the frustum are
+		* dropped, the largest on screen occluder boxes of the rest are rasterized and every remaining
+		* chunk is tested against them. Call once per frame; from then on the fallback draws only
+		* cover the slots that passed.
+		*/
+		void cull_on_cpu(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, SoftwareOcclusion& occlusion, JobPool& jobs)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			Frustum frustum = extract_frustum(viewProjection);
+			slotStates.assign(slotCount, SlotState::Empty);
+			uint32_t jobCount = std::max(std::min(jobs.get_thread_count() * jobsPerThread, slotCount / minSlotsPerJob), 1u);
+			auto job_range = [this, jobCount](uint32_t job)
+			{
+				return std::make_pair(slotCount * job / jobCount, slotCount * (job + 1) / jobCount);
+			};
+
+			jobs.run(jobCount, [&](uint32_t job, uint32_t)
+			{
+				auto [begin, end] = job_range(job);
+				for (uint32_t slot = begin; slot < end; slot++)
+				{
+					const Chunk& chunk = chunks[slot];
+					if (chunk.live)
+					{
+						slotStates[slot] = box_in_frustum(frustum, chunk.boundsMin, chunk.boundsMax) ? SlotState::Visible : SlotState::OutsideFrustum;
+					}
+				}
+			});
+
+			//projected size over distance squared ranks the occluders, only the best few are worth rasterizing
+			occluderCandidates.clear();
+			for (uint32_t slot = 0; slot < slotCount; slot++)
+			{
+				if (slotStates[slot] != SlotState::Visible)
+				{
+					continue;
+				}
+				for (const OccluderBox& box : chunks[slot].occluders)
+				{
+					glm::vec3 boxMin(box.boundsMin[0], box.boundsMin[1], box.boundsMin[2]);
+					glm::vec3 boxMax(box.boundsMax[0], box.boundsMax[1], box.boundsMax[2]);
+					glm::vec3 offset = glm::max(glm::max(boxMin - cameraPosition, cameraPosition - boxMax), glm::vec3(0.0f));
+					float size = glm::length(boxMax - boxMin);
+					float distance = std::max(glm::dot(offset, offset), 1.0f);
+					occluderCandidates.push_back({ size * size / distance, box });
+				}
+			}
+			if (occluderCandidates.size() > maxOccluders)
+			{
+				std::nth_element(occluderCandidates.begin(), occluderCandidates.begin() + maxOccluders, occluderCandidates.end(),
+					[](const auto& a, const auto& b) { return a.first > b.first; });
+				occluderCandidates.resize(maxOccluders);
+			}
+			occluders.clear();
+			for (const auto& candidate : occluderCandidates)
+			{
+				occluders.push_back(candidate.second);
+			}
+			occlusion.render(viewProjection, cameraPosition, occluders, &jobs);
+
+			jobs.run(jobCount, [&](uint32_t job, uint32_t)
+			{
+				auto [begin, end] = job_range(job);
+				for (uint32_t slot = begin; slot < end; slot++)
+				{
+					const Chunk& chunk = chunks[slot];
+					if (slotStates[slot] == SlotState::Visible && !occlusion.test_box(viewProjection, chunk.boundsMin, chunk.boundsMax))
+					{
+						slotStates[slot] = SlotState::Occluded;
+					}
+				}
+			});
+
+			cpuStatistics = {};
+			visibleSlots.clear();
+			for (uint32_t slot = 0; slot < slotCount; slot++)
+			{
+				switch (slotStates[slot])
+				{
+				case SlotState::Visible:
+					visibleSlots.push_back(slot);
+					break;
+				case SlotState::OutsideFrustum:
+					cpuStatistics.frustumCulled++;
+					break;
+				case SlotState::Occluded:
+					cpuStatistics.occlusionCulled++;
+					break;
+				default:
+					continue;
+				}
+				cpuStatistics.tested++;
+			}
+			cpuStatistics.occluders = static_cast<uint32_t>(occluders.size());
+			cpuStatistics.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			cpuCulled = true;
+		}
+
+		const CpuCullStatistics& get_cpu_cull_statistics() const
+		{
+			return cpuStatistics;
+		}
+
+		//reads the counters the frame's last late phase wrote, its fence must have signaled, false when there are none
+		bool collect_statistics(uint32_t frame)
+		{
+			FrameResources& resources = frames[frame];
+			if (!resources.countersWritten || !resources.readback->mapped)
+			{
+				return false;
+			}
+			resources.countersWritten = false;
+
+			memoryManager->invalidate(resources.readback);
+			std::memcpy(&lastStatistics, resources.readback->mapped, sizeof(CullStatistics));
+			return true;
+		}
+
+		const CullStatistics& get_cull_statistics() const
+		{
+			return lastStatistics;
+		}
+
+		//a single indirect draw covers every chunk, otherwise draws are spread over slots
+		bool gpu_driven() const
+		{
+			return drawIndirectCount;
+		}
+
+		//slots the culling pass and fallback draws cover, live chunks plus holes left by removed ones
+		uint32_t get_slot_count() const
+		{
+			return slotCount;
+		}
+
+		uint32_t get_chunk_count() const
+		{
+			return liveChunks;
+		}
+
+		void log_statistics() const
+		{
+			std::cout << "Chunk renderer: " << liveChunks << " chunks in " << slotCount << " slots, vertex arena "
+				<< vertexArena.used() / (1 << 20) << '/' << vertexArena.capacity / (1 << 20) << "MiB, index arena "
+				<< indexArena.used() / (1 << 20) << '/' << indexArena.capacity / (1 << 20) << "MiB\n";
+			std::cout << "Chunk culling: " << lastStatistics.tested << " tested, " << lastStatistics.frustumCulled << " outside the frustum, "
+				<< lastStatistics.occlusionCulled << " occluded, " << lastStatistics.drawnEarly << " drawn early and "
+				<< lastStatistics.drawnLate << " late\n";
+			if (cpuCulled)
+			{
+				std::cout << "CPU chunk culling: " << cpuStatistics.tested << " tested, " << cpuStatistics.frustumCulled << " outside the frustum, "
+					<< cpuStatistics.occlusionCulled << " occluded by " << cpuStatistics.occluders << " boxes in " << cpuStatistics.milliseconds << "ms\n";
+			}
+		}
+
+		void destroy()
+		{
+			device.destroyPipeline(cullPipeline);
+			device.destroyDescriptorPool(descriptorPool);
+
+			for (FrameResources& frame : frames)
+			{
+				for (Buffer* commands : frame.commands)
+				{
+					memoryManager->destroy_buffer(commands);
+				}
+				memoryManager->destroy_buffer(frame.counters);
+				memoryManager->destroy_buffer(frame.readback);
+			}
+			frames.clear();
+
+			memoryManager->destroy_buffer(visibility);
+			memoryManager->destroy_buffer(chunkDraws);
+			vertexArena.destroy(memoryManager);
+			indexArena.destroy(memoryManager);
+		}
+
+	private:
+
+		//std430 layout of ChunkDraw in chunk_cull.comp
+		struct ChunkDraw
+		{
+			std::array<float, 4> boundsMin;
+			std::array<float, 4> boundsMax;
+			uint32_t indexCount;
+			uint32_t firstIndex;
+			int32_t vertexOffset;
+			uint32_t padding;
+		};
+
+		//push constants of chunk_cull.comp
+		struct CullConstants
+		{
+			float viewProjection[16];
+			uint32_t chunkCount;
+			uint32_t phase;
+			uint32_t compact;
+			uint32_t pyramidLevels;
+			float pyramidSize[2];
+		};
+
+		struct ArenaRange
+		{
+			VmaVirtualAllocation allocation{ nullptr };
+			vk::DeviceSize offset{ 0 };
+		};
+
+		//one large buffer carved up with a VMA virtual block
+		struct Arena
+		{
+			Buffer* buffer{ nullptr };
+			VmaVirtualBlock block{ nullptr };
+			vk::DeviceSize capacity{ 0 };
+
+			bool allocate(vk::DeviceSize size, vk::DeviceSize alignment, ArenaRange& range)
+			{
+				VmaVirtualAllocationCreateInfo allocationInfo = {};
+				allocationInfo.size = size;
+				allocationInfo.alignment = alignment;
+				return block && vmaVirtualAllocate(block, &allocationInfo, &range.allocation, &range.offset) == VK_SUCCESS;
+			}
+
+			void free(ArenaRange& range)
+			{
+				if (range.allocation)
+				{
+					vmaVirtualFree(block, range.allocation);
+				}
+				range = {};
+			}
+
+			vk::DeviceSize used() const
+			{
+				if (!block)
+				{
+					return 0;
+				}
+				VmaStatistics statistics = {};
+				vmaGetVirtualBlockStatistics(block, &statistics);
+				return statistics.allocationBytes;
+			}
+
+			void destroy(MemoryManager* memoryManager)
+			{
+				if (block)
+				{
+					vmaClearVirtualBlock(block);
+					vmaDestroyVirtualBlock(block);
+					block = nullptr;
+				}
+				memoryManager->destroy_buffer(buffer);
+				buffer = nullptr;
+			}
+		};
+
+		struct Chunk
+		{
+			ArenaRange vertices;
+			ArenaRange indices;
+			std::array<float, 3> boundsMin{};
+			std::array<float, 3> boundsMax{};
+			std::vector<OccluderBox> occluders;
+			bool live{ false };
+		};
+
+		//a removed chunk's slot, reusable from frame on once the upload clearing its draw (ticket) has landed
+		struct RetiredChunk
+		{
+			ChunkHandle handle;
+			uint64_t frame;
+			uint64_t ticket;
+		};
+
+		enum class SlotState : uint8_t
+		{
+			Empty,
+			OutsideFrustum,
+			Occluded,
+			Visible
+		};
+
+		//draw commands per phase, the counters start with the phases' draw counts
+		struct FrameResources
+		{
+			std::array<Buffer*, 2> commands{};
+			Buffer* counters{ nullptr };
+			Buffer* readback{ nullptr };
+			bool countersWritten{ false };
+			vk::DescriptorSet descriptorSet{ nullptr };
+		};
+
+		static constexpr uint32_t cullGroupSize = 64;
+
+		//CPU culling splits the slots into a few jobs per thread, but not into tiny ones
+		static constexpr uint32_t jobsPerThread = 4;
+		static constexpr uint32_t minSlotsPerJob = 256;
+
+		//chunks, visibility, both phases' commands and the counters, then the depth pyramid
+		static constexpr uint32_t storageBindings = 5;
+
+		vk::Device device;
+		MemoryManager* memoryManager;
+		UploadService* uploadService;
+		uint32_t maxChunks;
+		uint32_t maxOccluders;
+		bool drawIndirectCount;
+		bool multiDrawIndirect;
+		const vk::DispatchLoaderDynamic* dispatch;
+
+		Arena vertexArena;
+		Arena indexArena;
+		Buffer* chunkDraws{ nullptr };
+		Buffer* visibility{ nullptr };
+		bool visibilityCleared{ false };
+		CullStatistics lastStatistics{};
+
+		std::vector<Chunk> chunks;
+		std::vector<ChunkHandle> freeHandles;
+		uint32_t slotCount{ 0 };
+		uint32_t liveChunks{ 0 };
+
+		//removed chunks, waiting for their frames in flight and cleared draws
+		std::vector<RetiredChunk> retired;
+
+		//CPU culling results, the fallback draws cover visibleSlots once cull_on_cpu has run
+		bool cpuCulled{ false };
+		std::vector<SlotState> slotStates;
+		std::vector<uint32_t> visibleSlots;
+		std::vector<std::pair<float, OccluderBox>> occluderCandidates;
+		std::vector<OccluderBox> occluders;
+		CpuCullStatistics cpuStatistics{};
+
+		std::vector<FrameResources> frames;
+		vk::DescriptorPool descriptorPool{ nullptr };
+		vk::Pipeline cullPipeline{ nullptr };
+		vk::PipelineLayout cullLayout{ nullptr };
+
+		Arena make_arena(vk::DeviceSize capacity, vk::BufferUsageFlags usage, bool debug)
+		{
+			Arena arena = {};
+			arena.capacity = capacity;
+			arena.buffer = memoryManager->create_buffer(capacity, usage, MemoryPool::ChunkMesh, debug);
+
+			VmaVirtualBlockCreateInfo blockInfo = {};
+			blockInfo.size = capacity;
+			if (vmaCreateVirtualBlock(&blockInfo, &arena.block) != VK_SUCCESS && debug)
+			{
+				std::cout << "Failed to create chunk mesh arena" << std::endl;
+			}
+			return arena;
+		}
+
+		uint32_t fallback_slot(uint32_t draw) const
+		{
+			return cpuCulled ? visibleSlots[draw] : draw;
+		}
+
+		void bind_geometry(vk::CommandBuffer commandBuffer)
+		{
+			vk::DeviceSize offset = 0;
+			commandBuffer.bindVertexBuffers(0, 1, &vertexArena.buffer->buffer, &offset);
+			commandBuffer.bindIndexBuffer(indexArena.buffer->buffer, 0, vk::IndexType::eUint32);
+		}
+
+		static void buffer_barrier(
+			vk::CommandBuffer commandBuffer, vk::Buffer buffer,
+			vk::PipelineStageFlags srcStage, vk::AccessFlags srcAccess,
+			vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+		{
+			vk::BufferMemoryBarrier barrier = {};
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = buffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			commandBuffer.pipelineBarrier(srcStage, dstStage, vk::DependencyFlags(), nullptr, barrier, nullptr);
+		}
+	};
+
+	//appends an axis aligned box with faces wound clockwise seen from outside, what the pipelines treat as front facing
+	void append_box(ChunkMeshData& mesh, const std::array<float, 3>& boxMin, const std::array<float, 3>& boxMax, const std::array<float, 3>& color)
+	{
+		//normal axis and sign, then two tangent axes whose cross product is the normal
+		const int faces[6][4] = {
+			{ 0, 1, 1, 2 }, { 0, 0, 2, 1 },
+			{ 1, 1, 2, 0 }, { 1, 0, 0, 2 },
+			{ 2, 1, 0, 1 }, { 2, 0, 1, 0 }
+		};
+		//cheap directional shading so faces read apart
+		const float shades[6] = { 0.8f, 0.6f, 1.0f, 0.4f, 0.9f, 0.7f };
+
+		for (int face = 0; face < 6; face++)
+		{
+			int normal = faces[face][0];
+			int u = faces[face][2];
+			int v = faces[face][3];
+			uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+
+			//counter clockwise around the outward normal
+			const int corners[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+			for (const int* corner : corners)
+			{
+				ChunkVertex vertex = {};
+				vertex.position[normal] = faces[face][1] ? boxMax[normal] : boxMin[normal];
+				vertex.position[u] = corner[0] ? boxMax[u] : boxMin[u];
+				vertex.position[v] = corner[1] ? boxMax[v] : boxMin[v];
+				for (int i = 0; i < 3; i++)
+				{
+					vertex.color[i] = color[i] * shades[face];
+				}
+				mesh.vertices.push_back(vertex);
+			}
+
+			//reversed to clockwise
+			for (uint32_t index : { 0u, 2u, 1u, 0u, 3u, 2u })
+			{
+				mesh.indices.push_back(base + index);
+			}
+		}
+
+		mesh.occluders.push_back({ boxMin, boxMax });
+
+		for (int i = 0; i < 3; i++)
+		{
+			mesh.boundsMin[i] = mesh.vertices.size() > 24 ? std::min(mesh.boundsMin[i], boxMin[i]) : boxMin[i];
+			mesh.boundsMax[i] = mesh.vertices.size() > 24 ? std::max(mesh.boundsMax[i], boxMax[i]) : boxMax[i];
+		}
+	}
+}
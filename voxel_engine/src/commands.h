@@ -0,0 +1,91 @@
+#pragma once
+#include "config.h"
+#include "queue_families.h"
+
+namespace vkInit
+{
+	vk::CommandPool make_command_pool(vk::Device device, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, bool debug)
+	{
+		vkUtil::QueueFamilyIndices queueFamilyIndices = vkUtil::findQueueFamilies(physicalDevice, surface, false);
+
+		vk::CommandPoolCreateInfo poolInfo = {};
+		poolInfo.flags = vk::CommandPoolCreateFlags() | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+		poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+		try
+		{
+			return device.createCommandPool(poolInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create command pool" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	vk::CommandBuffer make_command_buffer(vk::Device device, vk::CommandPool commandPool, bool debug)
+	{
+		vk::CommandBufferAllocateInfo allocInfo = {};
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = vk::CommandBufferLevel::ePrimary;
+		allocInfo.commandBufferCount = 1;
+
+		try
+		{
+			return device.allocateCommandBuffers(allocInfo)[0];
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to allocate command buffer" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	//per thread pools, the family is known up front and the pool is reset as a whole
+	vk::CommandPool make_command_pool(vk::Device device, uint32_t queueFamilyIndex, vk::CommandPoolCreateFlags flags, bool debug)
+	{
+		vk::CommandPoolCreateInfo poolInfo = {};
+		poolInfo.flags = flags;
+		poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+		try
+		{
+			return device.createCommandPool(poolInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create command pool" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	std::vector<vk::CommandBuffer> make_command_buffers(vk::Device device, vk::CommandPool commandPool, vk::CommandBufferLevel level, uint32_t count, bool debug)
+	{
+		vk::CommandBufferAllocateInfo allocInfo = {};
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = level;
+		allocInfo.commandBufferCount = count;
+
+		try
+		{
+			return device.allocateCommandBuffers(allocInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to allocate command buffers" << std::endl;
+			}
+		}
+		return {};
+	}
+}
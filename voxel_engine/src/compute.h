@@ -0,0 +1,285 @@
+#pragma once
+#include "config.h"
+#include "sync.h"
+#include <functional>
+
+namespace vkUtil
+{
+	//a semaphore a compute job waits for before it starts, binary semaphores ignore value
+	struct ComputeWait
+	{
+		vk::Semaphore semaphore;
+		uint64_t value;
+		vk::PipelineStageFlags stage{ vk::PipelineStageFlagBits::eComputeShader };
+	};
+
+	struct ComputeSchedulerInput
+	{
+		vk::Device device;
+
+		//async compute queue, may be the graphics queue on devices without a separate family
+		vk::Queue queue;
+		uint32_t queueFamilyIndex;
+
+		//timeline semaphores are enabled (core 1.2 or the KHR extension), otherwise completion is tracked with fences
+		bool timelineSemaphores;
+
+		//device level dispatch for the timeline semaphore host functions, aliased to the KHR ones before 1.2
+		const vk::DispatchLoaderDynamic* dispatch;
+	};
+
+	/*
+	* Submits compute jobs (meshing, generation, culling) to the compute queue independently of
+	* the frame's graphics work. Each job is recorded by a callback into its own command buffer
+	* and signals the next value of a timeline semaphore, the ticket submit returns: the graphics
+	* queue, the upload service or other jobs wait for that value to consume the results.
+	* When the compute and graphics queues are the same queue, submit from the render thread.
+	*/
+	class ComputeScheduler
+	{
+	public:
+
+		using RecordCallback = std::function<void(vk::CommandBuffer)>;
+
+		ComputeScheduler(const ComputeSchedulerInput& input, bool debug) :
+			device(input.device),
+			queue(input.queue),
+			timelineSemaphores(input.timelineSemaphores),
+			dispatch(input.dispatch)
+		{
+			vk::CommandPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::CommandPoolCreateFlags() | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+			poolInfo.queueFamilyIndex = input.queueFamilyIndex;
+
+			try
+			{
+				commandPool = device.createCommandPool(poolInfo);
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create compute command pool" << std::endl;
+				}
+			}
+
+			if (timelineSemaphores)
+			{
+				timeline = vkInit::make_timeline_semaphore(device, 0, debug);
+				timelineSemaphores = static_cast<bool>(timeline);
+			}
+		}
+
+		ComputeScheduler(const ComputeScheduler&) = delete;
+		ComputeScheduler& operator=(const ComputeScheduler&) = delete;
+
+		//records a job with record and submits it after waits, returns its ticket (0 on failure)
+		uint64_t submit(const RecordCallback& record, const std::vector<ComputeWait>& waits, bool debug)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			retire_completed();
+			ComputeJob job = acquire_job();
+			job.ticket = submittedTicket + 1;
+
+			vk::CommandBufferBeginInfo beginInfo = {};
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+			job.commandBuffer.begin(beginInfo);
+			record(job.commandBuffer);
+			job.commandBuffer.end();
+
+			std::vector<vk::Semaphore> waitSemaphores;
+			std::vector<vk::PipelineStageFlags> waitStages;
+			std::vector<uint64_t> waitValues;
+			for (const ComputeWait& wait : waits)
+			{
+				waitSemaphores.push_back(wait.semaphore);
+				waitStages.push_back(wait.stage);
+				waitValues.push_back(wait.value);
+			}
+
+			vk::TimelineSemaphoreSubmitInfo timelineInfo = {};
+			timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+			timelineInfo.pWaitSemaphoreValues = waitValues.data();
+			timelineInfo.signalSemaphoreValueCount = 1;
+			timelineInfo.pSignalSemaphoreValues = &job.ticket;
+
+			vk::SubmitInfo submitInfo = {};
+			submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+			submitInfo.pWaitSemaphores = waitSemaphores.data();
+			submitInfo.pWaitDstStageMask = waitStages.data();
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &job.commandBuffer;
+			if (timelineSemaphores)
+			{
+				submitInfo.pNext = &timelineInfo;
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &timeline;
+			}
+
+			try
+			{
+				queue.submit(submitInfo, job.fence);
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to submit compute job" << std::endl;
+				}
+				freeJobs.push_back(job);
+				return 0;
+			}
+
+			submittedTicket = job.ticket;
+			inFlight.push_back(job);
+			return job.ticket;
+		}
+
+		//ticket of the last job submitted, wait for it to drain the queue
+		uint64_t submitted_ticket()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return submittedTicket;
+		}
+
+		//highest ticket whose job has finished on the GPU
+		uint64_t completed_ticket()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			retire_completed();
+			return completedTicket;
+		}
+
+		bool is_complete(uint64_t ticket)
+		{
+			return ticket <= completed_ticket();
+		}
+
+		//blocks the calling thread until ticket's job has finished
+		void wait(uint64_t ticket)
+		{
+			if (timelineSemaphores)
+			{
+				vk::SemaphoreWaitInfo waitInfo = {};
+				waitInfo.semaphoreCount = 1;
+				waitInfo.pSemaphores = &timeline;
+				waitInfo.pValues = &ticket;
+				if (device.waitSemaphores(waitInfo, UINT64_MAX, *dispatch) != vk::Result::eSuccess)
+				{
+					return;
+				}
+			}
+			else
+			{
+				std::vector<vk::Fence> fences;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					for (ComputeJob& job : inFlight)
+					{
+						if (job.ticket <= ticket)
+						{
+							fences.push_back(job.fence);
+						}
+					}
+				}
+				if (!fences.empty() && device.waitForFences(fences, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+				{
+					return;
+				}
+			}
+
+			completed_ticket();
+		}
+
+		//semaphore other queues wait on with a ticket as value, null without timeline support
+		vk::Semaphore get_timeline_semaphore() const
+		{
+			return timelineSemaphores ? timeline : nullptr;
+		}
+
+		void destroy()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			//the caller has waited for the device to go idle
+			for (ComputeJob& job : inFlight)
+			{
+				device.destroyFence(job.fence);
+			}
+			for (ComputeJob& job : freeJobs)
+			{
+				device.destroyFence(job.fence);
+			}
+			inFlight.clear();
+			freeJobs.clear();
+
+			device.destroyCommandPool(commandPool);
+			device.destroySemaphore(timeline);
+		}
+
+	private:
+
+		struct ComputeJob
+		{
+			uint64_t ticket{ 0 };
+			vk::CommandBuffer commandBuffer{ nullptr };
+
+			//signaled with the job, tells the host when its command buffer can be reused
+			vk::Fence fence{ nullptr };
+		};
+
+		vk::Device device;
+		vk::Queue queue;
+		bool timelineSemaphores;
+		const vk::DispatchLoaderDynamic* dispatch;
+
+		vk::CommandPool commandPool{ nullptr };
+		vk::Semaphore timeline{ nullptr };
+
+		std::mutex mutex;
+		std::vector<ComputeJob> inFlight;
+		std::vector<ComputeJob> freeJobs;
+
+		uint64_t submittedTicket{ 0 };
+		uint64_t completedTicket{ 0 };
+
+		//called with the mutex held
+		ComputeJob acquire_job()
+		{
+			ComputeJob job = {};
+			if (!freeJobs.empty())
+			{
+				job = freeJobs.back();
+				freeJobs.pop_back();
+				job.commandBuffer.reset();
+			}
+			else
+			{
+				vk::CommandBufferAllocateInfo allocInfo = {};
+				allocInfo.commandPool = commandPool;
+				allocInfo.level = vk::CommandBufferLevel::ePrimary;
+				allocInfo.commandBufferCount = 1;
+				job.commandBuffer = device.allocateCommandBuffers(allocInfo)[0];
+
+				vk::FenceCreateInfo fenceInfo = {};
+				job.fence = device.createFence(fenceInfo);
+			}
+			device.resetFences(job.fence);
+			return job;
+		}
+
+		//called with the mutex held, jobs retire in submission order once their fence signals
+		void retire_completed()
+		{
+			size_t retired = 0;
+			while (retired < inFlight.size() && device.getFenceStatus(inFlight[retired].fence) == vk::Result::eSuccess)
+			{
+				completedTicket = std::max(completedTicket, inFlight[retired].ticket);
+				freeJobs.push_back(inFlight[retired]);
+				retired++;
+			}
+			inFlight.erase(inFlight.begin(), inFlight.begin() + retired);
+		}
+	};
+}
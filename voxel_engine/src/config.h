@@ -7,4 +7,11 @@
 #include <set>
 #include <string>
 #include <optional>
-#include <fstream>
\ No newline at end of file
+#include <fstream>
+#include <cstring>
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <mutex>
\ No newline at end of file
@@ -0,0 +1,283 @@
+#pragma once
+#include "config.h"
+#include "gpu_memory.h"
+#include "image.h"
+#include "pipeline.h"
+#include "descriptors.h"
+
+namespace vkUtil
+{
+	/*
+	* Hierarchical depth: a mip chain where every texel holds the farthest depth beneath it, built
+	* from the depth buffer with one compute dispatch per level. Level 0 is the largest power of two
+	* that fits in the depth buffer, so any screen rectangle covers at most 2x2 texels of some level
+	* and four fetches tell whether everything behind it is nearer than a box. Reverse-Z: farthest
+	* is the smallest depth. The levels stay in general layout, readable by compute shaders.
+	*/
+	class DepthPyramid
+	{
+	public:
+
+		DepthPyramid(vk::Device device, MemoryManager* memoryManager, bool debug) :
+			device(device),
+			memoryManager(memoryManager)
+		{
+			sampler = make_sampler(device, vk::Filter::eNearest, debug);
+		}
+
+		DepthPyramid(const DepthPyramid&) = delete;
+		DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+		//empty SPIR-V (a failed compile) builds nothing
+		bool build_pipeline(const std::vector<uint32_t>& spirv, vk::PipelineCache pipelineCache, LayoutCache* layoutCache, bool debug)
+		{
+			if (spirv.empty())
+			{
+				return false;
+			}
+
+			vkInit::ComputePipelineInBundle specification = {};
+			specification.device = device;
+			specification.computeCode = spirv;
+			specification.pipelineCache = pipelineCache;
+			specification.layoutCache = layoutCache;
+
+			vkInit::ComputePipelineOutBundle output = vkInit::make_compute_pipeline(specification, debug);
+			if (!output.pipeline || output.setLayouts.empty())
+			{
+				return false;
+			}
+
+			device.destroyPipeline(pipeline);
+			pipeline = output.pipeline;
+			layout = output.layout;
+			setLayout = output.setLayouts[0];
+			return true;
+		}
+
+		/*
+		* Recreates the pyramid for a depth buffer of a new size or a new view of it (the render graph
+		* recreates its transients when it compiles). The GPU must be done with the old pyramid.
+		*/
+		void resize(vk::Extent2D depthExtent, vk::ImageView depthView, bool debug)
+		{
+			destroy_levels();
+
+			extent = vk::Extent2D(previous_power_of_two(depthExtent.width), previous_power_of_two(depthExtent.height));
+			levelCount = 1;
+			while ((std::max(extent.width, extent.height) >> levelCount) > 0)
+			{
+				levelCount++;
+			}
+
+			vk::ImageCreateInfo imageInfo = {};
+			imageInfo.imageType = vk::ImageType::e2D;
+			imageInfo.format = format;
+			imageInfo.extent = vk::Extent3D(extent.width, extent.height, 1);
+			imageInfo.mipLevels = levelCount;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = vk::SampleCountFlagBits::e1;
+			imageInfo.tiling = vk::ImageTiling::eOptimal;
+			imageInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage;
+			imageInfo.sharingMode = vk::SharingMode::eExclusive;
+			imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+			image = memoryManager->create_image(imageInfo, false, debug);
+			if (!image.image)
+			{
+				levelCount = 0;
+				return;
+			}
+
+			view = make_image_view(device, image.image, format, vk::ImageAspectFlagBits::eColor, 0, levelCount);
+			for (uint32_t level = 0; level < levelCount; level++)
+			{
+				levelViews.push_back(make_image_view(device, image.image, format, vk::ImageAspectFlagBits::eColor, level, 1));
+			}
+			undefinedLayout = true;
+
+			if (!setLayout)
+			{
+				return;
+			}
+
+			//a set per level: read the level above (the depth buffer for level 0), write this one
+			descriptorPool = vkInit::make_descriptor_pool(device, {
+				vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, levelCount),
+				vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, levelCount)
+			}, levelCount, debug);
+
+			for (uint32_t level = 0; level < levelCount; level++)
+			{
+				vk::DescriptorSet set = vkInit::allocate_descriptor_set(device, descriptorPool, setLayout, debug);
+				if (!set)
+				{
+					break;
+				}
+				if (level == 0)
+				{
+					write_image(device, set, 0, vk::DescriptorType::eCombinedImageSampler, sampler, depthView, vk::ImageLayout::eShaderReadOnlyOptimal);
+				}
+				else
+				{
+					write_image(device, set, 0, vk::DescriptorType::eCombinedImageSampler, sampler, levelViews[level - 1], vk::ImageLayout::eGeneral);
+				}
+				write_image(device, set, 1, vk::DescriptorType::eStorageImage, nullptr, levelViews[level], vk::ImageLayout::eGeneral);
+				descriptorSets.push_back(set);
+			}
+
+			if (debug)
+			{
+				std::cout << "Depth pyramid: " << extent.width << 'x' << extent.height << ", " << levelCount << " levels\n";
+			}
+		}
+
+		//a new pyramid is undefined until its first build, record before anything binds it
+		void record_prepare(vk::CommandBuffer commandBuffer)
+		{
+			if (!undefinedLayout || !image.image)
+			{
+				return;
+			}
+			undefinedLayout = false;
+
+			level_barrier(commandBuffer, 0, levelCount, vk::ImageLayout::eUndefined,
+				vk::PipelineStageFlagBits::eTopOfPipe, vk::AccessFlags(),
+				vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		}
+
+		//the depth buffer must be in shader read only layout, every level is readable by compute shaders after
+		void record_build(vk::CommandBuffer commandBuffer)
+		{
+			if (!ready())
+			{
+				return;
+			}
+
+			//last frame's culling may still be reading the levels about to be overwritten
+			level_barrier(commandBuffer, 0, levelCount, vk::ImageLayout::eGeneral,
+				vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlags(),
+				vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+
+			commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+			for (uint32_t level = 0; level < levelCount; level++)
+			{
+				uint32_t levelWidth = std::max(extent.width >> level, 1u);
+				uint32_t levelHeight = std::max(extent.height >> level, 1u);
+
+				commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, descriptorSets[level], nullptr);
+				commandBuffer.dispatch((levelWidth + groupSize - 1) / groupSize, (levelHeight + groupSize - 1) / groupSize, 1);
+
+				//the next level reads this one
+				level_barrier(commandBuffer, level, 1, vk::ImageLayout::eGeneral,
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite,
+					vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead);
+			}
+		}
+
+		//built and complete, without a pipeline the contents are undefined and nothing should test against them
+		bool ready() const
+		{
+			return pipeline && image.image && descriptorSets.size() == levelCount;
+		}
+
+		vk::ImageView get_view() const
+		{
+			return view;
+		}
+
+		vk::Sampler get_sampler() const
+		{
+			return sampler;
+		}
+
+		vk::Extent2D get_extent() const
+		{
+			return extent;
+		}
+
+		uint32_t get_level_count() const
+		{
+			return levelCount;
+		}
+
+		void destroy()
+		{
+			destroy_levels();
+			device.destroyPipeline(pipeline);
+			device.destroySampler(sampler);
+			pipeline = nullptr;
+			sampler = nullptr;
+		}
+
+	private:
+
+		static constexpr vk::Format format = vk::Format::eR32Sfloat;
+		static constexpr uint32_t groupSize = 8;
+
+		vk::Device device;
+		MemoryManager* memoryManager;
+
+		vk::Pipeline pipeline{ nullptr };
+		vk::PipelineLayout layout{ nullptr };
+		vk::DescriptorSetLayout setLayout{ nullptr };
+		vk::Sampler sampler{ nullptr };
+
+		vk::Extent2D extent{ 0, 0 };
+		uint32_t levelCount{ 0 };
+		Image image{};
+		vk::ImageView view{ nullptr };
+		std::vector<vk::ImageView> levelViews;
+		vk::DescriptorPool descriptorPool{ nullptr };
+		std::vector<vk::DescriptorSet> descriptorSets;
+		bool undefinedLayout{ false };
+
+		static uint32_t previous_power_of_two(uint32_t value)
+		{
+			uint32_t power = 1;
+			while (power * 2 <= value)
+			{
+				power *= 2;
+			}
+			return power;
+		}
+
+		void level_barrier(
+			vk::CommandBuffer commandBuffer, uint32_t baseLevel, uint32_t count, vk::ImageLayout oldLayout,
+			vk::PipelineStageFlags srcStage, vk::AccessFlags srcAccess,
+			vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+		{
+			vk::ImageMemoryBarrier barrier = {};
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = vk::ImageLayout::eGeneral;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image.image;
+			barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, baseLevel, count, 0, 1);
+			commandBuffer.pipelineBarrier(srcStage, dstStage, vk::DependencyFlags(), nullptr, nullptr, barrier);
+		}
+
+		void destroy_levels()
+		{
+			device.destroyDescriptorPool(descriptorPool);
+			descriptorPool = nullptr;
+			descriptorSets.clear();
+
+			for (vk::ImageView levelView : levelViews)
+			{
+				device.destroyImageView(levelView);
+			}
+			levelViews.clear();
+			device.destroyImageView(view);
+			view = nullptr;
+
+			if (image.image)
+			{
+				memoryManager->destroy_image(image);
+			}
+			levelCount = 0;
+		}
+	};
+}
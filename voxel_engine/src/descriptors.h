@@ -0,0 +1,94 @@
+#pragma once
+#include "config.h"
+
+namespace vkInit
+{
+	vk::DescriptorPool make_descriptor_pool(vk::Device device, const std::vector<vk::DescriptorPoolSize>& poolSizes, uint32_t maxSets, bool debug)
+	{
+		vk::DescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.flags = vk::DescriptorPoolCreateFlags();
+		poolInfo.maxSets = maxSets;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+
+		try
+		{
+			return device.createDescriptorPool(poolInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create descriptor pool" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	vk::DescriptorSet allocate_descriptor_set(vk::Device device, vk::DescriptorPool pool, vk::DescriptorSetLayout layout, bool debug)
+	{
+		vk::DescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.descriptorPool = pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = &layout;
+
+		try
+		{
+			return device.allocateDescriptorSets(allocInfo)[0];
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to allocate descriptor set" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+}
+
+namespace vkUtil
+{
+	//whole buffers bound to consecutive storage buffer bindings starting at 0
+	void write_storage_buffers(vk::Device device, vk::DescriptorSet set, const std::vector<vk::Buffer>& buffers)
+	{
+		std::vector<vk::DescriptorBufferInfo> bufferInfos;
+		for (vk::Buffer buffer : buffers)
+		{
+			bufferInfos.push_back(vk::DescriptorBufferInfo(buffer, 0, VK_WHOLE_SIZE));
+		}
+
+		std::vector<vk::WriteDescriptorSet> writes;
+		for (uint32_t binding = 0; binding < bufferInfos.size(); binding++)
+		{
+			vk::WriteDescriptorSet write = {};
+			write.dstSet = set;
+			write.dstBinding = binding;
+			write.dstArrayElement = 0;
+			write.descriptorCount = 1;
+			write.descriptorType = vk::DescriptorType::eStorageBuffer;
+			write.pBufferInfo = &bufferInfos[binding];
+			writes.push_back(write);
+		}
+
+		device.updateDescriptorSets(writes, nullptr);
+	}
+
+	//a single image descriptor, the sampler only matters for combined image samplers
+	void write_image(
+		vk::Device device, vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+		vk::Sampler sampler, vk::ImageView view, vk::ImageLayout layout)
+	{
+		vk::DescriptorImageInfo imageInfo(sampler, view, layout);
+
+		vk::WriteDescriptorSet write = {};
+		write.dstSet = set;
+		write.dstBinding = binding;
+		write.dstArrayElement = 0;
+		write.descriptorCount = 1;
+		write.descriptorType = type;
+		write.pImageInfo = &imageInfo;
+
+		device.updateDescriptorSets(write, nullptr);
+	}
+}
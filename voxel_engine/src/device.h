@@ -2,6 +2,7 @@
 #include "config.h"
 #include "logging.h"
 #include "queue_families.h"
+#include "capabilities.h"
 
 namespace vkInit
 {
@@ -30,101 +31,120 @@ namespace vkInit
 		return requiredExtensions.empty();
 	}
 
-	bool isSuitable(vk::PhysicalDevice& device, bool debug)
+	std::vector<const char*> get_device_extensions(bool headless)
 	{
-		if (debug)
+		std::vector<const char*> extensions;
+
+		//nothing is presented in headless mode
+		if (!headless)
 		{
-			std::cout << "Checking if device is suitable\n";
+			extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 		}
 
-		const std::vector<const char*> requestedExtensions = {
-			VK_KHR_SWAPCHAIN_EXTENSION_NAME
-		};
+		return extensions;
+	}
 
-		if (debug)
+	//extensions enabled when the device has them, the engine falls back gracefully otherwise
+	std::vector<const char*> get_optional_device_extensions(const vk::PhysicalDevice& device, bool properties2Enabled, bool debug)
+	{
+		std::vector<const char*> candidates;
+
+		//live heap usage and budgets for the memory manager, needs VK_KHR_get_physical_device_properties2 on the instance
+		if (properties2Enabled)
 		{
-			std::cout << "Requested device extensions:\n";
+			candidates.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
-			for (const char* ext : requestedExtensions)
-			{
-				std::cout << "\t\"" << ext << "\"\n";
-			}
+			//lets the graphics queue wait on uploads by counter value instead of per-batch semaphores
+			candidates.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
 		}
 
-		if (bool extensionsSupported = checkDeviceExtensionSupport(device, requestedExtensions, debug))
+		std::vector<vk::ExtensionProperties> supportedExtensions = device.enumerateDeviceExtensionProperties();
+
+		std::vector<const char*> extensions;
+		for (const char* candidate : candidates)
 		{
-			if (debug)
+			bool found = false;
+			for (vk::ExtensionProperties& ext : supportedExtensions)
 			{
-				std::cout << "Device can support the requested extensions\n";
+				found |= strcmp(ext.extensionName, candidate) == 0;
+			}
+			if (found)
+			{
+				extensions.push_back(candidate);
 			}
-		}
-		else
-		{
 			if (debug)
 			{
-				std::cout << "Device can't support the requested extensions\n";
+				std::cout << "Optional device extension \"" << candidate << "\" is " << (found ? "enabled\n" : "not supported\n");
 			}
-			return false;
 		}
-		return true;
+
+		return extensions;
 	}
 
-	vk::PhysicalDevice choose_physical_device(vk::Instance& instance, bool debug)
+	bool isSuitable(vk::PhysicalDevice& device, bool headless, bool debug)
 	{
 		if (debug)
 		{
-			std::cout << "Choosing physical device...\n";
+			std::cout << "Checking if device is suitable\n";
 		}
 
-		std::vector<vk::PhysicalDevice> availableDevices = instance.enumeratePhysicalDevices();
+		const std::vector<const char*> requestedExtensions = get_device_extensions(headless);
 
 		if (debug)
 		{
-			std::cout << "There are " << availableDevices.size() << " available devices\n";
+			std::cout << "Requested device extensions:\n";
+
+			for (const char* ext : requestedExtensions)
+			{
+				std::cout << "\t\"" << ext << "\"\n";
+			}
 		}
 
-		for (vk::PhysicalDevice device : availableDevices)
+		if (bool extensionsSupported = checkDeviceExtensionSupport(device, requestedExtensions, debug))
 		{
 			if (debug)
 			{
-				log_device_properties(device);
+				std::cout << "Device can support the requested extensions\n";
 			}
-			if (isSuitable(device, debug))
+		}
+		else
+		{
+			if (debug)
 			{
-				return device;
+				std::cout << "Device can't support the requested extensions\n";
 			}
+			return false;
 		}
-
-		return  nullptr;
+		return true;
 	}
 
-	vk::Device create_logical_device(vk::PhysicalDevice& physicalDevice, vk::SurfaceKHR surface, bool debug)
+	vk::Device create_logical_device(
+		vk::PhysicalDevice& physicalDevice, vk::SurfaceKHR surface, bool headless,
+		const std::vector<const char*>& optionalExtensions, const DeviceCapabilities& capabilities,
+		bool properties2Enabled, bool debug)
 	{
-		vkUtil::QueueFamilyIndices indices = vkUtil::findQueueFamilies(physicalDevice, surface, debug);
-		std::vector<uint32_t> uniqueIndices;
-		uniqueIndices.push_back(indices.graphicsFamily.value());
-		if (indices.graphicsFamily.value() != indices.presentFamily.value())
-		{
-			uniqueIndices.push_back(indices.presentFamily.value());
-		}
-		float queuePriority{ 1.0f };
+		vkUtil::QueueLayout queueLayout = vkUtil::make_queue_layout(physicalDevice, surface, debug);
 
+		//one create info per family, as many queues as roles got assigned to it
 		std::vector<vk::DeviceQueueCreateInfo> queueCreateInfo;
-		for (uint32_t queueIndex : uniqueIndices)
+		for (std::pair<const uint32_t, std::vector<float>>& family : queueLayout.priorities)
 		{
 			queueCreateInfo.push_back(
 				vk::DeviceQueueCreateInfo(
-					vk::DeviceQueueCreateFlags(), queueIndex,
-					1, &queuePriority
+					vk::DeviceQueueCreateFlags(), family.first,
+					static_cast<uint32_t>(family.second.size()), family.second.data()
 				)
 			);
 		}
 
-		std::vector<const char*> deviceExtensions = {
-			VK_KHR_SWAPCHAIN_EXTENSION_NAME
-		};
+		std::vector<const char*> deviceExtensions = get_device_extensions(headless);
+		deviceExtensions.insert(deviceExtensions.end(), optionalExtensions.begin(), optionalExtensions.end());
+		deviceExtensions.insert(deviceExtensions.end(), capabilities.extensions.begin(), capabilities.extensions.end());
 
-		vk::PhysicalDeviceFeatures deviceFeatures = vk::PhysicalDeviceFeatures();
+		//exactly the probed features, extension features included, are switched on
+		DeviceFeatureChain features;
+		make_enabled_features(capabilities, deviceExtensions, features);
+		bool features2 = capabilities.apiVersion >= VK_API_VERSION_1_1 || properties2Enabled;
 
 		std::vector<const char*> enabledLayers;
 
@@ -138,8 +158,12 @@ namespace vkInit
 			queueCreateInfo.size(), queueCreateInfo.data(),
 			enabledLayers.size(), enabledLayers.data(),
 			deviceExtensions.size(), deviceExtensions.data(),
-			&deviceFeatures
+			features2 ? nullptr : &features.features2.features
 		);
+		if (features2)
+		{
+			deviceInfo.pNext = &features.features2;
+		}
 
 		try
 		{
@@ -160,13 +184,16 @@ namespace vkInit
 		}
 	}
 
-	std::array<vk::Queue, 2> get_queues(vk::PhysicalDevice physicalDevice, vk::Device device, vk::SurfaceKHR surface, bool debug)
+	//graphics, present, transfer and compute queues, the same queue may appear several times
+	std::array<vk::Queue, 4> get_queues(vk::PhysicalDevice physicalDevice, vk::Device device, vk::SurfaceKHR surface, bool debug)
 	{
-		vkUtil::QueueFamilyIndices indices = vkUtil::findQueueFamilies(physicalDevice, surface, false);
+		vkUtil::QueueLayout layout = vkUtil::make_queue_layout(physicalDevice, surface, false);
 
 		return { {
-				device.getQueue(indices.graphicsFamily.value(), 0),
-				device.getQueue(indices.presentFamily.value(), 0)
+				device.getQueue(layout.graphics.family, layout.graphics.index),
+				device.getQueue(layout.present.family, layout.present.index),
+				device.getQueue(layout.transfer.family, layout.transfer.index),
+				device.getQueue(layout.compute.family, layout.compute.index)
 			} };
 	}
 }
@@ -0,0 +1,293 @@
+#pragma once
+#include "config.h"
+#include "device.h"
+#include "queue_families.h"
+#include "logging.h"
+#include "hash.h"
+#include <cctype>
+
+namespace vkInit
+{
+	//how much each criterion contributed to a device's score, unsuitable devices are never picked
+	struct DeviceScore
+	{
+		vk::PhysicalDevice device{ nullptr };
+		std::string name;
+		std::string uuid;
+
+		bool suitable{ false };
+		int64_t typeScore{ 0 };
+		int64_t memoryScore{ 0 };
+		int64_t featureScore{ 0 };
+		int64_t queueScore{ 0 };
+
+		int64_t total() const
+		{
+			return typeScore + memoryScore + featureScore + queueScore;
+		}
+	};
+
+	struct DeviceSelection
+	{
+		vk::PhysicalDevice device{ nullptr };
+
+		//"persisted", "override" or "scored"
+		std::string method;
+		DeviceScore chosen;
+
+		//every enumerated device, only filled when devices were scored
+		std::vector<DeviceScore> candidates;
+	};
+
+	struct DeviceSelectionInput
+	{
+		vk::Instance instance;
+		vk::SurfaceKHR surface;
+		bool headless;
+
+		//VK_KHR_get_physical_device_properties2 is enabled, needed to read device UUIDs
+		bool properties2Enabled;
+		const vk::DispatchLoaderDynamic* dispatch;
+
+		//device name substring or UUID, empty to let the scores decide
+		std::string preferredDevice;
+
+		//where the chosen device's UUID is kept between runs, empty disables persistence
+		std::string persistFilename;
+	};
+
+	/*
+	* The device UUID is stable across runs and tells identical adapters apart,
+	* without properties2 the vendor and device IDs plus the name stand in for it.
+	*/
+	std::string get_device_uuid(vk::PhysicalDevice device, bool properties2Enabled, const vk::DispatchLoaderDynamic& dispatch)
+	{
+		const char* digits = "0123456789abcdef";
+		std::string uuid;
+
+		if (properties2Enabled)
+		{
+			vk::StructureChain<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties> chain =
+				device.getProperties2KHR<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>(dispatch);
+			for (uint8_t byte : chain.get<vk::PhysicalDeviceIDProperties>().deviceUUID)
+			{
+				uuid += digits[byte >> 4];
+				uuid += digits[byte & 0xf];
+			}
+			return uuid;
+		}
+
+		vk::PhysicalDeviceProperties properties = device.getProperties();
+		uint64_t hash = vkUtil::hash_value(properties.vendorID);
+		hash = vkUtil::hash_value(properties.deviceID, hash);
+		hash = vkUtil::hash_string(std::string(properties.deviceName.data()), hash);
+		return vkUtil::hash_to_string(hash);
+	}
+
+	//required extensions plus graphics and (windowed) present queues
+	bool is_device_usable(vk::PhysicalDevice device, vk::SurfaceKHR surface, bool headless, bool debug)
+	{
+		if (!isSuitable(device, headless, debug))
+		{
+			return false;
+		}
+		return vkUtil::findQueueFamilies(device, surface, false).isComplete();
+	}
+
+	/*
+	* Device type dominates so a discrete GPU beats an integrated one and anything beats a software
+	* rasterizer, the largest device local heap breaks ties between GPUs of a type, then the features
+	* and queue families the engine can make use of.
+	*/
+	DeviceScore score_physical_device(vk::PhysicalDevice device, const DeviceSelectionInput& input, bool debug)
+	{
+		DeviceScore score = {};
+		score.device = device;
+
+		vk::PhysicalDeviceProperties properties = device.getProperties();
+		score.name = properties.deviceName.data();
+		score.uuid = get_device_uuid(device, input.properties2Enabled, *input.dispatch);
+		score.suitable = is_device_usable(device, input.surface, input.headless, debug);
+
+		switch (properties.deviceType)
+		{
+		case vk::PhysicalDeviceType::eDiscreteGpu:
+			score.typeScore = 10000; break;
+		case vk::PhysicalDeviceType::eIntegratedGpu:
+			score.typeScore = 5000; break;
+		case vk::PhysicalDeviceType::eVirtualGpu:
+			score.typeScore = 2000; break;
+		case vk::PhysicalDeviceType::eCpu:
+			score.typeScore = 100; break;
+		default:
+			score.typeScore = 0; break;
+		}
+
+		//a point per 16MiB of the largest device local heap, chunk meshes and textures live there
+		vk::PhysicalDeviceMemoryProperties memoryProperties = device.getMemoryProperties();
+		vk::DeviceSize largestHeap = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		{
+			if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+			{
+				largestHeap = std::max(largestHeap, memoryProperties.memoryHeaps[i].size);
+			}
+		}
+		score.memoryScore = static_cast<int64_t>(largestHeap / (16ull << 20));
+
+		vk::PhysicalDeviceFeatures features = device.getFeatures();
+		score.featureScore += features.multiDrawIndirect ? 300 : 0;
+		score.featureScore += features.drawIndirectFirstInstance ? 100 : 0;
+		score.featureScore += features.pipelineStatisticsQuery ? 50 : 0;
+		score.featureScore += features.fillModeNonSolid ? 50 : 0;
+		score.featureScore += features.samplerAnisotropy ? 50 : 0;
+		score.featureScore += 100 * static_cast<int64_t>(get_optional_device_extensions(device, input.properties2Enabled, false).size());
+
+		//dedicated transfer and async compute families let uploads and compute overlap rendering
+		vkUtil::QueueFamilyIndices indices = vkUtil::findQueueFamilies(device, input.surface, false);
+		if (indices.isComplete())
+		{
+			score.queueScore += indices.transferFamily != indices.graphicsFamily ? 250 : 0;
+			score.queueScore += indices.computeFamily != indices.graphicsFamily ? 250 : 0;
+			score.queueScore += indices.presentFamily == indices.graphicsFamily ? 50 : 0;
+		}
+
+		return score;
+	}
+
+	bool matches_preferred_device(const DeviceScore& score, const std::string& preferred)
+	{
+		auto lower = [](std::string text)
+		{
+			std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			return text;
+		};
+
+		//UUIDs are matched whole with or without dashes, names by substring
+		std::string wanted = lower(preferred);
+		std::string undashed = wanted;
+		undashed.erase(std::remove(undashed.begin(), undashed.end(), '-'), undashed.end());
+
+		return undashed == score.uuid || lower(score.name).find(wanted) != std::string::npos;
+	}
+
+	void log_device_score(const DeviceScore& score)
+	{
+		std::cout << "\t" << score.name << " [" << score.uuid << "]: ";
+		if (!score.suitable)
+		{
+			std::cout << "unsuitable\n";
+			return;
+		}
+		std::cout << score.total() << " (type " << score.typeScore << ", memory " << score.memoryScore
+			<< ", features " << score.featureScore << ", queues " << score.queueScore << ")\n";
+	}
+
+	/*
+	* A device persisted by an earlier run is taken as is, skipping scoring and logging every adapter.
+	* Otherwise the preferred device wins when it is usable and the highest scoring usable device
+	* is picked last. The winner is persisted for the next startup.
+	*/
+	DeviceSelection select_physical_device(const DeviceSelectionInput& input, bool debug)
+	{
+		DeviceSelection selection = {};
+
+		std::vector<vk::PhysicalDevice> availableDevices = input.instance.enumeratePhysicalDevices();
+
+		if (input.preferredDevice.empty() && !input.persistFilename.empty() && std::filesystem::exists(input.persistFilename))
+		{
+			std::string persistedUuid;
+			std::ifstream file(input.persistFilename);
+			file >> persistedUuid;
+
+			for (vk::PhysicalDevice device : availableDevices)
+			{
+				if (get_device_uuid(device, input.properties2Enabled, *input.dispatch) == persistedUuid
+					&& is_device_usable(device, input.surface, input.headless, false))
+				{
+					selection.device = device;
+					selection.method = "persisted";
+					selection.chosen = score_physical_device(device, input, false);
+					break;
+				}
+			}
+
+			if (debug && !selection.device)
+			{
+				std::cout << "Persisted device " << persistedUuid << " is gone or unusable, scoring devices again\n";
+			}
+		}
+
+		if (!selection.device)
+		{
+			if (debug)
+			{
+				std::cout << "Choosing physical device...\n";
+				std::cout << "There are " << availableDevices.size() << " available devices\n";
+			}
+
+			for (vk::PhysicalDevice device : availableDevices)
+			{
+				if (debug)
+				{
+					log_device_properties(device);
+				}
+				selection.candidates.push_back(score_physical_device(device, input, debug));
+			}
+
+			if (!input.preferredDevice.empty())
+			{
+				for (const DeviceScore& candidate : selection.candidates)
+				{
+					if (candidate.suitable && matches_preferred_device(candidate, input.preferredDevice))
+					{
+						selection.device = candidate.device;
+						selection.method = "override";
+						selection.chosen = candidate;
+						break;
+					}
+				}
+
+				if (debug && !selection.device)
+				{
+					std::cout << "No usable device matches \"" << input.preferredDevice << "\", falling back to scoring\n";
+				}
+			}
+
+			if (!selection.device)
+			{
+				for (const DeviceScore& candidate : selection.candidates)
+				{
+					if (candidate.suitable && (!selection.device || candidate.total() > selection.chosen.total()))
+					{
+						selection.device = candidate.device;
+						selection.method = "scored";
+						selection.chosen = candidate;
+					}
+				}
+			}
+
+			if (debug)
+			{
+				std::cout << "Device scores:\n";
+				for (const DeviceScore& candidate : selection.candidates)
+				{
+					log_device_score(candidate);
+				}
+			}
+
+			if (selection.device && !input.persistFilename.empty())
+			{
+				std::ofstream file(input.persistFilename, std::ios::trunc);
+				file << selection.chosen.uuid << '\n';
+			}
+		}
+
+		if (debug && selection.device)
+		{
+			std::cout << "Using " << selection.chosen.name << " (" << selection.method << ")\n";
+		}
+
+		return selection;
+	}
+}
@@ -2,23 +2,89 @@
 #include "instance.h"
 #include "logging.h"
 #include "device.h"
+#include "device_selection.h"
 #include "swapchain.h"
 #include "pipeline.h"
+#include "pipeline_cache.h"
+#include "pipeline_state_cache.h"
+#include "shader_compiler.h"
+#include "shader_watcher.h"
+#include "layout_cache.h"
+#include "gpu_memory.h"
+#include "upload.h"
+#include "compute.h"
+#include "offscreen.h"
+#include "render_graph.h"
+#include "commands.h"
+#include "sync.h"
+#include "frame_pacing.h"
+#include "queries.h"
+#include "parallel_recording.h"
+#include "chunk_renderer.h"
+#include "depth_pyramid.h"
+#include "camera.h"
+#include "job_pool.h"
+#include "software_occlusion.h"
+#include "chunk.h"
+#include "chunk_map.h"
+#include "svo_dag.h"
+#include "brickmap.h"
 
-Engine::Engine()
+//pipeline statistics query per pass: the early and late culling phases' passes (depth prepass or
+//shading), then the shading pass that follows a depth prepass
+constexpr uint32_t earlyPassQuery = 0;
+constexpr uint32_t latePassQuery = 1;
+constexpr uint32_t opaqueQuery = 2;
+constexpr uint32_t passQueryCount = 3;
+
+//materials of the test scene's terrain
+constexpr vkUtil::VoxelId stoneVoxel = 1;
+constexpr vkUtil::VoxelId dirtVoxel = 2;
+constexpr vkUtil::VoxelId grassVoxel = 3;
+
+Engine::Engine(EngineSettings settings) :
+	headless(settings.headless),
+	maxFramesInFlight(std::max(settings.framesInFlight, 1u)),
+	hotReloadShaders(settings.hotReloadShaders),
+	latencyPolicy(settings.latencyPolicy),
+	preferredDevice(settings.preferredDevice),
+	disabledFeatures(settings.disabledFeatures),
+	depthPrepass(settings.depthPrepass),
+	recordingThreads(settings.recordingThreads),
+	testChunks(settings.testChunks),
+	cpuOcclusionCulling(settings.cpuOcclusionCulling),
+	brickmapBudgetMiB(settings.brickmapBudgetMiB)
 {
 
 	if (debugMode) {
 		std::cout << "Creating Engine\n";
+		std::cout << maxFramesInFlight << " frames in flight\n";
+		if (headless) {
+			std::cout << "Running headless\n";
+		}
 	}
 	
-	build_glfw_window();
+	if (!headless) {
+		build_glfw_window();
+	}
+
+	framePacer = std::make_unique<vkUtil::FramePacer>(settings.targetFps > 0.0 ? 1000.0 / settings.targetFps : 0.0);
 
 	make_instance();
 
 	make_device();
 
+	make_memory_manager();
+
+	make_upload_service();
+
+	make_compute_scheduler();
+
 	make_pipeline();
+
+	make_chunk_renderer();
+
+	finalize_setup();
 }
 
 void Engine::build_glfw_window()
@@ -28,12 +94,18 @@ void Engine::build_glfw_window()
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
 	if (window = glfwCreateWindow(width, height, "Voxel Engine", nullptr, nullptr)) {
 		if (debugMode) {
 			std::cout << "Window Created\n";
 		}
+
+		//not every platform reports a resize through an out of date swapchain, flag it ourselves
+		glfwSetWindowUserPointer(window, this);
+		glfwSetFramebufferSizeCallback(window, [](GLFWwindow* resizedWindow, int, int) {
+			static_cast<Engine*>(glfwGetWindowUserPointer(resizedWindow))->framebufferResized = true;
+		});
 	}
 	else {
 		if (debugMode) {
@@ -44,12 +116,17 @@ void Engine::build_glfw_window()
 
 void Engine::make_instance()
 {
-	instance = vkInit::make_instance(debugMode, "Voxel Engine");
+	instance = vkInit::make_instance(debugMode, "Voxel Engine", headless);
 	dldi = vk::DispatchLoaderDynamic(instance, vkGetInstanceProcAddr);
 	if (debugMode)
 	{
 		debugMessenger = vkInit::make_debug_messenger(instance, dldi);
 	}
+	if (headless)
+	{
+		//no window, no surface
+		return;
+	}
 	VkSurfaceKHR c_surface;
 	if (glfwCreateWindowSurface(instance, window, nullptr, &c_surface) != VK_SUCCESS)
 	{
@@ -67,77 +144,1402 @@ void Engine::make_instance()
 
 void Engine::make_device()
 {
-	physicalDevice = vkInit::choose_physical_device(instance, debugMode);
-	device = vkInit::create_logical_device(physicalDevice, surface, debugMode);
-	std::array<vk::Queue, 2> queues = vkInit::get_queues(physicalDevice, device, surface, debugMode);
+	//make_instance enables properties2 whenever the loader has it
+	bool properties2Enabled = vkInit::instance_extension_supported(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
+	vkInit::DeviceSelectionInput selectionInput = {};
+	selectionInput.instance = instance;
+	selectionInput.surface = surface;
+	selectionInput.headless = headless;
+	selectionInput.properties2Enabled = properties2Enabled;
+	selectionInput.dispatch = &dldi;
+	selectionInput.preferredDevice = preferredDevice;
+	selectionInput.persistFilename = deviceSelectionFilename;
+	deviceSelection = std::make_unique<vkInit::DeviceSelection>(vkInit::select_physical_device(selectionInput, debugMode));
+	physicalDevice = deviceSelection->device;
+	if (!physicalDevice)
+	{
+		throw std::runtime_error("no usable Vulkan device");
+	}
+
+	std::vector<const char*> optionalExtensions = vkInit::get_optional_device_extensions(
+		physicalDevice, properties2Enabled, debugMode
+	);
+	for (const char* extension : optionalExtensions)
+	{
+		memoryBudgetEnabled |= strcmp(extension, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+	}
+
+	//features past 1.0 are enabled as found, disabled ones run their fallback path instead
+	capabilities = std::make_unique<vkInit::DeviceCapabilities>(vkInit::probe_device_capabilities(
+		physicalDevice, vkInit::get_instance_api_version(), properties2Enabled, optionalExtensions, dldi, debugMode
+	));
+	for (const std::string& feature : disabledFeatures)
+	{
+		if (!vkInit::disable_capability(*capabilities, feature) && debugMode)
+		{
+			std::cout << "Unknown feature \"" << feature << "\", nothing disabled\n";
+		}
+	}
+	timelineSemaphoresEnabled = capabilities->timelineSemaphore;
+
+	device = vkInit::create_logical_device(
+		physicalDevice, surface, headless, optionalExtensions, *capabilities, properties2Enabled, debugMode
+	);
+	std::array<vk::Queue, 4> queues = vkInit::get_queues(physicalDevice, device, surface, debugMode);
 	graphicsQueue = queues[0];
 	presentQueue = queues[1];
-	vkInit::SwapChainBundle bundle = vkInit::create_swapchain(device, physicalDevice, surface, width, height, debugMode);
+	transferQueue = queues[2];
+	computeQueue = queues[3];
+	vkUtil::QueueLayout queueLayout = vkUtil::make_queue_layout(physicalDevice, surface, false);
+	graphicsQueueFamily = queueLayout.graphics.family;
+	transferQueueFamily = queueLayout.transfer.family;
+	computeQueueFamily = queueLayout.compute.family;
+
+	//extension and 1.2 device functions (timeline semaphore waits) go through the dynamic loader
+	dldi.init(device);
+	vkInit::SwapChainBundle bundle = headless
+		? vkInit::create_offscreen_targets(device, physicalDevice, width, height, offscreenImageCount, debugMode)
+		: vkInit::create_swapchain(device, physicalDevice, surface, width, height, nullptr, latencyPolicy, debugMode);
 	swapchain = bundle.swapchain;
 	swapchainFrames = bundle.frames;
 	swapchainFormat = bundle.format;
 	swapchainExtent = bundle.extent;
+	presentMode = bundle.presentMode;
+}
+
+void Engine::make_memory_manager()
+{
+	vkUtil::MemoryManagerInput input = {};
+	input.instance = instance;
+	input.physicalDevice = physicalDevice;
+	input.device = device;
+	input.apiVersion = capabilities->apiVersion;
+	input.queue = graphicsQueue;
+	input.queueFamilyIndex = graphicsQueueFamily;
+	input.memoryBudget = memoryBudgetEnabled;
+	//chunk meshes are uploaded, generated and drawn on different queues
+	for (uint32_t family : { graphicsQueueFamily, transferQueueFamily, computeQueueFamily })
+	{
+		if (std::find(input.queueFamilies.begin(), input.queueFamilies.end(), family) == input.queueFamilies.end())
+		{
+			input.queueFamilies.push_back(family);
+		}
+	}
+
+	memoryManager = std::make_unique<vkUtil::MemoryManager>(input, debugMode);
+}
+
+void Engine::make_upload_service()
+{
+	vkUtil::UploadServiceInput input = {};
+	input.device = device;
+	input.queue = transferQueue;
+	input.queueFamilyIndex = transferQueueFamily;
+	input.memoryManager = memoryManager.get();
+	input.timelineSemaphores = timelineSemaphoresEnabled;
+	input.dispatch = &dldi;
+
+	uploadService = std::make_unique<vkUtil::UploadService>(input, debugMode);
+
+	if (debugMode)
+	{
+		std::cout << "Uploads run on " << (transferQueueFamily != graphicsQueueFamily ? "a dedicated transfer queue" : "the graphics queue")
+			<< ", completion tracked with " << (uploadService->get_timeline_semaphore() ? "a timeline semaphore" : "fences") << '\n';
+	}
+}
+
+vkUtil::UploadService& Engine::get_upload_service()
+{
+	return *uploadService;
+}
+
+void Engine::wait_for_upload(uint64_t ticket)
+{
+	frameUploadTicket = std::max(frameUploadTicket, ticket);
+}
+
+void Engine::make_compute_scheduler()
+{
+	vkUtil::ComputeSchedulerInput input = {};
+	input.device = device;
+	input.queue = computeQueue;
+	input.queueFamilyIndex = computeQueueFamily;
+	input.timelineSemaphores = timelineSemaphoresEnabled;
+	input.dispatch = &dldi;
+
+	computeScheduler = std::make_unique<vkUtil::ComputeScheduler>(input, debugMode);
+
+	if (debugMode)
+	{
+		std::cout << "Compute jobs run on " << (computeQueue != graphicsQueue ? "an async compute queue" : "the graphics queue") << '\n';
+	}
+}
+
+vkUtil::ComputeScheduler& Engine::get_compute_scheduler()
+{
+	return *computeScheduler;
+}
+
+void Engine::wait_for_compute(uint64_t ticket)
+{
+	frameComputeTicket = std::max(frameComputeTicket, ticket);
+}
+
+const vkInit::DeviceSelection& Engine::get_device_selection() const
+{
+	return *deviceSelection;
+}
+
+const vkInit::DeviceCapabilities& Engine::get_capabilities() const
+{
+	return *capabilities;
+}
+
+vkUtil::MemoryManager& Engine::get_memory_manager()
+{
+	return *memoryManager;
 }
 
 void Engine::make_pipeline()
 {
+	auto start = std::chrono::steady_clock::now();
+
+	vkInit::PipelineCacheBundle cacheBundle = vkInit::make_pipeline_cache(device, physicalDevice, pipelineCacheFilename, debugMode);
+	pipelineCache = cacheBundle.cache;
+
+	layoutCache = std::make_unique<vkUtil::LayoutCache>(device);
+	pipelineStateCache = std::make_unique<vkUtil::PipelineStateCache>(device, pipelineCache, layoutCache.get());
+
+	depthFormat = vkUtil::choose_depth_format(physicalDevice);
+	if (debugMode)
+	{
+		std::cout << "Reverse-Z depth buffer: " << vk::to_string(depthFormat)
+			<< (depthPrepass ? ", depth prepass on\n" : ", depth prepass off\n");
+	}
+	publish_pipeline_formats();
+
+	build_pipelines(false, pipelines);
+	if (debugMode)
+	{
+		layoutCache->log_statistics();
+		pipelineStateCache->log_statistics();
+	}
+
+	//cold vs warm startup, the number to watch for pipeline cache regressions
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Pipeline setup took " << milliseconds << "ms ("
+		<< (cacheBundle.warm ? "warm" : "cold") << " pipeline cache)\n";
+
+	if (hotReloadShaders && !headless)
+	{
+		shaderWatcher = std::make_unique<vkUtil::ShaderWatcher>(
+			shaderDirectory, shaderCacheDirectory,
+			[this](const std::vector<std::string>& files) { reload_shaders(files); },
+			debugMode
+		);
+	}
+}
+
+void Engine::make_chunk_renderer()
+{
+	vkUtil::ChunkRendererInput input = {};
+	input.device = device;
+	input.memoryManager = memoryManager.get();
+	input.uploadService = uploadService.get();
+	input.frameCount = maxFramesInFlight;
+	input.drawIndirectCount = capabilities->drawIndirectCount;
+	input.multiDrawIndirect = capabilities->multiDrawIndirect;
+	input.dispatch = &dldi;
+
+	chunkRenderer = std::make_unique<vkUtil::ChunkRenderer>(input, debugMode);
+
+	//compiled from source like the scene shaders, a failed compile leaves the pipeline unbuilt
+	std::vector<vkUtil::ShaderCompileOutput> shaders = vkUtil::compile_shaders(
+		{ { chunkCullShaderFile, vkUtil::shader_kind_from_filename(chunkCullShaderFile) } },
+		shaderDirectory, shaderCacheDirectory, debugMode
+	);
+	if (!chunkRenderer->build_cull_pipeline(shaders[0].spirv, pipelineCache, layoutCache.get(), debugMode) && debugMode)
+	{
+		std::cout << "Failed to build the chunk culling pipeline, no chunks will be drawn\n";
+	}
+
+	//sized when the render graph compiles, the depth buffer it reads is one of the graph's transients
+	depthPyramid = std::make_unique<vkUtil::DepthPyramid>(device, memoryManager.get(), debugMode);
+	shaders = vkUtil::compile_shaders(
+		{ { depthPyramidShaderFile, vkUtil::shader_kind_from_filename(depthPyramidShaderFile) } },
+		shaderDirectory, shaderCacheDirectory, debugMode
+	);
+	if (!depthPyramid->build_pipeline(shaders[0].spirv, pipelineCache, layoutCache.get(), debugMode) && debugMode)
+	{
+		std::cout << "Failed to build the depth pyramid pipeline, chunks will only be frustum culled\n";
+	}
+
+	//one set of worker threads records draws and culls on the CPU, 0 threads means one per hardware thread
+	if (recordingThreads == 0)
+	{
+		recordingThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	jobPool = std::make_unique<vkUtil::JobPool>(recordingThreads, debugMode);
+
+	//only the fallback draws are culled on the CPU, the GPU driven path never waits on it
+	cpuOcclusionCulling = cpuOcclusionCulling && !chunkRenderer->gpu_driven();
+	if (cpuOcclusionCulling)
+	{
+		softwareOcclusion = std::make_unique<vkUtil::SoftwareOcclusion>(vkUtil::detect_simd_level(), debugMode);
+	}
+
+	//one reader slot per job pool thread, the render thread included as thread 0; every read so far
+	//happens on the render thread, which owns the map and needs no guard
+	world = std::make_unique<vkUtil::ChunkMap>(jobPool->get_thread_count(), debugMode);
+
+	//covers the test scene, chunks are streamed into it as they are stored
+	if (brickmapBudgetMiB > 0)
+	{
+		vkUtil::BrickmapInput brickmapInput = {};
+		brickmapInput.memoryManager = memoryManager.get();
+		brickmapInput.uploadService = uploadService.get();
+		brickmapInput.frameCount = maxFramesInFlight;
+		brickmapInput.gridChunks = { std::max(testChunks, 1u), testColumnChunks, std::max(testChunks, 1u) };
+		brickmapInput.vramBudget = static_cast<vk::DeviceSize>(brickmapBudgetMiB) << 20;
+		brickmap = std::make_unique<vkUtil::Brickmap>(brickmapInput, debugMode);
+	}
+
+	camera = std::make_unique<vkUtil::Camera>();
+	make_test_scene();
+}
+
+void Engine::make_test_scene()
+{
+	const float chunkSize = 32.0f;
+	float halfExtent = 0.5f * chunkSize * static_cast<float>(testChunks);
+
+	uint64_t ticket = 0;
+	for (uint32_t z = 0; z < testChunks; z++)
+	{
+		for (uint32_t x = 0; x < testChunks; x++)
+		{
+			//hashed heights, the same scene every run
+			uint32_t columnHeight = 4 + static_cast<uint32_t>(vkUtil::hash_value(x * 73856093u ^ z * 19349663u) % 60);
+			float height = static_cast<float>(columnHeight);
+			ticket = std::max(ticket, add_test_column(x, z, columnHeight));
+
+			float x0 = static_cast<float>(x) * chunkSize - halfExtent;
+			float z0 = static_cast<float>(z) * chunkSize - halfExtent;
+
+			vkUtil::ChunkMeshData mesh;
+			vkUtil::append_box(mesh,
+				{ x0 + 1.0f, 0.0f, z0 + 1.0f }, { x0 + chunkSize - 1.0f, height, z0 + chunkSize - 1.0f },
+				{ 0.3f + height / 90.0f, 0.6f, 1.0f - height / 90.0f });
+
+			uint64_t chunkTicket = 0;
+			chunkRenderer->add_chunk(mesh, chunkTicket, debugMode);
+			ticket = std::max(ticket, chunkTicket);
+		}
+	}
+	wait_for_upload(ticket);
+
+	camera->target = { 0.0f, 16.0f, 0.0f };
+	camera->distance = 1.5f * halfExtent + 64.0f;
+
+	build_far_field();
+
+	if (debugMode)
+	{
+		chunkRenderer->log_statistics();
+
+		size_t packedBytes = 0;
+		uint32_t uniformChunks = 0;
+		world->for_each([&](const vkUtil::ChunkCoordinate&, const vkUtil::Chunk& chunk)
+		{
+			packedBytes += chunk.memory_bytes();
+			uniformChunks += chunk.is_uniform() ? 1 : 0;
+		});
+		size_t flatBytes = world->size() * vkUtil::Chunk().get_volume() * sizeof(vkUtil::VoxelId);
+		std::cout << "Voxel chunks: " << world->size() << " chunks (" << uniformChunks << " uniform) in "
+			<< (packedBytes >> 10) << "KiB palette packed, " << (flatBytes >> 10) << "KiB as 16 bit grids\n";
+	}
+}
+
+uint64_t Engine::add_test_column(uint32_t x, uint32_t z, uint32_t height)
+{
+	//stone under three layers of dirt and one of grass, inset by a voxel like the box meshes,
+	//with air up to the top of the column: chunks above the terrain stay uniform and allocate nothing
+	uint32_t size = vkUtil::Chunk::defaultSize;
+	uint64_t ticket = 0;
+	for (uint32_t chunkY = 0; chunkY < testColumnChunks; chunkY++)
+	{
+		vkUtil::Chunk chunk;
+		auto fill_layers = [&](uint32_t begin, uint32_t end, vkUtil::VoxelId id)
+		{
+			uint32_t base = chunkY * size;
+			begin = std::max(begin, base);
+			end = std::min(end, base + size);
+			if (begin < end)
+			{
+				chunk.fill({ 1, begin - base, 1 }, { size - 1, end - base, size - 1 }, id);
+			}
+		};
+		fill_layers(0, height - 4, stoneVoxel);
+		fill_layers(height - 4, height - 1, dirtVoxel);
+		fill_layers(height - 1, height, grassVoxel);
+
+		ticket = std::max(ticket, set_world_chunk(
+			{ static_cast<int32_t>(x), static_cast<int32_t>(chunkY), static_cast<int32_t>(z) }, std::move(chunk)
+		));
+	}
+	return ticket;
+}
+
+uint64_t Engine::set_world_chunk(const vkUtil::ChunkCoordinate& coordinate, vkUtil::Chunk&& chunk)
+{
+	//the render thread is the map's only writer, the stored chunk stays valid until it replaces it
+	const vkUtil::Chunk* stored = world->insert(coordinate, std::move(chunk));
+
+	if (farField)
+	{
+		farField->update_chunk(coordinate, stored);
+	}
+	return brickmap ? brickmap->update_chunk(coordinate, stored, frameNumber, debugMode) : 0;
+}
+
+void Engine::build_far_field()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	farField = std::make_unique<vkUtil::SvoDag>(farFieldRegionChunks, debugMode);
+	world->for_each([this](const vkUtil::ChunkCoordinate& coordinate, const vkUtil::Chunk& chunk)
+	{
+		farField->update_chunk(coordinate, &chunk);
+	});
+	farField->compact();
+
+	farFieldBuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Engine::log_far_field_compression()
+{
+	size_t paletteBytes = 0;
+	size_t flatBytes = 0;
+	world->for_each([&](const vkUtil::ChunkCoordinate&, const vkUtil::Chunk& chunk)
+	{
+		paletteBytes += chunk.memory_bytes();
+		flatBytes += chunk.get_volume() * sizeof(vkUtil::VoxelId);
+	});
+
+	size_t dagBytes = std::max(farField->memory_bytes(), size_t(1));
+	std::cout << "Far field DAG: " << (dagBytes >> 10) << "KiB in " << farField->get_node_count() << " nodes for "
+		<< world->size() << " chunks, built in " << farFieldBuildMs << "ms. "
+		<< static_cast<double>(paletteBytes) / dagBytes << "x smaller than palette chunks (" << (paletteBytes >> 10) << "KiB), "
+		<< static_cast<double>(flatBytes) / dagBytes << "x smaller than 16 bit grids (" << (flatBytes >> 10) << "KiB)\n";
+}
+
+bool Engine::build_pipelines(bool reload, ScenePipelines& built)
+{
+	std::vector<vkUtil::ShaderCompileInput> shaderInputs;
+	for (const std::string& filename : pipelineShaderFiles)
+	{
+		shaderInputs.push_back({ filename, vkUtil::shader_kind_from_filename(filename) });
+	}
+	std::vector<vkUtil::ShaderCompileOutput> shaders = vkUtil::compile_shaders(
+		shaderInputs, shaderDirectory, shaderCacheDirectory, debugMode
+	);
+
+	//a broken shader during a reload keeps the current pipelines live, at startup there is nothing to draw with
+	for (const vkUtil::ShaderCompileOutput& shader : shaders)
+	{
+		if (shader.spirv.empty())
+		{
+			if (debugMode && !reload)
+			{
+				std::cout << "Failed to compile the scene shaders, nothing will be drawn\n";
+			}
+			return false;
+		}
+	}
+
 	vkInit::GraphicsPipelineInBundle specification = {};
 
 	specification.device = device;
-	specification.vertexFilepath = "shaders/vertex.spv";
-	specification.fragmentFilepath = "shaders/fragment.spv";
-	specification.swapchainExtent = swapchainExtent;
-	specification.swapchainFormat = swapchainFormat;
+	specification.vertexCode = shaders[0].spirv;
+	specification.fragmentCode = shaders[1].spirv;
 
-	vkInit::GraphicsPipelineOutBundle output = vkInit::make_graphics_pipeline(specification, debugMode);
+	//this runs on the watcher thread during a reload, the render thread owns swapchainFormat and depthFormat
+	{
+		std::lock_guard<std::mutex> lock(reloadMutex);
+		specification.swapchainFormat = pipelineSwapchainFormat;
+		specification.depthFormat = pipelineDepthFormat;
+	}
+	if (headless)
+	{
+		//offscreen images are left ready to be copied out
+		specification.finalLayout = vk::ImageLayout::eTransferSrcOptimal;
+	}
+	specification.depthTest = true;
+
+	//with a prepass only the front most fragment survives the equal test, without one shading writes depth itself
+	specification.depthWrite = !depthPrepass;
+	specification.depthCompare = depthPrepass ? vk::CompareOp::eEqual : vk::CompareOp::eGreaterOrEqual;
+
+	//variants are keyed by their full state, an unchanged rebuild gets the cached pipeline back
+	uint64_t opaqueKey = pipelineStateCache->request(specification);
+	uint64_t depthPrepassKey = 0;
+
+	if (depthPrepass)
+	{
+		//same vertex stage, no fragment shader and no color output: the cheapest way to fill the depth buffer
+		vkInit::GraphicsPipelineInBundle prepass = specification;
+		prepass.fragmentCode.clear();
+		prepass.swapchainFormat = vk::Format::eUndefined;
+		prepass.depthWrite = true;
+		prepass.depthCompare = vk::CompareOp::eGreaterOrEqual;
+		depthPrepassKey = pipelineStateCache->request(prepass);
+	}
+
+	//both variants compile in parallel
+	pipelineStateCache->compile_pending(debugMode);
+
+	built = {};
+	built.opaque = pipelineStateCache->get_pipeline(opaqueKey);
+	if (built.opaque)
+	{
+		built.opaqueKey = opaqueKey;
+		built.opaqueLayout = pipelineStateCache->get_layout(opaqueKey);
+	}
+	if (depthPrepassKey != 0)
+	{
+		built.depthPrepass = pipelineStateCache->get_pipeline(depthPrepassKey);
+		if (built.depthPrepass)
+		{
+			built.depthPrepassKey = depthPrepassKey;
+			built.depthPrepassLayout = pipelineStateCache->get_layout(depthPrepassKey);
+		}
+	}
 
-	layout = output.layout;
-	renderpass = output.renderpass;
-	pipeline = output.pipeline;
+	//hand back nothing half built, whatever did compile is released unless it is live
+	if (!built.opaque || (depthPrepass && !built.depthPrepass))
+	{
+		std::lock_guard<std::mutex> lock(reloadMutex);
+		for (uint64_t key : built.keys())
+		{
+			if (key != 0 && !pipelines.uses(key) && !pendingPipelines.uses(key))
+			{
+				device.destroyPipeline(pipelineStateCache->release(key));
+			}
+		}
+		built = {};
+		return false;
+	}
+	return true;
 }
 
-Engine::~Engine()
+void Engine::reload_shaders(const std::vector<std::string>& changedFiles)
 {
-	if (debugMode) {
-		std::cout << "Destroying Engine\n";
+	//only rebuild if one of the changed files ends up in this pipeline
+	bool affected = false;
+	for (const std::string& shaderFile : pipelineShaderFiles)
+	{
+		std::string sources;
+		std::set<std::string> dependencies;
+		vkUtil::collect_shader_sources(shaderFile, shaderDirectory, sources, dependencies);
+
+		for (const std::string& changedFile : changedFiles)
+		{
+			affected |= dependencies.count(changedFile) > 0;
+		}
 	}
 
-	//destroy window
-	glfwDestroyWindow(window);
+	if (!affected)
+	{
+		return;
+	}
 
-	//destroy image views
-	for (vkUtil::SwapChainFrame frame : swapchainFrames)
+	auto start = std::chrono::steady_clock::now();
+
+	ScenePipelines rebuilt = {};
+	if (!build_pipelines(true, rebuilt))
 	{
-		device.destroyImageView(frame.imageView);
+		std::cout << "Shader reload failed, keeping the current pipelines\n";
+		return;
 	}
 
-	//destroy pipeline
-	device.destroyPipeline(pipeline);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Rebuilt pipelines in " << milliseconds << "ms\n";
 
-	//destroy renderpass
-	device.destroyRenderPass(renderpass);
+	std::lock_guard<std::mutex> lock(reloadMutex);
 
-	//destroy layout
-	device.destroyPipelineLayout(layout);
+	//a rebuild that never made it to the screen is superseded, variants it shares with the live set or the rebuild stay
+	for (uint64_t key : pendingPipelines.keys())
+	{
+		if (key != 0 && !pipelines.uses(key) && !rebuilt.uses(key))
+		{
+			device.destroyPipeline(pipelineStateCache->release(key));
+		}
+	}
+	pendingPipelines = {};
 
-	//destroy swapchain
-	device.destroySwapchainKHR(swapchain);
+	//saving a file without changing the compiled shaders yields the live variants, nothing to swap
+	if (rebuilt.keys() == pipelines.keys())
+	{
+		return;
+	}
+	pendingPipelines = rebuilt;
+}
 
-	//destroy device
-	device.destroy();
+void Engine::publish_pipeline_formats()
+{
+	std::lock_guard<std::mutex> lock(reloadMutex);
+	pipelineSwapchainFormat = swapchainFormat;
+	pipelineDepthFormat = depthFormat;
+}
 
-	//destroy surface
-	instance.destroySurfaceKHR(surface);
+void Engine::swap_reloaded_pipelines()
+{
+	std::lock_guard<std::mutex> lock(reloadMutex);
 
-	//destroy messenger
-	if (debugMode)
+	if (!pendingPipelines.opaque)
 	{
-		instance.destroyDebugUtilsMessengerEXT(debugMessenger, nullptr, dldi);
+		return;
 	}
 
-	//destroy instance
-	instance.destroy();
+	//frames still in flight may reference the old pipelines, keep them until their slots come around again,
+	//a vertex shader only change leaves the prepass variant as it was
+	for (uint64_t key : pipelines.keys())
+	{
+		if (key != 0 && !pendingPipelines.uses(key))
+		{
+			retiredPipelines.push_back({ frameNumber + maxFramesInFlight - 1, pipelineStateCache->release(key) });
+		}
+	}
+	pipelines = pendingPipelines;
+	pendingPipelines = {};
+}
 
-	//terminate glfw
-	glfwTerminate();
+void Engine::destroy_retired_swapchains()
+{
+	for (size_t i = 0; i < retiredSwapchains.size(); )
+	{
+		if (frameNumber >= retiredSwapchains[i].first)
+		{
+			device.destroySwapchainKHR(retiredSwapchains[i].second);
+			retiredSwapchains.erase(retiredSwapchains.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void Engine::destroy_retired_pipelines()
+{
+	for (size_t i = 0; i < retiredPipelines.size(); )
+	{
+		if (frameNumber >= retiredPipelines[i].first)
+		{
+			device.destroyPipeline(retiredPipelines[i].second);
+			retiredPipelines.erase(retiredPipelines.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void Engine::build_render_graph(bool debug)
+{
+	renderGraph->reset();
+
+	//headless frames end up copied out instead of presented
+	vkUtil::RenderImageDescription backbufferDescription = {};
+	backbufferDescription.format = swapchainFormat;
+	backbuffer = renderGraph->import_image(
+		"backbuffer", backbufferDescription,
+		headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR,
+		vk::PipelineStageFlagBits::eColorAttachmentOutput
+	);
+	renderGraph->mark_output(backbuffer);
+
+	//reverse-Z: cleared to 0 (the far plane), float precision is spent close to the camera where voxels are dense
+	vkUtil::RenderImageDescription depthDescription = {};
+	depthDescription.format = depthFormat;
+	depthDescription.aspect = vk::ImageAspectFlagBits::eDepth;
+	depthBuffer = renderGraph->create_image("depth", depthDescription);
+
+	//two phase culling: chunks visible last frame are drawn, their depth becomes the pyramid the
+	//late culling phase tests every chunk against, then the chunks it newly found visible are drawn
+	auto add_scene_pass = [this](const std::string& name, bool prepass, std::vector<vkUtil::CullPhase> phases, uint32_t query)
+	{
+		vkUtil::RenderPassHandle pass = renderGraph->add_pass(name,
+			[this, prepass, phases, query](vk::CommandBuffer commandBuffer, const vkUtil::RenderPassContext& context)
+			{
+				if (prepass)
+				{
+					record_scene_pass(commandBuffer, context, pipelines.depthPrepass, pipelines.depthPrepassLayout, phases, query);
+				}
+				else
+				{
+					record_scene_pass(commandBuffer, context, pipelines.opaque, pipelines.opaqueLayout, phases, query);
+				}
+			}
+		);
+		renderGraph->record_secondary(pass);
+		return pass;
+	};
+	vk::ClearColorValue clearColor(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f });
+
+	vkUtil::RenderPassHandle earlyPass = add_scene_pass(
+		depthPrepass ? "depth prepass early" : "opaque early", depthPrepass, { vkUtil::CullPhase::Early }, earlyPassQuery
+	);
+	if (!depthPrepass)
+	{
+		renderGraph->write_color(earlyPass, backbuffer, clearColor);
+	}
+	renderGraph->write_depth(earlyPass, depthBuffer, 0.0f);
+
+	//the culling results live in the chunk renderer's buffers, invisible to the graph
+	vkUtil::RenderPassHandle occlusionPass = renderGraph->add_pass("occlusion culling",
+		[this](vk::CommandBuffer commandBuffer, const vkUtil::RenderPassContext&)
+		{
+			depthPyramid->record_build(commandBuffer);
+			chunkRenderer->record_cull(commandBuffer, currentFrame, vkUtil::CullPhase::Late, viewProjection, *depthPyramid);
+		}
+	);
+	renderGraph->read_texture(occlusionPass, depthBuffer, vk::PipelineStageFlagBits::eComputeShader);
+	renderGraph->mark_side_effects(occlusionPass);
+
+	//both phases load what the early one drew
+	vkUtil::RenderPassHandle latePass = add_scene_pass(
+		depthPrepass ? "depth prepass late" : "opaque late", depthPrepass, { vkUtil::CullPhase::Late }, latePassQuery
+	);
+	if (!depthPrepass)
+	{
+		renderGraph->write_color(latePass, backbuffer, std::nullopt);
+	}
+	renderGraph->write_depth(latePass, depthBuffer, std::nullopt);
+
+	//with a prepass, hidden voxel faces fail the equal test before their fragments are shaded
+	if (depthPrepass)
+	{
+		vkUtil::RenderPassHandle opaquePass = add_scene_pass(
+			"opaque", false, { vkUtil::CullPhase::Early, vkUtil::CullPhase::Late }, opaqueQuery
+		);
+		renderGraph->write_color(opaquePass, backbuffer, clearColor);
+		renderGraph->read_depth(opaquePass, depthBuffer);
+	}
+
+	if (!renderGraph->compile(swapchainExtent, debug) && debug)
+	{
+		std::cout << "Failed to compile render graph" << std::endl;
+	}
+
+	depthPyramid->resize(swapchainExtent, renderGraph->get_view(depthBuffer), debug);
+
+	//a fixed low resolution with the swapchain's aspect, occluders are large and chunks coarse
+	if (softwareOcclusion && swapchainExtent.width > 0)
+	{
+		uint32_t occlusionHeight = std::max(occlusionWidth * swapchainExtent.height / swapchainExtent.width, 1u);
+		softwareOcclusion->resize(occlusionWidth, occlusionHeight);
+	}
+
+	imagesInFlight.assign(swapchainFrames.size(), nullptr);
+}
+
+void Engine::record_scene_pass(
+	vk::CommandBuffer commandBuffer, const vkUtil::RenderPassContext& context,
+	vk::Pipeline scenePipeline, vk::PipelineLayout sceneLayout, const std::vector<vkUtil::CullPhase>& phases, uint32_t query)
+{
+	vk::CommandBufferInheritanceInfo inheritance = {};
+	inheritance.renderPass = context.renderpass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = context.framebuffer;
+	if (recordingQueries)
+	{
+		inheritance.pipelineStatistics = vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+	}
+
+	//GPU driven: one draw call whatever the chunk count, otherwise indirect draws over the slots CPU culling kept,
+	//nothing without a pipeline (the scene shaders failed to compile at startup)
+	bool gpuDriven = chunkRenderer->gpu_driven();
+	uint32_t drawCount = !scenePipeline ? 0 : gpuDriven ? 1 : chunkRenderer->get_fallback_draw_count();
+
+	//every batch binds its own state, secondary command buffers inherit none from the primary
+	vk::Extent2D extent = context.extent;
+	std::vector<vk::CommandBuffer> batches = recorder->record(currentFrame, drawCount, minDrawsPerBatch, inheritance,
+		[this, extent, scenePipeline, sceneLayout, gpuDriven, &phases](vk::CommandBuffer batch, uint32_t begin, uint32_t end)
+		{
+			batch.bindPipeline(vk::PipelineBindPoint::eGraphics, scenePipeline);
+			set_viewport(batch, extent);
+			batch.pushConstants(sceneLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(viewProjection), viewProjection.data());
+			for (vkUtil::CullPhase phase : phases)
+			{
+				if (gpuDriven)
+				{
+					chunkRenderer->record_draws(batch, currentFrame, phase);
+				}
+				else
+				{
+					chunkRenderer->record_draws(batch, currentFrame, phase, begin, end);
+				}
+			}
+		}
+	);
+
+	if (recordingQueries)
+	{
+		commandBuffer.beginQuery(recordingQueries, query, vk::QueryControlFlags());
+	}
+	if (!batches.empty())
+	{
+		commandBuffer.executeCommands(batches);
+	}
+	if (recordingQueries)
+	{
+		commandBuffer.endQuery(recordingQueries, query);
+	}
+}
+
+void Engine::set_viewport(vk::CommandBuffer commandBuffer, vk::Extent2D extent)
+{
+	vk::Viewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(extent.width);
+	viewport.height = static_cast<float>(extent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	commandBuffer.setViewport(0, 1, &viewport);
+
+	vk::Rect2D scissor = {};
+	scissor.offset.x = 0;
+	scissor.offset.y = 0;
+	scissor.extent = extent;
+	commandBuffer.setScissor(0, 1, &scissor);
+}
+
+void Engine::recreate_swapchain()
+{
+	//minimized: there is nothing to render into until the window has a size again
+	int framebufferWidth{ 0 };
+	int framebufferHeight{ 0 };
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	while ((framebufferWidth == 0 || framebufferHeight == 0) && !glfwWindowShouldClose(window))
+	{
+		glfwWaitEvents();
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	}
+	if (framebufferWidth == 0 || framebufferHeight == 0)
+	{
+		return;
+	}
+	width = framebufferWidth;
+	height = framebufferHeight;
+
+	auto start = std::chrono::steady_clock::now();
+
+	//only frames in flight can still use the old images, uploads and compute keep running
+	std::vector<vk::Fence> fences;
+	for (vkUtil::FrameSlot& slot : frameSlots)
+	{
+		fences.push_back(slot.inFlight);
+	}
+	if (device.waitForFences(fences, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+	{
+		return;
+	}
+
+	for (vkUtil::SwapChainFrame& frame : swapchainFrames)
+	{
+		device.destroyImageView(frame.imageView);
+	}
+
+	//pipelines only depend on the format, which stays the same for a surface
+	vk::SwapchainKHR oldSwapchain = swapchain;
+	vkInit::SwapChainBundle bundle = vkInit::create_swapchain(device, physicalDevice, surface, width, height, oldSwapchain, latencyPolicy, false);
+
+	//the slot fences cover rendering, not presentation: the old images may still be queued for present
+	retiredSwapchains.push_back({ frameNumber + maxFramesInFlight, oldSwapchain });
+
+	swapchain = bundle.swapchain;
+	swapchainFrames = bundle.frames;
+	swapchainFormat = bundle.format;
+	swapchainExtent = bundle.extent;
+	presentMode = bundle.presentMode;
+	publish_pipeline_formats();
+
+	build_render_graph(false);
+
+	if (debugMode)
+	{
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Recreated swapchain at " << swapchainExtent.width << 'x' << swapchainExtent.height
+			<< " in " << milliseconds << "ms\n";
+	}
+}
+
+void Engine::finalize_setup()
+{
+	renderGraph = std::make_unique<vkUtil::RenderGraph>(device, memoryManager.get());
+	build_render_graph(debugMode);
+
+	//shaded fragment counts show what the depth prepass saves, the queries are skipped where unsupported,
+	//scene passes are recorded in secondary command buffers so the query has to stay active across them
+	pipelineStatisticsEnabled = capabilities->pipelineStatisticsQuery && capabilities->inheritedQueries;
+
+	recorder = std::make_unique<vkUtil::ParallelRecorder>(device, graphicsQueueFamily, maxFramesInFlight, jobPool.get(), debugMode);
+
+	frameSlots.resize(maxFramesInFlight);
+	for (vkUtil::FrameSlot& slot : frameSlots)
+	{
+		slot.commandPool = vkInit::make_command_pool(device, physicalDevice, surface, debugMode);
+		slot.commandBuffer = vkInit::make_command_buffer(device, slot.commandPool, debugMode);
+
+		slot.inFlight = vkInit::make_fence(device, debugMode);
+		slot.imageAvailable = vkInit::make_semaphore(device, debugMode);
+		slot.renderFinished = vkInit::make_semaphore(device, debugMode);
+
+		if (pipelineStatisticsEnabled)
+		{
+			slot.statisticsQueries = vkInit::make_statistics_query_pool(
+				device, passQueryCount, vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations, debugMode
+			);
+		}
+	}
+}
+
+void Engine::record_draw_commands(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	vk::CommandBufferBeginInfo beginInfo = {};
+
+	try
+	{
+		commandBuffer.begin(beginInfo);
+	}
+	catch (vk::SystemError err)
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to begin recording command buffer" << std::endl;
+		}
+	}
+
+	//queries are reset outside of render passes, the passes begin and end their own
+	if (recordingQueries)
+	{
+		commandBuffer.resetQueryPool(recordingQueries, 0, passQueryCount);
+	}
+
+	//slow orbit until there is input, the culling passes see a new view every frame
+	camera->yaw = 0.002f * static_cast<float>(frameNumber);
+	glm::mat4 matrix = camera->view_projection(static_cast<float>(swapchainExtent.width) / static_cast<float>(swapchainExtent.height));
+	std::memcpy(viewProjection.data(), &matrix[0][0], sizeof(viewProjection));
+
+	//trims the fallback draws before the recording threads walk them
+	if (cpuOcclusionCulling)
+	{
+		chunkRenderer->cull_on_cpu(matrix, camera->position(), *softwareOcclusion, *jobPool);
+		totalCpuCullMs += chunkRenderer->get_cpu_cull_statistics().milliseconds;
+		cpuCulledFrames++;
+	}
+
+	//chunks visible last frame become the early indirect draws before any pass reads them,
+	//the late phase is recorded by the graph once the depth pyramid is built
+	depthPyramid->record_prepare(commandBuffer);
+	chunkRenderer->record_cull(commandBuffer, currentFrame, vkUtil::CullPhase::Early, viewProjection, *depthPyramid);
+
+	//barriers, layout transitions and render passes all come from the graph
+	renderGraph->bind_imported(backbuffer, swapchainFrames[imageIndex].image, swapchainFrames[imageIndex].imageView);
+	renderGraph->execute(commandBuffer);
+	recordingQueries = nullptr;
+
+	try
+	{
+		commandBuffer.end();
+	}
+	catch (vk::SystemError err)
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to finish recording command buffer" << std::endl;
+		}
+	}
+}
+
+void Engine::render()
+{
+	auto frameStart = std::chrono::steady_clock::now();
+
+	//frame boundary: pick up pipelines rebuilt by the shader watcher
+	swap_reloaded_pipelines();
+
+	vkUtil::FrameSlot& slot = frameSlots[currentFrame];
+
+	//block until the GPU has finished the last frame recorded into this slot
+	auto waitStart = std::chrono::steady_clock::now();
+	if (device.waitForFences(1, &slot.inFlight, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+	{
+		return;
+	}
+	slot.fenceWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+	totalFenceWaitMs += slot.fenceWaitMs;
+
+	destroy_retired_pipelines();
+	destroy_retired_swapchains();
+
+	memoryManager->begin_frame(frameNumber);
+
+	//compacting only stalls the queues when the chunk mesh pool is actually fragmented; uploads and
+	//compute jobs already submitted hold the buffers' current handles, so both queues drain first
+	if (frameNumber > 0 && frameNumber % defragmentationInterval == 0 && memoryManager->chunk_pool_fragmented())
+	{
+		uploadService->wait(uploadService->flush(debugMode));
+		computeScheduler->wait(computeScheduler->submitted_ticket());
+
+		//taken before the memory manager locks, the upload service frees staging buffers under its own lock
+		std::vector<const vkUtil::Buffer*> written = uploadService->get_written_buffers();
+		memoryManager->defragment_chunk_pool([&](const vkUtil::Buffer* buffer)
+		{
+			return std::find(written.begin(), written.end(), buffer) != written.end();
+		}, debugMode);
+	}
+
+	//headless: no swapchain to acquire from, cycle through the offscreen images
+	uint32_t imageIndex = static_cast<uint32_t>(frameNumber % swapchainFrames.size());
+	if (!headless)
+	{
+		framePacer->begin_acquire();
+		try
+		{
+			//a suboptimal image still signals the semaphore, render it and recreate after presenting
+			imageIndex = device.acquireNextImageKHR(swapchain, UINT64_MAX, slot.imageAvailable, nullptr).value;
+		}
+		catch (vk::OutOfDateKHRError err)
+		{
+			//nothing was acquired and the slot's fence is untouched, retry next frame
+			recreate_swapchain();
+			return;
+		}
+	}
+
+	//another slot may still be rendering to this image
+	if (imagesInFlight[imageIndex] && imagesInFlight[imageIndex] != slot.inFlight)
+	{
+		if (device.waitForFences(1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+		{
+			return;
+		}
+	}
+	imagesInFlight[imageIndex] = slot.inFlight;
+
+	if (device.resetFences(1, &slot.inFlight) != vk::Result::eSuccess)
+	{
+		return;
+	}
+
+	//the slot's fence has signaled, everything allocated from its pool is free to reuse
+	device.resetCommandPool(slot.commandPool);
+
+	recorder->begin_frame(currentFrame);
+	chunkRenderer->begin_frame(frameNumber);
+	if (brickmap)
+	{
+		brickmap->begin_frame(frameNumber);
+	}
+
+	//chunks replaced or evicted a while ago are freed once no reader can still hold them
+	world->collect();
+
+	collect_pipeline_statistics(slot);
+	if (chunkRenderer->collect_statistics(currentFrame))
+	{
+		const vkUtil::CullStatistics& culling = chunkRenderer->get_cull_statistics();
+		totalChunksDrawn += culling.drawnEarly + culling.drawnLate;
+		cullMeasuredFrames++;
+	}
+	recordingQueries = slot.statisticsQueries;
+	slot.statisticsWritten = static_cast<bool>(slot.statisticsQueries);
+
+	auto recordStart = std::chrono::steady_clock::now();
+	record_draw_commands(slot.commandBuffer, imageIndex);
+	totalRecordMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+	//everything queued for upload this frame goes to the transfer queue as one batch
+	uploadService->flush(debugMode);
+
+	vk::SubmitInfo submitInfo = {};
+
+	std::array<vk::Semaphore, 3> waitSemaphores = {};
+	std::array<vk::PipelineStageFlags, 3> waitStages = {};
+	std::array<uint64_t, 3> waitValues = {};
+	uint32_t waitCount = 0;
+
+	if (!headless)
+	{
+		waitSemaphores[waitCount] = slot.imageAvailable;
+		waitStages[waitCount] = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+		waitCount++;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &slot.renderFinished;
+	}
+
+	//uploads and compute results this frame reads: the GPU waits for them, the CPU keeps going
+	vk::TimelineSemaphoreSubmitInfo timelineInfo = {};
+	auto wait_for_ticket = [&](auto& producer, uint64_t ticket, vk::PipelineStageFlags stages)
+	{
+		if (ticket == 0 || producer.is_complete(ticket))
+		{
+			return;
+		}
+		if (vk::Semaphore timeline = producer.get_timeline_semaphore())
+		{
+			waitSemaphores[waitCount] = timeline;
+			waitStages[waitCount] = stages;
+			waitValues[waitCount] = ticket;
+			waitCount++;
+
+			timelineInfo.waitSemaphoreValueCount = waitCount;
+			timelineInfo.pWaitSemaphoreValues = waitValues.data();
+			submitInfo.pNext = &timelineInfo;
+		}
+		else
+		{
+			//no timeline semaphores, fall back to waiting on the host
+			producer.wait(ticket);
+		}
+	};
+
+	//chunk metadata is read by the culling dispatch before any vertex is fetched
+	vk::PipelineStageFlags geometryStages = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eVertexInput
+		| vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader;
+	wait_for_ticket(*uploadService, frameUploadTicket, geometryStages);
+	wait_for_ticket(*computeScheduler, frameComputeTicket, geometryStages | vk::PipelineStageFlagBits::eDrawIndirect);
+	frameUploadTicket = 0;
+	frameComputeTicket = 0;
+
+	submitInfo.waitSemaphoreCount = waitCount;
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &slot.commandBuffer;
+
+	try
+	{
+		graphicsQueue.submit(submitInfo, slot.inFlight);
+	}
+	catch (vk::SystemError err)
+	{
+		if (debugMode)
+		{
+			std::cout << "Failed to submit draw command buffer" << std::endl;
+		}
+	}
+
+	bool outOfDate = false;
+	if (!headless)
+	{
+		vk::PresentInfoKHR presentInfo = {};
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &slot.renderFinished;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &swapchain;
+		presentInfo.pImageIndices = &imageIndex;
+
+		vk::Result presentResult = vk::Result::eSuccess;
+		try
+		{
+			presentResult = presentQueue.presentKHR(presentInfo);
+		}
+		catch (vk::OutOfDateKHRError err)
+		{
+			presentResult = vk::Result::eErrorOutOfDateKHR;
+		}
+		framePacer->end_present();
+
+		if (presentResult != vk::Result::eSuccess || framebufferResized)
+		{
+			framebufferResized = false;
+			outOfDate = true;
+		}
+	}
+
+	currentFrame = (currentFrame + 1) % maxFramesInFlight;
+	frameNumber++;
+
+	if (outOfDate)
+	{
+		recreate_swapchain();
+	}
+
+	totalFrameMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+}
+
+void Engine::collect_pipeline_statistics(vkUtil::FrameSlot& slot)
+{
+	if (!slot.statisticsWritten)
+	{
+		return;
+	}
+	slot.statisticsWritten = false;
+
+	//the fence has signaled so the results are available, a pass that was culled never wrote its query
+	std::array<uint64_t, passQueryCount> fragments = {};
+	uint32_t count = depthPrepass ? passQueryCount : opaqueQuery;
+	vk::Result result = device.getQueryPoolResults(
+		slot.statisticsQueries, 0, count,
+		sizeof(uint64_t) * count, fragments.data(), sizeof(uint64_t),
+		vk::QueryResultFlagBits::e64
+	);
+	if (result != vk::Result::eSuccess)
+	{
+		return;
+	}
+
+	//without a prepass both culling phases shade
+	lastShadedFragments = depthPrepass ? fragments[opaqueQuery] : fragments[earlyPassQuery] + fragments[latePassQuery];
+	totalShadedFragments += lastShadedFragments;
+	measuredFrames++;
+}
+
+FrameStats Engine::get_frame_stats() const
+{
+	FrameStats stats = {};
+	stats.frames = frameNumber;
+	if (frameNumber > 0)
+	{
+		stats.averageFrameMs = totalFrameMs / frameNumber;
+		stats.averageFenceWaitMs = totalFenceWaitMs / frameNumber;
+		stats.lastFenceWaitMs = frameSlots[(currentFrame + maxFramesInFlight - 1) % maxFramesInFlight].fenceWaitMs;
+		stats.averageRecordMs = totalRecordMs / frameNumber;
+	}
+	stats.averageAcquireToPresentMs = framePacer->get_average_latency_ms();
+	stats.lastAcquireToPresentMs = framePacer->get_last_latency_ms();
+	stats.maxAcquireToPresentMs = framePacer->get_max_latency_ms();
+	stats.lastRecordEfficiency = recorder->get_last_efficiency();
+	stats.shadedFragmentsMeasured = measuredFrames > 0;
+	if (measuredFrames > 0)
+	{
+		stats.averageShadedFragments = static_cast<double>(totalShadedFragments) / measuredFrames;
+		stats.lastShadedFragments = lastShadedFragments;
+	}
+	stats.cullingMeasured = cullMeasuredFrames > 0;
+	if (cullMeasuredFrames > 0)
+	{
+		const vkUtil::CullStatistics& culling = chunkRenderer->get_cull_statistics();
+		stats.averageChunksDrawn = static_cast<double>(totalChunksDrawn) / cullMeasuredFrames;
+		stats.lastChunksTested = culling.tested;
+		stats.lastChunksFrustumCulled = culling.frustumCulled;
+		stats.lastChunksOcclusionCulled = culling.occlusionCulled;
+		stats.lastChunksDrawn = culling.drawnEarly + culling.drawnLate;
+	}
+	stats.cpuCullingMeasured = cpuCulledFrames > 0;
+	if (cpuCulledFrames > 0)
+	{
+		stats.averageCpuCullMs = totalCpuCullMs / cpuCulledFrames;
+		stats.lastCpuOccluded = chunkRenderer->get_cpu_cull_statistics().occlusionCulled;
+	}
+	return stats;
+}
+
+void Engine::run(uint32_t maxFrames)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	while (maxFrames == 0 || frameNumber < maxFrames)
+	{
+		//sleep off the rest of the frame budget before sampling input, not after
+		framePacer->wait_for_next_frame();
+
+		if (!headless)
+		{
+			if (glfwWindowShouldClose(window))
+			{
+				break;
+			}
+			glfwPollEvents();
+		}
+
+		render();
+	}
+
+	device.waitIdle();
+
+	//frame throughput, this is what headless benchmark runs are after
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Rendered " << frameNumber << " frames in " << seconds << "s ("
+		<< (seconds > 0.0 ? frameNumber / seconds : 0.0) << " fps)\n";
+
+	FrameStats stats = get_frame_stats();
+	std::cout << "Average CPU frame time: " << stats.averageFrameMs << "ms, "
+		<< "of which waiting on frame fences: " << stats.averageFenceWaitMs << "ms ("
+		<< (stats.averageFenceWaitMs > 0.5 * stats.averageFrameMs ? "GPU bound" : "CPU bound") << ")\n";
+	if (!headless)
+	{
+		std::cout << "Acquire to present: " << stats.averageAcquireToPresentMs << "ms average, "
+			<< stats.maxAcquireToPresentMs << "ms worst (" << vkInit::log_present_mode_small(presentMode) << " present mode)\n";
+	}
+
+	std::cout << "Command recording: " << stats.averageRecordMs << "ms average for " << chunkRenderer->get_chunk_count() << " chunks on "
+		<< recorder->get_thread_count() << " threads (" << stats.lastRecordEfficiency * 100.0 << "% efficiency last frame)\n";
+
+	if (stats.shadedFragmentsMeasured)
+	{
+		double pixels = static_cast<double>(swapchainExtent.width) * swapchainExtent.height;
+		std::cout << "Shaded fragments: " << stats.averageShadedFragments << " per frame ("
+			<< (pixels > 0.0 ? stats.averageShadedFragments / pixels : 0.0) << " per pixel, depth prepass "
+			<< (depthPrepass ? "on" : "off") << ")\n";
+	}
+
+	if (stats.cullingMeasured)
+	{
+		std::cout << "Chunk culling: " << stats.averageChunksDrawn << " chunks drawn per frame, last frame "
+			<< stats.lastChunksDrawn << " of " << stats.lastChunksTested << " (" << stats.lastChunksFrustumCulled
+			<< " outside the frustum, " << stats.lastChunksOcclusionCulled << " occluded)\n";
+	}
+
+	if (world->size() > 0)
+	{
+		log_far_field_compression();
+	}
+
+	if (brickmap)
+	{
+		vkUtil::BrickmapStatistics brickStats = brickmap->get_statistics();
+		std::cout << "Brickmap: " << brickStats.bricksUsed << " of " << brickStats.brickCapacity << " bricks ("
+			<< ((brickStats.bricksUsed * vkUtil::Brickmap::brickBytes) >> 10) << "KiB), " << brickStats.uniformCells
+			<< " single voxel and " << brickStats.emptyCells << " empty cells without a brick";
+		if (brickStats.overflowCells > 0)
+		{
+			std::cout << ", " << brickStats.overflowCells << " bricks over budget";
+		}
+		std::cout << '\n';
+	}
+
+	if (stats.cpuCullingMeasured)
+	{
+		std::cout << "CPU occlusion culling: " << stats.averageCpuCullMs << "ms average on " << jobPool->get_thread_count() << " threads with "
+			<< vkUtil::simd_level_name(softwareOcclusion->get_simd_level()) << ", " << stats.lastCpuOccluded << " chunks occluded last frame\n";
+	}
+
+	if (debugMode)
+	{
+		recorder->log_statistics();
+		chunkRenderer->log_statistics();
+		memoryManager->log_statistics();
+	}
+}
+
+Engine::~Engine()
+{
+	if (debugMode) {
+		std::cout << "Destroying Engine\n";
+	}
+
+	//stop watching before tearing down what the reload thread uses
+	shaderWatcher.reset();
+
+	device.waitIdle();
+
+	//destroy window
+	if (!headless)
+	{
+		glfwDestroyWindow(window);
+	}
+
+	//destroy frame slots, destroying a command pool frees its command buffers
+	for (vkUtil::FrameSlot slot : frameSlots)
+	{
+		device.destroyFence(slot.inFlight);
+		device.destroySemaphore(slot.imageAvailable);
+		device.destroySemaphore(slot.renderFinished);
+		device.destroyCommandPool(slot.commandPool);
+		if (slot.statisticsQueries)
+		{
+			device.destroyQueryPool(slot.statisticsQueries);
+		}
+	}
+
+	//destroying the recording command pools frees the secondary command buffers, then the workers stop
+	recorder->destroy();
+	jobPool->destroy();
+
+	//chunk arenas, metadata, indirect buffers, the depth pyramid and the brickmap go back to the memory manager
+	chunkRenderer->destroy();
+	depthPyramid->destroy();
+	if (brickmap)
+	{
+		brickmap->destroy();
+	}
+
+	//destroy framebuffers and image views
+	for (vkUtil::SwapChainFrame frame : swapchainFrames)
+	{
+		device.destroyImageView(frame.imageView);
+
+		//swapchain images belong to the swapchain, offscreen images belong to us
+		if (headless)
+		{
+			device.destroyImage(frame.image);
+			device.freeMemory(frame.imageMemory);
+		}
+	}
+
+	//destroy retired pipelines, the live and pending ones belong to the pipeline state cache
+	for (std::pair<uint64_t, vk::Pipeline> retired : retiredPipelines)
+	{
+		device.destroyPipeline(retired.second);
+	}
+
+	//persist and destroy pipeline cache
+	vkInit::save_pipeline_cache(device, pipelineCache, pipelineCacheFilename, debugMode);
+	device.destroyPipelineCache(pipelineCache);
+
+	//destroy cached pipeline variants and their renderpasses
+	pipelineStateCache->destroy();
+
+	//destroy the render graph's render passes, framebuffers and transient images
+	renderGraph->destroy();
+
+	//destroy pipeline and descriptor set layouts
+	layoutCache->destroy();
+
+	//return staging buffers, then free every buffer and image still allocated, the pools and the allocator
+	uploadService->destroy();
+	computeScheduler->destroy();
+	memoryManager->destroy(debugMode);
+
+	//destroy swapchain, retired ones first
+	if (!headless)
+	{
+		for (std::pair<uint64_t, vk::SwapchainKHR> retired : retiredSwapchains)
+		{
+			device.destroySwapchainKHR(retired.second);
+		}
+		device.destroySwapchainKHR(swapchain);
+	}
+
+	//destroy device
+	device.destroy();
+
+	//destroy surface
+	if (!headless)
+	{
+		instance.destroySurfaceKHR(surface);
+	}
+
+	//destroy messenger
+	if (debugMode)
+	{
+		instance.destroyDebugUtilsMessengerEXT(debugMessenger, nullptr, dldi);
+	}
+
+	//destroy instance
+	instance.destroy();
+
+	//terminate glfw
+	if (!headless)
+	{
+		glfwTerminate();
+	}
 }
\ No newline at end of file
@@ -2,44 +2,338 @@
 #include "config.h"
 #include "frame.h"
 
+namespace vkUtil
+{
+	class ShaderWatcher;
+	class LayoutCache;
+	class PipelineStateCache;
+	class MemoryManager;
+	class UploadService;
+	class ComputeScheduler;
+	class FramePacer;
+	class RenderGraph;
+	class ParallelRecorder;
+	class ChunkRenderer;
+	class DepthPyramid;
+	class JobPool;
+	class SoftwareOcclusion;
+	class Chunk;
+	class ChunkMap;
+	class SvoDag;
+	class Brickmap;
+	using ChunkCoordinate = std::array<int32_t, 3>;
+	enum class CullPhase : uint32_t;
+	struct Camera;
+}
+
+namespace vkInit
+{
+	struct DeviceSelection;
+	struct DeviceCapabilities;
+}
+
+//startup options, filled from the command line in main
+struct EngineSettings
+{
+	//no window, no surface, rendering into engine-owned images
+	bool headless{ false };
+
+	//number of frames the CPU may record ahead of the GPU
+	uint32_t framesInFlight{ 2 };
+
+	//rebuild pipelines when their shader sources change on disk (windowed mode only)
+	bool hotReloadShaders{ true };
+
+	//present mode and swapchain depth, input latency is favored over peak frame rate by default
+	vkUtil::LatencyPolicy latencyPolicy{ vkUtil::LatencyPolicy::LowestLatency };
+
+	//frame rate the loop is paced to, 0 renders as fast as the present mode allows
+	double targetFps{ 0.0 };
+
+	//device name substring or UUID to use instead of the persisted or best scoring device
+	std::string preferredDevice{};
+
+	//capabilities to leave off even when supported, so their fallback paths run (see vkInit::disable_capability)
+	std::vector<std::string> disabledFeatures{};
+
+	//lay down depth before shading so each pixel is shaded once, off to measure the overdraw it saves
+	bool depthPrepass{ true };
+
+	//worker threads recording draws and culling on the CPU, 0 uses every hardware thread
+	uint32_t recordingThreads{ 0 };
+
+	//side of the square grid of box chunks generated at startup until there is a world, 0 for none
+	uint32_t testChunks{ 32 };
+
+	//cull chunks against a software occlusion buffer before recording, where the GPU cannot count its own draws
+	bool cpuOcclusionCulling{ true };
+
+	//MiB of device memory for the brickmap the world is ray marched through, 0 for none
+	uint32_t brickmapBudgetMiB{ 64 };
+};
+
+//CPU side frame timings, averaged over the frames rendered so far
+struct FrameStats
+{
+	uint64_t frames{ 0 };
+	double averageFrameMs{ 0.0 };
+
+	//time blocked waiting for a frame slot's fence, a large share of the frame means GPU bound
+	double averageFenceWaitMs{ 0.0 };
+	double lastFenceWaitMs{ 0.0 };
+
+	//CPU time from acquiring a swapchain image to presenting it, 0 when headless
+	double averageAcquireToPresentMs{ 0.0 };
+	double lastAcquireToPresentMs{ 0.0 };
+	double maxAcquireToPresentMs{ 0.0 };
+
+	//CPU time recording the frame's command buffers, and how well it spread over the recording threads
+	double averageRecordMs{ 0.0 };
+	double lastRecordEfficiency{ 0.0 };
+
+	//fragment shader invocations of the shading pass, from pipeline statistics queries (0 when unsupported)
+	bool shadedFragmentsMeasured{ false };
+	double averageShadedFragments{ 0.0 };
+	uint64_t lastShadedFragments{ 0 };
+
+	//GPU culling counters, the last frame's are a few frames old since they are read back after its fence
+	bool cullingMeasured{ false };
+	double averageChunksDrawn{ 0.0 };
+	uint32_t lastChunksTested{ 0 };
+	uint32_t lastChunksFrustumCulled{ 0 };
+	uint32_t lastChunksOcclusionCulled{ 0 };
+	uint32_t lastChunksDrawn{ 0 };
+
+	//CPU culling before recording, only on the path without draw indirect count
+	bool cpuCullingMeasured{ false };
+	double averageCpuCullMs{ 0.0 };
+	uint32_t lastCpuOccluded{ 0 };
+};
+
+//pipelines built from the scene shaders, hot reload swaps them together
+struct ScenePipelines
+{
+	vk::Pipeline opaque{ nullptr };
+	vk::PipelineLayout opaqueLayout{ nullptr };
+	uint64_t opaqueKey{ 0 };
+
+	//null when the depth prepass is off
+	vk::Pipeline depthPrepass{ nullptr };
+	vk::PipelineLayout depthPrepassLayout{ nullptr };
+	uint64_t depthPrepassKey{ 0 };
+
+	//pipeline state cache keys, 0 for pipelines that are not built
+	std::array<uint64_t, 2> keys() const
+	{
+		return { opaqueKey, depthPrepassKey };
+	}
+
+	bool uses(uint64_t key) const
+	{
+		return key != 0 && (key == opaqueKey || key == depthPrepassKey);
+	}
+};
+
 class Engine {
 
 public:
 
-	Engine();
+	Engine(EngineSettings settings = {});
 
 	~Engine();
 
+	//run the frame loop, until the window closes or maxFrames frames have been rendered (0 = no limit)
+	void run(uint32_t maxFrames = 0);
+
+	//render a single frame
+	void render();
+
+	FrameStats get_frame_stats() const;
+
+	//which physical device is in use, how it was picked and the score breakdown
+	const vkInit::DeviceSelection& get_device_selection() const;
+
+	//optional features found and enabled on the device, fast paths check these
+	const vkInit::DeviceCapabilities& get_capabilities() const;
+
+	//buffer and image allocation, per pool statistics and heap budgets
+	vkUtil::MemoryManager& get_memory_manager();
+
+	//asynchronous buffer and image uploads on the transfer queue
+	vkUtil::UploadService& get_upload_service();
+
+	//make the next frame's graphics submission wait (on the GPU) for an upload ticket
+	void wait_for_upload(uint64_t ticket);
+
+	//compute jobs (meshing, generation, culling) on the async compute queue
+	vkUtil::ComputeScheduler& get_compute_scheduler();
+
+	//make the next frame's graphics submission wait (on the GPU) for a compute ticket
+	void wait_for_compute(uint64_t ticket);
+
 private:
 
 	//whether to print debug messages in functions
 	bool debugMode = true;
 
+	//headless mode: no window, no surface, rendering into engine-owned images
+	bool headless{ false };
+	uint32_t offscreenImageCount{ 3 };
+
+	uint32_t maxFramesInFlight{ 2 };
+
 	//glfw window parameters
 	int width{ 640 };
 	int height{ 480 };
 	GLFWwindow* window{ nullptr };
 
+	//set by the framebuffer size callback, the swapchain is rebuilt after the next present
+	bool framebufferResized{ false };
+
+	//present mode selection and frame pacing
+	vkUtil::LatencyPolicy latencyPolicy{ vkUtil::LatencyPolicy::LowestLatency };
+	std::unique_ptr<vkUtil::FramePacer> framePacer;
+
 	//vulkan instance variables
 	vk::Instance instance{ nullptr };
 	vk::DebugUtilsMessengerEXT debugMessenger{ nullptr };
 	vk::DispatchLoaderDynamic dldi;
 	vk::SurfaceKHR surface;
 
-	//vulkan device variables
+	//vulkan device variables, the chosen device's UUID is kept in deviceSelectionFilename
+	std::string preferredDevice{};
+	std::string deviceSelectionFilename{ "physical_device.txt" };
+	std::unique_ptr<vkInit::DeviceSelection> deviceSelection;
 	vk::PhysicalDevice physicalDevice{ nullptr };
+	std::vector<std::string> disabledFeatures{};
+	std::unique_ptr<vkInit::DeviceCapabilities> capabilities;
 	vk::Device device{ nullptr };
 	vk::Queue graphicsQueue{ nullptr };
 	vk::Queue presentQueue{ nullptr };
+	uint32_t graphicsQueueFamily{ 0 };
+	vk::Queue transferQueue{ nullptr };
+	uint32_t transferQueueFamily{ 0 };
+	vk::Queue computeQueue{ nullptr };
+	uint32_t computeQueueFamily{ 0 };
+	bool timelineSemaphoresEnabled{ false };
 	vk::SwapchainKHR swapchain;
+
+	//swapchains replaced on resize, their images may still be queued for present until every frame slot has cycled
+	std::vector<std::pair<uint64_t, vk::SwapchainKHR>> retiredSwapchains{};
 	std::vector<vkUtil::SwapChainFrame> swapchainFrames{};
 	vk::Format swapchainFormat;
 	vk::Extent2D swapchainExtent;
+	vk::PresentModeKHR presentMode{ vk::PresentModeKHR::eFifo };
+
+	//GPU memory, the chunk mesh pool is checked for fragmentation every defragmentationInterval frames
+	std::unique_ptr<vkUtil::MemoryManager> memoryManager;
+	bool memoryBudgetEnabled{ false };
+	uint64_t defragmentationInterval{ 600 };
+
+	//streaming uploads, the highest ticket the next frame has to wait for
+	std::unique_ptr<vkUtil::UploadService> uploadService;
+	uint64_t frameUploadTicket{ 0 };
+
+	//async compute, the highest ticket the next frame has to wait for
+	std::unique_ptr<vkUtil::ComputeScheduler> computeScheduler;
+	uint64_t frameComputeTicket{ 0 };
+
+	//shader sources and compiled SPIR-V cache
+	std::string shaderDirectory{ "shaders" };
+	std::string shaderCacheDirectory{ "shaders/cache" };
+	std::vector<std::string> pipelineShaderFiles{ "shaders/chunk.vert", "shaders/chunk.frag" };
+	std::string chunkCullShaderFile{ "shaders/chunk_cull.comp" };
+	std::string depthPyramidShaderFile{ "shaders/depth_pyramid.comp" };
+
+	//shader hot reload, the watcher thread rebuilds pipelines and hands them over at a frame boundary
+	bool hotReloadShaders{ true };
+	std::unique_ptr<vkUtil::ShaderWatcher> shaderWatcher;
+	std::mutex reloadMutex;
+	ScenePipelines pendingPipelines{};
+	std::vector<std::pair<uint64_t, vk::Pipeline>> retiredPipelines{};
+
+	//copies of swapchainFormat and depthFormat for the watcher thread, written by the render thread under reloadMutex
+	vk::Format pipelineSwapchainFormat{ vk::Format::eUndefined };
+	vk::Format pipelineDepthFormat{ vk::Format::eUndefined };
 
 	//vulkan pipeline variables
-	vk::PipelineLayout layout;
-	vk::RenderPass renderpass;
-	vk::Pipeline pipeline;
+	std::string pipelineCacheFilename{ "pipeline_cache.bin" };
+	vk::PipelineCache pipelineCache;
+	std::unique_ptr<vkUtil::LayoutCache> layoutCache;
+	std::unique_ptr<vkUtil::PipelineStateCache> pipelineStateCache;
+	ScenePipelines pipelines{};
+
+	//reverse-Z depth: cleared to 0, greater passes, the shading pass tests equal against the prepass
+	bool depthPrepass{ true };
+	vk::Format depthFormat{ vk::Format::eUndefined };
+
+	//frame structure: passes, the attachments they use and the barriers between them
+	std::unique_ptr<vkUtil::RenderGraph> renderGraph;
+	uint32_t backbuffer{ 0 };
+	uint32_t depthBuffer{ 0 };
+
+	//pipeline statistics queries, one per pass, in the pool of the frame slot being recorded
+	bool pipelineStatisticsEnabled{ false };
+	vk::QueryPool recordingQueries{ nullptr };
+	uint64_t measuredFrames{ 0 };
+	uint64_t totalShadedFragments{ 0 };
+	uint64_t lastShadedFragments{ 0 };
+
+	//scene draws are recorded into secondary command buffers on the job pool's recordingThreads threads
+	uint32_t recordingThreads{ 0 };
+	uint32_t minDrawsPerBatch{ 256 };
+	std::unique_ptr<vkUtil::ParallelRecorder> recorder;
+
+	//worker threads shared by parallel recording and CPU culling, the calling thread is thread 0
+	std::unique_ptr<vkUtil::JobPool> jobPool;
+
+	//chunk meshes, culled and turned into indirect draws on the GPU
+	std::unique_ptr<vkUtil::ChunkRenderer> chunkRenderer;
+	uint32_t testChunks{ 32 };
+	uint64_t cullMeasuredFrames{ 0 };
+	uint64_t totalChunksDrawn{ 0 };
+
+	//voxel contents of the world by chunk coordinate, test scene meshes are still built from boxes
+	std::unique_ptr<vkUtil::ChunkMap> world;
+
+	//the world as a deduplicated octree, what far terrain would be ray marched from
+	std::unique_ptr<vkUtil::SvoDag> farField;
+	uint32_t farFieldRegionChunks{ 8 };
+	double farFieldBuildMs{ 0.0 };
+	uint32_t testColumnChunks{ 4 };
+
+	//the world as cells and 8^3 voxel bricks in storage buffers, kept in step with the chunk map
+	std::unique_ptr<vkUtil::Brickmap> brickmap;
+	uint32_t brickmapBudgetMiB{ 64 };
+
+	//farthest depth per screen region, built between the two culling phases
+	std::unique_ptr<vkUtil::DepthPyramid> depthPyramid;
+
+	//CPU culling for the fallback draws: the occlusion buffer the job pool rasterizes into
+	bool cpuOcclusionCulling{ true };
+	std::unique_ptr<vkUtil::SoftwareOcclusion> softwareOcclusion;
+	uint32_t occlusionWidth{ 320 };
+	uint64_t cpuCulledFrames{ 0 };
+	double totalCpuCullMs{ 0.0 };
+
+	//camera, the view-projection is pushed to the chunk shaders
+	std::unique_ptr<vkUtil::Camera> camera;
+	std::array<float, 16> viewProjection{};
+
+	//frames in flight, each with its own command pool, command buffer and sync objects
+	std::vector<vkUtil::FrameSlot> frameSlots{};
+	uint32_t currentFrame{ 0 };
+
+	//fence of the frame slot last rendering to each swapchain image
+	std::vector<vk::Fence> imagesInFlight{};
+
+	//frame counter, also picks the offscreen image in headless mode
+	uint64_t frameNumber{ 0 };
+
+	//accumulated CPU timings
+	double totalFenceWaitMs{ 0.0 };
+	double totalFrameMs{ 0.0 };
+	double totalRecordMs{ 0.0 };
 
 	//glfw setup
 	void build_glfw_window();
@@ -50,6 +344,70 @@ private:
 	//device setup
 	void make_device();
 
+	//allocator and memory pools
+	void make_memory_manager();
+
+	//transfer queue upload service
+	void make_upload_service();
+
+	//async compute job submission
+	void make_compute_scheduler();
+
 	//pipeline setup
 	void make_pipeline();
-};
\ No newline at end of file
+
+	//chunk mesh arenas, metadata, the culling pipeline and the depth pyramid
+	void make_chunk_renderer();
+
+	//a grid of box chunks of varying heights to look at
+	void make_test_scene();
+
+	//voxel chunks of one test scene column, testColumnChunks high, returns their upload ticket
+	uint64_t add_test_column(uint32_t x, uint32_t z, uint32_t height);
+
+	//store a chunk in the world and bring the far field and brickmap up to date, returns their upload ticket
+	uint64_t set_world_chunk(const vkUtil::ChunkCoordinate& coordinate, vkUtil::Chunk&& chunk);
+
+	//far field octree of every world chunk
+	void build_far_field();
+
+	//DAG size against the chunks it was built from
+	void log_far_field_compression();
+
+	//compile the scene shaders and build every pipeline using them through the pipeline state cache
+	bool build_pipelines(bool reload, ScenePipelines& built);
+
+	//shader watcher callback, runs on the watcher thread
+	void reload_shaders(const std::vector<std::string>& changedFiles);
+
+	//render thread side of hot reload
+	void swap_reloaded_pipelines();
+	void destroy_retired_pipelines();
+
+	//hands the current attachment formats to pipeline builds on the watcher thread
+	void publish_pipeline_formats();
+
+	//render graph, command buffers and synchronization objects
+	void finalize_setup();
+
+	//declare and compile the frame's passes for the current swapchain
+	void build_render_graph(bool debug);
+
+	//rebuild the swapchain, its image views and the render graph at the window's new size, pipelines are kept
+	void recreate_swapchain();
+	void destroy_retired_swapchains();
+
+	//record the draw commands for the given image
+	void record_draw_commands(vk::CommandBuffer commandBuffer, uint32_t imageIndex);
+
+	//record the given culling phases' chunk draws with the given pipeline and execute them in the pass, in parallel on the fallback path
+	void record_scene_pass(
+		vk::CommandBuffer commandBuffer, const vkUtil::RenderPassContext& context,
+		vk::Pipeline scenePipeline, vk::PipelineLayout sceneLayout, const std::vector<vkUtil::CullPhase>& phases, uint32_t query);
+
+	//full extent viewport and scissor, both are dynamic state
+	void set_viewport(vk::CommandBuffer commandBuffer, vk::Extent2D extent);
+
+	//read the statistics a frame slot's last submission wrote, its fence must have signaled
+	void collect_pipeline_statistics(vkUtil::FrameSlot& slot);
+};
@@ -3,9 +3,47 @@
 
 namespace vkUtil
 {
+	/*
+	* What the swapchain trades for what: lowest latency shows the newest frame without tearing
+	* where possible, vsync never tears, relaxed vsync tears only when a frame misses the
+	* vblank, uncapped presents immediately and tears.
+	*/
+	enum class LatencyPolicy
+	{
+		LowestLatency,
+		Vsync,
+		VsyncRelaxed,
+		Uncapped
+	};
+
 	struct SwapChainFrame
 	{
 		vk::Image image;
 		vk::ImageView imageView;
+
+		//only set for engine-owned (headless) images, swapchain images are owned by the swapchain
+		vk::DeviceMemory imageMemory;
+	};
+
+	/*
+	* Per frame-in-flight resources, independent of the swapchain images.
+	* Recording frame N+1 into one slot overlaps the GPU executing frame N from another.
+	*/
+	struct FrameSlot
+	{
+		vk::CommandPool commandPool;
+		vk::CommandBuffer commandBuffer;
+
+		//signaled when the GPU is done with this slot's last submission
+		vk::Fence inFlight;
+		vk::Semaphore imageAvailable;
+		vk::Semaphore renderFinished;
+
+		//time the CPU spent blocked on inFlight the last time this slot was reused
+		double fenceWaitMs{ 0.0 };
+
+		//pipeline statistics of the slot's last submission, null when the device can't query them
+		vk::QueryPool statisticsQueries{ nullptr };
+		bool statisticsWritten{ false };
 	};
-}
\ No newline at end of file
+}
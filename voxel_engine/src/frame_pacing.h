@@ -0,0 +1,113 @@
+#pragma once
+#include "config.h"
+#include <thread>
+
+namespace vkUtil
+{
+	/*
+	* Holds the frame loop to a target frame time and measures acquire-to-present latency.
+	* The loop sleeps before polling input, so the frame that follows samples input as late
+	* as possible instead of queueing ahead of the display and going stale in the swapchain.
+	* A target of 0 disables pacing, latency is measured either way.
+	*/
+	class FramePacer
+	{
+	public:
+
+		using Clock = std::chrono::steady_clock;
+
+		FramePacer(double targetFrameMs) : targetFrameMs(targetFrameMs) {}
+
+		//blocks until the next frame is due, call right before polling input
+		void wait_for_next_frame()
+		{
+			Clock::time_point now = Clock::now();
+			if (targetFrameMs <= 0.0)
+			{
+				lastFrameStart = now;
+				return;
+			}
+
+			if (lastFrameStart == Clock::time_point{})
+			{
+				nextFrameStart = now;
+			}
+
+			//sleep is only accurate to the scheduler's granularity, spin through the last stretch
+			Clock::duration spinThreshold = std::chrono::microseconds(1500);
+			if (nextFrameStart - now > spinThreshold)
+			{
+				std::this_thread::sleep_for(nextFrameStart - now - spinThreshold);
+			}
+			while (Clock::now() < nextFrameStart)
+			{
+				std::this_thread::yield();
+			}
+
+			now = Clock::now();
+			std::chrono::duration<double, std::milli> target(targetFrameMs);
+
+			//a frame that ran long sets a new baseline instead of rushing the next ones to catch up
+			nextFrameStart += std::chrono::duration_cast<Clock::duration>(target);
+			if (nextFrameStart < now)
+			{
+				nextFrameStart = now + std::chrono::duration_cast<Clock::duration>(target);
+			}
+
+			lastFrameStart = now;
+		}
+
+		void begin_acquire()
+		{
+			acquireStart = Clock::now();
+		}
+
+		//CPU time from asking for a swapchain image to handing the frame to the presentation engine
+		void end_present()
+		{
+			lastLatencyMs = std::chrono::duration<double, std::milli>(Clock::now() - acquireStart).count();
+			totalLatencyMs += lastLatencyMs;
+			maxLatencyMs = std::max(maxLatencyMs, lastLatencyMs);
+			presentedFrames++;
+		}
+
+		void set_target_frame_ms(double frameMs)
+		{
+			targetFrameMs = frameMs;
+			lastFrameStart = {};
+		}
+
+		double get_target_frame_ms() const
+		{
+			return targetFrameMs;
+		}
+
+		double get_last_latency_ms() const
+		{
+			return lastLatencyMs;
+		}
+
+		double get_average_latency_ms() const
+		{
+			return presentedFrames > 0 ? totalLatencyMs / presentedFrames : 0.0;
+		}
+
+		double get_max_latency_ms() const
+		{
+			return maxLatencyMs;
+		}
+
+	private:
+
+		double targetFrameMs;
+
+		Clock::time_point lastFrameStart{};
+		Clock::time_point nextFrameStart{};
+		Clock::time_point acquireStart{};
+
+		double lastLatencyMs{ 0.0 };
+		double totalLatencyMs{ 0.0 };
+		double maxLatencyMs{ 0.0 };
+		uint64_t presentedFrames{ 0 };
+	};
+}
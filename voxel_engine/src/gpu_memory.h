@@ -0,0 +1,668 @@
+#pragma once
+#include "config.h"
+#include <vma/vk_mem_alloc.h>
+#include <functional>
+
+namespace vkUtil
+{
+	//what a buffer is used for decides which pool, and so which memory type, it lives in
+	enum class MemoryPool : uint32_t
+	{
+		ChunkMesh,	//long lived device local buffers: chunk meshes, culling metadata and indirect draws, the brickmap; defragmented
+		Staging,	//CPU to GPU uploads, host visible and write combined
+		Uniform,	//per frame constants, host visible, device local when the heap allows
+		Readback,	//GPU to CPU results, host visible and cached
+		Count
+	};
+
+	struct Buffer
+	{
+		vk::Buffer buffer{ nullptr };
+		VmaAllocation allocation{ nullptr };
+		vk::DeviceSize size{ 0 };
+		vk::BufferUsageFlags usage;
+		MemoryPool pool{ MemoryPool::ChunkMesh };
+
+		//persistently mapped pointer for host visible pools, null otherwise
+		void* mapped{ nullptr };
+	};
+
+	struct Image
+	{
+		vk::Image image{ nullptr };
+		VmaAllocation allocation{ nullptr };
+	};
+
+	struct PoolStatistics
+	{
+		const char* name;
+		uint32_t memoryTypeIndex;
+		uint32_t allocationCount;
+		uint32_t blockCount;
+
+		//bytes handed out to allocations versus bytes of device memory the pool holds
+		vk::DeviceSize bytesUsed;
+		vk::DeviceSize bytesReserved;
+
+		//0 when all free space is one range, close to 1 when it is scattered in small holes
+		float fragmentation;
+	};
+
+	struct HeapBudget
+	{
+		vk::DeviceSize usage;
+		vk::DeviceSize budget;
+		bool deviceLocal;
+	};
+
+	struct MemoryManagerInput
+	{
+		vk::Instance instance;
+		vk::PhysicalDevice physicalDevice;
+		vk::Device device;
+
+		//version the instance and device were created at, VMA uses the core 1.1+ paths (dedicated allocations, bind2) from it
+		uint32_t apiVersion;
+
+		//queue used to move chunk meshes during defragmentation
+		vk::Queue queue;
+		uint32_t queueFamilyIndex;
+
+		//VK_EXT_memory_budget was enabled on the device, budgets are live instead of estimated
+		bool memoryBudget;
+
+		//families that touch chunk meshes and shared images, more than one means concurrent sharing
+		std::vector<uint32_t> queueFamilies;
+	};
+
+	/*
+	* All buffer and image memory goes through here. Buffers are suballocated from one VMA pool
+	* per usage so streaming chunk meshes can't fragment the memory uniforms and staging live in,
+	* and the chunk mesh pool is compacted incrementally when it gets fragmented.
+	* Buffers are handed out by pointer: defragmentation replaces their vk::Buffer in place.
+	* A buffer larger than its pool's blocks gets memory of its own of the pool's memory type,
+	* it is never moved.
+	*/
+	class MemoryManager
+	{
+	public:
+
+		MemoryManager(const MemoryManagerInput& input, bool debug) :
+			device(input.device),
+			queue(input.queue),
+			memoryBudget(input.memoryBudget),
+			queueFamilies(input.queueFamilies)
+		{
+			VmaVulkanFunctions functions = {};
+			functions.vkGetInstanceProcAddr = &vkGetInstanceProcAddr;
+			functions.vkGetDeviceProcAddr = &vkGetDeviceProcAddr;
+
+			VmaAllocatorCreateInfo allocatorInfo = {};
+			allocatorInfo.flags = memoryBudget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0;
+			allocatorInfo.physicalDevice = input.physicalDevice;
+			allocatorInfo.device = input.device;
+			allocatorInfo.instance = input.instance;
+			allocatorInfo.pVulkanFunctions = &functions;
+			allocatorInfo.vulkanApiVersion = input.apiVersion;
+
+			if (vmaCreateAllocator(&allocatorInfo, &allocator) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create memory allocator" << std::endl;
+				}
+				return;
+			}
+
+			vk::PhysicalDeviceMemoryProperties memoryProperties = input.physicalDevice.getMemoryProperties();
+			for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+			{
+				heapDeviceLocal.push_back(static_cast<bool>(memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal));
+			}
+
+			for (uint32_t i = 0; i < poolCount; i++)
+			{
+				make_pool(static_cast<MemoryPool>(i), debug);
+			}
+
+			vk::CommandPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::CommandPoolCreateFlags() | vk::CommandPoolCreateFlagBits::eTransient;
+			poolInfo.queueFamilyIndex = input.queueFamilyIndex;
+
+			try
+			{
+				commandPool = device.createCommandPool(poolInfo);
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create defragmentation command pool" << std::endl;
+				}
+			}
+		}
+
+		MemoryManager(const MemoryManager&) = delete;
+		MemoryManager& operator=(const MemoryManager&) = delete;
+
+		Buffer* create_buffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryPool pool, bool debug)
+		{
+			const PoolDescription& description = poolDescriptions[static_cast<uint32_t>(pool)];
+
+			Buffer* buffer = new Buffer();
+			buffer->size = size;
+			buffer->usage = usage | description.usage;
+			buffer->pool = pool;
+
+			vk::BufferCreateInfo bufferInfo = {};
+			bufferInfo.size = size;
+			bufferInfo.usage = buffer->usage;
+			set_sharing(bufferInfo, pool == MemoryPool::ChunkMesh);
+			const VkBufferCreateInfo& c_bufferInfo = bufferInfo;
+
+			VmaAllocationCreateInfo allocationInfo = {};
+			allocationInfo.flags = description.flags;
+			allocationInfo.pool = pools[static_cast<uint32_t>(pool)];
+			allocationInfo.pUserData = buffer;
+			if (size > description.blockSize)
+			{
+				//pools with a fixed block size can't hold dedicated allocations, the default pool of the same type can
+				allocationInfo.flags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+				allocationInfo.pool = nullptr;
+				allocationInfo.usage = description.memoryUsage;
+				allocationInfo.memoryTypeBits = 1u << poolMemoryTypes[static_cast<uint32_t>(pool)];
+			}
+
+			VkBuffer c_buffer;
+			VmaAllocationInfo allocated = {};
+			if (vmaCreateBuffer(allocator, &c_bufferInfo, &allocationInfo, &c_buffer, &buffer->allocation, &allocated) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to allocate " << size << " bytes from the " << description.name << " pool" << std::endl;
+				}
+				delete buffer;
+				return nullptr;
+			}
+			buffer->buffer = c_buffer;
+			buffer->mapped = allocated.pMappedData;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.insert(buffer);
+			return buffer;
+		}
+
+		void destroy_buffer(Buffer* buffer)
+		{
+			if (!buffer)
+			{
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			vmaDestroyBuffer(allocator, buffer->buffer, buffer->allocation);
+			buffers.erase(buffer);
+			delete buffer;
+		}
+
+		/*
+		* Images come from VMA's default pools, large render targets get dedicated memory.
+		* Shared images are written on the transfer queue and read on the graphics queue.
+		*/
+		Image create_image(vk::ImageCreateInfo imageInfo, bool shared, bool debug)
+		{
+			if (shared && queueFamilies.size() > 1)
+			{
+				imageInfo.sharingMode = vk::SharingMode::eConcurrent;
+				imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+				imageInfo.pQueueFamilyIndices = queueFamilies.data();
+			}
+			const VkImageCreateInfo& c_imageInfo = imageInfo;
+
+			VmaAllocationCreateInfo allocationInfo = {};
+			allocationInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+			Image image = {};
+			VkImage c_image;
+			if (vmaCreateImage(allocator, &c_imageInfo, &allocationInfo, &c_image, &image.allocation, nullptr) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to allocate image memory" << std::endl;
+				}
+				return {};
+			}
+			image.image = c_image;
+			return image;
+		}
+
+		void destroy_image(Image& image)
+		{
+			vmaDestroyImage(allocator, image.image, image.allocation);
+			image = {};
+		}
+
+		/*
+		* A device local block that several images are bound into at offsets chosen by the caller,
+		* used for transient attachments whose lifetimes never overlap within a frame.
+		* requirements must satisfy every image that will be bound into it.
+		*/
+		VmaAllocation allocate_aliasing_memory(const vk::MemoryRequirements& requirements, bool debug)
+		{
+			const VkMemoryRequirements& c_requirements = requirements;
+
+			VmaAllocationCreateInfo allocationInfo = {};
+			allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			allocationInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+			VmaAllocation allocation = nullptr;
+			if (vmaAllocateMemory(allocator, &c_requirements, &allocationInfo, &allocation, nullptr) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to allocate aliasing memory" << std::endl;
+				}
+				return nullptr;
+			}
+			return allocation;
+		}
+
+		bool bind_aliased_image(VmaAllocation allocation, vk::DeviceSize offset, vk::Image image, bool debug)
+		{
+			if (vmaBindImageMemory2(allocator, allocation, offset, static_cast<VkImage>(image), nullptr) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to bind image into aliasing memory" << std::endl;
+				}
+				return false;
+			}
+			return true;
+		}
+
+		//the images bound into allocation must be destroyed first
+		void free_aliasing_memory(VmaAllocation& allocation)
+		{
+			if (allocation)
+			{
+				vmaFreeMemory(allocator, allocation);
+				allocation = nullptr;
+			}
+		}
+
+		//host writes to a mapped buffer have to be flushed before the GPU reads them, a no-op on coherent memory
+		void flush(Buffer* buffer, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE)
+		{
+			vmaFlushAllocation(allocator, buffer->allocation, offset, size);
+		}
+
+		//and GPU writes have to be invalidated before the host reads them
+		void invalidate(Buffer* buffer, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE)
+		{
+			vmaInvalidateAllocation(allocator, buffer->allocation, offset, size);
+		}
+
+		//budgets from VK_EXT_memory_budget are refreshed once per frame index
+		void begin_frame(uint64_t frameNumber)
+		{
+			vmaSetCurrentFrameIndex(allocator, static_cast<uint32_t>(frameNumber));
+		}
+
+		PoolStatistics get_pool_statistics(MemoryPool pool)
+		{
+			uint32_t index = static_cast<uint32_t>(pool);
+
+			VmaDetailedStatistics detailed = {};
+			vmaCalculatePoolStatistics(allocator, pools[index], &detailed);
+
+			PoolStatistics statistics = {};
+			statistics.name = poolDescriptions[index].name;
+			statistics.memoryTypeIndex = poolMemoryTypes[index];
+			statistics.allocationCount = detailed.statistics.allocationCount;
+			statistics.blockCount = detailed.statistics.blockCount;
+			statistics.bytesUsed = detailed.statistics.allocationBytes;
+			statistics.bytesReserved = detailed.statistics.blockBytes;
+
+			vk::DeviceSize freeBytes = statistics.bytesReserved - statistics.bytesUsed;
+			if (freeBytes > 0 && detailed.unusedRangeCount > 0)
+			{
+				statistics.fragmentation = 1.0f - static_cast<float>(detailed.unusedRangeSizeMax) / static_cast<float>(freeBytes);
+			}
+			return statistics;
+		}
+
+		std::vector<HeapBudget> get_heap_budgets()
+		{
+			std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+			vmaGetHeapBudgets(allocator, budgets.data());
+
+			std::vector<HeapBudget> heaps;
+			for (size_t i = 0; i < heapDeviceLocal.size(); i++)
+			{
+				heaps.push_back({ budgets[i].usage, budgets[i].budget, heapDeviceLocal[i] });
+			}
+			return heaps;
+		}
+
+		//video memory the process can still take before the driver starts evicting, what streaming radii are sized against
+		vk::DeviceSize device_local_headroom()
+		{
+			vk::DeviceSize headroom = 0;
+			for (const HeapBudget& heap : get_heap_budgets())
+			{
+				if (heap.deviceLocal && heap.budget > heap.usage)
+				{
+					headroom += heap.budget - heap.usage;
+				}
+			}
+			return headroom;
+		}
+
+		//the chunk mesh pool is fragmented past the threshold, a defragmentation pass would move buffers
+		bool chunk_pool_fragmented()
+		{
+			return commandPool && get_pool_statistics(MemoryPool::ChunkMesh).fragmentation >= defragmentationThreshold;
+		}
+
+		/*
+		* Runs one incremental defragmentation pass over the chunk mesh pool if it is fragmented
+		* past the threshold. Moved buffers are copied on the GPU and swapped in place; the queue is
+		* drained first so no frame in flight still reads an old buffer. Work on other queues
+		* records vk::Buffer handles too: the caller drains the transfer and compute queues first,
+		* and buffers busy says are still being written are left where they are. Returns the bytes moved.
+		*/
+		vk::DeviceSize defragment_chunk_pool(const std::function<bool(const Buffer*)>& busy, bool debug)
+		{
+			if (!chunk_pool_fragmented())
+			{
+				return 0;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			VmaDefragmentationInfo defragmentationInfo = {};
+			defragmentationInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FAST_BIT;
+			defragmentationInfo.pool = pools[static_cast<uint32_t>(MemoryPool::ChunkMesh)];
+			defragmentationInfo.maxBytesPerPass = defragmentationBytesPerPass;
+
+			VmaDefragmentationContext context;
+			if (vmaBeginDefragmentation(allocator, &defragmentationInfo, &context) != VK_SUCCESS)
+			{
+				return 0;
+			}
+
+			VmaDefragmentationPassMoveInfo pass = {};
+			if (vmaBeginDefragmentationPass(allocator, context, &pass) == VK_INCOMPLETE)
+			{
+				move_buffers(pass, busy, debug);
+				vmaEndDefragmentationPass(allocator, context, &pass);
+			}
+
+			VmaDefragmentationStats defragmentationStats = {};
+			vmaEndDefragmentation(allocator, context, &defragmentationStats);
+
+			if (debug && defragmentationStats.bytesMoved > 0)
+			{
+				std::cout << "Defragmented chunk mesh pool: moved " << defragmentationStats.allocationsMoved << " buffers ("
+					<< defragmentationStats.bytesMoved << " bytes), freed " << defragmentationStats.deviceMemoryBlocksFreed << " blocks\n";
+			}
+			return defragmentationStats.bytesMoved;
+		}
+
+		void log_statistics()
+		{
+			for (uint32_t i = 0; i < poolCount; i++)
+			{
+				PoolStatistics statistics = get_pool_statistics(static_cast<MemoryPool>(i));
+				std::cout << "Memory pool \"" << statistics.name << "\" (type " << statistics.memoryTypeIndex << "): "
+					<< statistics.allocationCount << " allocations, "
+					<< statistics.bytesUsed << " / " << statistics.bytesReserved << " bytes used, "
+					<< statistics.fragmentation * 100.0f << "% fragmented\n";
+			}
+
+			std::vector<HeapBudget> heaps = get_heap_budgets();
+			for (size_t i = 0; i < heaps.size(); i++)
+			{
+				std::cout << "Memory heap " << i << (heaps[i].deviceLocal ? " (device local)" : "") << ": "
+					<< heaps[i].usage << " / " << heaps[i].budget << " bytes"
+					<< (memoryBudget ? "" : " (estimated)") << '\n';
+			}
+		}
+
+		void destroy(bool debug)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (debug && !buffers.empty())
+			{
+				std::cout << buffers.size() << " buffers still alive at shutdown" << std::endl;
+			}
+			for (Buffer* buffer : buffers)
+			{
+				vmaDestroyBuffer(allocator, buffer->buffer, buffer->allocation);
+				delete buffer;
+			}
+			buffers.clear();
+
+			device.destroyCommandPool(commandPool);
+
+			for (VmaPool pool : pools)
+			{
+				if (pool)
+				{
+					vmaDestroyPool(allocator, pool);
+				}
+			}
+
+			vmaDestroyAllocator(allocator);
+			allocator = nullptr;
+		}
+
+	private:
+
+		struct PoolDescription
+		{
+			const char* name;
+
+			//usage every buffer of the pool gets, the pool's memory type is picked for it
+			vk::BufferUsageFlags usage;
+			VmaMemoryUsage memoryUsage;
+			VmaAllocationCreateFlags flags;
+			vk::DeviceSize blockSize;
+		};
+
+		static constexpr uint32_t poolCount = static_cast<uint32_t>(MemoryPool::Count);
+
+		//chunk meshes are transfer sources and destinations so defragmentation can copy them,
+		//the culling pass reads chunk metadata and writes indirect draws from the same pool
+		const std::array<PoolDescription, poolCount> poolDescriptions = { {
+			{
+				"chunk mesh",
+				vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer
+					| vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer
+					| vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst,
+				VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, 0, 64ull << 20
+			},
+			{
+				"staging",
+				vk::BufferUsageFlagBits::eTransferSrc,
+				VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+				VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, 32ull << 20
+			},
+			{
+				"uniform",
+				vk::BufferUsageFlagBits::eUniformBuffer,
+				VMA_MEMORY_USAGE_AUTO,
+				VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, 8ull << 20
+			},
+			{
+				"readback",
+				vk::BufferUsageFlagBits::eTransferDst,
+				VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+				VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, 8ull << 20
+			}
+		} };
+
+		//defragment once a fifth of the free space is scattered, moving at most this much per pass
+		static constexpr float defragmentationThreshold{ 0.2f };
+		static constexpr vk::DeviceSize defragmentationBytesPerPass{ 16ull << 20 };
+
+		vk::Device device;
+		vk::Queue queue;
+		bool memoryBudget;
+		std::vector<uint32_t> queueFamilies;
+
+		VmaAllocator allocator{ nullptr };
+		std::array<VmaPool, poolCount> pools{};
+		std::array<uint32_t, poolCount> poolMemoryTypes{};
+		std::vector<bool> heapDeviceLocal;
+		vk::CommandPool commandPool{ nullptr };
+
+		std::mutex mutex;
+		std::set<Buffer*> buffers;
+
+		//chunk meshes are uploaded on the transfer queue and drawn on the graphics queue, no ownership transfers
+		void set_sharing(vk::BufferCreateInfo& bufferInfo, bool shared)
+		{
+			bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+			if (shared && queueFamilies.size() > 1)
+			{
+				bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+				bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+				bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+			}
+		}
+
+		void make_pool(MemoryPool pool, bool debug)
+		{
+			uint32_t index = static_cast<uint32_t>(pool);
+			const PoolDescription& description = poolDescriptions[index];
+
+			//a representative buffer picks the memory type, every buffer in the pool shares it
+			vk::BufferCreateInfo sampleInfo = {};
+			sampleInfo.size = 1024;
+			sampleInfo.usage = description.usage;
+			set_sharing(sampleInfo, pool == MemoryPool::ChunkMesh);
+			const VkBufferCreateInfo& c_sampleInfo = sampleInfo;
+
+			VmaAllocationCreateInfo allocationInfo = {};
+			allocationInfo.usage = description.memoryUsage;
+			allocationInfo.flags = description.flags;
+
+			if (vmaFindMemoryTypeIndexForBufferInfo(allocator, &c_sampleInfo, &allocationInfo, &poolMemoryTypes[index]) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "No memory type for the " << description.name << " pool" << std::endl;
+				}
+				return;
+			}
+
+			VmaPoolCreateInfo poolInfo = {};
+			poolInfo.memoryTypeIndex = poolMemoryTypes[index];
+			poolInfo.blockSize = description.blockSize;
+
+			if (vmaCreatePool(allocator, &poolInfo, &pools[index]) != VK_SUCCESS)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create the " << description.name << " pool" << std::endl;
+				}
+				return;
+			}
+			vmaSetPoolName(allocator, pools[index], description.name);
+
+			if (debug)
+			{
+				std::cout << "Memory pool \"" << description.name << "\" uses memory type " << poolMemoryTypes[index] << '\n';
+			}
+		}
+
+		//binds a fresh buffer to each move's destination, copies the contents over and swaps it in
+		void move_buffers(VmaDefragmentationPassMoveInfo& pass, const std::function<bool(const Buffer*)>& busy, bool debug)
+		{
+			std::vector<std::pair<Buffer*, vk::Buffer>> moved;
+
+			vk::CommandBufferAllocateInfo allocInfo = {};
+			allocInfo.commandPool = commandPool;
+			allocInfo.level = vk::CommandBufferLevel::ePrimary;
+			allocInfo.commandBufferCount = 1;
+
+			vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(allocInfo)[0];
+
+			vk::CommandBufferBeginInfo beginInfo = {};
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+			commandBuffer.begin(beginInfo);
+
+			for (uint32_t i = 0; i < pass.moveCount; i++)
+			{
+				VmaDefragmentationMove& move = pass.pMoves[i];
+
+				VmaAllocationInfo allocationInfo = {};
+				vmaGetAllocationInfo(allocator, move.srcAllocation, &allocationInfo);
+				Buffer* buffer = static_cast<Buffer*>(allocationInfo.pUserData);
+				if (busy(buffer))
+				{
+					move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+					continue;
+				}
+
+				vk::BufferCreateInfo bufferInfo = {};
+				bufferInfo.size = buffer->size;
+				bufferInfo.usage = buffer->usage;
+				set_sharing(bufferInfo, true);
+
+				vk::Buffer destination = nullptr;
+				try
+				{
+					destination = device.createBuffer(bufferInfo);
+				}
+				catch (vk::SystemError err)
+				{
+					if (debug)
+					{
+						std::cout << "Failed to create buffer for defragmentation, skipping move" << std::endl;
+					}
+					move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+					continue;
+				}
+				vmaBindBufferMemory(allocator, move.dstTmpAllocation, destination);
+
+				vk::BufferCopy region = {};
+				region.size = buffer->size;
+				commandBuffer.copyBuffer(buffer->buffer, destination, 1, &region);
+
+				moved.push_back({ buffer, destination });
+			}
+
+			//make the copies visible to every way the pool's buffers are used by the frames that come after:
+			//culling and ray marching in compute, indirect draws, vertex and index fetch
+			vk::MemoryBarrier barrier = {};
+			barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+			barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite
+				| vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead;
+			commandBuffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput,
+				vk::DependencyFlags(), 1, &barrier, 0, nullptr, 0, nullptr
+			);
+
+			commandBuffer.end();
+
+			//frames already submitted may still read the old buffers, wait for them along with the copies
+			vk::SubmitInfo submitInfo = {};
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &commandBuffer;
+			queue.submit(submitInfo, nullptr);
+			queue.waitIdle();
+
+			for (std::pair<Buffer*, vk::Buffer>& move : moved)
+			{
+				device.destroyBuffer(move.first->buffer);
+				move.first->buffer = move.second;
+			}
+
+			device.resetCommandPool(commandPool);
+		}
+	};
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace vkUtil
+{
+	//64 bit FNV-1a, stable across runs and platforms so it can name files on disk
+	constexpr uint64_t fnvOffsetBasis = 14695981039346656037ull;
+	constexpr uint64_t fnvPrime = 1099511628211ull;
+
+	inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = fnvOffsetBasis)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		uint64_t hash = seed;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= fnvPrime;
+		}
+		return hash;
+	}
+
+	inline uint64_t hash_string(const std::string& text, uint64_t seed = fnvOffsetBasis)
+	{
+		//hash the length too, so ("ab", "c") and ("a", "bc") differ
+		uint64_t length = text.size();
+		seed = hash_bytes(&length, sizeof(length), seed);
+		return hash_bytes(text.data(), text.size(), seed);
+	}
+
+	template<typename T>
+	inline uint64_t hash_value(const T& value, uint64_t seed = fnvOffsetBasis)
+	{
+		return hash_bytes(&value, sizeof(T), seed);
+	}
+
+	inline std::string hash_to_string(uint64_t hash)
+	{
+		const char* digits = "0123456789abcdef";
+		std::string result(16, '0');
+		for (int i = 15; i >= 0; i--)
+		{
+			result[i] = digits[hash & 0xf];
+			hash >>= 4;
+		}
+		return result;
+	}
+}
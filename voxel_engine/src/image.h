@@ -0,0 +1,157 @@
+#pragma once
+#include "config.h"
+#include "memory.h"
+
+namespace vkUtil
+{
+	struct ImageInputChunk
+	{
+		vk::Device logicalDevice;
+		vk::PhysicalDevice physicalDevice;
+		uint32_t width, height;
+		vk::Format format;
+		vk::ImageTiling tiling;
+		vk::ImageUsageFlags usage;
+		vk::MemoryPropertyFlags memoryProperties;
+	};
+
+	vk::Image make_image(ImageInputChunk input, bool debug)
+	{
+		vk::ImageCreateInfo imageInfo = {};
+		imageInfo.flags = vk::ImageCreateFlags();
+		imageInfo.imageType = vk::ImageType::e2D;
+		imageInfo.extent = vk::Extent3D(input.width, input.height, 1);
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = input.format;
+		imageInfo.tiling = input.tiling;
+		imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+		imageInfo.usage = input.usage;
+		imageInfo.sharingMode = vk::SharingMode::eExclusive;
+		imageInfo.samples = vk::SampleCountFlagBits::e1;
+
+		try
+		{
+			return input.logicalDevice.createImage(imageInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create image" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	vk::DeviceMemory make_image_memory(ImageInputChunk input, vk::Image image, bool debug)
+	{
+		vk::MemoryRequirements requirements = input.logicalDevice.getImageMemoryRequirements(image);
+
+		vk::MemoryAllocateInfo allocation = {};
+		allocation.allocationSize = requirements.size;
+		allocation.memoryTypeIndex = findMemoryTypeIndex(
+			input.physicalDevice, requirements.memoryTypeBits, input.memoryProperties
+		);
+
+		try
+		{
+			vk::DeviceMemory imageMemory = input.logicalDevice.allocateMemory(allocation);
+			input.logicalDevice.bindImageMemory(image, imageMemory, 0);
+			return imageMemory;
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to allocate memory for image" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	//the first mip level by default, mip chains get a view per level or one over all of them
+	vk::ImageView make_image_view(
+		vk::Device logicalDevice, vk::Image image, vk::Format format, vk::ImageAspectFlags aspect,
+		uint32_t baseMipLevel = 0, uint32_t levelCount = 1)
+	{
+		vk::ImageViewCreateInfo createInfo = {};
+		createInfo.image = image;
+		createInfo.viewType = vk::ImageViewType::e2D;
+		createInfo.format = format;
+		createInfo.components.r = vk::ComponentSwizzle::eIdentity;
+		createInfo.components.g = vk::ComponentSwizzle::eIdentity;
+		createInfo.components.b = vk::ComponentSwizzle::eIdentity;
+		createInfo.components.a = vk::ComponentSwizzle::eIdentity;
+		createInfo.subresourceRange.aspectMask = aspect;
+		createInfo.subresourceRange.baseMipLevel = baseMipLevel;
+		createInfo.subresourceRange.levelCount = levelCount;
+		createInfo.subresourceRange.baseArrayLayer = 0;
+		createInfo.subresourceRange.layerCount = 1;
+
+		return logicalDevice.createImageView(createInfo);
+	}
+
+	//clamped to the edge, every mip level reachable
+	vk::Sampler make_sampler(vk::Device logicalDevice, vk::Filter filter, bool debug)
+	{
+		vk::SamplerCreateInfo samplerInfo = {};
+		samplerInfo.magFilter = filter;
+		samplerInfo.minFilter = filter;
+		samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+		samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+		samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+		samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+		samplerInfo.minLod = 0.0f;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+		try
+		{
+			return logicalDevice.createSampler(samplerInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create sampler" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	vk::Format find_supported_format(
+		vk::PhysicalDevice physicalDevice,
+		const std::vector<vk::Format>& candidates,
+		vk::ImageTiling tiling, vk::FormatFeatureFlags features)
+	{
+		for (vk::Format format : candidates)
+		{
+			vk::FormatProperties properties = physicalDevice.getFormatProperties(format);
+
+			if (tiling == vk::ImageTiling::eLinear
+				&& (properties.linearTilingFeatures & features) == features)
+			{
+				return format;
+			}
+
+			if (tiling == vk::ImageTiling::eOptimal
+				&& (properties.optimalTilingFeatures & features) == features)
+			{
+				return format;
+			}
+		}
+
+		throw std::runtime_error("failed to find a supported format");
+	}
+
+	//32 bit float first, reverse-Z needs the float precision to stay ahead of 24 bit unorm
+	vk::Format choose_depth_format(vk::PhysicalDevice physicalDevice)
+	{
+		return find_supported_format(
+			physicalDevice,
+			{ vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint },
+			vk::ImageTiling::eOptimal,
+			vk::FormatFeatureFlagBits::eDepthStencilAttachment
+		);
+	}
+}
@@ -81,7 +81,30 @@ namespace vkInit
 		return true;
 	}
 
-	vk::Instance make_instance(bool debug, const char* applicationName)
+	bool instance_extension_supported(const char* extension)
+	{
+		for (vk::ExtensionProperties supportedExtension : vk::enumerateInstanceExtensionProperties())
+		{
+			if (strcmp(supportedExtension.extensionName, extension) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//the newest version the engine is written against that the loader supports
+	uint32_t get_instance_api_version()
+	{
+		uint32_t version = VK_API_VERSION_1_0;
+		if (vkEnumerateInstanceVersion(&version) != VK_SUCCESS)
+		{
+			return VK_API_VERSION_1_0;
+		}
+		return std::min<uint32_t>(version, VK_API_VERSION_1_3);
+	}
+
+	vk::Instance make_instance(bool debug, const char* applicationName, bool headless)
 	{
 		if (debug)
 		{
@@ -101,8 +124,8 @@ namespace vkInit
 				<< VK_API_VERSION_VARIANT(version) << '\n';
 		}
 		
-		//using version 1.0.0
-		version = VK_MAKE_VERSION(1, 0, 0);
+		//the newest version the engine knows how to use, features past 1.0 are probed per device
+		version = get_instance_api_version();
 
 		vk::ApplicationInfo appInfo = vk::ApplicationInfo(
 			applicationName,
@@ -113,9 +136,13 @@ namespace vkInit
 		);
 
 		uint32_t glfwExtCount{ 0 };
-		const char** glfwExtentions;
+		const char** glfwExtentions{ nullptr };
 
-		glfwExtentions = glfwGetRequiredInstanceExtensions(&glfwExtCount);
+		//headless mode never initializes glfw and doesn't need surface extensions
+		if (!headless)
+		{
+			glfwExtentions = glfwGetRequiredInstanceExtensions(&glfwExtCount);
+		}
 
 		if (debug)
 		{
@@ -129,6 +156,12 @@ namespace vkInit
 			extensions.push_back("VK_EXT_debug_utils");
 		}
 
+		//optional, lets the device report live heap budgets through VK_EXT_memory_budget
+		if (instance_extension_supported(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+		{
+			extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		}
+
 		if (debug)
 		{
 			std::cout << "Extensions to be requested:\n";
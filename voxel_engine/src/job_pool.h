@@ -0,0 +1,138 @@
+#pragma once
+#include "config.h"
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+namespace vkUtil
+{
+	/*
+	* Persistent worker threads for CPU work that splits into independent jobs (culling, rasterizing
+	* screen bands, recording draw batches). Jobs are handed out through an atomic counter, so uneven
+	* jobs balance themselves, and the calling thread works through jobs too instead of waiting.
+	*/
+	class JobPool
+	{
+	public:
+
+		//job is the index of the job, thread the index of the thread running it (0 is the caller)
+		using JobCallback = std::function<void(uint32_t job, uint32_t thread)>;
+
+		JobPool(uint32_t threadCount, bool debug)
+		{
+			threadCount = std::max(threadCount, 1u);
+			for (uint32_t thread = 1; thread < threadCount; thread++)
+			{
+				workers.emplace_back(&JobPool::work, this, thread);
+			}
+
+			if (debug)
+			{
+				std::cout << "Job pool: " << threadCount << " threads\n";
+			}
+		}
+
+		JobPool(const JobPool&) = delete;
+		JobPool& operator=(const JobPool&) = delete;
+
+		//runs jobs [0, jobCount) and blocks until all of them are done
+		void run(uint32_t jobCount, JobCallback callback)
+		{
+			job.count = jobCount;
+			job.callback = callback;
+			job.next = 0;
+
+			if (jobCount > 1 && !workers.empty())
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					activeWorkers = static_cast<uint32_t>(workers.size());
+					generation++;
+				}
+				wake.notify_all();
+
+				run_jobs(0);
+
+				std::unique_lock<std::mutex> lock(mutex);
+				done.wait(lock, [this]() { return activeWorkers == 0; });
+			}
+			else
+			{
+				run_jobs(0);
+			}
+
+			job.callback = nullptr;
+		}
+
+		uint32_t get_thread_count() const
+		{
+			return static_cast<uint32_t>(workers.size()) + 1;
+		}
+
+		void destroy()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+			workers.clear();
+		}
+
+	private:
+
+		struct Job
+		{
+			uint32_t count{ 0 };
+			JobCallback callback;
+			std::atomic<uint32_t> next{ 0 };
+		};
+
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		uint64_t generation{ 0 };
+		uint32_t activeWorkers{ 0 };
+		bool stopping{ false };
+		Job job;
+
+		void work(uint32_t thread)
+		{
+			uint64_t seenGeneration = 0;
+			while (true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+					if (stopping)
+					{
+						return;
+					}
+					seenGeneration = generation;
+				}
+
+				run_jobs(thread);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--activeWorkers == 0)
+				{
+					done.notify_one();
+				}
+			}
+		}
+
+		void run_jobs(uint32_t thread)
+		{
+			for (uint32_t index = job.next++; index < job.count; index = job.next++)
+			{
+				job.callback(index, thread);
+			}
+		}
+	};
+}
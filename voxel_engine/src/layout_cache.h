@@ -0,0 +1,186 @@
+#pragma once
+#include "config.h"
+#include "hash.h"
+#include "reflection.h"
+#include <unordered_map>
+
+namespace vkUtil
+{
+	/*
+	* Owns every descriptor set layout and pipeline layout built from reflection.
+	* Identical layouts are only created once, so pipelines with the same interface
+	* share handles and descriptor sets stay bound across pipeline switches.
+	* Safe to use from the render thread and the shader reload thread at once.
+	*/
+	class LayoutCache
+	{
+	public:
+
+		LayoutCache(vk::Device device) : device(device) {}
+
+		vk::DescriptorSetLayout get_descriptor_set_layout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings, bool debug)
+		{
+			uint64_t hash = hash_value(bindings.size());
+			for (const vk::DescriptorSetLayoutBinding& binding : bindings)
+			{
+				hash = hash_binding(binding, hash);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (const SetLayoutEntry& entry : setLayouts[hash])
+			{
+				if (entry.bindings == bindings)
+				{
+					hits++;
+					return entry.layout;
+				}
+			}
+
+			vk::DescriptorSetLayoutCreateInfo layoutInfo = {};
+			layoutInfo.flags = vk::DescriptorSetLayoutCreateFlags();
+			layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+			layoutInfo.pBindings = bindings.data();
+
+			try
+			{
+				vk::DescriptorSetLayout layout = device.createDescriptorSetLayout(layoutInfo);
+				setLayouts[hash].push_back({ bindings, layout });
+				misses++;
+				return layout;
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create descriptor set layout" << std::endl;
+				}
+			}
+			return nullptr;
+		}
+
+		vk::PipelineLayout get_pipeline_layout(const PipelineReflection& reflection, bool debug)
+		{
+			//sets the shaders skip still need a layout, an empty one
+			std::vector<vk::DescriptorSetLayout> setLayouts;
+			for (const std::vector<vk::DescriptorSetLayoutBinding>& bindings : reflection.descriptorSets)
+			{
+				setLayouts.push_back(get_descriptor_set_layout(bindings, debug));
+			}
+
+			uint64_t hash = hash_value(setLayouts.size());
+			for (vk::DescriptorSetLayout setLayout : setLayouts)
+			{
+				hash = hash_value(static_cast<VkDescriptorSetLayout>(setLayout), hash);
+			}
+			for (const vk::PushConstantRange& range : reflection.pushConstantRanges)
+			{
+				hash = hash_value(static_cast<uint32_t>(range.stageFlags), hash);
+				hash = hash_value(range.offset, hash);
+				hash = hash_value(range.size, hash);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (const PipelineLayoutEntry& entry : pipelineLayouts[hash])
+			{
+				if (entry.setLayouts == setLayouts && entry.pushConstantRanges == reflection.pushConstantRanges)
+				{
+					hits++;
+					return entry.layout;
+				}
+			}
+
+			vk::PipelineLayoutCreateInfo layoutInfo = {};
+			layoutInfo.flags = vk::PipelineLayoutCreateFlags();
+			layoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+			layoutInfo.pSetLayouts = setLayouts.data();
+			layoutInfo.pushConstantRangeCount = static_cast<uint32_t>(reflection.pushConstantRanges.size());
+			layoutInfo.pPushConstantRanges = reflection.pushConstantRanges.data();
+
+			try
+			{
+				vk::PipelineLayout layout = device.createPipelineLayout(layoutInfo);
+				pipelineLayouts[hash].push_back({ setLayouts, reflection.pushConstantRanges, layout });
+				misses++;
+				if (debug)
+				{
+					std::cout << "Created pipeline layout with " << setLayouts.size() << " descriptor sets and "
+						<< reflection.pushConstantRanges.size() << " push constant ranges\n";
+				}
+				return layout;
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create pipeline layout" << std::endl;
+				}
+			}
+			return nullptr;
+		}
+
+		//distinct layouts created versus requests served from the cache
+		void log_statistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::cout << "Layout cache: " << misses << " layouts created, " << hits << " requests deduplicated\n";
+		}
+
+		void destroy()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (std::pair<const uint64_t, std::vector<PipelineLayoutEntry>>& bucket : pipelineLayouts)
+			{
+				for (PipelineLayoutEntry& entry : bucket.second)
+				{
+					device.destroyPipelineLayout(entry.layout);
+				}
+			}
+			for (std::pair<const uint64_t, std::vector<SetLayoutEntry>>& bucket : setLayouts)
+			{
+				for (SetLayoutEntry& entry : bucket.second)
+				{
+					device.destroyDescriptorSetLayout(entry.layout);
+				}
+			}
+
+			pipelineLayouts.clear();
+			setLayouts.clear();
+		}
+
+	private:
+
+		struct SetLayoutEntry
+		{
+			std::vector<vk::DescriptorSetLayoutBinding> bindings;
+			vk::DescriptorSetLayout layout;
+		};
+
+		struct PipelineLayoutEntry
+		{
+			std::vector<vk::DescriptorSetLayout> setLayouts;
+			std::vector<vk::PushConstantRange> pushConstantRanges;
+			vk::PipelineLayout layout;
+		};
+
+		static uint64_t hash_binding(const vk::DescriptorSetLayoutBinding& binding, uint64_t hash)
+		{
+			hash = hash_value(binding.binding, hash);
+			hash = hash_value(static_cast<uint32_t>(binding.descriptorType), hash);
+			hash = hash_value(binding.descriptorCount, hash);
+			return hash_value(static_cast<uint32_t>(binding.stageFlags), hash);
+		}
+
+		vk::Device device;
+		std::mutex mutex;
+
+		//buckets keyed by hash, entries compared in full on lookup
+		std::unordered_map<uint64_t, std::vector<SetLayoutEntry>> setLayouts;
+		std::unordered_map<uint64_t, std::vector<PipelineLayoutEntry>> pipelineLayouts;
+
+		uint32_t hits{ 0 };
+		uint32_t misses{ 0 };
+	};
+}
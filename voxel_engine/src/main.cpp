@@ -1,10 +1,81 @@
 #include "engine.h"
 
-int main() {
+int main(int argc, char** argv) {
 
-	Engine* graphicsEngine = new Engine();
+	//--headless renders offscreen without a window, --frames N stops after N frames
+	EngineSettings settings = {};
+	uint32_t maxFrames = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			settings.headless = true;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			maxFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--no-hot-reload") == 0) {
+			settings.hotReloadShaders = false;
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+			settings.framesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+			//lowest (default), vsync, relaxed or uncapped
+			std::string policy = argv[++i];
+			if (policy == "vsync") {
+				settings.latencyPolicy = vkUtil::LatencyPolicy::Vsync;
+			}
+			else if (policy == "relaxed") {
+				settings.latencyPolicy = vkUtil::LatencyPolicy::VsyncRelaxed;
+			}
+			else if (policy == "uncapped") {
+				settings.latencyPolicy = vkUtil::LatencyPolicy::Uncapped;
+			}
+			else {
+				settings.latencyPolicy = vkUtil::LatencyPolicy::LowestLatency;
+			}
+		}
+		else if (strcmp(argv[i], "--target-fps") == 0 && i + 1 < argc) {
+			settings.targetFps = std::stod(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+			//name substring or UUID, overrides the device remembered from the last run
+			settings.preferredDevice = argv[++i];
+		}
+		else if (strcmp(argv[i], "--disable-feature") == 0 && i + 1 < argc) {
+			//e.g. timeline-semaphore, runs the fallback path on hardware that has the feature
+			settings.disabledFeatures.push_back(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--no-depth-prepass") == 0) {
+			//baseline for the shaded fragment counts the prepass saves
+			settings.depthPrepass = false;
+		}
+		else if (strcmp(argv[i], "--recording-threads") == 0 && i + 1 < argc) {
+			settings.recordingThreads = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--test-chunks") == 0 && i + 1 < argc) {
+			//an N x N grid of chunks: --test-chunks 128 draws 16384 of them
+			settings.testChunks = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--no-cpu-occlusion") == 0) {
+			//with --disable-feature draw-indirect-count, measures what the software occlusion buffer saves
+			settings.cpuOcclusionCulling = false;
+		}
+		else if (strcmp(argv[i], "--brickmap-budget") == 0 && i + 1 < argc) {
+			//MiB of device memory for the brickmap, 0 leaves it out
+			settings.brickmapBudgetMiB = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+	}
+
+	//a headless run has no window to close, give it a default length
+	if (settings.headless && maxFrames == 0) {
+		maxFrames = 1000;
+	}
+
+	Engine* graphicsEngine = new Engine(settings);
+
+	graphicsEngine->run(maxFrames);
 
 	delete graphicsEngine;
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "config.h"
+
+namespace vkUtil
+{
+	uint32_t findMemoryTypeIndex(vk::PhysicalDevice physicalDevice, uint32_t supportedMemoryIndices, vk::MemoryPropertyFlags requestedProperties)
+	{
+		vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		{
+			//bit i of supportedMemoryIndices is set if memory type i is allowed
+			bool supported{ static_cast<bool>(supportedMemoryIndices & (1 << i)) };
+
+			bool sufficient{ (memoryProperties.memoryTypes[i].propertyFlags & requestedProperties) == requestedProperties };
+
+			if (supported && sufficient)
+			{
+				return i;
+			}
+		}
+
+		return UINT32_MAX;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "config.h"
+#include "image.h"
+#include "swapchain.h"
+
+namespace vkInit
+{
+	/*
+	* Headless replacement for create_swapchain: the engine allocates and owns
+	* its color images, there is no surface and nothing to present.
+	* Depth lives in the render graph like it does for the swapchain.
+	*/
+	SwapChainBundle create_offscreen_targets(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, int width, int height, uint32_t imageCount, bool debug)
+	{
+		SwapChainBundle bundle{};
+		bundle.swapchain = nullptr;
+		bundle.format = vk::Format::eB8G8R8A8Unorm;
+		bundle.extent = vk::Extent2D(static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+
+		if (debug)
+		{
+			std::cout << "Creating " << imageCount << " offscreen targets ("
+				<< width << 'x' << height << ", "
+				<< vk::to_string(bundle.format) << ")\n";
+		}
+
+		vkUtil::ImageInputChunk colorInput = {};
+		colorInput.logicalDevice = logicalDevice;
+		colorInput.physicalDevice = physicalDevice;
+		colorInput.width = bundle.extent.width;
+		colorInput.height = bundle.extent.height;
+		colorInput.format = bundle.format;
+		colorInput.tiling = vk::ImageTiling::eOptimal;
+		colorInput.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+		colorInput.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+
+		bundle.frames.resize(imageCount);
+
+		for (vkUtil::SwapChainFrame& frame : bundle.frames)
+		{
+			frame.image = vkUtil::make_image(colorInput, debug);
+			frame.imageMemory = vkUtil::make_image_memory(colorInput, frame.image, debug);
+			frame.imageView = vkUtil::make_image_view(logicalDevice, frame.image, bundle.format, vk::ImageAspectFlagBits::eColor);
+		}
+
+		return bundle;
+	}
+}
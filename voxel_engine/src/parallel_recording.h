@@ -0,0 +1,215 @@
+#pragma once
+#include "config.h"
+#include "commands.h"
+#include "job_pool.h"
+#include <atomic>
+#include <functional>
+
+namespace vkUtil
+{
+	/*
+	* Records a pass's draws on the threads of a JobPool. Every thread owns a command pool per frame in
+	* flight, so recording never locks and a frame's pools are reset in one call once its fence has signaled.
+	* The draws are split into contiguous batches, one secondary command buffer each, and handed back
+	* in batch order for the render thread to execute inside the pass: the result does not depend on
+	* which thread recorded what.
+	*/
+	class ParallelRecorder
+	{
+	public:
+
+		//records draws [begin, end) into a secondary command buffer that is already begun
+		using RecordCallback = std::function<void(vk::CommandBuffer, uint32_t begin, uint32_t end)>;
+
+		ParallelRecorder(vk::Device device, uint32_t queueFamilyIndex, uint32_t frameCount, JobPool* jobPool, bool debug) :
+			device(device),
+			jobPool(jobPool),
+			debug(debug)
+		{
+			uint32_t threadCount = jobPool->get_thread_count();
+
+			frames.resize(frameCount);
+			for (std::vector<ThreadPool>& pools : frames)
+			{
+				pools.resize(threadCount);
+				for (ThreadPool& pool : pools)
+				{
+					pool.commandPool = vkInit::make_command_pool(
+						device, queueFamilyIndex, vk::CommandPoolCreateFlagBits::eTransient, debug
+					);
+				}
+			}
+
+			if (debug)
+			{
+				std::cout << "Recording draws on " << threadCount << " threads, "
+					<< frameCount * threadCount << " command pools\n";
+			}
+		}
+
+		ParallelRecorder(const ParallelRecorder&) = delete;
+		ParallelRecorder& operator=(const ParallelRecorder&) = delete;
+
+		//the frame's fence has signaled, its secondary command buffers can be recorded again
+		void begin_frame(uint32_t frame)
+		{
+			for (ThreadPool& pool : frames[frame])
+			{
+				if (pool.used > 0)
+				{
+					device.resetCommandPool(pool.commandPool);
+					pool.used = 0;
+				}
+			}
+		}
+
+		/*
+		* Splits drawCount draws into batches of at least minBatchSize and records them, blocks until
+		* every batch is done. A few batches per thread even out draws that cost more than others.
+		*/
+		std::vector<vk::CommandBuffer> record(
+			uint32_t frame, uint32_t drawCount, uint32_t minBatchSize,
+			const vk::CommandBufferInheritanceInfo& inheritance, RecordCallback callback)
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			uint32_t batchCount = (drawCount + std::max(minBatchSize, 1u) - 1) / std::max(minBatchSize, 1u);
+			batchCount = std::clamp(batchCount, std::min(drawCount, 1u), get_thread_count() * batchesPerThread);
+
+			std::vector<vk::CommandBuffer> results(batchCount, nullptr);
+			std::atomic<uint64_t> busyNanoseconds{ 0 };
+
+			jobPool->run(batchCount, [&](uint32_t batch, uint32_t thread) {
+				auto batchStart = std::chrono::steady_clock::now();
+				results[batch] = record_batch(frames[frame][thread], batch, batchCount, drawCount, inheritance, callback);
+				busyNanoseconds += static_cast<uint64_t>(
+					std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - batchStart).count()
+				);
+			});
+
+			//a batch whose command buffer failed to record is dropped, the rest still draw
+			std::vector<vk::CommandBuffer> recorded;
+			for (vk::CommandBuffer commandBuffer : results)
+			{
+				if (commandBuffer)
+				{
+					recorded.push_back(commandBuffer);
+				}
+			}
+
+			lastRecordMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			lastBusyMs = busyNanoseconds / 1e6;
+			lastBatchCount = batchCount;
+			return recorded;
+		}
+
+		uint32_t get_thread_count() const
+		{
+			return jobPool->get_thread_count();
+		}
+
+		//wall time of the last record call
+		double get_last_record_ms() const
+		{
+			return lastRecordMs;
+		}
+
+		//recording time summed over threads divided by wall time times threads, 1 is perfect scaling
+		double get_last_efficiency() const
+		{
+			return lastRecordMs > 0.0 ? lastBusyMs / (lastRecordMs * get_thread_count()) : 0.0;
+		}
+
+		void log_statistics() const
+		{
+			std::cout << "Parallel recording: " << lastBatchCount << " batches on " << get_thread_count()
+				<< " threads in " << lastRecordMs << "ms (" << get_last_efficiency() * 100.0 << "% efficiency)\n";
+		}
+
+		//destroys the pools, which frees their command buffers; the job pool is owned by the caller
+		void destroy()
+		{
+			for (std::vector<ThreadPool>& pools : frames)
+			{
+				for (ThreadPool& pool : pools)
+				{
+					device.destroyCommandPool(pool.commandPool);
+				}
+			}
+			frames.clear();
+		}
+
+	private:
+
+		//command buffers are allocated as needed and reused once the pool is reset
+		struct ThreadPool
+		{
+			vk::CommandPool commandPool;
+			std::vector<vk::CommandBuffer> commandBuffers;
+			size_t used{ 0 };
+		};
+
+		static constexpr uint32_t batchesPerThread = 4;
+
+		vk::Device device;
+		JobPool* jobPool;
+		bool debug;
+
+		//[frame in flight][thread]
+		std::vector<std::vector<ThreadPool>> frames;
+
+		double lastRecordMs{ 0.0 };
+		double lastBusyMs{ 0.0 };
+		uint32_t lastBatchCount{ 0 };
+
+		vk::CommandBuffer next_command_buffer(ThreadPool& pool)
+		{
+			if (pool.used == pool.commandBuffers.size())
+			{
+				std::vector<vk::CommandBuffer> allocated = vkInit::make_command_buffers(
+					device, pool.commandPool, vk::CommandBufferLevel::eSecondary, 1, debug
+				);
+				if (allocated.empty())
+				{
+					return nullptr;
+				}
+				pool.commandBuffers.push_back(allocated[0]);
+			}
+			return pool.commandBuffers[pool.used++];
+		}
+
+		vk::CommandBuffer record_batch(
+			ThreadPool& pool, uint32_t batch, uint32_t batchCount, uint32_t drawCount,
+			const vk::CommandBufferInheritanceInfo& inheritance, const RecordCallback& callback)
+		{
+			uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(drawCount) * batch / batchCount);
+			uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(drawCount) * (batch + 1) / batchCount);
+
+			vk::CommandBuffer commandBuffer = next_command_buffer(pool);
+			if (!commandBuffer)
+			{
+				return nullptr;
+			}
+
+			vk::CommandBufferBeginInfo beginInfo = {};
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+			beginInfo.pInheritanceInfo = &inheritance;
+
+			try
+			{
+				commandBuffer.begin(beginInfo);
+				callback(commandBuffer, begin, end);
+				commandBuffer.end();
+				return commandBuffer;
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to record secondary command buffer" << std::endl;
+				}
+				return nullptr;
+			}
+		}
+	};
+}
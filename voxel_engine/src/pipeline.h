@@ -1,16 +1,63 @@
 #pragma once
 #include "config.h"
 #include "shaders.h"
+#include "layout_cache.h"
 
 namespace vkInit
 {
+	enum class BlendMode : uint32_t
+	{
+		Opaque,
+		AlphaBlend,
+		Additive
+	};
+
+	//applied to every stage, stages that don't declare the id ignore it
+	struct SpecializationConstant
+	{
+		uint32_t id;
+		uint32_t value;
+
+		bool operator==(const SpecializationConstant& other) const
+		{
+			return id == other.id && value == other.value;
+		}
+	};
+
 	struct GraphicsPipelineInBundle
 	{
 		vk::Device device;
 		std::string vertexFilepath;
 		std::string fragmentFilepath;
-		vk::Extent2D swapchainExtent;
+
+		//SPIR-V compiled in process, when empty the modules are loaded from the filepaths instead
+		std::vector<uint32_t> vertexCode;
+		std::vector<uint32_t> fragmentCode;
 		vk::Format swapchainFormat;
+		vk::ImageLayout finalLayout = vk::ImageLayout::ePresentSrcKHR;
+
+		//eUndefined leaves the attachment out: no depth buffer, or no color output (depth only passes)
+		vk::Format depthFormat = vk::Format::eUndefined;
+
+		//reverse-Z: depth is cleared to 0 and nearer fragments have larger depth values
+		bool depthTest = false;
+		bool depthWrite = false;
+		vk::CompareOp depthCompare = vk::CompareOp::eGreaterOrEqual;
+		vk::PipelineCache pipelineCache = nullptr;
+
+		//fixed function state, e.g. opaque, cutout, water and debug variants of the same shaders
+		vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+		vk::PolygonMode polygonMode = vk::PolygonMode::eFill;
+		vk::CullModeFlags cullMode = vk::CullModeFlagBits::eBack;
+		BlendMode blendMode = BlendMode::Opaque;
+		std::vector<SpecializationConstant> specializationConstants;
+
+		//reused instead of created when set, e.g. when rebuilding a pipeline after a shader change
+		vk::PipelineLayout layout = nullptr;
+		vk::RenderPass renderpass = nullptr;
+
+		//when set and no layout is given, the layout is derived from the shaders and owned by the cache
+		vkUtil::LayoutCache* layoutCache = nullptr;
 	};
 
 	struct GraphicsPipelineOutBundle
@@ -40,8 +87,14 @@ namespace vkInit
 		return nullptr;
 	}
 
-	vk::RenderPass make_renderpass(vk::Device device, vk::Format swapchainImageFormat, bool debug)
+	/*
+	* Color attachment when swapchainImageFormat is set, depth attachment when depthFormat is set.
+	* Pipelines built against it stay compatible with render graph passes using the same formats.
+	*/
+	vk::RenderPass make_renderpass(vk::Device device, vk::Format swapchainImageFormat, vk::ImageLayout finalLayout, vk::Format depthFormat, bool debug)
 	{
+		std::vector<vk::AttachmentDescription> attachments;
+
 		vk::AttachmentDescription colorAttachment = {};
 		colorAttachment.flags = vk::AttachmentDescriptionFlags();
 		colorAttachment.format = swapchainImageFormat;
@@ -51,24 +104,61 @@ namespace vkInit
 		colorAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 		colorAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 		colorAttachment.initialLayout = vk::ImageLayout::eUndefined;
-		colorAttachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+		colorAttachment.finalLayout = finalLayout;
 
 		vk::AttachmentReference colorAttachmentRef = {};
 		colorAttachmentRef.attachment = 0;
 		colorAttachmentRef.layout = vk::ImageLayout::eColorAttachmentOptimal;
 
+		if (swapchainImageFormat != vk::Format::eUndefined)
+		{
+			attachments.push_back(colorAttachment);
+		}
+
+		vk::AttachmentDescription depthAttachment = {};
+		depthAttachment.flags = vk::AttachmentDescriptionFlags();
+		depthAttachment.format = depthFormat;
+		depthAttachment.samples = vk::SampleCountFlagBits::e1;
+		depthAttachment.loadOp = vk::AttachmentLoadOp::eClear;
+		depthAttachment.storeOp = vk::AttachmentStoreOp::eDontCare;
+		depthAttachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+		depthAttachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+		depthAttachment.initialLayout = vk::ImageLayout::eUndefined;
+		depthAttachment.finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+		vk::AttachmentReference depthAttachmentRef = {};
+		depthAttachmentRef.attachment = static_cast<uint32_t>(attachments.size());
+		depthAttachmentRef.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+		if (depthFormat != vk::Format::eUndefined)
+		{
+			attachments.push_back(depthAttachment);
+		}
+
 		vk::SubpassDescription subpass = {};
 		subpass.flags = vk::SubpassDescriptionFlags();
 		subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-		subpass.colorAttachmentCount = 1;
+		subpass.colorAttachmentCount = swapchainImageFormat != vk::Format::eUndefined ? 1 : 0;
 		subpass.pColorAttachments = &colorAttachmentRef;
+		subpass.pDepthStencilAttachment = depthFormat != vk::Format::eUndefined ? &depthAttachmentRef : nullptr;
+
+		//wait for the image to be released (acquire semaphore) before writing to it
+		vk::SubpassDependency dependency = {};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+		dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests;
+		dependency.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+		dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests;
+		dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
 
 		vk::RenderPassCreateInfo renderpassInfo = {};
 		renderpassInfo.flags = vk::RenderPassCreateFlags();
-		renderpassInfo.attachmentCount = 1;
-		renderpassInfo.pAttachments = &colorAttachment;
+		renderpassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderpassInfo.pAttachments = attachments.data();
 		renderpassInfo.subpassCount = 1;
 		renderpassInfo.pSubpasses = &subpass;
+		renderpassInfo.dependencyCount = 1;
+		renderpassInfo.pDependencies = &dependency;
 
 		try
 		{
@@ -91,17 +181,37 @@ namespace vkInit
 
 		std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
 
+		//SPIR-V, compiled in process or loaded from the prebuilt files
+		std::vector<uint32_t> vertexCode = specification.vertexCode.empty()
+			? vkUtil::readSpirv(specification.vertexFilepath, debug)
+			: specification.vertexCode;
+		//depth only pipelines (prepass, shadows) have no fragment shader
+		bool hasFragmentStage = !specification.fragmentCode.empty() || !specification.fragmentFilepath.empty();
+		std::vector<uint32_t> fragmentCode = specification.fragmentCode.empty() && hasFragmentStage
+			? vkUtil::readSpirv(specification.fragmentFilepath, debug)
+			: specification.fragmentCode;
+
+		//Reflection (what the shaders declare: vertex inputs, descriptors, push constants)
+		std::vector<vkUtil::ShaderReflection> stageReflections = { vkUtil::reflect_shader(vertexCode, debug) };
+		if (hasFragmentStage)
+		{
+			stageReflections.push_back(vkUtil::reflect_shader(fragmentCode, debug));
+		}
+		vkUtil::PipelineReflection reflection = vkUtil::merge_reflections(stageReflections);
+
 		//Vertex Input (Data)
 		vk::PipelineVertexInputStateCreateInfo vertexInputInfo = {};
 		vertexInputInfo.flags = vk::PipelineVertexInputStateCreateFlags();
-		vertexInputInfo.vertexAttributeDescriptionCount = 0;
-		vertexInputInfo.vertexBindingDescriptionCount = 0;
+		vertexInputInfo.vertexAttributeDescriptionCount = reflection.vertexAttributes.size();
+		vertexInputInfo.pVertexAttributeDescriptions = reflection.vertexAttributes.data();
+		vertexInputInfo.vertexBindingDescriptionCount = reflection.vertexBindings.size();
+		vertexInputInfo.pVertexBindingDescriptions = reflection.vertexBindings.data();
 		pipelineInfo.pVertexInputState = &vertexInputInfo;
 
 		//Input Assembly (How to organise the given data)
 		vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {};
 		inputAssemblyInfo.flags = vk::PipelineInputAssemblyStateCreateFlags();
-		inputAssemblyInfo.topology = vk::PrimitiveTopology::eTriangleList;
+		inputAssemblyInfo.topology = specification.topology;
 		pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
 
 		//Vertex Shader
@@ -109,58 +219,81 @@ namespace vkInit
 		{
 			std::cout << "Create vertex shader module" << std::endl;
 		}
-		vk::ShaderModule vertexShader = vkUtil::createModule(specification.vertexFilepath, specification.device, debug);
+		vk::ShaderModule vertexShader = vkUtil::createModule(vertexCode, specification.vertexFilepath, specification.device, debug);
 		vk::PipelineShaderStageCreateInfo vertexShaderInfo = {};
 		vertexShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
 		vertexShaderInfo.stage = vk::ShaderStageFlagBits::eVertex;
 		vertexShaderInfo.module = vertexShader;
 		vertexShaderInfo.pName = "main";
+
+		//Specialization constants
+		//values are read in place from the constant list, each one sits right after its id
+		std::vector<vk::SpecializationMapEntry> specializationEntries;
+		for (size_t i = 0; i < specification.specializationConstants.size(); i++)
+		{
+			specializationEntries.push_back(vk::SpecializationMapEntry(
+				specification.specializationConstants[i].id,
+				static_cast<uint32_t>(i * sizeof(SpecializationConstant) + offsetof(SpecializationConstant, value)),
+				sizeof(uint32_t)
+			));
+		}
+		vk::SpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+		specializationInfo.pMapEntries = specializationEntries.data();
+		specializationInfo.dataSize = specification.specializationConstants.size() * sizeof(SpecializationConstant);
+		specializationInfo.pData = specification.specializationConstants.data();
+		if (!specializationEntries.empty())
+		{
+			vertexShaderInfo.pSpecializationInfo = &specializationInfo;
+		}
 		shaderStages.push_back(vertexShaderInfo);
 
 		//Viewport & Scissor
-		vk::Viewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = specification.swapchainExtent.width;
-		viewport.height = specification.swapchainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-		vk::Rect2D scissor = {};
-		scissor.offset.x = 0.0f;
-		scissor.offset.y = 0.0f;
-		scissor.extent = specification.swapchainExtent;
+		//dynamic, set when recording, so a resized swapchain never needs a new pipeline
 		vk::PipelineViewportStateCreateInfo viewportState = {};
 		viewportState.flags = vk::PipelineViewportStateCreateFlags();
 		viewportState.viewportCount = 1;
-		viewportState.pViewports = &viewport;
+		viewportState.pViewports = nullptr;
 		viewportState.scissorCount = 1;
-		viewportState.pScissors = &scissor;
+		viewportState.pScissors = nullptr;
 		pipelineInfo.pViewportState = &viewportState;
 
+		std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+		vk::PipelineDynamicStateCreateInfo dynamicState = {};
+		dynamicState.flags = vk::PipelineDynamicStateCreateFlags();
+		dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+		dynamicState.pDynamicStates = dynamicStates.data();
+		pipelineInfo.pDynamicState = &dynamicState;
+
 		//Rasterizer
 		vk::PipelineRasterizationStateCreateInfo rasterizer = {};
 		rasterizer.flags = vk::PipelineRasterizationStateCreateFlags();
 		rasterizer.depthClampEnable = VK_FALSE;
 		rasterizer.rasterizerDiscardEnable = VK_FALSE;
-		rasterizer.polygonMode = vk::PolygonMode::eFill;
+		rasterizer.polygonMode = specification.polygonMode;
 		rasterizer.lineWidth = 1.0f;
-		rasterizer.cullMode = vk::CullModeFlagBits::eBack;
+		rasterizer.cullMode = specification.cullMode;
 		rasterizer.frontFace = vk::FrontFace::eClockwise;
 		rasterizer.depthBiasEnable = VK_FALSE;
 		pipelineInfo.pRasterizationState = &rasterizer;
 
 		//Fragment Shader
-		if (debug)
+		vk::ShaderModule fragmentShader = nullptr;
+		if (hasFragmentStage)
 		{
-			std::cout << "Create fragment shader module" << std::endl;
+			if (debug)
+			{
+				std::cout << "Create fragment shader module" << std::endl;
+			}
+			fragmentShader = vkUtil::createModule(fragmentCode, specification.fragmentFilepath, specification.device, debug);
+			vk::PipelineShaderStageCreateInfo fragmentShaderInfo = {};
+			fragmentShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
+			fragmentShaderInfo.stage = vk::ShaderStageFlagBits::eFragment;
+			fragmentShaderInfo.module = fragmentShader;
+			fragmentShaderInfo.pName = "main";
+			fragmentShaderInfo.pSpecializationInfo = vertexShaderInfo.pSpecializationInfo;
+			shaderStages.push_back(fragmentShaderInfo);
 		}
-		vk::ShaderModule fragmentShader = vkUtil::createModule(specification.fragmentFilepath, specification.device, debug);
-		vk::PipelineShaderStageCreateInfo fragmentShaderInfo = {};
-		fragmentShaderInfo.flags = vk::PipelineShaderStageCreateFlags();
-		fragmentShaderInfo.stage = vk::ShaderStageFlagBits::eFragment;
-		fragmentShaderInfo.module = fragmentShader;
-		fragmentShaderInfo.pName = "main";
-		shaderStages.push_back(fragmentShaderInfo);
 		pipelineInfo.stageCount = shaderStages.size();
 		pipelineInfo.pStages = shaderStages.data();
 
@@ -175,11 +308,23 @@ namespace vkInit
 		vk::PipelineColorBlendAttachmentState colorBlendAttachment = {};
 		colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
 		colorBlendAttachment.blendEnable = VK_FALSE;
+		if (specification.blendMode != BlendMode::Opaque)
+		{
+			colorBlendAttachment.blendEnable = VK_TRUE;
+			colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+			colorBlendAttachment.dstColorBlendFactor = specification.blendMode == BlendMode::Additive
+				? vk::BlendFactor::eOne
+				: vk::BlendFactor::eOneMinusSrcAlpha;
+			colorBlendAttachment.colorBlendOp = vk::BlendOp::eAdd;
+			colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+			colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+			colorBlendAttachment.alphaBlendOp = vk::BlendOp::eAdd;
+		}
 		vk::PipelineColorBlendStateCreateInfo colorBlending = {};
 		colorBlending.flags = vk::PipelineColorBlendStateCreateFlags();
 		colorBlending.logicOpEnable = VK_FALSE;
 		colorBlending.logicOp = vk::LogicOp::eCopy;
-		colorBlending.attachmentCount = 1;
+		colorBlending.attachmentCount = specification.swapchainFormat != vk::Format::eUndefined ? 1 : 0;
 		colorBlending.pAttachments = &colorBlendAttachment;
 		colorBlending.blendConstants[0] = 0.0f;
 		colorBlending.blendConstants[1] = 0.0f;
@@ -187,20 +332,45 @@ namespace vkInit
 		colorBlending.blendConstants[3] = 0.0f;
 		pipelineInfo.pColorBlendState = &colorBlending;
 
+		//Depth
+		vk::PipelineDepthStencilStateCreateInfo depthStencil = {};
+		depthStencil.flags = vk::PipelineDepthStencilStateCreateFlags();
+		depthStencil.depthTestEnable = specification.depthTest;
+		depthStencil.depthWriteEnable = specification.depthWrite;
+		depthStencil.depthCompareOp = specification.depthCompare;
+		depthStencil.depthBoundsTestEnable = VK_FALSE;
+		depthStencil.stencilTestEnable = VK_FALSE;
+		if (specification.depthFormat != vk::Format::eUndefined)
+		{
+			pipelineInfo.pDepthStencilState = &depthStencil;
+		}
+
 		//Pipeline Layout
-		if (debug)
+		vk::PipelineLayout layout = specification.layout;
+		if (!layout)
 		{
-			std::cout << "Create Pipeline Layout" << std::endl;
+			if (debug)
+			{
+				std::cout << "Create Pipeline Layout" << std::endl;
+			}
+			layout = specification.layoutCache
+				? specification.layoutCache->get_pipeline_layout(reflection, debug)
+				: make_pipeline_layout(specification.device, debug);
 		}
-		vk::PipelineLayout layout = make_pipeline_layout(specification.device, debug);
 		pipelineInfo.layout = layout;
 
 		//Renderpass
-		if (debug)
+		vk::RenderPass renderpass = specification.renderpass;
+		if (!renderpass)
 		{
-			std::cout << "Create renderpass" << std::endl;
+			if (debug)
+			{
+				std::cout << "Create renderpass" << std::endl;
+			}
+			renderpass = make_renderpass(
+				specification.device, specification.swapchainFormat, specification.finalLayout, specification.depthFormat, debug
+			);
 		}
-		vk::RenderPass renderpass = make_renderpass(specification.device, specification.swapchainFormat, debug);
 		pipelineInfo.renderPass = renderpass;
 
 		//Extra stuff
@@ -214,7 +384,7 @@ namespace vkInit
 		vk::Pipeline graphicsPipeline;
 		try
 		{
-			graphicsPipeline = (specification.device.createGraphicsPipeline(nullptr, pipelineInfo)).value;
+			graphicsPipeline = (specification.device.createGraphicsPipeline(specification.pipelineCache, pipelineInfo)).value;
 		}
 		catch (vk::SystemError err)
 		{
@@ -234,4 +404,70 @@ namespace vkInit
 
 		return output;
 	}
-}
\ No newline at end of file
+
+	struct ComputePipelineInBundle
+	{
+		vk::Device device;
+		std::string computeFilepath;
+
+		//SPIR-V compiled in process, when empty the module is loaded from computeFilepath instead
+		std::vector<uint32_t> computeCode;
+		vk::PipelineCache pipelineCache = nullptr;
+
+		//the layout is derived from the shader, descriptor set layouts come back so sets can be allocated
+		vkUtil::LayoutCache* layoutCache = nullptr;
+	};
+
+	struct ComputePipelineOutBundle
+	{
+		vk::PipelineLayout layout;
+		std::vector<vk::DescriptorSetLayout> setLayouts;
+		vk::Pipeline pipeline;
+	};
+
+	ComputePipelineOutBundle make_compute_pipeline(const ComputePipelineInBundle& specification, bool debug)
+	{
+		ComputePipelineOutBundle output = {};
+
+		std::vector<uint32_t> computeCode = specification.computeCode.empty()
+			? vkUtil::readSpirv(specification.computeFilepath, debug)
+			: specification.computeCode;
+
+		vkUtil::PipelineReflection reflection = vkUtil::merge_reflections({ vkUtil::reflect_shader(computeCode, debug) });
+		for (const std::vector<vk::DescriptorSetLayoutBinding>& bindings : reflection.descriptorSets)
+		{
+			output.setLayouts.push_back(specification.layoutCache->get_descriptor_set_layout(bindings, debug));
+		}
+		output.layout = specification.layoutCache->get_pipeline_layout(reflection, debug);
+
+		if (debug)
+		{
+			std::cout << "Create compute shader module" << std::endl;
+		}
+		vk::ShaderModule computeShader = vkUtil::createModule(computeCode, specification.computeFilepath, specification.device, debug);
+
+		vk::ComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.flags = vk::PipelineCreateFlags();
+		pipelineInfo.stage.flags = vk::PipelineShaderStageCreateFlags();
+		pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+		pipelineInfo.stage.module = computeShader;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = output.layout;
+
+		try
+		{
+			output.pipeline = specification.device.createComputePipeline(specification.pipelineCache, pipelineInfo).value;
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create compute pipeline" << std::endl;
+			}
+		}
+
+		specification.device.destroyShaderModule(computeShader);
+
+		return output;
+	}
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include "config.h"
+#include "shaders.h"
+
+namespace vkInit
+{
+	struct PipelineCacheBundle
+	{
+		vk::PipelineCache cache;
+
+		//whether a valid cache blob was found on disk
+		bool warm;
+	};
+
+	/*
+	* A cache blob is only usable by the exact device and driver that wrote it,
+	* check its header before handing it to the driver.
+	*/
+	bool is_pipeline_cache_compatible(const std::vector<char>& data, vk::PhysicalDevice physicalDevice, bool debug)
+	{
+		VkPipelineCacheHeaderVersionOne header = {};
+
+		if (data.size() < sizeof(header))
+		{
+			if (debug)
+			{
+				std::cout << "Pipeline cache is too small to hold a header\n";
+			}
+			return false;
+		}
+
+		memcpy(&header, data.data(), sizeof(header));
+
+		vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+
+		if (header.headerSize < sizeof(header)
+			|| header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		{
+			if (debug)
+			{
+				std::cout << "Pipeline cache header is malformed\n";
+			}
+			return false;
+		}
+
+		if (header.vendorID != properties.vendorID
+			|| header.deviceID != properties.deviceID
+			|| memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0)
+		{
+			if (debug)
+			{
+				std::cout << "Pipeline cache was written by another device or driver\n";
+			}
+			return false;
+		}
+
+		return true;
+	}
+
+	PipelineCacheBundle make_pipeline_cache(vk::Device device, vk::PhysicalDevice physicalDevice, std::string filename, bool debug)
+	{
+		PipelineCacheBundle bundle = {};
+		bundle.warm = false;
+
+		std::vector<char> data;
+		if (std::filesystem::exists(filename))
+		{
+			data = vkUtil::readFile(filename, debug);
+			bundle.warm = is_pipeline_cache_compatible(data, physicalDevice, debug);
+		}
+		else if (debug)
+		{
+			std::cout << "No pipeline cache at \"" << filename << "\", starting cold\n";
+		}
+
+		vk::PipelineCacheCreateInfo cacheInfo = {};
+		cacheInfo.flags = vk::PipelineCacheCreateFlags();
+		if (bundle.warm)
+		{
+			cacheInfo.initialDataSize = data.size();
+			cacheInfo.pInitialData = data.data();
+		}
+
+		try
+		{
+			bundle.cache = device.createPipelineCache(cacheInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create pipeline cache" << std::endl;
+			}
+			bundle.cache = nullptr;
+			bundle.warm = false;
+		}
+
+		if (debug && bundle.warm)
+		{
+			std::cout << "Loaded " << data.size() << " bytes of pipeline cache from \"" << filename << "\"\n";
+		}
+
+		return bundle;
+	}
+
+	/*
+	* Write to a temporary file first and rename it over the old cache,
+	* so a crash mid-write never leaves a truncated blob behind.
+	*/
+	void save_pipeline_cache(vk::Device device, vk::PipelineCache cache, std::string filename, bool debug)
+	{
+		if (!cache)
+		{
+			return;
+		}
+
+		std::vector<uint8_t> data = device.getPipelineCacheData(cache);
+
+		std::string temporaryFilename = filename + ".tmp";
+		{
+			std::ofstream file(temporaryFilename, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				if (debug)
+				{
+					std::cout << "Failed to open \"" << temporaryFilename << "\" for writing\n";
+				}
+				return;
+			}
+			file.write(reinterpret_cast<const char*>(data.data()), data.size());
+			if (!file.good())
+			{
+				if (debug)
+				{
+					std::cout << "Failed to write pipeline cache\n";
+				}
+				return;
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryFilename, filename, error);
+		if (error)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to replace \"" << filename << "\": " << error.message() << '\n';
+			}
+			std::filesystem::remove(temporaryFilename, error);
+			return;
+		}
+
+		if (debug)
+		{
+			std::cout << "Saved " << data.size() << " bytes of pipeline cache to \"" << filename << "\"\n";
+		}
+	}
+}
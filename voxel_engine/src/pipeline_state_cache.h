@@ -0,0 +1,299 @@
+#pragma once
+#include "config.h"
+#include "hash.h"
+#include "pipeline.h"
+#include "layout_cache.h"
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+
+namespace vkUtil
+{
+	/*
+	* Owns every graphics pipeline and render pass, keyed by a hash of the full pipeline state
+	* (SPIR-V, fixed function state, formats, specialization constants). Variants sharing a
+	* format share a render pass and variants with the same shader interface share a layout
+	* through the layout cache. Requested variants are compiled together across worker threads,
+	* so adding variants costs little extra time as long as there are cores to spare.
+	* Safe to use from the render thread and the shader reload thread at once: looking up a
+	* variant another thread is compiling waits for that compile, so null always means failed
+	* (or never compiled).
+	*/
+	class PipelineStateCache
+	{
+	public:
+
+		PipelineStateCache(vk::Device device, vk::PipelineCache pipelineCache, LayoutCache* layoutCache) :
+			device(device),
+			pipelineCache(pipelineCache),
+			layoutCache(layoutCache)
+		{
+		}
+
+		static uint64_t hash_state(const vkInit::GraphicsPipelineInBundle& specification)
+		{
+			//shaders by content, or by file when they are loaded from prebuilt SPIR-V
+			uint64_t hash = specification.vertexCode.empty()
+				? hash_string(specification.vertexFilepath)
+				: hash_bytes(specification.vertexCode.data(), specification.vertexCode.size() * sizeof(uint32_t));
+			hash = specification.fragmentCode.empty()
+				? hash_string(specification.fragmentFilepath, hash)
+				: hash_bytes(specification.fragmentCode.data(), specification.fragmentCode.size() * sizeof(uint32_t), hash);
+
+			hash = hash_value(static_cast<uint32_t>(specification.swapchainFormat), hash);
+			hash = hash_value(static_cast<uint32_t>(specification.finalLayout), hash);
+			hash = hash_value(static_cast<uint32_t>(specification.topology), hash);
+			hash = hash_value(static_cast<uint32_t>(specification.polygonMode), hash);
+			hash = hash_value(static_cast<uint32_t>(specification.cullMode), hash);
+			hash = hash_value(static_cast<uint32_t>(specification.blendMode), hash);
+			hash = hash_value(static_cast<uint32_t>(specification.depthFormat), hash);
+			hash = hash_value(specification.depthTest, hash);
+			hash = hash_value(specification.depthWrite, hash);
+			hash = hash_value(static_cast<uint32_t>(specification.depthCompare), hash);
+			hash = hash_value(specification.specializationConstants.size(), hash);
+			for (const vkInit::SpecializationConstant& constant : specification.specializationConstants)
+			{
+				hash = hash_value(constant.id, hash);
+				hash = hash_value(constant.value, hash);
+			}
+			return hash;
+		}
+
+		//one render pass per output formats and final layout, shared by every variant drawing there
+		vk::RenderPass get_renderpass(vk::Format format, vk::ImageLayout finalLayout, vk::Format depthFormat, bool debug)
+		{
+			uint64_t hash = hash_value(static_cast<uint32_t>(format));
+			hash = hash_value(static_cast<uint32_t>(finalLayout), hash);
+			hash = hash_value(static_cast<uint32_t>(depthFormat), hash);
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto found = renderpasses.find(hash);
+			if (found != renderpasses.end())
+			{
+				return found->second;
+			}
+
+			vk::RenderPass renderpass = vkInit::make_renderpass(device, format, finalLayout, depthFormat, debug);
+			renderpasses[hash] = renderpass;
+			return renderpass;
+		}
+
+		//registers a variant to be built by the next compile_pending, returns its key
+		uint64_t request(const vkInit::GraphicsPipelineInBundle& specification)
+		{
+			uint64_t key = hash_state(specification);
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (pipelines.find(key) == pipelines.end())
+			{
+				PipelineEntry entry = {};
+				entry.specification = specification;
+				pipelines[key] = entry;
+				pending.push_back(key);
+			}
+			return key;
+		}
+
+		//compiles every requested variant that isn't built yet, in parallel, and waits for them
+		void compile_pending(bool debug)
+		{
+			std::vector<std::pair<uint64_t, vkInit::GraphicsPipelineInBundle>> jobs;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (uint64_t key : pending)
+				{
+					jobs.push_back({ key, pipelines[key].specification });
+					compiling.insert(key);
+				}
+				pending.clear();
+			}
+
+			if (jobs.empty())
+			{
+				return;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+
+			//render passes first, so the workers only ever read them
+			for (std::pair<uint64_t, vkInit::GraphicsPipelineInBundle>& job : jobs)
+			{
+				job.second.device = device;
+				job.second.pipelineCache = pipelineCache;
+				job.second.layoutCache = layoutCache;
+				job.second.renderpass = get_renderpass(job.second.swapchainFormat, job.second.finalLayout, job.second.depthFormat, debug);
+			}
+
+			std::vector<vkInit::GraphicsPipelineOutBundle> outputs(jobs.size());
+
+			//pipeline caches are internally synchronized, workers may create pipelines at once
+			std::atomic<size_t> next{ 0 };
+			auto worker = [&]()
+			{
+				for (size_t job = next++; job < jobs.size(); job = next++)
+				{
+					outputs[job] = vkInit::make_graphics_pipeline(jobs[job].second, false);
+				}
+			};
+
+			size_t workerCount = std::min<size_t>(jobs.size(), std::max(1u, std::thread::hardware_concurrency()));
+			std::vector<std::thread> workers;
+			for (size_t i = 1; i < workerCount; i++)
+			{
+				workers.emplace_back(worker);
+			}
+			worker();
+			for (std::thread& thread : workers)
+			{
+				thread.join();
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+
+			size_t failed = 0;
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				//failed variants are forgotten, so requesting them again retries
+				if (!outputs[i].pipeline)
+				{
+					pipelines.erase(jobs[i].first);
+					failed++;
+					continue;
+				}
+
+				PipelineEntry& entry = pipelines[jobs[i].first];
+				entry.pipeline = outputs[i].pipeline;
+				entry.layout = outputs[i].layout;
+				entry.renderpass = outputs[i].renderpass;
+			}
+			compiled += jobs.size() - failed;
+
+			for (std::pair<uint64_t, vkInit::GraphicsPipelineInBundle>& job : jobs)
+			{
+				compiling.erase(job.first);
+			}
+			lock.unlock();
+			compiledCondition.notify_all();
+
+			if (debug)
+			{
+				double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				std::cout << "Compiled " << jobs.size() - failed << " pipeline variants on " << workerCount
+					<< " threads in " << milliseconds << "ms";
+				if (failed > 0)
+				{
+					std::cout << ", " << failed << " failed";
+				}
+				std::cout << '\n';
+			}
+		}
+
+		//requests and compiles a single variant, returns the cached one when it exists (waiting if another thread is compiling it)
+		vk::Pipeline get_or_create(const vkInit::GraphicsPipelineInBundle& specification, uint64_t& key, bool debug)
+		{
+			key = request(specification);
+			compile_pending(debug);
+			return get_pipeline(key);
+		}
+
+		vk::Pipeline get_pipeline(uint64_t key)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wait_compiled(lock, key);
+			auto found = pipelines.find(key);
+			return found != pipelines.end() ? found->second.pipeline : nullptr;
+		}
+
+		vk::PipelineLayout get_layout(uint64_t key)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wait_compiled(lock, key);
+			auto found = pipelines.find(key);
+			return found != pipelines.end() ? found->second.layout : nullptr;
+		}
+
+		vk::RenderPass get_renderpass(uint64_t key)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wait_compiled(lock, key);
+			auto found = pipelines.find(key);
+			return found != pipelines.end() ? found->second.renderpass : nullptr;
+		}
+
+		/*
+		* Drops a variant from the cache and hands its pipeline to the caller, who destroys it
+		* once no frame in flight uses it (a hot reloaded shader makes the old variant obsolete).
+		*/
+		vk::Pipeline release(uint64_t key)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wait_compiled(lock, key);
+			auto found = pipelines.find(key);
+			if (found == pipelines.end())
+			{
+				return nullptr;
+			}
+			vk::Pipeline pipeline = found->second.pipeline;
+			pipelines.erase(found);
+			return pipeline;
+		}
+
+		void log_statistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::cout << "Pipeline state cache: " << pipelines.size() << " variants (" << compiled << " compiled so far), "
+				<< renderpasses.size() << " render passes\n";
+		}
+
+		void destroy()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (std::pair<const uint64_t, PipelineEntry>& entry : pipelines)
+			{
+				device.destroyPipeline(entry.second.pipeline);
+			}
+			for (std::pair<const uint64_t, vk::RenderPass>& renderpass : renderpasses)
+			{
+				device.destroyRenderPass(renderpass.second);
+			}
+
+			pipelines.clear();
+			renderpasses.clear();
+			pending.clear();
+		}
+
+	private:
+
+		struct PipelineEntry
+		{
+			vkInit::GraphicsPipelineInBundle specification;
+			vk::Pipeline pipeline{ nullptr };
+			vk::PipelineLayout layout{ nullptr };
+			vk::RenderPass renderpass{ nullptr };
+		};
+
+		vk::Device device;
+		vk::PipelineCache pipelineCache;
+		LayoutCache* layoutCache;
+
+		std::mutex mutex;
+		std::unordered_map<uint64_t, PipelineEntry> pipelines;
+		std::unordered_map<uint64_t, vk::RenderPass> renderpasses;
+		std::vector<uint64_t> pending;
+		size_t compiled{ 0 };
+
+		//keys some compile_pending is building right now, lookups of them wait for it to finish
+		std::unordered_set<uint64_t> compiling;
+		std::condition_variable compiledCondition;
+
+		void wait_compiled(std::unique_lock<std::mutex>& lock, uint64_t key)
+		{
+			compiledCondition.wait(lock, [&]() { return compiling.find(key) == compiling.end(); });
+		}
+	};
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "config.h"
+
+namespace vkInit
+{
+	//one result per enabled statistic per query, in the order the statistic bits are declared
+	vk::QueryPool make_statistics_query_pool(vk::Device device, uint32_t queryCount, vk::QueryPipelineStatisticFlags statistics, bool debug)
+	{
+		vk::QueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.flags = vk::QueryPoolCreateFlags();
+		queryPoolInfo.queryType = vk::QueryType::ePipelineStatistics;
+		queryPoolInfo.queryCount = queryCount;
+		queryPoolInfo.pipelineStatistics = statistics;
+
+		try
+		{
+			return device.createQueryPool(queryPoolInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create pipeline statistics query pool" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+}
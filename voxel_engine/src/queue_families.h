@@ -1,5 +1,6 @@
 #pragma once
 #include "config.h"
+#include <map>
 
 namespace vkUtil
 {
@@ -8,6 +9,12 @@ namespace vkUtil
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
 
+		//a transfer-only family when the device has one, the graphics family otherwise
+		std::optional<uint32_t> transferFamily;
+
+		//a compute family without graphics (async compute) when the device has one, the graphics family otherwise
+		std::optional<uint32_t> computeFamily;
+
 		bool isComplete()
 		{
 			return graphicsFamily.has_value() && presentFamily.has_value();
@@ -37,7 +44,12 @@ namespace vkUtil
 				}
 			}
 
-			if (device.getSurfaceSupportKHR(i, surface))
+			//headless: there is no surface, graphics queue stands in for presenting
+			if (!surface && indices.graphicsFamily.has_value())
+			{
+				indices.presentFamily = indices.graphicsFamily;
+			}
+			else if (surface && device.getSurfaceSupportKHR(i, surface))
 			{
 				indices.presentFamily = i;
 
@@ -53,6 +65,117 @@ namespace vkUtil
 			}
 		}
 
+		//transfer-only families are the DMA engines, copies there run beside graphics work;
+		//failing that any non-graphics family with transfer support still overlaps
+		for (int i = 0; i < queueFamilies.size() && !indices.transferFamily.has_value(); i++)
+		{
+			vk::QueueFlags flags = queueFamilies[i].queueFlags;
+			if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+			{
+				indices.transferFamily = i;
+			}
+		}
+		for (int i = 0; i < queueFamilies.size() && !indices.transferFamily.has_value(); i++)
+		{
+			vk::QueueFlags flags = queueFamilies[i].queueFlags;
+			if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & vk::QueueFlagBits::eGraphics))
+			{
+				indices.transferFamily = i;
+			}
+		}
+
+		//graphics queues can always copy
+		if (!indices.transferFamily.has_value())
+		{
+			indices.transferFamily = indices.graphicsFamily;
+		}
+
+		for (int i = 0; i < queueFamilies.size() && !indices.computeFamily.has_value(); i++)
+		{
+			vk::QueueFlags flags = queueFamilies[i].queueFlags;
+			if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics))
+			{
+				indices.computeFamily = i;
+			}
+		}
+
+		//graphics families always support compute too
+		if (!indices.computeFamily.has_value())
+		{
+			indices.computeFamily = indices.graphicsFamily;
+		}
+
+		if (debug && indices.transferFamily.has_value())
+		{
+			std::cout << "Queue family " << indices.transferFamily.value() << " is used for transfers\n";
+			std::cout << "Queue family " << indices.computeFamily.value() << " is used for compute\n";
+		}
+
 		return indices;
 	}
+
+	//graphics work is latency critical, compute jobs feed upcoming frames, uploads stream in the background
+	constexpr float graphicsQueuePriority{ 1.0f };
+	constexpr float computeQueuePriority{ 0.5f };
+	constexpr float transferQueuePriority{ 0.25f };
+
+	struct QueueAssignment
+	{
+		uint32_t family{ 0 };
+		uint32_t index{ 0 };
+	};
+
+	/*
+	* Which queue of which family each role runs on, and the priorities each family's queues
+	* are created with. Roles get a queue of their own while the family has spare queues,
+	* after that they share the family's first queue and have to submit from the same thread.
+	*/
+	struct QueueLayout
+	{
+		QueueAssignment graphics;
+		QueueAssignment present;
+		QueueAssignment transfer;
+		QueueAssignment compute;
+
+		std::map<uint32_t, std::vector<float>> priorities;
+	};
+
+	QueueLayout make_queue_layout(vk::PhysicalDevice& device, vk::SurfaceKHR surface, bool debug)
+	{
+		QueueFamilyIndices indices = findQueueFamilies(device, surface, debug);
+		std::vector<vk::QueueFamilyProperties> queueFamilies = device.getQueueFamilyProperties();
+
+		QueueLayout layout;
+
+		auto assign = [&](uint32_t family, float priority) -> QueueAssignment
+		{
+			std::vector<float>& familyPriorities = layout.priorities[family];
+			if (familyPriorities.size() < queueFamilies[family].queueCount)
+			{
+				familyPriorities.push_back(priority);
+				return { family, static_cast<uint32_t>(familyPriorities.size() - 1) };
+			}
+			return { family, 0 };
+		};
+
+		layout.graphics = assign(indices.graphicsFamily.value(), graphicsQueuePriority);
+
+		//presenting from the graphics queue avoids a cross-queue handoff every frame
+		layout.present = indices.presentFamily.value() == indices.graphicsFamily.value()
+			? layout.graphics
+			: assign(indices.presentFamily.value(), graphicsQueuePriority);
+
+		layout.compute = assign(indices.computeFamily.value(), computeQueuePriority);
+		layout.transfer = assign(indices.transferFamily.value(), transferQueuePriority);
+
+		if (debug)
+		{
+			std::cout << "Queues (family, index): graphics (" << layout.graphics.family << ", " << layout.graphics.index
+				<< "), present (" << layout.present.family << ", " << layout.present.index
+				<< "), compute (" << layout.compute.family << ", " << layout.compute.index
+				<< "), transfer (" << layout.transfer.family << ", " << layout.transfer.index << ")\n";
+		}
+
+		return layout;
+	}
 }
\ No newline at end of file
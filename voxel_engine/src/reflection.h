@@ -0,0 +1,303 @@
+#pragma once
+#include "config.h"
+#include <spirv_cross/spirv_cross_c.h>
+
+namespace vkUtil
+{
+	//what a single shader stage declares, as read back from its SPIR-V
+	struct ShaderReflection
+	{
+		vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex;
+
+		//indexed by set number
+		std::vector<std::vector<vk::DescriptorSetLayoutBinding>> descriptorSets;
+
+		//covers every push constant member the stage reads, size 0 if none
+		vk::PushConstantRange pushConstants;
+
+		//vertex stage inputs, sorted by location
+		std::vector<vk::VertexInputAttributeDescription> vertexAttributes;
+		uint32_t vertexStride = 0;
+	};
+
+	//the union of all stages of a pipeline
+	struct PipelineReflection
+	{
+		std::vector<std::vector<vk::DescriptorSetLayoutBinding>> descriptorSets;
+		std::vector<vk::PushConstantRange> pushConstantRanges;
+		std::vector<vk::VertexInputAttributeDescription> vertexAttributes;
+		std::vector<vk::VertexInputBindingDescription> vertexBindings;
+	};
+
+	vk::ShaderStageFlagBits stage_from_execution_model(SpvExecutionModel model)
+	{
+		switch (model)
+		{
+		case SpvExecutionModelVertex: return vk::ShaderStageFlagBits::eVertex;
+		case SpvExecutionModelTessellationControl: return vk::ShaderStageFlagBits::eTessellationControl;
+		case SpvExecutionModelTessellationEvaluation: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+		case SpvExecutionModelGeometry: return vk::ShaderStageFlagBits::eGeometry;
+		case SpvExecutionModelFragment: return vk::ShaderStageFlagBits::eFragment;
+		case SpvExecutionModelGLCompute: return vk::ShaderStageFlagBits::eCompute;
+		default: return vk::ShaderStageFlagBits::eAll;
+		}
+	}
+
+	vk::Format vertex_format(spvc_basetype baseType, unsigned vectorSize)
+	{
+		static const vk::Format floats[] = { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat };
+		static const vk::Format ints[] = { vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint };
+		static const vk::Format uints[] = { vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint };
+
+		if (vectorSize < 1 || vectorSize > 4)
+		{
+			return vk::Format::eUndefined;
+		}
+
+		switch (baseType)
+		{
+		case SPVC_BASETYPE_FP32: return floats[vectorSize - 1];
+		case SPVC_BASETYPE_INT32: return ints[vectorSize - 1];
+		case SPVC_BASETYPE_UINT32: return uints[vectorSize - 1];
+		default: return vk::Format::eUndefined;
+		}
+	}
+
+	void reflect_descriptors(
+		spvc_compiler compiler, spvc_resources resources, spvc_resource_type resourceType,
+		vk::DescriptorType descriptorType, ShaderReflection& reflection)
+	{
+		const spvc_reflected_resource* list = nullptr;
+		size_t count = 0;
+		spvc_resources_get_resource_list_for_type(resources, resourceType, &list, &count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t set = spvc_compiler_get_decoration(compiler, list[i].id, SpvDecorationDescriptorSet);
+			uint32_t binding = spvc_compiler_get_decoration(compiler, list[i].id, SpvDecorationBinding);
+
+			vk::DescriptorType type = descriptorType;
+			spvc_type typeHandle = spvc_compiler_get_type_handle(compiler, list[i].type_id);
+
+			//image resources over a buffer dimension are texel buffers
+			if (resourceType == SPVC_RESOURCE_TYPE_SEPARATE_IMAGE || resourceType == SPVC_RESOURCE_TYPE_STORAGE_IMAGE)
+			{
+				if (spvc_type_get_image_dimension(typeHandle) == SpvDimBuffer)
+				{
+					type = resourceType == SPVC_RESOURCE_TYPE_STORAGE_IMAGE
+						? vk::DescriptorType::eStorageTexelBuffer
+						: vk::DescriptorType::eUniformTexelBuffer;
+				}
+			}
+
+			//arrays of descriptors, runtime sized arrays count as one until descriptor indexing is in use
+			uint32_t descriptorCount = 1;
+			for (unsigned dimension = 0; dimension < spvc_type_get_num_array_dimensions(typeHandle); dimension++)
+			{
+				if (spvc_type_array_dimension_is_literal(typeHandle, dimension))
+				{
+					descriptorCount *= std::max(1u, static_cast<uint32_t>(spvc_type_get_array_dimension(typeHandle, dimension)));
+				}
+			}
+
+			if (reflection.descriptorSets.size() <= set)
+			{
+				reflection.descriptorSets.resize(set + 1);
+			}
+
+			vk::DescriptorSetLayoutBinding layoutBinding = {};
+			layoutBinding.binding = binding;
+			layoutBinding.descriptorType = type;
+			layoutBinding.descriptorCount = descriptorCount;
+			layoutBinding.stageFlags = reflection.stage;
+			reflection.descriptorSets[set].push_back(layoutBinding);
+		}
+	}
+
+	ShaderReflection reflect_shader(const std::vector<uint32_t>& spirv, bool debug)
+	{
+		ShaderReflection reflection = {};
+
+		spvc_context context = nullptr;
+		spvc_parsed_ir ir = nullptr;
+		spvc_compiler compiler = nullptr;
+		spvc_resources resources = nullptr;
+
+		if (spvc_context_create(&context) != SPVC_SUCCESS)
+		{
+			return reflection;
+		}
+
+		if (spvc_context_parse_spirv(context, spirv.data(), spirv.size(), &ir) != SPVC_SUCCESS
+			|| spvc_context_create_compiler(context, SPVC_BACKEND_NONE, ir, SPVC_CAPTURE_MODE_TAKE_OWNERSHIP, &compiler) != SPVC_SUCCESS
+			|| spvc_compiler_create_shader_resources(compiler, &resources) != SPVC_SUCCESS)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to reflect shader: " << spvc_context_get_last_error_string(context) << '\n';
+			}
+			spvc_context_destroy(context);
+			return reflection;
+		}
+
+		reflection.stage = stage_from_execution_model(spvc_compiler_get_execution_model(compiler));
+
+		//descriptors
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_UNIFORM_BUFFER, vk::DescriptorType::eUniformBuffer, reflection);
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_STORAGE_BUFFER, vk::DescriptorType::eStorageBuffer, reflection);
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_STORAGE_IMAGE, vk::DescriptorType::eStorageImage, reflection);
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_SAMPLED_IMAGE, vk::DescriptorType::eCombinedImageSampler, reflection);
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_SEPARATE_IMAGE, vk::DescriptorType::eSampledImage, reflection);
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_SEPARATE_SAMPLERS, vk::DescriptorType::eSampler, reflection);
+		reflect_descriptors(compiler, resources, SPVC_RESOURCE_TYPE_SUBPASS_INPUT, vk::DescriptorType::eInputAttachment, reflection);
+
+		//push constants, only the members the stage actually reads
+		const spvc_reflected_resource* list = nullptr;
+		size_t count = 0;
+		spvc_resources_get_resource_list_for_type(resources, SPVC_RESOURCE_TYPE_PUSH_CONSTANT, &list, &count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const spvc_buffer_range* ranges = nullptr;
+			size_t rangeCount = 0;
+			spvc_compiler_get_active_buffer_ranges(compiler, list[i].id, &ranges, &rangeCount);
+
+			if (rangeCount == 0)
+			{
+				continue;
+			}
+
+			size_t begin = ranges[0].offset;
+			size_t end = ranges[0].offset + ranges[0].range;
+			for (size_t j = 1; j < rangeCount; j++)
+			{
+				begin = std::min(begin, ranges[j].offset);
+				end = std::max(end, ranges[j].offset + ranges[j].range);
+			}
+
+			reflection.pushConstants.stageFlags = reflection.stage;
+			reflection.pushConstants.offset = static_cast<uint32_t>(begin);
+			reflection.pushConstants.size = static_cast<uint32_t>(end - begin);
+		}
+
+		//vertex inputs, packed into a single interleaved binding in location order
+		if (reflection.stage == vk::ShaderStageFlagBits::eVertex)
+		{
+			//attribute and its size in bytes
+			std::vector<std::pair<vk::VertexInputAttributeDescription, uint32_t>> attributes;
+
+			spvc_resources_get_resource_list_for_type(resources, SPVC_RESOURCE_TYPE_STAGE_INPUT, &list, &count);
+			for (size_t i = 0; i < count; i++)
+			{
+				spvc_type typeHandle = spvc_compiler_get_type_handle(compiler, list[i].type_id);
+				unsigned vectorSize = spvc_type_get_vector_size(typeHandle);
+
+				vk::VertexInputAttributeDescription attribute = {};
+				attribute.binding = 0;
+				attribute.location = spvc_compiler_get_decoration(compiler, list[i].id, SpvDecorationLocation);
+				attribute.format = vertex_format(spvc_type_get_basetype(typeHandle), vectorSize);
+
+				if (attribute.format == vk::Format::eUndefined)
+				{
+					if (debug)
+					{
+						std::cout << "Unsupported vertex input type for \"" << list[i].name << "\"\n";
+					}
+					continue;
+				}
+
+				//all supported formats are 32 bit per component
+				attributes.push_back({ attribute, 4 * vectorSize });
+			}
+
+			std::sort(attributes.begin(), attributes.end(),
+				[](const std::pair<vk::VertexInputAttributeDescription, uint32_t>& a, const std::pair<vk::VertexInputAttributeDescription, uint32_t>& b)
+				{
+					return a.first.location < b.first.location;
+				});
+
+			for (std::pair<vk::VertexInputAttributeDescription, uint32_t>& attribute : attributes)
+			{
+				attribute.first.offset = reflection.vertexStride;
+				reflection.vertexStride += attribute.second;
+				reflection.vertexAttributes.push_back(attribute.first);
+			}
+		}
+
+		spvc_context_destroy(context);
+
+		return reflection;
+	}
+
+	PipelineReflection merge_reflections(const std::vector<ShaderReflection>& stages)
+	{
+		PipelineReflection pipeline = {};
+
+		vk::PushConstantRange pushConstants = {};
+		uint32_t pushConstantsEnd = 0;
+
+		for (const ShaderReflection& stage : stages)
+		{
+			//a binding used by several stages is visible to all of them
+			for (uint32_t set = 0; set < stage.descriptorSets.size(); set++)
+			{
+				if (pipeline.descriptorSets.size() <= set)
+				{
+					pipeline.descriptorSets.resize(set + 1);
+				}
+
+				for (const vk::DescriptorSetLayoutBinding& binding : stage.descriptorSets[set])
+				{
+					auto existing = std::find_if(pipeline.descriptorSets[set].begin(), pipeline.descriptorSets[set].end(),
+						[&](const vk::DescriptorSetLayoutBinding& other) { return other.binding == binding.binding; });
+
+					if (existing == pipeline.descriptorSets[set].end())
+					{
+						pipeline.descriptorSets[set].push_back(binding);
+					}
+					else
+					{
+						existing->stageFlags |= binding.stageFlags;
+					}
+				}
+			}
+
+			//one range covering every stage keeps vkCmdPushConstants simple
+			if (stage.pushConstants.size > 0)
+			{
+				if (!pushConstants.stageFlags)
+				{
+					pushConstants.offset = stage.pushConstants.offset;
+				}
+				pushConstants.stageFlags |= stage.pushConstants.stageFlags;
+				pushConstants.offset = std::min(pushConstants.offset, stage.pushConstants.offset);
+				pushConstantsEnd = std::max(pushConstantsEnd, stage.pushConstants.offset + stage.pushConstants.size);
+			}
+
+			if (stage.stage == vk::ShaderStageFlagBits::eVertex && !stage.vertexAttributes.empty())
+			{
+				pipeline.vertexAttributes = stage.vertexAttributes;
+				pipeline.vertexBindings.push_back(
+					vk::VertexInputBindingDescription(0, stage.vertexStride, vk::VertexInputRate::eVertex)
+				);
+			}
+		}
+
+		if (pushConstants.stageFlags)
+		{
+			pushConstants.size = pushConstantsEnd - pushConstants.offset;
+			pipeline.pushConstantRanges.push_back(pushConstants);
+		}
+
+		//canonical binding order, so identical sets hash identically
+		for (std::vector<vk::DescriptorSetLayoutBinding>& set : pipeline.descriptorSets)
+		{
+			std::sort(set.begin(), set.end(),
+				[](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b)
+				{
+					return a.binding < b.binding;
+				});
+		}
+
+		return pipeline;
+	}
+}
@@ -0,0 +1,906 @@
+#pragma once
+#include "config.h"
+#include "gpu_memory.h"
+#include "image.h"
+#include "hash.h"
+#include <functional>
+#include <unordered_map>
+
+namespace vkUtil
+{
+	using RenderResource = uint32_t;
+	using RenderPassHandle = uint32_t;
+
+	struct RenderImageDescription
+	{
+		vk::Format format;
+		vk::ImageAspectFlags aspect{ vk::ImageAspectFlagBits::eColor };
+
+		//0 x 0 follows the extent the graph is compiled for
+		vk::Extent2D extent{ 0, 0 };
+	};
+
+	//how a pass touches an image, decides its layout, stages and access masks
+	enum class RenderAccess
+	{
+		ColorWrite,
+		DepthWrite,
+		DepthRead,
+		ShaderRead
+	};
+
+	//handed to a pass while it records, the render pass is begun already when the pass has attachments
+	struct RenderPassContext
+	{
+		vk::RenderPass renderpass;
+		vk::Extent2D extent;
+
+		//set for passes recorded into secondary command buffers, which inherit the render pass and framebuffer
+		vk::Framebuffer framebuffer{ nullptr };
+		bool secondary{ false };
+	};
+
+	/*
+	* Frame graph: passes declare the images they write and read, compile derives the order,
+	* drops passes nothing visible depends on, places pipeline barriers and layout transitions
+	* only where a hazard or layout change needs one, and binds transient images whose lifetimes
+	* don't overlap into the same memory. Imported images (the swapchain) are bound each frame.
+	* Declare, compile once, then execute every frame; reset and declare again when the
+	* structure or the extent changes.
+	*/
+	class RenderGraph
+	{
+	public:
+
+		using ExecuteCallback = std::function<void(vk::CommandBuffer, const RenderPassContext&)>;
+
+		RenderGraph(vk::Device device, MemoryManager* memoryManager) :
+			device(device),
+			memoryManager(memoryManager)
+		{
+		}
+
+		RenderGraph(const RenderGraph&) = delete;
+		RenderGraph& operator=(const RenderGraph&) = delete;
+
+		//an image owned by the graph, alive only between its first and last use in a frame
+		RenderResource create_image(const std::string& name, const RenderImageDescription& description)
+		{
+			Resource resource = {};
+			resource.name = name;
+			resource.description = description;
+			resources.push_back(resource);
+			return static_cast<RenderResource>(resources.size() - 1);
+		}
+
+		/*
+		* An image owned elsewhere, its contents are discarded at the start of the frame and it is
+		* left in finalLayout at the end. previousStages is what last used it before the graph
+		* (for the swapchain, the stage that waits on the acquire semaphore).
+		*/
+		RenderResource import_image(
+			const std::string& name, const RenderImageDescription& description,
+			vk::ImageLayout finalLayout, vk::PipelineStageFlags previousStages)
+		{
+			Resource resource = {};
+			resource.name = name;
+			resource.description = description;
+			resource.imported = true;
+			resource.finalLayout = finalLayout;
+			resource.previousStages = previousStages;
+			resources.push_back(resource);
+			return static_cast<RenderResource>(resources.size() - 1);
+		}
+
+		//outputs and everything they depend on survive culling
+		void mark_output(RenderResource resource)
+		{
+			resources[resource].output = true;
+		}
+
+		RenderPassHandle add_pass(const std::string& name, ExecuteCallback execute)
+		{
+			Pass pass = {};
+			pass.name = name;
+			pass.execute = execute;
+			passes.push_back(pass);
+			return static_cast<RenderPassHandle>(passes.size() - 1);
+		}
+
+		//the pass only executes secondary command buffers inside its render pass, recorded on other threads
+		void record_secondary(RenderPassHandle pass)
+		{
+			passes[pass].secondary = true;
+		}
+
+		//the pass writes something outside the graph (buffers, images it owns), it is never culled
+		void mark_side_effects(RenderPassHandle pass)
+		{
+			passes[pass].sideEffects = true;
+		}
+
+		//without a clear value the previous contents are loaded, which makes them an input too
+		void write_color(RenderPassHandle pass, RenderResource resource, std::optional<vk::ClearColorValue> clear)
+		{
+			Use use = { resource, RenderAccess::ColorWrite, {} };
+			use.clear = clear.has_value();
+			if (clear)
+			{
+				use.clearValue.color = *clear;
+			}
+			passes[pass].uses.push_back(use);
+		}
+
+		void write_depth(RenderPassHandle pass, RenderResource resource, std::optional<float> clear)
+		{
+			Use use = { resource, RenderAccess::DepthWrite, {} };
+			use.clear = clear.has_value();
+			if (clear)
+			{
+				use.clearValue.depthStencil = vk::ClearDepthStencilValue(*clear, 0);
+			}
+			passes[pass].uses.push_back(use);
+		}
+
+		//depth tested but not written (after a depth prepass), in a read only layout
+		void read_depth(RenderPassHandle pass, RenderResource resource)
+		{
+			passes[pass].uses.push_back({ resource, RenderAccess::DepthRead, vk::PipelineStageFlags() });
+		}
+
+		//sampled in the given shader stages
+		void read_texture(RenderPassHandle pass, RenderResource resource, vk::PipelineStageFlags stages)
+		{
+			passes[pass].uses.push_back({ resource, RenderAccess::ShaderRead, stages });
+		}
+
+		bool compile(vk::Extent2D extent, bool debug)
+		{
+			destroy_compiled();
+			graphExtent = extent;
+
+			cull_passes();
+			if (!allocate_transients(debug))
+			{
+				return false;
+			}
+			plan_barriers();
+			return make_renderpasses(debug);
+		}
+
+		void bind_imported(RenderResource resource, vk::Image image, vk::ImageView view)
+		{
+			resources[resource].image = image;
+			resources[resource].view = view;
+		}
+
+		void execute(vk::CommandBuffer commandBuffer)
+		{
+			for (uint32_t passIndex : order)
+			{
+				Pass& pass = passes[passIndex];
+				record_barriers(commandBuffer, pass.barriers);
+
+				RenderPassContext context = {};
+				context.renderpass = pass.renderpass;
+				context.extent = graphExtent;
+
+				if (!pass.renderpass)
+				{
+					pass.execute(commandBuffer, context);
+					continue;
+				}
+
+				std::vector<vk::ClearValue> clearValues;
+				for (uint32_t useIndex : pass.attachments)
+				{
+					clearValues.push_back(pass.uses[useIndex].clearValue);
+				}
+
+				context.framebuffer = get_framebuffer(passIndex);
+				context.secondary = pass.secondary;
+
+				vk::RenderPassBeginInfo renderpassInfo = {};
+				renderpassInfo.renderPass = pass.renderpass;
+				renderpassInfo.framebuffer = context.framebuffer;
+				renderpassInfo.renderArea.offset = vk::Offset2D(0, 0);
+				renderpassInfo.renderArea.extent = graphExtent;
+				renderpassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+				renderpassInfo.pClearValues = clearValues.data();
+
+				commandBuffer.beginRenderPass(
+					&renderpassInfo, pass.secondary ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline
+				);
+				pass.execute(commandBuffer, context);
+				commandBuffer.endRenderPass();
+			}
+
+			record_barriers(commandBuffer, finalBarriers);
+		}
+
+		//transients get a new view every compile
+		vk::ImageView get_view(RenderResource resource) const
+		{
+			return resources[resource].view;
+		}
+
+		//render pass a pipeline drawing in pass has to be compatible with
+		vk::RenderPass get_renderpass(RenderPassHandle pass) const
+		{
+			return passes[pass].renderpass;
+		}
+
+		void log_statistics() const
+		{
+			size_t barrierCount = finalBarriers.size();
+			for (uint32_t passIndex : order)
+			{
+				barrierCount += passes[passIndex].barriers.size();
+			}
+
+			std::cout << "Render graph: " << order.size() << " of " << passes.size() << " passes live, "
+				<< barrierCount << " image barriers per frame, transient images need "
+				<< transientBytes / (1 << 20) << "MiB, aliased into " << aliasedBytes / (1 << 20) << "MiB\n";
+		}
+
+		//drops declarations and compiled objects, the caller makes sure the GPU is done with them
+		void reset()
+		{
+			destroy_compiled();
+			resources.clear();
+			passes.clear();
+		}
+
+		void destroy()
+		{
+			reset();
+		}
+
+	private:
+
+		struct Use
+		{
+			RenderResource resource;
+			RenderAccess access;
+			vk::PipelineStageFlags shaderStages;
+			bool clear{ false };
+			vk::ClearValue clearValue{};
+		};
+
+		struct ImageState
+		{
+			vk::ImageLayout layout{ vk::ImageLayout::eUndefined };
+			vk::PipelineStageFlags stages;
+			vk::AccessFlags access;
+		};
+
+		struct Barrier
+		{
+			RenderResource resource;
+			ImageState from;
+			ImageState to;
+		};
+
+		struct Pass
+		{
+			std::string name;
+			ExecuteCallback execute;
+			std::vector<Use> uses;
+			bool secondary{ false };
+			bool sideEffects{ false };
+
+			//filled by compile
+			bool live{ false };
+			std::vector<Barrier> barriers;
+			std::vector<uint32_t> attachments;
+			vk::RenderPass renderpass{ nullptr };
+		};
+
+		struct Resource
+		{
+			std::string name;
+			RenderImageDescription description;
+			bool imported{ false };
+			bool output{ false };
+			vk::ImageLayout finalLayout{ vk::ImageLayout::eUndefined };
+			vk::PipelineStageFlags previousStages;
+
+			//filled by compile (transients) or bind_imported
+			vk::Image image{ nullptr };
+			vk::ImageView view{ nullptr };
+			vk::ImageUsageFlags usage;
+			uint32_t firstUse{ UINT32_MAX };
+			uint32_t lastUse{ 0 };
+			uint32_t slot{ UINT32_MAX };
+			ImageState lastState;
+		};
+
+		//one allocation shared by transients whose lifetimes don't overlap
+		struct MemorySlot
+		{
+			vk::MemoryRequirements requirements;
+			std::vector<RenderResource> residents;
+			VmaAllocation allocation{ nullptr };
+		};
+
+		//the full key is kept, the hash only picks the bucket
+		struct CachedFramebuffer
+		{
+			vk::RenderPass renderpass;
+			std::vector<vk::ImageView> views;
+			vk::Extent2D extent;
+			vk::Framebuffer framebuffer;
+		};
+
+		vk::Device device;
+		MemoryManager* memoryManager;
+		vk::Extent2D graphExtent;
+
+		std::vector<Resource> resources;
+		std::vector<Pass> passes;
+
+		//live passes in execution order, declaration order is already a valid order
+		std::vector<uint32_t> order;
+		std::vector<Barrier> finalBarriers;
+		std::vector<MemorySlot> slots;
+		std::unordered_multimap<uint64_t, CachedFramebuffer> framebuffers;
+
+		vk::DeviceSize transientBytes{ 0 };
+		vk::DeviceSize aliasedBytes{ 0 };
+
+		static ImageState state_for(const Use& use)
+		{
+			ImageState state = {};
+			switch (use.access)
+			{
+			case RenderAccess::ColorWrite:
+				state.layout = vk::ImageLayout::eColorAttachmentOptimal;
+				state.stages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+				state.access = vk::AccessFlagBits::eColorAttachmentWrite;
+				if (!use.clear)
+				{
+					state.access |= vk::AccessFlagBits::eColorAttachmentRead;
+				}
+				break;
+			case RenderAccess::DepthWrite:
+				state.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+				state.stages = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+				state.access = vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentRead;
+				break;
+			case RenderAccess::DepthRead:
+				state.layout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+				state.stages = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+				state.access = vk::AccessFlagBits::eDepthStencilAttachmentRead;
+				break;
+			case RenderAccess::ShaderRead:
+				state.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+				state.stages = use.shaderStages ? use.shaderStages : vk::PipelineStageFlagBits::eFragmentShader;
+				state.access = vk::AccessFlagBits::eShaderRead;
+				break;
+			}
+			return state;
+		}
+
+		static vk::ImageUsageFlags usage_for(RenderAccess access)
+		{
+			switch (access)
+			{
+			case RenderAccess::ColorWrite:
+				return vk::ImageUsageFlagBits::eColorAttachment;
+			case RenderAccess::DepthWrite:
+			case RenderAccess::DepthRead:
+				return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+			default:
+				return vk::ImageUsageFlagBits::eSampled;
+			}
+		}
+
+		static bool is_write(RenderAccess access)
+		{
+			return access == RenderAccess::ColorWrite || access == RenderAccess::DepthWrite;
+		}
+
+		static vk::AccessFlags write_bits(vk::AccessFlags access)
+		{
+			return access & (vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite
+				| vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eMemoryWrite);
+		}
+
+		/*
+		* Walks the passes backwards from the outputs: a pass lives if it writes something a live pass
+		* or an output needs, or has side effects. A cleared write fully replaces the image, so earlier writers of it are
+		* only needed when something in between loads or reads it.
+		*/
+		void cull_passes()
+		{
+			std::vector<bool> needed(resources.size(), false);
+			for (size_t i = 0; i < resources.size(); i++)
+			{
+				needed[i] = resources[i].output;
+			}
+
+			for (size_t i = passes.size(); i-- > 0; )
+			{
+				Pass& pass = passes[i];
+				pass.live = pass.sideEffects;
+				for (const Use& use : pass.uses)
+				{
+					pass.live |= is_write(use.access) && needed[use.resource];
+				}
+				if (!pass.live)
+				{
+					continue;
+				}
+
+				for (const Use& use : pass.uses)
+				{
+					if (is_write(use.access) && use.clear)
+					{
+						needed[use.resource] = false;
+					}
+				}
+				for (const Use& use : pass.uses)
+				{
+					if (!is_write(use.access) || !use.clear)
+					{
+						needed[use.resource] = true;
+					}
+				}
+			}
+
+			order.clear();
+			for (uint32_t i = 0; i < passes.size(); i++)
+			{
+				if (passes[i].live)
+				{
+					order.push_back(i);
+				}
+			}
+		}
+
+		/*
+		* Transients get an image each, then share memory: biggest first, every image goes into the
+		* first slot whose residents it never overlaps with in the frame and whose memory type suits it.
+		*/
+		bool allocate_transients(bool debug)
+		{
+			for (Resource& resource : resources)
+			{
+				resource.usage = vk::ImageUsageFlags();
+				resource.firstUse = UINT32_MAX;
+				resource.lastUse = 0;
+				resource.slot = UINT32_MAX;
+			}
+			for (uint32_t step = 0; step < order.size(); step++)
+			{
+				for (const Use& use : passes[order[step]].uses)
+				{
+					Resource& resource = resources[use.resource];
+					resource.usage |= usage_for(use.access);
+					resource.firstUse = std::min(resource.firstUse, step);
+					resource.lastUse = std::max(resource.lastUse, step);
+				}
+			}
+
+			std::vector<std::pair<RenderResource, vk::MemoryRequirements>> transients;
+			for (RenderResource i = 0; i < resources.size(); i++)
+			{
+				Resource& resource = resources[i];
+				if (resource.imported || resource.firstUse == UINT32_MAX)
+				{
+					continue;
+				}
+
+				vk::Extent2D extent = resource.description.extent.width > 0 ? resource.description.extent : graphExtent;
+
+				vk::ImageCreateInfo imageInfo = {};
+				imageInfo.imageType = vk::ImageType::e2D;
+				imageInfo.format = resource.description.format;
+				imageInfo.extent = vk::Extent3D(extent.width, extent.height, 1);
+				imageInfo.mipLevels = 1;
+				imageInfo.arrayLayers = 1;
+				imageInfo.samples = vk::SampleCountFlagBits::e1;
+				imageInfo.tiling = vk::ImageTiling::eOptimal;
+				imageInfo.usage = resource.usage;
+				imageInfo.sharingMode = vk::SharingMode::eExclusive;
+				imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+				try
+				{
+					resource.image = device.createImage(imageInfo);
+				}
+				catch (vk::SystemError err)
+				{
+					if (debug)
+					{
+						std::cout << "Failed to create transient image \"" << resource.name << "\"" << std::endl;
+					}
+					return false;
+				}
+				transients.push_back({ i, device.getImageMemoryRequirements(resource.image) });
+				transientBytes += transients.back().second.size;
+			}
+
+			std::sort(transients.begin(), transients.end(),
+				[](const std::pair<RenderResource, vk::MemoryRequirements>& a, const std::pair<RenderResource, vk::MemoryRequirements>& b)
+				{
+					return a.second.size > b.second.size;
+				});
+
+			for (std::pair<RenderResource, vk::MemoryRequirements>& transient : transients)
+			{
+				Resource& resource = resources[transient.first];
+				for (uint32_t s = 0; s < slots.size() && resource.slot == UINT32_MAX; s++)
+				{
+					MemorySlot& slot = slots[s];
+					bool fits = (slot.requirements.memoryTypeBits & transient.second.memoryTypeBits) != 0;
+					for (RenderResource resident : slot.residents)
+					{
+						fits &= resources[resident].lastUse < resource.firstUse || resource.lastUse < resources[resident].firstUse;
+					}
+					if (fits)
+					{
+						slot.requirements.size = std::max(slot.requirements.size, transient.second.size);
+						slot.requirements.alignment = std::max(slot.requirements.alignment, transient.second.alignment);
+						slot.requirements.memoryTypeBits &= transient.second.memoryTypeBits;
+						slot.residents.push_back(transient.first);
+						resource.slot = s;
+					}
+				}
+				if (resource.slot == UINT32_MAX)
+				{
+					MemorySlot slot = {};
+					slot.requirements = transient.second;
+					slot.residents.push_back(transient.first);
+					resource.slot = static_cast<uint32_t>(slots.size());
+					slots.push_back(slot);
+				}
+			}
+
+			for (MemorySlot& slot : slots)
+			{
+				slot.allocation = memoryManager->allocate_aliasing_memory(slot.requirements, debug);
+				if (!slot.allocation)
+				{
+					return false;
+				}
+				aliasedBytes += slot.requirements.size;
+
+				for (RenderResource resident : slot.residents)
+				{
+					Resource& resource = resources[resident];
+					if (!memoryManager->bind_aliased_image(slot.allocation, 0, resource.image, debug))
+					{
+						return false;
+					}
+					resource.view = make_image_view(device, resource.image, resource.description.format, resource.description.aspect);
+				}
+
+				//residents take turns in the order they are used
+				std::sort(slot.residents.begin(), slot.residents.end(),
+					[this](RenderResource a, RenderResource b) { return resources[a].firstUse < resources[b].firstUse; });
+			}
+
+			return true;
+		}
+
+		/*
+		* Replays the frame tracking each image's layout and last access. Read after read in the same
+		* layout needs nothing, any write or layout change gets one barrier, batched per pass.
+		* A transient starts undefined and waits on whatever last used its memory: the previous
+		* resident, or for the first resident the last one of the previous frame.
+		*/
+		void plan_barriers()
+		{
+			std::vector<bool> touched(resources.size(), false);
+
+			//steady state: what each resource looks like at the end of a frame
+			for (uint32_t passIndex : order)
+			{
+				for (const Use& use : passes[passIndex].uses)
+				{
+					resources[use.resource].lastState = state_for(use);
+				}
+			}
+
+			std::vector<ImageState> current(resources.size());
+			for (RenderResource i = 0; i < resources.size(); i++)
+			{
+				Resource& resource = resources[i];
+				current[i].layout = vk::ImageLayout::eUndefined;
+				if (resource.imported)
+				{
+					current[i].stages = resource.previousStages;
+				}
+				else if (resource.slot != UINT32_MAX)
+				{
+					const std::vector<RenderResource>& residents = slots[resource.slot].residents;
+					size_t position = std::find(residents.begin(), residents.end(), i) - residents.begin();
+					RenderResource previous = residents[(position + residents.size() - 1) % residents.size()];
+					current[i].stages = resources[previous].lastState.stages;
+					current[i].access = write_bits(resources[previous].lastState.access);
+				}
+			}
+
+			for (uint32_t passIndex : order)
+			{
+				Pass& pass = passes[passIndex];
+				pass.barriers.clear();
+				for (const Use& use : pass.uses)
+				{
+					ImageState wanted = state_for(use);
+					ImageState& state = current[use.resource];
+
+					bool readAfterRead = state.layout == wanted.layout && touched[use.resource]
+						&& !write_bits(state.access) && !write_bits(wanted.access);
+					if (readAfterRead)
+					{
+						state.stages |= wanted.stages;
+						state.access |= wanted.access;
+						continue;
+					}
+
+					ImageState from = state;
+					from.access = write_bits(from.access);
+					pass.barriers.push_back({ use.resource, from, wanted });
+					state = wanted;
+					touched[use.resource] = true;
+				}
+			}
+
+			//imported images leave in the layout their next user expects
+			finalBarriers.clear();
+			for (RenderResource i = 0; i < resources.size(); i++)
+			{
+				Resource& resource = resources[i];
+				if (!resource.imported || !touched[i] || current[i].layout == resource.finalLayout)
+				{
+					continue;
+				}
+
+				ImageState to = {};
+				to.layout = resource.finalLayout;
+				switch (resource.finalLayout)
+				{
+				case vk::ImageLayout::eTransferSrcOptimal:
+					to.stages = vk::PipelineStageFlagBits::eTransfer;
+					to.access = vk::AccessFlagBits::eTransferRead;
+					break;
+				case vk::ImageLayout::eShaderReadOnlyOptimal:
+					to.stages = vk::PipelineStageFlagBits::eFragmentShader;
+					to.access = vk::AccessFlagBits::eShaderRead;
+					break;
+				default:
+					//presenting is ordered by the semaphore, no access to make visible
+					to.stages = vk::PipelineStageFlagBits::eBottomOfPipe;
+					break;
+				}
+
+				ImageState from = current[i];
+				from.access = write_bits(from.access);
+				finalBarriers.push_back({ i, from, to });
+			}
+		}
+
+		//one render pass per live pass with attachments, layouts already set by the graph's barriers
+		bool make_renderpasses(bool debug)
+		{
+			for (uint32_t passIndex : order)
+			{
+				Pass& pass = passes[passIndex];
+				pass.attachments.clear();
+
+				std::vector<vk::AttachmentDescription> attachments;
+				std::vector<vk::AttachmentReference> colorReferences;
+				vk::AttachmentReference depthReference = {};
+				bool hasDepth = false;
+
+				for (uint32_t useIndex = 0; useIndex < pass.uses.size(); useIndex++)
+				{
+					const Use& use = pass.uses[useIndex];
+					if (use.access == RenderAccess::ShaderRead)
+					{
+						continue;
+					}
+
+					vk::ImageLayout layout = state_for(use).layout;
+
+					vk::AttachmentDescription attachment = {};
+					attachment.format = resources[use.resource].description.format;
+					attachment.samples = vk::SampleCountFlagBits::e1;
+					attachment.loadOp = use.clear ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad;
+					attachment.storeOp = vk::AttachmentStoreOp::eStore;
+					attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+					attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+					attachment.initialLayout = layout;
+					attachment.finalLayout = layout;
+
+					//nothing after this pass reads it, the tile memory never has to be written out
+					if (!resources[use.resource].imported && resources[use.resource].lastUse == index_in_order(passIndex))
+					{
+						attachment.storeOp = vk::AttachmentStoreOp::eDontCare;
+					}
+
+					vk::AttachmentReference reference(static_cast<uint32_t>(attachments.size()), layout);
+					if (use.access == RenderAccess::ColorWrite)
+					{
+						colorReferences.push_back(reference);
+					}
+					else
+					{
+						depthReference = reference;
+						hasDepth = true;
+					}
+					attachments.push_back(attachment);
+					pass.attachments.push_back(useIndex);
+				}
+
+				if (attachments.empty())
+				{
+					continue;
+				}
+
+				vk::SubpassDescription subpass = {};
+				subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+				subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+				subpass.pColorAttachments = colorReferences.data();
+				subpass.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+				vk::RenderPassCreateInfo renderpassInfo = {};
+				renderpassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+				renderpassInfo.pAttachments = attachments.data();
+				renderpassInfo.subpassCount = 1;
+				renderpassInfo.pSubpasses = &subpass;
+
+				try
+				{
+					pass.renderpass = device.createRenderPass(renderpassInfo);
+				}
+				catch (vk::SystemError err)
+				{
+					if (debug)
+					{
+						std::cout << "Failed to create renderpass for pass \"" << pass.name << "\"" << std::endl;
+					}
+					return false;
+				}
+			}
+
+			if (debug)
+			{
+				for (const Pass& pass : passes)
+				{
+					if (!pass.live)
+					{
+						std::cout << "Render graph culled pass \"" << pass.name << "\"\n";
+					}
+				}
+				log_statistics();
+			}
+			return true;
+		}
+
+		uint32_t index_in_order(uint32_t passIndex) const
+		{
+			return static_cast<uint32_t>(std::find(order.begin(), order.end(), passIndex) - order.begin());
+		}
+
+		//imported views change every frame, framebuffers are cached per combination of views
+		vk::Framebuffer get_framebuffer(uint32_t passIndex)
+		{
+			Pass& pass = passes[passIndex];
+
+			std::vector<vk::ImageView> views;
+			uint64_t hash = hash_value(static_cast<VkRenderPass>(pass.renderpass));
+			hash = hash_value(graphExtent.width, hash);
+			hash = hash_value(graphExtent.height, hash);
+			for (uint32_t useIndex : pass.attachments)
+			{
+				views.push_back(resources[pass.uses[useIndex].resource].view);
+				hash = hash_value(static_cast<VkImageView>(views.back()), hash);
+			}
+
+			auto [first, last] = framebuffers.equal_range(hash);
+			for (auto found = first; found != last; ++found)
+			{
+				const CachedFramebuffer& cached = found->second;
+				if (cached.renderpass == pass.renderpass && cached.views == views
+					&& cached.extent.width == graphExtent.width && cached.extent.height == graphExtent.height)
+				{
+					return cached.framebuffer;
+				}
+			}
+
+			vk::FramebufferCreateInfo framebufferInfo = {};
+			framebufferInfo.renderPass = pass.renderpass;
+			framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+			framebufferInfo.pAttachments = views.data();
+			framebufferInfo.width = graphExtent.width;
+			framebufferInfo.height = graphExtent.height;
+			framebufferInfo.layers = 1;
+
+			vk::Framebuffer framebuffer = device.createFramebuffer(framebufferInfo);
+			framebuffers.emplace(hash, CachedFramebuffer{ pass.renderpass, std::move(views), graphExtent, framebuffer });
+			return framebuffer;
+		}
+
+		void record_barriers(vk::CommandBuffer commandBuffer, const std::vector<Barrier>& barriers)
+		{
+			if (barriers.empty())
+			{
+				return;
+			}
+
+			vk::PipelineStageFlags srcStages;
+			vk::PipelineStageFlags dstStages;
+			std::vector<vk::ImageMemoryBarrier> imageBarriers;
+			for (const Barrier& barrier : barriers)
+			{
+				const Resource& resource = resources[barrier.resource];
+
+				vk::ImageMemoryBarrier imageBarrier = {};
+				imageBarrier.oldLayout = barrier.from.layout;
+				imageBarrier.newLayout = barrier.to.layout;
+				imageBarrier.srcAccessMask = barrier.from.access;
+				imageBarrier.dstAccessMask = barrier.to.access;
+				imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				imageBarrier.image = resource.image;
+				imageBarrier.subresourceRange = vk::ImageSubresourceRange(resource.description.aspect, 0, 1, 0, 1);
+				imageBarriers.push_back(imageBarrier);
+
+				srcStages |= barrier.from.stages;
+				dstStages |= barrier.to.stages;
+			}
+
+			if (!srcStages)
+			{
+				srcStages = vk::PipelineStageFlagBits::eTopOfPipe;
+			}
+
+			commandBuffer.pipelineBarrier(
+				srcStages, dstStages, vk::DependencyFlags(),
+				0, nullptr, 0, nullptr,
+				static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data()
+			);
+		}
+
+		void destroy_compiled()
+		{
+			for (std::pair<const uint64_t, CachedFramebuffer>& framebuffer : framebuffers)
+			{
+				device.destroyFramebuffer(framebuffer.second.framebuffer);
+			}
+			framebuffers.clear();
+
+			for (Pass& pass : passes)
+			{
+				device.destroyRenderPass(pass.renderpass);
+				pass.renderpass = nullptr;
+				pass.barriers.clear();
+				pass.attachments.clear();
+			}
+
+			for (Resource& resource : resources)
+			{
+				if (!resource.imported)
+				{
+					device.destroyImageView(resource.view);
+					device.destroyImage(resource.image);
+					resource.view = nullptr;
+					resource.image = nullptr;
+				}
+			}
+			for (MemorySlot& slot : slots)
+			{
+				memoryManager->free_aliasing_memory(slot.allocation);
+			}
+			slots.clear();
+
+			order.clear();
+			finalBarriers.clear();
+			transientBytes = 0;
+			aliasedBytes = 0;
+		}
+	};
+}
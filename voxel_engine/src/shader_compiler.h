@@ -0,0 +1,337 @@
+#pragma once
+#include "config.h"
+#include "hash.h"
+#include <shaderc/shaderc.hpp>
+#include <thread>
+#include <atomic>
+#include <sstream>
+
+namespace vkUtil
+{
+	struct ShaderCompileInput
+	{
+		std::string filename;
+		shaderc_shader_kind kind;
+		std::vector<std::pair<std::string, std::string>> defines;
+		bool optimize = true;
+	};
+
+	struct ShaderCompileOutput
+	{
+		std::vector<uint32_t> spirv;
+		bool fromCache = false;
+		std::string errors;
+	};
+
+	//bump when anything about how shaders get compiled changes, invalidates every cached blob
+	constexpr uint32_t shaderCacheVersion = 1;
+
+	shaderc_shader_kind shader_kind_from_filename(const std::string& filename)
+	{
+		std::string extension = std::filesystem::path(filename).extension().string();
+
+		if (extension == ".vert") return shaderc_glsl_vertex_shader;
+		if (extension == ".frag") return shaderc_glsl_fragment_shader;
+		if (extension == ".comp") return shaderc_glsl_compute_shader;
+		if (extension == ".geom") return shaderc_glsl_geometry_shader;
+		if (extension == ".tesc") return shaderc_glsl_tess_control_shader;
+		if (extension == ".tese") return shaderc_glsl_tess_evaluation_shader;
+
+		return shaderc_glsl_infer_from_source;
+	}
+
+	std::string read_text_file(const std::string& filename)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open())
+		{
+			return {};
+		}
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		return buffer.str();
+	}
+
+	/*
+	* #include "x" is resolved relative to the including file,
+	* #include <x> relative to the shader root directory.
+	*/
+	std::string resolve_shader_include(const std::string& requested, bool relative, const std::string& requesting, const std::string& rootDirectory)
+	{
+		std::filesystem::path base = relative
+			? std::filesystem::path(requesting).parent_path()
+			: std::filesystem::path(rootDirectory);
+		return (base / requested).lexically_normal().generic_string();
+	}
+
+	//result, resolved name and contents live together until shaderc releases the include
+	struct ShaderInclude
+	{
+		shaderc_include_result result;
+		std::string name;
+		std::string content;
+	};
+
+	class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface
+	{
+	public:
+
+		ShaderIncluder(std::string rootDirectory) : rootDirectory(rootDirectory) {}
+
+		shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override
+		{
+			ShaderInclude* include = new ShaderInclude();
+			include->name = resolve_shader_include(requestedSource, type == shaderc_include_type_relative, requestingSource, rootDirectory);
+			include->content = read_text_file(include->name);
+
+			if (include->content.empty())
+			{
+				//an empty source name tells shaderc the include failed, content holds the message
+				include->content = "cannot open \"" + include->name + "\"";
+				include->name.clear();
+			}
+
+			include->result.source_name = include->name.c_str();
+			include->result.source_name_length = include->name.size();
+			include->result.content = include->content.c_str();
+			include->result.content_length = include->content.size();
+			include->result.user_data = include;
+			return &include->result;
+		}
+
+		void ReleaseInclude(shaderc_include_result* data) override
+		{
+			delete static_cast<ShaderInclude*>(data->user_data);
+		}
+
+	private:
+
+		std::string rootDirectory;
+	};
+
+	/*
+	* Appends the source and, recursively, everything it includes, so the cache key
+	* changes whenever any file that ends up in the shader changes.
+	*/
+	void collect_shader_sources(const std::string& filename, const std::string& rootDirectory, std::string& sources, std::set<std::string>& visited)
+	{
+		if (!visited.insert(filename).second)
+		{
+			return;
+		}
+
+		std::string source = read_text_file(filename);
+		sources += filename;
+		sources += '\n';
+		sources += source;
+
+		std::istringstream lines(source);
+		std::string line;
+		while (std::getline(lines, line))
+		{
+			size_t directive = line.find("#include");
+			if (directive == std::string::npos)
+			{
+				continue;
+			}
+
+			size_t open = line.find_first_of("\"<", directive);
+			if (open == std::string::npos)
+			{
+				continue;
+			}
+			bool relative = line[open] == '"';
+			size_t close = line.find(relative ? '"' : '>', open + 1);
+			if (close == std::string::npos)
+			{
+				continue;
+			}
+
+			std::string requested = line.substr(open + 1, close - open - 1);
+			collect_shader_sources(
+				resolve_shader_include(requested, relative, filename, rootDirectory),
+				rootDirectory, sources, visited
+			);
+		}
+	}
+
+	//content address of a compiled shader: sources, defines and compiler options
+	uint64_t hash_shader(const ShaderCompileInput& input, const std::string& rootDirectory)
+	{
+		std::string sources;
+		std::set<std::string> visited;
+		collect_shader_sources(input.filename, rootDirectory, sources, visited);
+
+		uint64_t hash = hash_value(shaderCacheVersion);
+		hash = hash_string(sources, hash);
+		hash = hash_value(static_cast<uint32_t>(input.kind), hash);
+		hash = hash_value(input.optimize, hash);
+		for (const std::pair<std::string, std::string>& define : input.defines)
+		{
+			hash = hash_string(define.first, hash);
+			hash = hash_string(define.second, hash);
+		}
+		return hash;
+	}
+
+	bool read_cached_spirv(const std::string& filename, std::vector<uint32_t>& spirv)
+	{
+		std::ifstream file(filename, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		size_t filesize{ static_cast<size_t>(file.tellg()) };
+		if (filesize == 0 || filesize % sizeof(uint32_t) != 0)
+		{
+			return false;
+		}
+
+		spirv.resize(filesize / sizeof(uint32_t));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(spirv.data()), filesize);
+		return file.good();
+	}
+
+	void write_cached_spirv(const std::string& filename, const std::vector<uint32_t>& spirv)
+	{
+		//unique temporary name, several workers may write the same blob at once
+		std::ostringstream temporaryFilename;
+		temporaryFilename << filename << '.' << std::this_thread::get_id() << ".tmp";
+
+		{
+			std::ofstream file(temporaryFilename.str(), std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				return;
+			}
+			file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryFilename.str(), filename, error);
+		if (error)
+		{
+			std::filesystem::remove(temporaryFilename.str(), error);
+		}
+	}
+
+	ShaderCompileOutput compile_glsl(const shaderc::Compiler& compiler, const ShaderCompileInput& input, const std::string& rootDirectory)
+	{
+		ShaderCompileOutput output = {};
+
+		std::string source = read_text_file(input.filename);
+		if (source.empty())
+		{
+			output.errors = "cannot open \"" + input.filename + "\"";
+			return output;
+		}
+
+		shaderc::CompileOptions options;
+		options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+		options.SetOptimizationLevel(input.optimize ? shaderc_optimization_level_performance : shaderc_optimization_level_zero);
+		for (const std::pair<std::string, std::string>& define : input.defines)
+		{
+			options.AddMacroDefinition(define.first, define.second);
+		}
+		options.SetIncluder(std::make_unique<ShaderIncluder>(rootDirectory));
+
+		shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(source, input.kind, input.filename.c_str(), options);
+
+		if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+		{
+			output.errors = result.GetErrorMessage();
+			return output;
+		}
+
+		output.spirv.assign(result.cbegin(), result.cend());
+		return output;
+	}
+
+	/*
+	* Compiles GLSL shaders to SPIR-V. Results are cached in cacheDirectory under the hash
+	* of their sources, defines and options: shaders found there are loaded without ever
+	* creating a compiler, the others are compiled in parallel across the available cores.
+	*/
+	std::vector<ShaderCompileOutput> compile_shaders(
+		const std::vector<ShaderCompileInput>& inputs,
+		const std::string& rootDirectory, const std::string& cacheDirectory, bool debug)
+	{
+		std::vector<ShaderCompileOutput> outputs(inputs.size());
+		std::vector<std::string> cacheFilenames(inputs.size());
+		std::vector<size_t> misses;
+
+		std::error_code error;
+		std::filesystem::create_directories(cacheDirectory, error);
+
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			cacheFilenames[i] = (std::filesystem::path(cacheDirectory)
+				/ (hash_to_string(hash_shader(inputs[i], rootDirectory)) + ".spv")).generic_string();
+
+			if (read_cached_spirv(cacheFilenames[i], outputs[i].spirv))
+			{
+				outputs[i].fromCache = true;
+			}
+			else
+			{
+				outputs[i].spirv.clear();
+				misses.push_back(i);
+			}
+		}
+
+		if (!misses.empty())
+		{
+			shaderc::Compiler compiler;
+
+			//compiling through a const compiler is safe from several threads
+			std::atomic<size_t> next{ 0 };
+			auto worker = [&]()
+			{
+				for (size_t job = next++; job < misses.size(); job = next++)
+				{
+					size_t i = misses[job];
+					outputs[i] = compile_glsl(compiler, inputs[i], rootDirectory);
+					if (!outputs[i].spirv.empty())
+					{
+						write_cached_spirv(cacheFilenames[i], outputs[i].spirv);
+					}
+				}
+			};
+
+			size_t workerCount = std::min<size_t>(misses.size(), std::max(1u, std::thread::hardware_concurrency()));
+			std::vector<std::thread> workers;
+			for (size_t i = 1; i < workerCount; i++)
+			{
+				workers.emplace_back(worker);
+			}
+			worker();
+			for (std::thread& thread : workers)
+			{
+				thread.join();
+			}
+		}
+
+		if (debug)
+		{
+			for (size_t i = 0; i < inputs.size(); i++)
+			{
+				if (outputs[i].fromCache)
+				{
+					std::cout << "Loaded \"" << inputs[i].filename << "\" from shader cache\n";
+				}
+				else if (!outputs[i].spirv.empty())
+				{
+					std::cout << "Compiled \"" << inputs[i].filename << "\"\n";
+				}
+				else
+				{
+					std::cout << "Failed to compile \"" << inputs[i].filename << "\":\n" << outputs[i].errors << '\n';
+				}
+			}
+		}
+
+		return outputs;
+	}
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include "config.h"
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <map>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace vkUtil
+{
+	/*
+	* Watches a shader directory (and its subdirectories) on a background thread
+	* and calls onChange from that thread with the files that changed.
+	* Uses inotify on Linux and polls modification times elsewhere.
+	*/
+	class ShaderWatcher
+	{
+	public:
+
+		using ChangeCallback = std::function<void(const std::vector<std::string>&)>;
+
+		ShaderWatcher(std::string directory, std::string ignoredDirectory, ChangeCallback onChange, bool debug) :
+			directory(directory),
+			ignoredDirectory(std::filesystem::path(ignoredDirectory).lexically_normal().generic_string()),
+			onChange(onChange),
+			debug(debug)
+		{
+			thread = std::thread(&ShaderWatcher::watch, this);
+		}
+
+		~ShaderWatcher()
+		{
+			running = false;
+			if (thread.joinable())
+			{
+				thread.join();
+			}
+		}
+
+		ShaderWatcher(const ShaderWatcher&) = delete;
+		ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	private:
+
+		std::string directory;
+		std::string ignoredDirectory;
+		ChangeCallback onChange;
+		bool debug;
+
+		std::atomic<bool> running{ true };
+		std::thread thread;
+
+		//editors save in several steps, wait for the burst of events to settle
+		static constexpr std::chrono::milliseconds settleTime{ 100 };
+		static constexpr std::chrono::milliseconds pollInterval{ 250 };
+
+		bool is_ignored(const std::filesystem::path& path)
+		{
+			std::string normalized = path.lexically_normal().generic_string();
+			return normalized.compare(0, ignoredDirectory.size(), ignoredDirectory) == 0;
+		}
+
+		std::vector<std::filesystem::path> watched_directories()
+		{
+			std::vector<std::filesystem::path> directories = { directory };
+
+			std::error_code error;
+			for (std::filesystem::recursive_directory_iterator it(directory, error), end; it != end; it.increment(error))
+			{
+				if (error)
+				{
+					break;
+				}
+				if (it->is_directory() && !is_ignored(it->path()))
+				{
+					directories.push_back(it->path());
+				}
+			}
+
+			return directories;
+		}
+
+		void notify(std::set<std::string>& changed)
+		{
+			if (changed.empty())
+			{
+				return;
+			}
+
+			std::vector<std::string> files(changed.begin(), changed.end());
+			changed.clear();
+
+			if (debug)
+			{
+				for (const std::string& file : files)
+				{
+					std::cout << "Shader changed: \"" << file << "\"\n";
+				}
+			}
+
+			onChange(files);
+		}
+
+#ifdef __linux__
+		void watch()
+		{
+			int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (fd < 0)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to initialize inotify, shader hot reload disabled\n";
+				}
+				return;
+			}
+
+			std::map<int, std::filesystem::path> watches;
+			for (const std::filesystem::path& path : watched_directories())
+			{
+				int wd = inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+				if (wd >= 0)
+				{
+					watches[wd] = path;
+				}
+			}
+
+			std::set<std::string> changed;
+			alignas(inotify_event) char buffer[4096];
+
+			while (running)
+			{
+				pollfd descriptor = { fd, POLLIN, 0 };
+				int timeout = static_cast<int>(changed.empty() ? pollInterval.count() : settleTime.count());
+				int ready = poll(&descriptor, 1, timeout);
+
+				if (ready <= 0)
+				{
+					//timed out with nothing new: the burst is over
+					notify(changed);
+					continue;
+				}
+
+				ssize_t length = read(fd, buffer, sizeof(buffer));
+				for (ssize_t offset = 0; offset < length; )
+				{
+					const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+					offset += sizeof(inotify_event) + event->len;
+
+					if (event->len == 0 || watches.find(event->wd) == watches.end())
+					{
+						continue;
+					}
+
+					std::filesystem::path path = watches[event->wd] / event->name;
+					if (event->mask & IN_ISDIR)
+					{
+						//new subdirectory, start watching it too
+						if ((event->mask & IN_CREATE) && !is_ignored(path))
+						{
+							int wd = inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+							if (wd >= 0)
+							{
+								watches[wd] = path;
+							}
+						}
+						continue;
+					}
+
+					if (!is_ignored(path))
+					{
+						changed.insert(path.lexically_normal().generic_string());
+					}
+				}
+			}
+
+			close(fd);
+		}
+#else
+		void watch()
+		{
+			std::map<std::string, std::filesystem::file_time_type> writeTimes;
+
+			auto scan = [&](std::set<std::string>& changed)
+			{
+				std::error_code error;
+				for (std::filesystem::recursive_directory_iterator it(directory, error), end; it != end; it.increment(error))
+				{
+					if (error)
+					{
+						break;
+					}
+					if (!it->is_regular_file() || is_ignored(it->path()))
+					{
+						continue;
+					}
+
+					std::string file = it->path().lexically_normal().generic_string();
+					std::filesystem::file_time_type writeTime = it->last_write_time(error);
+
+					auto known = writeTimes.find(file);
+					if (known == writeTimes.end() || known->second != writeTime)
+					{
+						writeTimes[file] = writeTime;
+						changed.insert(file);
+					}
+				}
+			};
+
+			//first scan only records the current state
+			std::set<std::string> changed;
+			scan(changed);
+			changed.clear();
+
+			while (running)
+			{
+				std::this_thread::sleep_for(changed.empty() ? pollInterval : settleTime);
+
+				size_t before = changed.size();
+				scan(changed);
+
+				//nothing new since the last scan: the burst is over
+				if (changed.size() == before)
+				{
+					notify(changed);
+				}
+			}
+		}
+#endif
+	};
+}
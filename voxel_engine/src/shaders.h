@@ -7,9 +7,13 @@ namespace vkUtil
 	{
 		std::ifstream file(filename, std::iostream::ate | std::iostream::binary);
 
-		if (debug && !file.is_open())
+		if (!file.is_open())
 		{
-			std::cout << "Failed to load \"" << filename << "\"" << std::endl;
+			if (debug)
+			{
+				std::cout << "Failed to load \"" << filename << "\"" << std::endl;
+			}
+			return {};
 		}
 
 		size_t filesize{ static_cast<size_t>(file.tellg()) };
@@ -22,6 +26,37 @@ namespace vkUtil
 		return buffer;
 	}
 
+	std::vector<uint32_t> readSpirv(std::string filename, bool debug)
+	{
+		std::vector<char> bytes = readFile(filename, debug);
+
+		std::vector<uint32_t> code(bytes.size() / sizeof(uint32_t));
+		memcpy(code.data(), bytes.data(), code.size() * sizeof(uint32_t));
+		return code;
+	}
+
+	vk::ShaderModule createModule(const std::vector<uint32_t>& code, std::string name, vk::Device device, bool debug)
+	{
+		vk::ShaderModuleCreateInfo moduleInfo = vk::ShaderModuleCreateInfo{};
+		moduleInfo.flags = vk::ShaderModuleCreateFlags();
+		moduleInfo.codeSize = code.size() * sizeof(uint32_t);
+		moduleInfo.pCode = code.data();
+
+		try
+		{
+			return device.createShaderModule(moduleInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create shader module for \"" << name << "\"" << std::endl;
+			}
+		}
+
+		return nullptr;
+	}
+
 	vk::ShaderModule createModule(std::string filename, vk::Device device, bool debug)
 	{
 		std::vector<char> sourceCode = readFile(filename, debug);
@@ -0,0 +1,75 @@
+#pragma once
+#include "config.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VOXEL_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//MSVC compiles intrinsics of any instruction set, they are only called after the CPU check
+#define VOXEL_TARGET_SSE41
+#define VOXEL_TARGET_AVX2
+#else
+#define VOXEL_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define VOXEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace vkUtil
+{
+	enum class SimdLevel
+	{
+		Scalar,
+		SSE41,
+		AVX2
+	};
+
+	const char* simd_level_name(SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::AVX2:
+			return "AVX2";
+		case SimdLevel::SSE41:
+			return "SSE4.1";
+		default:
+			return "scalar";
+		}
+	}
+
+	//the widest instruction set both the CPU and the OS support
+	SimdLevel detect_simd_level()
+	{
+#if defined(VOXEL_SIMD_X86)
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		bool sse41 = (info[2] & (1 << 19)) != 0;
+		bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+
+		bool avx2 = false;
+		if (maxLeaf >= 7 && osSavesAvx)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+		bool sse41 = __builtin_cpu_supports("sse4.1");
+		bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+		if (avx2)
+		{
+			return SimdLevel::AVX2;
+		}
+		if (sse41)
+		{
+			return SimdLevel::SSE41;
+		}
+#endif
+		return SimdLevel::Scalar;
+	}
+}
@@ -0,0 +1,454 @@
+#pragma once
+#include "config.h"
+#include "job_pool.h"
+#include "simd.h"
+#include <glm/glm.hpp>
+#include <limits>
+
+namespace vkUtil
+{
+	//a box that is solid all the way through, anything behind it from every direction is hidden
+	struct OccluderBox
+	{
+		std::array<float, 3> boundsMin;
+		std::array<float, 3> boundsMax;
+	};
+
+	/*
+	* Masked software occlusion culling (after Andersson et al., "Masked Software Occlusion Culling").
+	* Occluder boxes are rasterized into a low resolution buffer of 8x4 pixel tiles. A tile keeps no
+	* per pixel depth, only a coverage mask and two depths: the farthest depth of a layer that covers
+	* all of it (the reference) and of the partly covered layer being built (the working layer). When the
+	* working layer fills the tile it becomes the reference. Testing a box is one compare per tile its
+	* screen rectangle touches: it is hidden when it is nearer than no tile's reference.
+	* Coverage masks come from edge functions evaluated 8 (AVX2) or 4 (SSE4.1) pixels at a time.
+	* Reverse-Z throughout: larger depth is nearer, the far plane is 0.
+	*/
+	class SoftwareOcclusion
+	{
+	public:
+
+		SoftwareOcclusion(SimdLevel simdLevel, bool debug) :
+			simdLevel(simdLevel)
+		{
+			if (debug)
+			{
+				std::cout << "Software occlusion culling with " << simd_level_name(simdLevel) << " rasterization\n";
+			}
+		}
+
+		//the buffer's resolution, rounded up to whole tiles
+		void resize(uint32_t width, uint32_t height)
+		{
+			tilesX = std::max((width + tileWidth - 1) / tileWidth, 1u);
+			tilesY = std::max((height + tileHeight - 1) / tileHeight, 1u);
+			tiles.assign(tilesX * tilesY, Tile());
+		}
+
+		/*
+		* Clears the buffer and rasterizes the front faces of the boxes, split into bands of tile rows
+		* over the job pool. Boxes the camera is inside of or that cross the near plane are skipped,
+		* leaving an occluder out only ever makes the culling less effective, never wrong.
+		*/
+		void render(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, const std::vector<OccluderBox>& boxes, JobPool* jobs)
+		{
+			std::fill(tiles.begin(), tiles.end(), Tile());
+
+			triangles.clear();
+			for (const OccluderBox& box : boxes)
+			{
+				setup_box(viewProjection, cameraPosition, box);
+			}
+
+			uint32_t bandCount = jobs ? std::min(tilesY, jobs->get_thread_count() * bandsPerThread) : 1;
+			auto rasterize_band = [this, bandCount](uint32_t band, uint32_t thread)
+			{
+				uint32_t firstRow = tilesY * band / bandCount;
+				uint32_t lastRow = tilesY * (band + 1) / bandCount;
+				for (const Triangle& triangle : triangles)
+				{
+					rasterize(triangle, firstRow, lastRow);
+				}
+			};
+
+			if (jobs)
+			{
+				jobs->run(bandCount, rasterize_band);
+			}
+			else
+			{
+				rasterize_band(0, 0);
+			}
+		}
+
+		//false when the box is certainly hidden behind the occluders rendered this frame
+		bool test_box(const glm::mat4& viewProjection, const std::array<float, 3>& boundsMin, const std::array<float, 3>& boundsMax) const
+		{
+			glm::vec2 rectMin(std::numeric_limits<float>::max());
+			glm::vec2 rectMax(-std::numeric_limits<float>::max());
+			float nearestDepth = 0.0f;
+
+			for (int i = 0; i < 8; i++)
+			{
+				glm::vec4 corner(
+					(i & 1) ? boundsMax[0] : boundsMin[0],
+					(i & 2) ? boundsMax[1] : boundsMin[1],
+					(i & 4) ? boundsMax[2] : boundsMin[2], 1.0f);
+				glm::vec4 clip = viewProjection * corner;
+
+				//reaches in front of the near plane: too close to say anything about
+				if (clip.w <= 0.0f || clip.z > clip.w)
+				{
+					return true;
+				}
+
+				glm::vec3 ndc = glm::vec3(clip) / clip.w;
+				glm::vec2 pixel = to_pixels(ndc);
+				rectMin = glm::min(rectMin, pixel);
+				rectMax = glm::max(rectMax, pixel);
+				nearestDepth = std::max(nearestDepth, ndc.z);
+			}
+
+			int firstX = std::max(static_cast<int>(std::floor(rectMin.x)) / static_cast<int>(tileWidth), 0);
+			int firstY = std::max(static_cast<int>(std::floor(rectMin.y)) / static_cast<int>(tileHeight), 0);
+			int lastX = std::min(static_cast<int>(std::floor(rectMax.x)) / static_cast<int>(tileWidth), static_cast<int>(tilesX) - 1);
+			int lastY = std::min(static_cast<int>(std::floor(rectMax.y)) / static_cast<int>(tileHeight), static_cast<int>(tilesY) - 1);
+
+			for (int y = firstY; y <= lastY; y++)
+			{
+				for (int x = firstX; x <= lastX; x++)
+				{
+					if (nearestDepth >= tiles[y * tilesX + x].depth)
+					{
+						return true;
+					}
+				}
+			}
+
+			//nearer than no tile it touches
+			return false;
+		}
+
+		SimdLevel get_simd_level() const
+		{
+			return simdLevel;
+		}
+
+		uint32_t get_triangle_count() const
+		{
+			return static_cast<uint32_t>(triangles.size());
+		}
+
+		uint32_t get_width() const
+		{
+			return tilesX * tileWidth;
+		}
+
+		uint32_t get_height() const
+		{
+			return tilesY * tileHeight;
+		}
+
+	private:
+
+		static constexpr uint32_t tileWidth = 8;
+		static constexpr uint32_t tileHeight = 4;
+		static constexpr uint32_t fullCoverage = 0xFFFFFFFF;
+		static constexpr uint32_t bandsPerThread = 2;
+
+		struct Tile
+		{
+			//farthest depth of a layer covering the whole tile, nothing is known to be nearer than the far plane yet
+			float depth{ 0.0f };
+
+			//farthest depth and coverage of the layer being built, bit row * 8 + column
+			float workingDepth{ 1.0f };
+			uint32_t mask{ 0 };
+		};
+
+		//edge functions a * x + b * y + c, positive inside, and the depth plane, in buffer pixels
+		struct Triangle
+		{
+			float a[3];
+			float b[3];
+			float c[3];
+			float depthX;
+			float depthY;
+			float depthOffset;
+			float farthestVertex;
+			int firstTileX;
+			int firstTileY;
+			int lastTileX;
+			int lastTileY;
+		};
+
+		SimdLevel simdLevel;
+		uint32_t tilesX{ 0 };
+		uint32_t tilesY{ 0 };
+		std::vector<Tile> tiles;
+		std::vector<Triangle> triangles;
+
+		glm::vec2 to_pixels(const glm::vec3& ndc) const
+		{
+			return glm::vec2(
+				(ndc.x * 0.5f + 0.5f) * static_cast<float>(tilesX * tileWidth),
+				(ndc.y * 0.5f + 0.5f) * static_cast<float>(tilesY * tileHeight));
+		}
+
+		//the faces the camera sees, two triangles each
+		void setup_box(const glm::mat4& viewProjection, const glm::vec3& cameraPosition, const OccluderBox& box)
+		{
+			glm::vec3 boxMin(box.boundsMin[0], box.boundsMin[1], box.boundsMin[2]);
+			glm::vec3 boxMax(box.boundsMax[0], box.boundsMax[1], box.boundsMax[2]);
+			if (glm::all(glm::greaterThanEqual(cameraPosition, boxMin)) && glm::all(glm::lessThanEqual(cameraPosition, boxMax)))
+			{
+				return;
+			}
+
+			glm::vec3 corners[8];
+			for (int i = 0; i < 8; i++)
+			{
+				glm::vec4 clip = viewProjection * glm::vec4(
+					(i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z, 1.0f);
+				if (clip.w <= 0.0f || clip.z > clip.w)
+				{
+					return;
+				}
+				glm::vec3 ndc = glm::vec3(clip) / clip.w;
+				corners[i] = glm::vec3(to_pixels(ndc), ndc.z);
+			}
+
+			//corner indices of each face, min side then max side per axis
+			const int faces[6][4] = {
+				{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+				{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+				{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+			};
+			for (int face = 0; face < 6; face++)
+			{
+				int axis = face / 2;
+				bool facing = face % 2 == 0 ? cameraPosition[axis] < boxMin[axis] : cameraPosition[axis] > boxMax[axis];
+				if (!facing)
+				{
+					continue;
+				}
+				const int* quad = faces[face];
+				setup_triangle(corners[quad[0]], corners[quad[1]], corners[quad[2]]);
+				setup_triangle(corners[quad[0]], corners[quad[2]], corners[quad[3]]);
+			}
+		}
+
+		void setup_triangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+		{
+			const glm::vec3* vertices[3] = { &v0, &v1, &v2 };
+
+			Triangle triangle = {};
+			for (int edge = 0; edge < 3; edge++)
+			{
+				const glm::vec3& from = *vertices[edge];
+				const glm::vec3& to = *vertices[(edge + 1) % 3];
+				triangle.a[edge] = from.y - to.y;
+				triangle.b[edge] = to.x - from.x;
+				triangle.c[edge] = from.x * to.y - from.y * to.x;
+			}
+
+			//either winding rasterizes, the edges are flipped so the inside is positive
+			float area = triangle.a[0] * v2.x + triangle.b[0] * v2.y + triangle.c[0];
+			if (std::abs(area) < 1e-6f)
+			{
+				return;
+			}
+			if (area < 0.0f)
+			{
+				for (int edge = 0; edge < 3; edge++)
+				{
+					triangle.a[edge] = -triangle.a[edge];
+					triangle.b[edge] = -triangle.b[edge];
+					triangle.c[edge] = -triangle.c[edge];
+				}
+			}
+
+			glm::vec3 d1 = v1 - v0;
+			glm::vec3 d2 = v2 - v0;
+			float determinant = d1.x * d2.y - d2.x * d1.y;
+			triangle.depthX = (d1.z * d2.y - d2.z * d1.y) / determinant;
+			triangle.depthY = (d2.z * d1.x - d1.z * d2.x) / determinant;
+			triangle.depthOffset = v0.z - triangle.depthX * v0.x - triangle.depthY * v0.y;
+			triangle.farthestVertex = std::min({ v0.z, v1.z, v2.z });
+
+			float minX = std::min({ v0.x, v1.x, v2.x });
+			float maxX = std::max({ v0.x, v1.x, v2.x });
+			float minY = std::min({ v0.y, v1.y, v2.y });
+			float maxY = std::max({ v0.y, v1.y, v2.y });
+			triangle.firstTileX = std::max(static_cast<int>(std::floor(minX)) / static_cast<int>(tileWidth), 0);
+			triangle.firstTileY = std::max(static_cast<int>(std::floor(minY)) / static_cast<int>(tileHeight), 0);
+			triangle.lastTileX = std::min(static_cast<int>(std::floor(maxX)) / static_cast<int>(tileWidth), static_cast<int>(tilesX) - 1);
+			triangle.lastTileY = std::min(static_cast<int>(std::floor(maxY)) / static_cast<int>(tileHeight), static_cast<int>(tilesY) - 1);
+			if (triangle.firstTileX > triangle.lastTileX || triangle.firstTileY > triangle.lastTileY)
+			{
+				return;
+			}
+			triangles.push_back(triangle);
+		}
+
+		//the triangle's tiles in rows [firstRow, lastRow)
+		void rasterize(const Triangle& triangle, uint32_t firstRow, uint32_t lastRow)
+		{
+			int firstY = std::max(triangle.firstTileY, static_cast<int>(firstRow));
+			int lastY = std::min(triangle.lastTileY, static_cast<int>(lastRow) - 1);
+
+			for (int tileY = firstY; tileY <= lastY; tileY++)
+			{
+				for (int tileX = triangle.firstTileX; tileX <= triangle.lastTileX; tileX++)
+				{
+					float x = static_cast<float>(tileX * tileWidth);
+					float y = static_cast<float>(tileY * tileHeight);
+
+					//edges at the outermost pixel centers: all outside one edge or all inside every edge
+					bool outside = false;
+					bool inside = true;
+					for (int edge = 0; edge < 3; edge++)
+					{
+						float base = triangle.a[edge] * (x + 0.5f) + triangle.b[edge] * (y + 0.5f) + triangle.c[edge];
+						float stepX = triangle.a[edge] * (tileWidth - 1);
+						float stepY = triangle.b[edge] * (tileHeight - 1);
+						float lowest = base + std::min(stepX, 0.0f) + std::min(stepY, 0.0f);
+						float highest = base + std::max(stepX, 0.0f) + std::max(stepY, 0.0f);
+						outside |= highest < 0.0f;
+						inside &= lowest >= 0.0f;
+					}
+					if (outside)
+					{
+						continue;
+					}
+
+					uint32_t coverage = inside ? fullCoverage : coverage_mask(triangle, x, y);
+					if (coverage == 0)
+					{
+						continue;
+					}
+
+					//the plane's farthest point over the tile, no farther than the farthest vertex
+					float corner = triangle.depthX * x + triangle.depthY * y + triangle.depthOffset;
+					float farthest = corner + std::min(triangle.depthX * tileWidth, 0.0f) + std::min(triangle.depthY * tileHeight, 0.0f);
+					merge(tiles[tileY * tilesX + tileX], coverage, std::max(farthest, triangle.farthestVertex));
+				}
+			}
+		}
+
+		/*
+		* A triangle nearer to the reference than to the working layer would drag the working layer
+		* back, so the working layer is dropped and restarted with it. Dropping coverage is always safe.
+		*/
+		static void merge(Tile& tile, uint32_t coverage, float depth)
+		{
+			if (depth <= tile.depth)
+			{
+				return;
+			}
+			if (tile.mask != 0 && tile.workingDepth - depth > depth - tile.depth)
+			{
+				tile.workingDepth = 1.0f;
+				tile.mask = 0;
+			}
+
+			tile.workingDepth = std::min(tile.workingDepth, depth);
+			tile.mask |= coverage;
+			if (tile.mask == fullCoverage)
+			{
+				tile.depth = tile.workingDepth;
+				tile.workingDepth = 1.0f;
+				tile.mask = 0;
+			}
+		}
+
+		uint32_t coverage_mask(const Triangle& triangle, float x, float y) const
+		{
+#if defined(VOXEL_SIMD_X86)
+			if (simdLevel == SimdLevel::AVX2)
+			{
+				return coverage_mask_avx2(triangle, x, y);
+			}
+			if (simdLevel == SimdLevel::SSE41)
+			{
+				return coverage_mask_sse41(triangle, x, y);
+			}
+#endif
+			return coverage_mask_scalar(triangle, x, y);
+		}
+
+		static uint32_t coverage_mask_scalar(const Triangle& triangle, float x, float y)
+		{
+			uint32_t mask = 0;
+			for (uint32_t row = 0; row < tileHeight; row++)
+			{
+				for (uint32_t column = 0; column < tileWidth; column++)
+				{
+					float pixelX = x + column + 0.5f;
+					float pixelY = y + row + 0.5f;
+					bool inside = true;
+					for (int edge = 0; edge < 3; edge++)
+					{
+						inside &= triangle.a[edge] * pixelX + triangle.b[edge] * pixelY + triangle.c[edge] >= 0.0f;
+					}
+					mask |= inside ? 1u << (row * tileWidth + column) : 0u;
+				}
+			}
+			return mask;
+		}
+
+#if defined(VOXEL_SIMD_X86)
+		//a row of 8 pixels as two halves of 4
+		VOXEL_TARGET_SSE41 static uint32_t coverage_mask_sse41(const Triangle& triangle, float x, float y)
+		{
+			const __m128 columnsLow = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 columnsHigh = _mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f);
+
+			uint32_t mask = 0;
+			for (uint32_t row = 0; row < tileHeight; row++)
+			{
+				__m128 insideLow = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				__m128 insideHigh = insideLow;
+				for (int edge = 0; edge < 3; edge++)
+				{
+					__m128 a = _mm_set1_ps(triangle.a[edge]);
+					__m128 rowBase = _mm_set1_ps(triangle.a[edge] * x + triangle.b[edge] * (y + row + 0.5f) + triangle.c[edge]);
+					insideLow = _mm_and_ps(insideLow, _mm_cmpge_ps(_mm_add_ps(rowBase, _mm_mul_ps(a, columnsLow)), _mm_setzero_ps()));
+					insideHigh = _mm_and_ps(insideHigh, _mm_cmpge_ps(_mm_add_ps(rowBase, _mm_mul_ps(a, columnsHigh)), _mm_setzero_ps()));
+				}
+
+				//nothing in this row, skip packing it
+				__m128i rowInside = _mm_castps_si128(_mm_or_ps(insideLow, insideHigh));
+				if (_mm_testz_si128(rowInside, rowInside))
+				{
+					continue;
+				}
+				uint32_t bits = static_cast<uint32_t>(_mm_movemask_ps(insideLow)) | (static_cast<uint32_t>(_mm_movemask_ps(insideHigh)) << 4);
+				mask |= bits << (row * tileWidth);
+			}
+			return mask;
+		}
+
+		//a row of 8 pixels per register
+		VOXEL_TARGET_AVX2 static uint32_t coverage_mask_avx2(const Triangle& triangle, float x, float y)
+		{
+			const __m256 columns = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+
+			uint32_t mask = 0;
+			for (uint32_t row = 0; row < tileHeight; row++)
+			{
+				__m256i inside = _mm256_set1_epi32(-1);
+				for (int edge = 0; edge < 3; edge++)
+				{
+					__m256 a = _mm256_set1_ps(triangle.a[edge]);
+					__m256 rowBase = _mm256_set1_ps(triangle.a[edge] * x + triangle.b[edge] * (y + row + 0.5f) + triangle.c[edge]);
+					__m256 distance = _mm256_add_ps(rowBase, _mm256_mul_ps(a, columns));
+					inside = _mm256_and_si256(inside, _mm256_castps_si256(_mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ)));
+				}
+				mask |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(inside))) << (row * tileWidth);
+			}
+			return mask;
+		}
+#endif
+	};
+}
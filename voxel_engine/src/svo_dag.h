@@ -0,0 +1,385 @@
+#pragma once
+#include "config.h"
+#include "chunk.h"
+#include "chunk_map.h"
+#include "hash.h"
+#include <unordered_set>
+#include <bitset>
+#include <unordered_map>
+
+namespace vkUtil
+{
+	/*
+	* Far field terrain as a sparse voxel octree with identical subtrees merged into one (a DAG).
+	* The world is cut into regions of regionChunks^3 chunks, each with its own root.
+	*
+	* Everything lives in one array of 32 bit words that can be uploaded as is and ray marched:
+	* a node is a header word whose low 8 bits say which octants are present, followed by one child
+	* reference per present octant in octant order (bit 0 of the octant is +x, bit 1 +y, bit 2 +z).
+	* A reference is 0 for empty space, terminalBit | id for a cube of a single voxel id however large,
+	* or otherwise the index of the child's header. Word 0 is never a node.
+	*
+	* Nodes are hash-consed as they are built, a node identical to an existing one is never stored
+	* twice, and a cube of one id collapses to a terminal reference without any node at all. Nodes are
+	* reference counted: updating a chunk rebuilds only its subtree and its region's top levels, the
+	* nodes nothing references anymore stay around (and can be revived) until compact() drops them.
+	*/
+	class SvoDag
+	{
+	public:
+
+		static constexpr uint32_t terminalBit = 0x80000000u;
+
+		//regionChunks is rounded up to a power of two, chunks must be cubes of a power of two too
+		SvoDag(uint32_t regionChunks, bool debug) :
+			regionChunks(next_power_of_two(regionChunks)),
+			nodeSet(0, NodeHash{ this }, NodeEqual{ this })
+		{
+			nodes.push_back(0);
+			refCounts.push_back(0);
+
+			if (debug)
+			{
+				std::cout << "Sparse voxel DAG: regions of " << this->regionChunks << "^3 chunks\n";
+			}
+		}
+
+		SvoDag(const SvoDag&) = delete;
+		SvoDag& operator=(const SvoDag&) = delete;
+
+		/*
+		* Rebuilds the chunk at coordinate from its voxels, null when it was removed. The chunk's
+		* subtree is shared with every identical one already stored, so unchanged terrain costs a
+		* lookup per node rather than new nodes.
+		*/
+		void update_chunk(const ChunkCoordinate& coordinate, const Chunk* chunk)
+		{
+			ChunkCoordinate regionCoordinate;
+			uint32_t chunkIndex = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				int32_t size = static_cast<int32_t>(regionChunks);
+				regionCoordinate[axis] = coordinate[axis] >= 0 ? coordinate[axis] / size : (coordinate[axis] - size + 1) / size;
+				uint32_t local = static_cast<uint32_t>(coordinate[axis] - regionCoordinate[axis] * size);
+				chunkIndex += local * (axis == 0 ? 1 : axis == 1 ? regionChunks * regionChunks : regionChunks);
+			}
+
+			uint64_t regionKey = morton_key(regionCoordinate);
+			auto found = regions.find(regionKey);
+			if (found == regions.end())
+			{
+				if (!chunk)
+				{
+					return;
+				}
+				found = regions.emplace(regionKey, Region{ regionCoordinate, std::vector<uint32_t>(regionChunks * regionChunks * regionChunks, 0), 0 }).first;
+			}
+			Region& region = found->second;
+
+			uint32_t reference = chunk ? build_chunk(*chunk) : 0;
+			acquire(reference);
+			release(region.chunkRoots[chunkIndex]);
+			region.chunkRoots[chunkIndex] = reference;
+
+			uint32_t root = build_region(region, 0, 0, 0, regionChunks);
+			acquire(root);
+			release(region.root);
+			region.root = root;
+
+			//an empty region keeps nothing alive, forget it
+			if (root == 0)
+			{
+				regions.erase(found);
+			}
+
+			if (garbageWords > live_words())
+			{
+				compact();
+			}
+		}
+
+		//drops nodes nothing references and closes the gaps, every reference is renumbered
+		void compact()
+		{
+			std::vector<uint32_t> remap(nodes.size(), 0);
+			std::vector<uint32_t> compacted = { 0 };
+			std::vector<uint32_t> compactedCounts = { 0 };
+
+			//children are always stored before their parents, one pass in order sees them first
+			for (uint32_t offset = 1; offset < nodes.size(); offset += node_size(offset))
+			{
+				if (refCounts[offset] == 0)
+				{
+					continue;
+				}
+				remap[offset] = static_cast<uint32_t>(compacted.size());
+				compacted.push_back(nodes[offset]);
+				compactedCounts.push_back(refCounts[offset]);
+				for (uint32_t child = 1; child < node_size(offset); child++)
+				{
+					compacted.push_back(remap_reference(remap, nodes[offset + child]));
+					compactedCounts.push_back(0);
+				}
+			}
+
+			for (auto& [key, region] : regions)
+			{
+				region.root = remap_reference(remap, region.root);
+				for (uint32_t& chunkRoot : region.chunkRoots)
+				{
+					chunkRoot = remap_reference(remap, chunkRoot);
+				}
+			}
+
+			nodes = std::move(compacted);
+			refCounts = std::move(compactedCounts);
+			garbageWords = 0;
+
+			nodeSet.clear();
+			for (uint32_t offset = 1; offset < nodes.size(); offset += node_size(offset))
+			{
+				nodeSet.insert(offset);
+			}
+		}
+
+		//the node array to upload, see the class comment for its layout
+		const std::vector<uint32_t>& get_nodes() const
+		{
+			return nodes;
+		}
+
+		//reference to the root of a region, a cube of regionChunks * chunk size voxels
+		uint32_t get_region_root(const ChunkCoordinate& regionCoordinate) const
+		{
+			auto found = regions.find(morton_key(regionCoordinate));
+			return found != regions.end() ? found->second.root : 0;
+		}
+
+		template<typename Callback>
+		void for_each_region(Callback callback) const
+		{
+			for (const auto& [key, region] : regions)
+			{
+				callback(region.coordinate, region.root);
+			}
+		}
+
+		uint32_t get_region_chunks() const
+		{
+			return regionChunks;
+		}
+
+		//bytes of the live node array, what a GPU copy would cost after compact()
+		size_t memory_bytes() const
+		{
+			return live_words() * sizeof(uint32_t);
+		}
+
+		//nodes something references, unreferenced ones waiting for compact() are not counted
+		size_t get_node_count() const
+		{
+			return liveNodes;
+		}
+
+	private:
+
+		struct Region
+		{
+			ChunkCoordinate coordinate;
+
+			//reference per chunk, x fastest then z then y like voxels in a chunk
+			std::vector<uint32_t> chunkRoots;
+			uint32_t root;
+		};
+
+		//nodes are identified by their offset, hashed and compared by their words
+		struct NodeHash
+		{
+			const SvoDag* dag;
+
+			size_t operator()(uint32_t offset) const
+			{
+				return static_cast<size_t>(hash_bytes(&dag->nodes[offset], dag->node_size(offset) * sizeof(uint32_t)));
+			}
+		};
+
+		struct NodeEqual
+		{
+			const SvoDag* dag;
+
+			bool operator()(uint32_t a, uint32_t b) const
+			{
+				uint32_t size = dag->node_size(a);
+				return size == dag->node_size(b) && std::equal(&dag->nodes[a], &dag->nodes[a] + size, &dag->nodes[b]);
+			}
+		};
+
+		uint32_t regionChunks;
+		std::vector<uint32_t> nodes;
+
+		//references from parent nodes and region roots, kept at the offset of each node's header
+		std::vector<uint32_t> refCounts;
+		size_t garbageWords{ 0 };
+		size_t liveNodes{ 0 };
+
+		std::unordered_set<uint32_t, NodeHash, NodeEqual> nodeSet;
+		std::unordered_map<uint64_t, Region> regions;
+
+		//scratch for decoding chunks
+		std::vector<VoxelId> voxels;
+
+		static uint32_t next_power_of_two(uint32_t value)
+		{
+			uint32_t power = 1;
+			while (power < value)
+			{
+				power *= 2;
+			}
+			return power;
+		}
+
+		static bool is_node(uint32_t reference)
+		{
+			return reference != 0 && (reference & terminalBit) == 0;
+		}
+
+		static uint32_t terminal(VoxelId id)
+		{
+			return id == airVoxel ? 0 : terminalBit | id;
+		}
+
+		uint32_t node_size(uint32_t offset) const
+		{
+			return 1 + static_cast<uint32_t>(std::bitset<8>(nodes[offset] & 0xFF).count());
+		}
+
+		size_t live_words() const
+		{
+			return nodes.size() - 1 - garbageWords;
+		}
+
+		static uint32_t remap_reference(const std::vector<uint32_t>& remap, uint32_t reference)
+		{
+			return is_node(reference) ? remap[reference] : reference;
+		}
+
+		/*
+		* Stores the node made of these children unless an identical one exists. Eight equal
+		* terminal children are that terminal, no node needed. New nodes start unreferenced and
+		* count as garbage until acquired.
+		*/
+		uint32_t make_node(const std::array<uint32_t, 8>& children)
+		{
+			if (!is_node(children[0]) && std::all_of(children.begin(), children.end(), [&](uint32_t child) { return child == children[0]; }))
+			{
+				return children[0];
+			}
+
+			//appended as a candidate, an existing equal node wins and the candidate is dropped
+			uint32_t offset = static_cast<uint32_t>(nodes.size());
+			uint32_t mask = 0;
+			nodes.push_back(0);
+			for (uint32_t octant = 0; octant < 8; octant++)
+			{
+				if (children[octant] != 0)
+				{
+					mask |= 1u << octant;
+					nodes.push_back(children[octant]);
+				}
+			}
+			nodes[offset] = mask;
+
+			auto [existing, inserted] = nodeSet.insert(offset);
+			if (!inserted)
+			{
+				nodes.resize(offset);
+				return *existing;
+			}
+			refCounts.resize(nodes.size(), 0);
+			garbageWords += node_size(offset);
+			return offset;
+		}
+
+		//a node going from unreferenced to referenced takes references on its children again
+		void acquire(uint32_t reference)
+		{
+			if (!is_node(reference))
+			{
+				return;
+			}
+			if (refCounts[reference]++ == 0)
+			{
+				garbageWords -= node_size(reference);
+				liveNodes++;
+				for (uint32_t child = 1; child < node_size(reference); child++)
+				{
+					acquire(nodes[reference + child]);
+				}
+			}
+		}
+
+		void release(uint32_t reference)
+		{
+			if (!is_node(reference))
+			{
+				return;
+			}
+			if (--refCounts[reference] == 0)
+			{
+				garbageWords += node_size(reference);
+				liveNodes--;
+				for (uint32_t child = 1; child < node_size(reference); child++)
+				{
+					release(nodes[reference + child]);
+				}
+			}
+		}
+
+		//uniform chunks are a terminal, the rest is decoded once and built bottom up
+		uint32_t build_chunk(const Chunk& chunk)
+		{
+			if (chunk.is_uniform())
+			{
+				return terminal(chunk.get_uniform_id());
+			}
+			voxels.resize(chunk.get_volume());
+			chunk.decode(voxels.data());
+			return build_voxels(chunk, 0, 0, 0, chunk.get_size());
+		}
+
+		uint32_t build_voxels(const Chunk& chunk, uint32_t x, uint32_t y, uint32_t z, uint32_t size)
+		{
+			if (size == 1)
+			{
+				return terminal(voxels[chunk.voxel_index(x, y, z)]);
+			}
+
+			uint32_t half = size / 2;
+			std::array<uint32_t, 8> children;
+			for (uint32_t octant = 0; octant < 8; octant++)
+			{
+				children[octant] = build_voxels(chunk,
+					x + ((octant & 1) ? half : 0), y + ((octant & 2) ? half : 0), z + ((octant & 4) ? half : 0), half);
+			}
+			return make_node(children);
+		}
+
+		//the levels above the chunks, built from the chunk references
+		uint32_t build_region(const Region& region, uint32_t x, uint32_t y, uint32_t z, uint32_t size)
+		{
+			if (size == 1)
+			{
+				return region.chunkRoots[x + regionChunks * (z + regionChunks * y)];
+			}
+
+			uint32_t half = size / 2;
+			std::array<uint32_t, 8> children;
+			for (uint32_t octant = 0; octant < 8; octant++)
+			{
+				children[octant] = build_region(region,
+					x + ((octant & 1) ? half : 0), y + ((octant & 2) ? half : 0), z + ((octant & 4) ? half : 0), half);
+			}
+			return make_node(children);
+		}
+	};
+}
@@ -19,6 +19,7 @@ namespace vkInit
 		std::vector<vkUtil::SwapChainFrame> frames;
 		vk::Format format;
 		vk::Extent2D extent;
+		vk::PresentModeKHR presentMode;
 	};
 
 	SwapChainSupportDetails query_swapchain_support(vk::PhysicalDevice device, vk::SurfaceKHR surface, bool debug)
@@ -68,10 +69,10 @@ namespace vkInit
 
 		support.formats = device.getSurfaceFormatsKHR(surface);
 
-		std::cout << "\tsupported surface formats:\n";
-
 		if (debug)
 		{
+			std::cout << "\tsupported surface formats:\n";
+
 			for (vk::SurfaceFormatKHR supportedFormat : support.formats)
 			{
 				std::cout << "\t\tpixel format: " << vk::to_string(supportedFormat.format) << '\n';
@@ -81,11 +82,14 @@ namespace vkInit
 
 		support.presentModes = device.getSurfacePresentModesKHR(surface);
 
-		std::cout << "\tpresent modes:\n";
-
-		for (vk::PresentModeKHR presentMode : support.presentModes)
+		if (debug)
 		{
-			std::cout << "\t\t" << log_present_mode_small(presentMode) << '\n';
+			std::cout << "\tpresent modes:\n";
+
+			for (vk::PresentModeKHR presentMode : support.presentModes)
+			{
+				std::cout << "\t\t" << log_present_mode_small(presentMode) << '\n';
+			}
 		}
 
 		return support;
@@ -105,19 +109,58 @@ namespace vkInit
 		return formats[0];
 	}
 
-	vk::PresentModeKHR choose_swapchain_present_mode(std::vector<vk::PresentModeKHR> presentModes)
+	//first mode of preferences the surface supports, fifo is always supported
+	vk::PresentModeKHR first_supported_present_mode(
+		const std::vector<vk::PresentModeKHR>& presentModes, std::initializer_list<vk::PresentModeKHR> preferences)
 	{
-		for (vk::PresentModeKHR mode : presentModes)
+		for (vk::PresentModeKHR preference : preferences)
 		{
-			if (mode == vk::PresentModeKHR::eMailbox)
+			if (std::find(presentModes.begin(), presentModes.end(), preference) != presentModes.end())
 			{
-				return mode;
+				return preference;
 			}
 		}
 
 		return vk::PresentModeKHR::eFifo;
 	}
 
+	vk::PresentModeKHR choose_swapchain_present_mode(const std::vector<vk::PresentModeKHR>& presentModes, vkUtil::LatencyPolicy policy)
+	{
+		switch (policy)
+		{
+		case vkUtil::LatencyPolicy::LowestLatency:
+			//mailbox replaces the queued image with the newest one, immediate tears but beats waiting on fifo
+			return first_supported_present_mode(presentModes, { vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate });
+		case vkUtil::LatencyPolicy::VsyncRelaxed:
+			return first_supported_present_mode(presentModes, { vk::PresentModeKHR::eFifoRelaxed });
+		case vkUtil::LatencyPolicy::Uncapped:
+			return first_supported_present_mode(presentModes, { vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox });
+		default:
+			return vk::PresentModeKHR::eFifo;
+		}
+	}
+
+	/*
+	* Every image queued ahead of the one being rendered is a frame of latency in fifo modes,
+	* so those get the minimum. Mailbox and immediate never block on a queue of presented images,
+	* one spare image keeps the renderer from waiting on the presentation engine.
+	* maxImageCount 0 means the surface has no upper limit.
+	*/
+	uint32_t choose_swapchain_image_count(const vk::SurfaceCapabilitiesKHR& capabilities, vk::PresentModeKHR presentMode)
+	{
+		uint32_t imageCount = capabilities.minImageCount;
+		if (presentMode == vk::PresentModeKHR::eMailbox || presentMode == vk::PresentModeKHR::eImmediate)
+		{
+			imageCount++;
+		}
+
+		if (capabilities.maxImageCount > 0)
+		{
+			imageCount = std::min(imageCount, capabilities.maxImageCount);
+		}
+		return std::max(imageCount, 1u);
+	}
+
 	vk::Extent2D choose_swapchain_extent(uint32_t width, uint32_t height, vk::SurfaceCapabilitiesKHR capabilities)
 	{
 		if (capabilities.currentExtent.width != UINT32_MAX)
@@ -142,20 +185,29 @@ namespace vkInit
 		}
 	}
 
-	SwapChainBundle create_swapchain(vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, int width, int height, bool debug)
+	/*
+	* Passing the swapchain being replaced lets the driver hand its resources over to the new one,
+	* the caller destroys the old swapchain once its images are no longer in use.
+	*/
+	SwapChainBundle create_swapchain(
+		vk::Device logicalDevice, vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface,
+		int width, int height, vk::SwapchainKHR oldSwapchain, vkUtil::LatencyPolicy policy, bool debug)
 	{
 		SwapChainSupportDetails support = query_swapchain_support(physicalDevice, surface, debug);
 
 		vk::SurfaceFormatKHR format = choose_swapchain_surface_format(support.formats);
 
-		vk::PresentModeKHR presentMode = choose_swapchain_present_mode(support.presentModes);
+		vk::PresentModeKHR presentMode = choose_swapchain_present_mode(support.presentModes, policy);
 
 		vk::Extent2D extent = choose_swapchain_extent(width, height, support.capabilities);
 
-		uint32_t imageCount = std::min(
-			support.capabilities.maxImageCount,
-			support.capabilities.minImageCount + 1
-		);
+		uint32_t imageCount = choose_swapchain_image_count(support.capabilities, presentMode);
+
+		if (debug)
+		{
+			std::cout << "Presenting with " << log_present_mode_small(presentMode) << " mode, requesting "
+				<< imageCount << " swapchain images\n";
+		}
 
 		vk::SwapchainCreateInfoKHR createInfo = vk::SwapchainCreateInfoKHR(
 			vk::SwapchainCreateFlagsKHR(), surface, imageCount,
@@ -179,7 +231,7 @@ namespace vkInit
 		createInfo.presentMode = presentMode;
 		createInfo.clipped = VK_TRUE;
 
-		createInfo.oldSwapchain = vk::SwapchainKHR(nullptr);
+		createInfo.oldSwapchain = oldSwapchain;
 
 		SwapChainBundle bundle{};
 		try
@@ -216,6 +268,7 @@ namespace vkInit
 
 		bundle.format = format.format;
 		bundle.extent = extent;
+		bundle.presentMode = presentMode;
 
 		return bundle;
 	}
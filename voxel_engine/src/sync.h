@@ -0,0 +1,69 @@
+#pragma once
+#include "config.h"
+
+namespace vkInit
+{
+	vk::Semaphore make_semaphore(vk::Device device, bool debug)
+	{
+		vk::SemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.flags = vk::SemaphoreCreateFlags();
+
+		try
+		{
+			return device.createSemaphore(semaphoreInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create semaphore" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	vk::Fence make_fence(vk::Device device, bool debug)
+	{
+		//fences start signaled so the first wait on them returns immediately
+		vk::FenceCreateInfo fenceInfo = {};
+		fenceInfo.flags = vk::FenceCreateFlags() | vk::FenceCreateFlagBits::eSignaled;
+
+		try
+		{
+			return device.createFence(fenceInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create fence" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+
+	//timeline semaphores carry a 64 bit counter instead of a signaled flag, needs VK_KHR_timeline_semaphore
+	vk::Semaphore make_timeline_semaphore(vk::Device device, uint64_t initialValue, bool debug)
+	{
+		vk::SemaphoreTypeCreateInfo typeInfo = {};
+		typeInfo.semaphoreType = vk::SemaphoreType::eTimeline;
+		typeInfo.initialValue = initialValue;
+
+		vk::SemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.flags = vk::SemaphoreCreateFlags();
+		semaphoreInfo.pNext = &typeInfo;
+
+		try
+		{
+			return device.createSemaphore(semaphoreInfo);
+		}
+		catch (vk::SystemError err)
+		{
+			if (debug)
+			{
+				std::cout << "Failed to create timeline semaphore" << std::endl;
+			}
+		}
+		return nullptr;
+	}
+}
\ No newline at end of file
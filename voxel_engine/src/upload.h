@@ -0,0 +1,476 @@
+#pragma once
+#include "config.h"
+#include "gpu_memory.h"
+#include "sync.h"
+
+namespace vkUtil
+{
+	struct UploadServiceInput
+	{
+		vk::Device device;
+
+		//transfer queue, may be the graphics queue on devices without a separate family
+		vk::Queue queue;
+		uint32_t queueFamilyIndex;
+
+		MemoryManager* memoryManager;
+
+		//timeline semaphores are enabled (core 1.2 or the KHR extension), otherwise completion is tracked with fences
+		bool timelineSemaphores;
+
+		//device level dispatch for the timeline semaphore host functions, aliased to the KHR ones before 1.2
+		const vk::DispatchLoaderDynamic* dispatch;
+	};
+
+	/*
+	* Streams buffer and image data to the GPU through staging buffers on the transfer queue.
+	* Uploads can be queued from any thread; they are recorded into the open batch and the
+	* batch is submitted by flush(). Every batch signals the next value of a timeline semaphore,
+	* the ticket returned when queueing: the graphics queue waits for that value on the GPU
+	* instead of the CPU waiting for the copy.
+	* Destinations are used from the graphics queue without ownership transfers, so they must
+	* be created with concurrent sharing across both families (the memory manager does so).
+	* Buffer copies are recorded when their batch is flushed, not when they are queued: the
+	* memory manager may swap a destination's vk::Buffer in between when it defragments.
+	*/
+	class UploadService
+	{
+	public:
+
+		UploadService(const UploadServiceInput& input, bool debug) :
+			device(input.device),
+			queue(input.queue),
+			memoryManager(input.memoryManager),
+			timelineSemaphores(input.timelineSemaphores),
+			dispatch(input.dispatch)
+		{
+			vk::CommandPoolCreateInfo poolInfo = {};
+			poolInfo.flags = vk::CommandPoolCreateFlags() | vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient;
+			poolInfo.queueFamilyIndex = input.queueFamilyIndex;
+
+			try
+			{
+				commandPool = device.createCommandPool(poolInfo);
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to create upload command pool" << std::endl;
+				}
+			}
+
+			if (timelineSemaphores)
+			{
+				timeline = vkInit::make_timeline_semaphore(device, 0, debug);
+				timelineSemaphores = static_cast<bool>(timeline);
+			}
+		}
+
+		UploadService(const UploadService&) = delete;
+		UploadService& operator=(const UploadService&) = delete;
+
+		//copies size bytes of data into destination at offset, returns the ticket the copy completes with
+		uint64_t upload_buffer(Buffer* destination, const void* data, vk::DeviceSize size, vk::DeviceSize offset, bool debug)
+		{
+			Buffer* staging = make_staging(data, size, debug);
+			if (!staging)
+			{
+				return 0;
+			}
+
+			vk::BufferCopy region = {};
+			region.srcOffset = 0;
+			region.dstOffset = offset;
+			region.size = size;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			return queue_copy(staging, destination, &region, 1, size);
+		}
+
+		/*
+		* Scattered variant: data is staged once and each region copies its part (srcOffset into
+		* data) to its place in destination. Returns the ticket the copies complete with.
+		*/
+		uint64_t upload_buffer_regions(Buffer* destination, const void* data, vk::DeviceSize size, const vk::BufferCopy* regions, uint32_t regionCount, bool debug)
+		{
+			if (regionCount == 0)
+			{
+				return 0;
+			}
+			Buffer* staging = make_staging(data, size, debug);
+			if (!staging)
+			{
+				return 0;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			return queue_copy(staging, destination, regions, regionCount, size);
+		}
+
+		/*
+		* Copies tightly packed texel data into the first mip level of image and leaves it in
+		* ShaderReadOnlyOptimal. Returns the ticket the copy completes with.
+		*/
+		uint64_t upload_image(vk::Image image, vk::Extent3D extent, vk::ImageAspectFlags aspect, const void* data, vk::DeviceSize size, bool debug)
+		{
+			Buffer* staging = make_staging(data, size, debug);
+			if (!staging)
+			{
+				return 0;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			vk::CommandBuffer commandBuffer = open_batch();
+
+			vk::ImageSubresourceRange range = {};
+			range.aspectMask = aspect;
+			range.baseMipLevel = 0;
+			range.levelCount = 1;
+			range.baseArrayLayer = 0;
+			range.layerCount = 1;
+
+			vk::ImageMemoryBarrier toTransfer = {};
+			toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+			toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+			toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			toTransfer.image = image;
+			toTransfer.subresourceRange = range;
+			toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+			commandBuffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toTransfer
+			);
+
+			vk::BufferImageCopy region = {};
+			region.imageSubresource.aspectMask = aspect;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = extent;
+			commandBuffer.copyBufferToImage(staging->buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+
+			//the transfer queue can't name shader stages, the graphics side's semaphore wait orders the reads
+			vk::ImageMemoryBarrier toShader = toTransfer;
+			toShader.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+			toShader.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+			toShader.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+			toShader.dstAccessMask = vk::AccessFlags();
+			commandBuffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+				vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &toShader
+			);
+
+			pending->staging.push_back(staging);
+			pendingBytes += size;
+			return pending->ticket;
+		}
+
+		/*
+		* Submits everything queued since the last flush as one batch and returns its ticket.
+		* When the transfer and graphics queues are the same queue, call this from the thread
+		* that submits graphics work.
+		*/
+		uint64_t flush(bool debug)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!pending)
+			{
+				return submittedTicket;
+			}
+
+			//destinations are resolved now, after any defragmentation since they were queued
+			for (const BufferCopy& copy : pending->copies)
+			{
+				pending->commandBuffer.copyBuffer(copy.staging->buffer, copy.destination->buffer,
+					copy.regionCount, &pending->regions[copy.firstRegion]);
+			}
+			pending->commandBuffer.end();
+
+			vk::TimelineSemaphoreSubmitInfo timelineInfo = {};
+			timelineInfo.signalSemaphoreValueCount = 1;
+			timelineInfo.pSignalSemaphoreValues = &pending->ticket;
+
+			vk::SubmitInfo submitInfo = {};
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &pending->commandBuffer;
+			if (timelineSemaphores)
+			{
+				submitInfo.pNext = &timelineInfo;
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &timeline;
+			}
+
+			try
+			{
+				queue.submit(submitInfo, pending->fence);
+			}
+			catch (vk::SystemError err)
+			{
+				if (debug)
+				{
+					std::cout << "Failed to submit upload batch" << std::endl;
+				}
+			}
+
+			submittedTicket = pending->ticket;
+			submittedBytes += pendingBytes;
+			pendingBytes = 0;
+			inFlight.push_back(std::move(*pending));
+			pending.reset();
+
+			return submittedTicket;
+		}
+
+		//highest ticket whose copies have finished on the GPU
+		uint64_t completed_ticket()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			retire_completed();
+			return completedTicket;
+		}
+
+		bool is_complete(uint64_t ticket)
+		{
+			return ticket <= completed_ticket();
+		}
+
+		//blocks the calling thread until ticket's batch has finished, flush it first
+		void wait(uint64_t ticket)
+		{
+			if (timelineSemaphores)
+			{
+				vk::SemaphoreWaitInfo waitInfo = {};
+				waitInfo.semaphoreCount = 1;
+				waitInfo.pSemaphores = &timeline;
+				waitInfo.pValues = &ticket;
+				if (device.waitSemaphores(waitInfo, UINT64_MAX, *dispatch) != vk::Result::eSuccess)
+				{
+					return;
+				}
+			}
+			else
+			{
+				std::vector<vk::Fence> fences;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					for (UploadBatch& batch : inFlight)
+					{
+						if (batch.ticket <= ticket)
+						{
+							fences.push_back(batch.fence);
+						}
+					}
+				}
+				if (!fences.empty() && device.waitForFences(fences, VK_TRUE, UINT64_MAX) != vk::Result::eSuccess)
+				{
+					return;
+				}
+			}
+
+			completed_ticket();
+		}
+
+		//semaphore the graphics queue waits on with a ticket as value, null without timeline support
+		vk::Semaphore get_timeline_semaphore() const
+		{
+			return timelineSemaphores ? timeline : nullptr;
+		}
+
+		//destinations of the copies queued or not yet retired, buffers that must not be moved meanwhile
+		std::vector<const Buffer*> get_written_buffers()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<const Buffer*> written;
+			auto add_batch = [&](const UploadBatch& batch)
+			{
+				for (const BufferCopy& copy : batch.copies)
+				{
+					written.push_back(copy.destination);
+				}
+			};
+			if (pending)
+			{
+				add_batch(*pending);
+			}
+			for (const UploadBatch& batch : inFlight)
+			{
+				add_batch(batch);
+			}
+			return written;
+		}
+
+		//total bytes handed to the transfer queue so far
+		vk::DeviceSize get_submitted_bytes()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return submittedBytes;
+		}
+
+		void destroy()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (pending)
+			{
+				pending->commandBuffer.end();
+				inFlight.push_back(std::move(*pending));
+				pending.reset();
+			}
+
+			//the caller has waited for the device to go idle
+			for (UploadBatch& batch : inFlight)
+			{
+				release(batch);
+				device.destroyFence(batch.fence);
+			}
+			inFlight.clear();
+			for (UploadBatch& batch : freeBatches)
+			{
+				device.destroyFence(batch.fence);
+			}
+			freeBatches.clear();
+
+			device.destroyCommandPool(commandPool);
+			device.destroySemaphore(timeline);
+		}
+
+	private:
+
+		//a buffer copy waiting for its batch to be flushed, its regions are in the batch's list
+		struct BufferCopy
+		{
+			Buffer* staging;
+			Buffer* destination;
+			uint32_t firstRegion;
+			uint32_t regionCount;
+		};
+
+		struct UploadBatch
+		{
+			uint64_t ticket{ 0 };
+			vk::CommandBuffer commandBuffer{ nullptr };
+
+			//signaled with the batch, tells the host when the batch can be recycled
+			vk::Fence fence{ nullptr };
+			std::vector<Buffer*> staging;
+			std::vector<BufferCopy> copies;
+			std::vector<vk::BufferCopy> regions;
+		};
+
+		vk::Device device;
+		vk::Queue queue;
+		MemoryManager* memoryManager;
+		bool timelineSemaphores;
+		const vk::DispatchLoaderDynamic* dispatch;
+
+		vk::CommandPool commandPool{ nullptr };
+		vk::Semaphore timeline{ nullptr };
+
+		std::mutex mutex;
+		std::optional<UploadBatch> pending;
+		std::vector<UploadBatch> inFlight;
+		std::vector<UploadBatch> freeBatches;
+
+		uint64_t submittedTicket{ 0 };
+		uint64_t completedTicket{ 0 };
+		vk::DeviceSize pendingBytes{ 0 };
+		vk::DeviceSize submittedBytes{ 0 };
+
+		//staging memory is written once by the host and only read by the copy
+		Buffer* make_staging(const void* data, vk::DeviceSize size, bool debug)
+		{
+			Buffer* staging = memoryManager->create_buffer(size, vk::BufferUsageFlagBits::eTransferSrc, MemoryPool::Staging, debug);
+			if (!staging)
+			{
+				return nullptr;
+			}
+			memcpy(staging->mapped, data, static_cast<size_t>(size));
+			memoryManager->flush(staging);
+			return staging;
+		}
+
+		//called with the mutex held, adds a copy out of staging to the open batch
+		uint64_t queue_copy(Buffer* staging, Buffer* destination, const vk::BufferCopy* regions, uint32_t regionCount, vk::DeviceSize size)
+		{
+			open_batch();
+			pending->copies.push_back({ staging, destination, static_cast<uint32_t>(pending->regions.size()), regionCount });
+			pending->regions.insert(pending->regions.end(), regions, regions + regionCount);
+			pending->staging.push_back(staging);
+			pendingBytes += size;
+			return pending->ticket;
+		}
+
+		//called with the mutex held, returns the open batch's command buffer
+		vk::CommandBuffer open_batch()
+		{
+			if (pending)
+			{
+				return pending->commandBuffer;
+			}
+
+			retire_completed();
+
+			UploadBatch batch = {};
+			if (!freeBatches.empty())
+			{
+				batch = std::move(freeBatches.back());
+				freeBatches.pop_back();
+				batch.commandBuffer.reset();
+			}
+			else
+			{
+				vk::CommandBufferAllocateInfo allocInfo = {};
+				allocInfo.commandPool = commandPool;
+				allocInfo.level = vk::CommandBufferLevel::ePrimary;
+				allocInfo.commandBufferCount = 1;
+				batch.commandBuffer = device.allocateCommandBuffers(allocInfo)[0];
+
+				vk::FenceCreateInfo fenceInfo = {};
+				batch.fence = device.createFence(fenceInfo);
+			}
+			device.resetFences(batch.fence);
+
+			batch.ticket = submittedTicket + 1;
+
+			vk::CommandBufferBeginInfo beginInfo = {};
+			beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+			batch.commandBuffer.begin(beginInfo);
+
+			pending = std::move(batch);
+			return pending->commandBuffer;
+		}
+
+		//called with the mutex held, batches retire in submission order once their fence signals
+		void retire_completed()
+		{
+			size_t retired = 0;
+			while (retired < inFlight.size())
+			{
+				UploadBatch& batch = inFlight[retired];
+				if (device.getFenceStatus(batch.fence) != vk::Result::eSuccess)
+				{
+					break;
+				}
+				completedTicket = std::max(completedTicket, batch.ticket);
+				release(batch);
+				freeBatches.push_back(std::move(batch));
+				retired++;
+			}
+			inFlight.erase(inFlight.begin(), inFlight.begin() + retired);
+		}
+
+		void release(UploadBatch& batch)
+		{
+			for (Buffer* staging : batch.staging)
+			{
+				memoryManager->destroy_buffer(staging);
+			}
+			batch.staging.clear();
+			batch.copies.clear();
+			batch.regions.clear();
+		}
+	};
+}
@@ -0,0 +1,3 @@
+//the allocator's implementation is compiled once, here, every other file only sees its declarations
+#define VMA_IMPLEMENTATION
+#include <vma/vk_mem_alloc.h>